@@ -1,2 +1,3 @@
 #!/bin/bash
-find /var/db/pkg -maxdepth 1 -not -path '*/[@.]*' -type d -printf "%f\n"
+# ask birbd for the package list if it's running, since it already has the list in memory
+birbd --query packages 2>/dev/null || find /var/db/pkg -maxdepth 1 -not -path '*/[@.]*' -type d -printf "%f\n"
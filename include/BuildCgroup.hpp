@@ -0,0 +1,61 @@
+#pragma once
+
+#include "Config.hpp"
+#include "Types.hpp"
+
+#include <optional>
+#include <string>
+#include <vector>
+
+namespace birb
+{
+	// resources used by the processes of a build, read from its cgroup
+	struct build_resource_usage
+	{
+		u64 cpu_usec{0};
+		u64 io_read_bytes{0};
+		u64 io_write_bytes{0};
+
+		// memory.peak needs Linux 5.19 or newer
+		std::optional<u64> memory_peak;
+	};
+
+	// keeps a package build from starving the rest of the system
+	//
+	// if cgroup v2 is available, the build processes are put into their own
+	// cgroup under /sys/fs/cgroup/birb with the limits from birb_config.
+	// Otherwise they are run with a lower nice and ionice priority
+	//
+	// the cgroup gets removed when this is destroyed. Cgroups left behind
+	// by birb processes that exited without cleaning up are removed when
+	// the next build cgroup is created
+	class build_cgroup
+	{
+	public:
+		build_cgroup(const std::string& pkg_name, const birb_config& config);
+		~build_cgroup();
+
+		build_cgroup(const build_cgroup&) = delete;
+		build_cgroup& operator=(const build_cgroup&) = delete;
+
+		// prefix the command so that it moves itself into the cgroup
+		// before it starts, or lowers its own priority without cgroups.
+		// The whole process tree of the command stays in the cgroup
+		void wrap(std::vector<std::string>& args) const;
+
+		__attribute__((warn_unused_result))
+		bool isolated() const;
+
+		// empty if the build isn't running in a cgroup
+		__attribute__((warn_unused_result))
+		std::optional<build_resource_usage> usage() const;
+
+	private:
+		// empty if the cgroup couldn't be created
+		std::string cgroup_path;
+
+		// priorities for the fallback
+		i32 niceness{0};
+		i32 ionice_level{4};
+	};
+}
@@ -0,0 +1,71 @@
+#pragma once
+
+#include "Process.hpp"
+#include "Types.hpp"
+
+#include <chrono>
+#include <optional>
+#include <string>
+#include <string_view>
+#include <vector>
+
+namespace birb
+{
+	// build output of a package that gets compressed into a log file
+	// while the build is running
+	//
+	// the last lines of the output are kept in memory so that they can
+	// be printed out if the build fails
+	class build_log
+	{
+	public:
+		// if append is set, the output is added to the end of an existing log
+		build_log(const std::string& log_path, const size_t tail_line_count, const bool append);
+		~build_log();
+
+		build_log(const build_log&) = delete;
+		build_log& operator=(const build_log&) = delete;
+
+		// write a header line that separates the output of different phases
+		void begin_phase(const std::string& phase_name);
+
+		// end the progress line of the phase if one was printed
+		void end_phase();
+
+		// write a chunk of build output into the log
+		void write(std::string_view chunk);
+
+		// flush and close the compressed log file
+		void finish();
+
+		__attribute__((warn_unused_result))
+		const std::string& path() const;
+
+		// print the last lines of the build output
+		void print_tail() const;
+
+		// print a one line summary of the progress of the current phase
+		// to the terminal, rate limited so that the terminal doesn't slow
+		// down the build
+		void print_progress(const bool force = false);
+
+	private:
+		void write_to_file(std::string_view data);
+
+		std::string log_path;
+		std::optional<process> compressor;
+		int log_fd{-1};
+		bool write_failed{false};
+
+		std::string phase;
+		u64 phase_line_count{0};
+		std::chrono::steady_clock::time_point last_progress_update;
+		bool progress_visible{false};
+
+		// ring buffer of the last lines of output
+		std::vector<std::string> tail_lines;
+		size_t tail_next{0};
+		size_t tail_count{0};
+		std::string partial_line;
+	};
+}
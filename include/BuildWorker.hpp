@@ -0,0 +1,47 @@
+#pragma once
+
+#include "Config.hpp"
+
+#include <functional>
+#include <string>
+#include <vector>
+
+namespace birb
+{
+	// packages can be built by worker processes instead of the birb process
+	// that installs them. A worker is any command that runs 'birb --worker'
+	// with its stdin and stdout connected to the installing birb process, so
+	// 'birb --worker' gives a local worker and 'ssh buildhost birb --worker'
+	// gives a remote one
+	//
+	// the protocol is a header line followed by raw file contents:
+	//
+	//   worker:      birb-worker <protocol version>
+	//   coordinator: job <package> <config hash> <package dir size> <source tarball|-> <source size>
+	//                <tar of the package directory><source tarball>
+	//   worker:      done <package> <size>
+	//                <tar of the fakeroot>
+	//            or  failed <package> <size>
+	//                <error message>
+	//
+	// a worker that exits in the middle of a job has failed the job. The
+	// output of the worker goes into a log file on the installing system
+
+	// the settings that change the build output. Workers refuse jobs
+	// from a system with a different hash
+	__attribute__((warn_unused_result))
+	std::string build_config_hash(const path_settings& paths, const birb_config& config);
+
+	// serve build jobs from stdin until it gets closed
+	void run_build_worker(const path_settings& paths, const birb_config& config);
+
+	// build the packages on the workers in config.build_workers. Packages
+	// get built once the packages they depend on have been installed, so
+	// packages that don't depend on each other get built in parallel
+	//
+	// on_built gets called for each package after its fakeroot has been
+	// unpacked, and it needs to install the package before returning.
+	// If a build fails, the other builds get killed and birb exits
+	void offload_builds(const std::vector<std::string>& packages, const path_settings& paths, const birb_config& config,
+			const std::function<void(const std::string&)>& on_built);
+}
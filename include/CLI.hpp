@@ -9,4 +9,12 @@ namespace birb
 	bool confirmation_menu(const std::string& msg, const bool default_answer);
 
 	void set_win_title(const std::string& title_text);
+
+	// check if birb is running in a terminal emulator of a graphical
+	// session, where changing the window title is useful
+	//
+	// this only looks at the environment and the X11 socket directory
+	// instead of searching /proc for an Xorg process
+	__attribute__((warn_unused_result))
+	bool can_set_win_title();
 }
@@ -1,6 +1,8 @@
 #pragma once
 
 #include <string>
+#include <string_view>
+#include <vector>
 
 #include "Logging.hpp"
 #include "Types.hpp"
@@ -21,8 +23,10 @@ struct path_settings
 			fakeroot_backup.insert(0, env_lfs);
 			distfiles.insert(0, env_lfs);
 			fakeroot.insert(0, env_lfs);
+			source_cache.insert(0, env_lfs);
 			birb_cfg.insert(0, env_lfs);
 			birb_repo_list.insert(0, env_lfs);
+			daemon_socket.insert(0, env_lfs);
 
 			lfs_var_set = true;
 			lfs_path = env_lfs;
@@ -35,12 +39,19 @@ struct path_settings
 	std::string fakeroot_backup{"/var/backup/birb/fakeroot_backups"};
 	std::string distfiles{"/var/cache/distfiles"};
 	std::string fakeroot{"/var/db/fakeroot"};
+	std::string source_cache{"/var/cache/birb/sources"};
 	std::string birb_cfg{"/etc/birb.conf"};
 	std::string birb_repo_list{"/etc/birb-sources.conf"};
+	std::string daemon_socket{"/run/birbd.sock"};
 
 	std::string nest() const { return db_dir + "/nest"; }
 	std::string package_list() const { return db_dir + "/packages"; }
+	std::string search_index() const { return db_dir + "/search_index"; }
 	std::string database() const { return db_dir + "/birb_db"; }
+	std::string transaction() const { return db_dir + "/transaction"; }
+	std::string build_logs() const { return db_dir + "/logs"; }
+	std::string distfile_index() const { return db_dir + "/distfiles"; }
+	std::string dedupe_manifest() const { return db_dir + "/dedupe"; }
 	std::string birb_dist() const { return distfiles + "/birb"; }
 
 	bool lfs_var_set{false};
@@ -51,7 +62,66 @@ struct birb_config
 {
 	bool enable_lto{true};
 	bool enable_tests{false};
-	bool enable_32bit_packages{true};
+	bool enable_32bit_packages{false};
 	u16 build_jobs{4};
+
+	// upper limit for the threads that birb itself uses for things like
+	// checking symlinks and reading seed.sh files, 0 uses all CPU threads
+	u16 max_threads{0};
+
+	// print the full build output instead of a condensed progress view
+	bool verbose_build{false};
+
+	// package builds run in their own cgroup with these limits when cgroup v2
+	// is available. The weights are relative to the weight of 100 that the
+	// rest of the system has by default, and without cgroups they get
+	// converted into nice and ionice priorities. Weights above 100 don't
+	// raise those priorities above the default
+	u16 build_cpu_weight{50};
+	u16 build_io_weight{50};
+
+	// the builds get throttled when their memory usage goes above
+	// memory_high and killed above memory_max. 0 means no limit, and
+	// these are ignored without cgroups
+	u64 build_memory_high{0};
+	u64 build_memory_max{0};
+
+	// amount of lines from the end of the build log to print when a build fails
+	u16 build_log_tail_lines{40};
+
+	// run test suites in the background at a low priority instead of
+	// blocking the installation, failures get reported at the end
+	bool defer_tests{false};
+
+	// uninstall packages whose deferred tests failed
+	bool rollback_failed_tests{false};
+
+	// keep extracted source trees around and clone them into
+	// the build directory instead of extracting the tarball again
+	bool source_cache{false};
+
+	// least recently used source trees get removed when
+	// the cache grows larger than this
+	u64 source_cache_max_size{20ull * 1024 * 1024 * 1024};
+
+	// commands that start build workers, like 'ssh buildhost birb --worker'.
+	// If there are any, the packages get built on the workers instead
+	std::vector<std::string> build_workers;
+
+	// link identical files in the fakeroot of each installed
+	// package to the copies in the other fakeroots
+	bool dedupe_after_install{false};
+
 	std::string birb_remote{"https://github.com/birb-linux/birb"};
 };
+
+namespace birb
+{
+	// read the settings that birb itself uses from the variables in a
+	// birb.conf file. Values that need the shell to be expanded, like
+	// $(nproc), are left for the seed.sh files
+	void parse_birb_config(const std::string_view text, birb_config& config);
+
+	// read /etc/birb.conf into the config if it exists
+	void load_birb_config(const path_settings& paths, birb_config& config);
+}
@@ -0,0 +1,23 @@
+#pragma once
+
+#include "Config.hpp"
+
+#include <string>
+#include <vector>
+
+namespace birb
+{
+	// keep the repositories, the package database and the dependency graph in
+	// memory and answer queries about them over a unix socket. The caches are
+	// invalidated with inotify when something changes on disk
+	//
+	// only returns if the socket can't be set up or the daemon gets stopped
+	void run_daemon(const path_settings& paths);
+
+	// send a query to a running daemon and print the answer
+	//
+	// returns 0 on success, 1 if the query failed and
+	// 2 if the daemon couldn't be reached
+	__attribute__((warn_unused_result))
+	int query_daemon(const std::vector<std::string>& query, const path_settings& paths);
+}
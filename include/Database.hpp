@@ -1,5 +1,10 @@
 #pragma once
 #include "Config.hpp"
+#include "FlatHashMap.hpp"
+#include "MappedFile.hpp"
+#include "PackageId.hpp"
+#include <mutex>
+#include <optional>
 #include <string>
 #include <unordered_map>
 #include <vector>
@@ -27,7 +32,8 @@ enum class pkg_variable
 	checksum,
 	deps,
 	flags,
-	notes
+	notes,
+	triggers
 };
 
 namespace birb
@@ -35,6 +41,11 @@ namespace birb
 	__attribute__((warn_unused_result))
 	std::vector<pkg_source> get_pkg_sources(const path_settings& paths);
 
+	/* Like get_pkg_sources(), but returns nothing instead of exiting if the
+	 * repository list is missing or malformed. The problem is printed as a warning */
+	__attribute__((warn_unused_result))
+	std::optional<std::vector<pkg_source>> try_get_pkg_sources(const path_settings& paths);
+
 	/* Get the package source repositories in the same ';' separated
 	 * format as they are in the configuration file at /etc/birb-sources.conf */
 	__attribute__((warn_unused_result))
@@ -47,6 +58,16 @@ namespace birb
 	__attribute__((warn_unused_result))
 	std::string read_pkg_variable(const std::string& pkg_name, const pkg_variable var, const std::string& repo_path);
 
+	/* Like read_pkg_variable(), but returns nothing instead of
+	 * exiting if the variable is malformed in the seed.sh file */
+	__attribute__((warn_unused_result))
+	std::optional<std::string> try_read_pkg_variable(const std::string& pkg_name, const pkg_variable var, const std::string& repo_path);
+
+	/* Map the birb_db file for reading its lines without copying them.
+	 * The contents are empty if the database doesn't exist yet */
+	__attribute__((warn_unused_result))
+	mapped_file map_birb_db(const path_settings& paths);
+
 	/* Returns the raw birb_db file if it exists */
 	__attribute__((warn_unused_result))
 	std::vector<std::string> read_birb_db(const path_settings& paths);
@@ -63,7 +84,14 @@ namespace birb
 	std::unordered_map<std::string, std::string> get_repo_versions(const path_settings& paths);
 
 	/* Caching */
-	inline std::unordered_map<std::string, std::string> var_cache;
+	inline flat_hash_map<u64, std::string> var_cache;
+	inline std::mutex var_cache_mutex; /* read_pkg_variable() can be called from multiple threads */
 	inline std::vector<std::string> installed_packages_cache;
-	inline std::unordered_map<std::string, pkg_source> pkg_repo_cache;
+	inline flat_hash_map<pkg_id, pkg_source> pkg_repo_cache;
+
+	/* The variables of all packages are in the same cache */
+	constexpr u64 var_cache_key(const pkg_id id, const pkg_variable var)
+	{
+		return (static_cast<u64>(id) << 8) | static_cast<u64>(var);
+	}
 }
@@ -0,0 +1,37 @@
+#pragma once
+
+#include "Config.hpp"
+
+#include <optional>
+#include <string>
+
+namespace birb
+{
+	struct dedupe_stats
+	{
+		u64 scanned_files{0};
+		u64 linked_files{0};
+		u64 saved_bytes{0};
+	};
+
+	// replace identical files in the package fakeroots and the fakeroot
+	// backups with hardlinks to a single copy. Files are compared by their
+	// size, owner, permissions and modification time first, then by a hash
+	// of their contents and finally byte by byte. Files in etc and var are
+	// left alone, since they get modified in place through the symlinks
+	//
+	// with pkg_name, only the duplicates of the files of that package are
+	// linked, which is a lot faster than going through everything again
+	//
+	// the linked files are recorded in the dedupe manifest
+	dedupe_stats dedupe_fakeroots(const path_settings& paths, const std::optional<std::string>& pkg_name = {});
+
+	// give the files of a package that were linked by dedupe_fakeroots()
+	// their own copies again, so that writing into the fakeroot can't
+	// change the files of other packages
+	void unshare_fakeroot(const std::string& pkg_name, const path_settings& paths);
+
+	// drop the files of an uninstalled package from the dedupe manifest.
+	// Removing a hardlink doesn't affect the other links to the same file
+	void forget_deduped_files(const std::string& pkg_name, const path_settings& paths);
+}
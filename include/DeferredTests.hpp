@@ -0,0 +1,74 @@
+#pragma once
+
+#include "Process.hpp"
+
+#include <string>
+#include <vector>
+
+namespace birb
+{
+	struct deferred_test_result
+	{
+		std::string pkg_name;
+		std::string phase;
+		std::string log_path;
+		process_result result;
+	};
+
+	// test suites that are run in the background at a low priority
+	// while the installation continues with other packages
+	//
+	// each test is run in a snapshot of the build directory, so that the
+	// installation can keep using the build directory. Build systems write
+	// absolute paths into the build directory, so the snapshot gets mounted
+	// over the build directory in a private mount namespace of the test
+	//
+	// tests that are still running when birb exits get cancelled, so that
+	// a failed installation doesn't leave them and their snapshots behind
+	class deferred_tests
+	{
+	public:
+		deferred_tests();
+		~deferred_tests();
+		deferred_tests(const deferred_tests&) = delete;
+		deferred_tests& operator=(const deferred_tests&) = delete;
+
+		// snapshot the build directory and start the test phase in the snapshot
+		//
+		// the build directory has to be kept around until the test has
+		// finished, since removing it would unmount the snapshot. It gets
+		// removed along with the snapshot afterwards. The output is
+		// written into log_path
+		void start(const std::string& pkg_name, const std::string& phase, const std::string& build_dir,
+				const std::string& snapshot_dir, const std::string& log_path, process_options options);
+
+		__attribute__((warn_unused_result))
+		bool empty() const;
+
+		__attribute__((warn_unused_result))
+		size_t size() const;
+
+		// wait for all of the tests to finish and remove their snapshots
+		std::vector<deferred_test_result> wait();
+
+		// kill the tests and remove their snapshots, for when the
+		// installation gets cancelled before the tests are done
+		void cancel();
+
+	private:
+		struct test
+		{
+			std::string pkg_name;
+			std::string phase;
+			std::string build_dir;
+			std::string snapshot_dir;
+			std::string log_path;
+			process proc;
+		};
+
+		std::vector<test> tests;
+	};
+
+	// print the last lines of a plain text log file
+	void print_log_tail(const std::string& log_path, const size_t line_count);
+}
@@ -1,8 +1,9 @@
 #pragma once
 #include "Config.hpp"
 #include "Database.hpp"
+#include "FlatHashMap.hpp"
+#include "PackageId.hpp"
 #include <string>
-#include <unordered_map>
 #include <vector>
 
 namespace birb
@@ -16,6 +17,6 @@ namespace birb
 	std::vector<std::string> deduplicated_dep_list(const std::vector<std::string>& dependencies, const path_settings& paths);
 	std::vector<std::string> find_orphan_packages(const std::vector<pkg_source>& repos, const path_settings& paths);
 
-	inline std::unordered_map<std::string, std::vector<std::string>> dependency_cache;
-	inline std::unordered_map<std::string, std::vector<std::string>> reverse_dependency_cache;
+	inline flat_hash_map<pkg_id, std::vector<std::string>> dependency_cache;
+	inline flat_hash_map<pkg_id, std::vector<std::string>> reverse_dependency_cache;
 }
@@ -2,8 +2,25 @@
 
 #include "Config.hpp"
 
+#include <optional>
+#include <string>
+
 namespace birb
 {
+	struct distclean_options
+	{
+		// never remove the source tarballs of the installed package versions
+		bool keep_installed{false};
+
+		// only remove the least recently used distfiles until
+		// the distcache fits within this size
+		std::optional<u64> max_size;
+	};
+
 	// clear the distcache
-	void distclean(const path_settings& paths);
+	void distclean(const path_settings& paths, const distclean_options& options = {});
+
+	// record which package version used a distfile and when, so that
+	// distclean can find the least recently used distfiles
+	void record_distfile_use(const std::string& tarball, const std::string& pkg_name, const std::string& version, const path_settings& paths);
 }
@@ -2,6 +2,7 @@
 
 #include "Config.hpp"
 
+#include <optional>
 #include <string>
 #include <vector>
 
@@ -9,4 +10,15 @@ namespace birb
 {
 	void download(const std::vector<std::string>& packages, const path_settings& paths);
 	void download_package(const std::string& pkg_name, const path_settings& paths, const bool xorg_running);
+
+	// file name of the source tarball of a package in the distfiles directory
+	//
+	// the SOURCE variable may refer to other variables in the seed.sh file,
+	// so the seed.sh file gets sourced to find out the real name
+	__attribute__((warn_unused_result))
+	std::string get_source_tarball(const std::string& pkg_name, const path_settings& paths);
+
+	// returns nothing instead of exiting if the seed.sh file can't be sourced
+	__attribute__((warn_unused_result))
+	std::optional<std::string> try_get_source_tarball(const std::string& pkg_name, const path_settings& paths);
 }
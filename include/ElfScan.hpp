@@ -0,0 +1,61 @@
+#pragma once
+
+#include "Config.hpp"
+
+#include <optional>
+#include <string>
+#include <string_view>
+#include <vector>
+
+namespace birb
+{
+	// the dynamic linking information of an ELF file
+	struct elf_info
+	{
+		// 32-bit libraries can't satisfy the needs of 64-bit programs
+		// and the other way around
+		bool is_64bit{true};
+
+		// empty if the file doesn't have a DT_SONAME entry
+		std::string soname;
+
+		// DT_NEEDED entries
+		std::vector<std::string> needed;
+	};
+
+	// read the dynamic section of an ELF file in the byte order of this
+	// system. Returns nothing for other files and for static executables
+	__attribute__((warn_unused_result))
+	std::optional<elf_info> parse_elf_dynamic(const std::string_view contents);
+
+	enum class library_problem_type
+	{
+		// the library is installed, but the package that provides it
+		// isn't in the DEPS of the package that links against it
+		missing_dep,
+
+		// the library doesn't exist anymore, for example because an
+		// update changed its soname
+		missing_library
+	};
+
+	struct library_problem
+	{
+		library_problem_type type;
+		std::string pkg_name;
+		std::string soname;
+
+		// the first file in the fakeroot that needs the library
+		std::string file;
+
+		// the package that provides the library with missing_dep
+		std::string provider;
+	};
+
+	// scan the ELF files in the fakeroots of the installed packages in
+	// parallel and check that every library they need is provided by a
+	// package in their dependency tree. Libraries that aren't in any
+	// fakeroot are looked up from the library directories of the system
+	__attribute__((warn_unused_result))
+	std::vector<library_problem> find_library_problems(const path_settings& paths);
+}
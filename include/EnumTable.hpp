@@ -0,0 +1,61 @@
+#pragma once
+
+#include <array>
+#include <cstddef>
+#include <optional>
+#include <string_view>
+#include <utility>
+
+namespace birb
+{
+	// names for the values of an enum that can be looked up in both
+	// directions without any static initialization
+	//
+	// the entries are in the same order as the enum values, so the
+	// name of a value is found by indexing. Tables should be created
+	// with make_enum_table(), which checks the order at compile time
+	template<typename Enum, size_t N>
+	struct enum_table
+	{
+		using entry = std::pair<Enum, std::string_view>;
+
+		std::array<entry, N> entries;
+
+		__attribute__((warn_unused_result))
+		constexpr std::string_view name(const Enum value) const
+		{
+			return entries.at(static_cast<size_t>(value)).second;
+		}
+
+		// the enum value with the given name, if there's one
+		__attribute__((warn_unused_result))
+		constexpr std::optional<Enum> parse(const std::string_view value_name) const
+		{
+			for (const auto& [value, name] : entries)
+				if (name == value_name)
+					return value;
+
+			return {};
+		}
+
+		constexpr auto begin() const { return entries.begin(); }
+		constexpr auto end() const { return entries.end(); }
+	};
+
+	template<typename Enum, size_t N>
+	consteval enum_table<Enum, N> make_enum_table(const std::pair<Enum, std::string_view> (&entries)[N])
+	{
+		enum_table<Enum, N> table{};
+
+		for (size_t i = 0; i < N; ++i)
+		{
+			// throwing in a consteval function fails the compilation
+			if (static_cast<size_t>(entries[i].first) != i)
+				throw "The entries of an enum_table have to be in the same order as the enum values";
+
+			table.entries[i] = entries[i];
+		}
+
+		return table;
+	}
+}
@@ -0,0 +1,447 @@
+#pragma once
+
+#ifdef BIRB_TEST
+#include <doctest/doctest.h>
+#endif /* BIRB_TEST */
+
+#include "Types.hpp"
+
+#include <algorithm>
+#include <bit>
+#include <cassert>
+#include <cstddef>
+#include <cstring>
+#include <functional>
+#include <iterator>
+#include <memory>
+#include <new>
+#include <stdexcept>
+#include <string>
+#include <string_view>
+#include <tuple>
+#include <type_traits>
+#include <utility>
+
+namespace birb
+{
+	// hash for string keys that accepts std::string, std::string_view and
+	// string literals alike, so that lookups don't need to build a std::string
+	struct string_hash
+	{
+		using is_transparent = void;
+
+		size_t operator()(const std::string_view text) const
+		{
+			return std::hash<std::string_view>{}(text);
+		}
+	};
+
+	// hash map that stores the entries in a single flat array and resolves
+	// collisions with linear probing. A separate array of control bytes with
+	// 7 bits of the hash of each entry is probed first, so most of the
+	// mismatching entries are skipped without touching the keys at all
+	//
+	// the lookups are heterogeneous when the hash has is_transparent (like
+	// string_hash), so a map with std::string keys can be searched with a
+	// std::string_view
+	//
+	// inserting and erasing invalidates iterators and references
+	template<typename Key, typename Value, typename Hash = std::hash<Key>, typename KeyEqual = std::equal_to<>>
+	class flat_hash_map
+	{
+	public:
+		using key_type = Key;
+		using mapped_type = Value;
+		using value_type = std::pair<Key, Value>;
+
+	private:
+		static constexpr u8 ctrl_empty = 0x80;
+		static constexpr u8 ctrl_deleted = 0xFE;
+		static constexpr size_t min_capacity = 16;
+		static constexpr size_t npos = static_cast<size_t>(-1);
+
+		// control bytes with the highest bit unset belong to full slots
+		static constexpr bool is_full(const u8 ctrl) { return (ctrl & 0x80) == 0; }
+
+		struct slot
+		{
+			alignas(value_type) std::byte storage[sizeof(value_type)];
+
+			value_type* get() { return std::launder(reinterpret_cast<value_type*>(storage)); }
+			const value_type* get() const { return std::launder(reinterpret_cast<const value_type*>(storage)); }
+		};
+
+		template<bool Const>
+		class basic_iterator
+		{
+			using map_ptr = std::conditional_t<Const, const flat_hash_map*, flat_hash_map*>;
+
+		public:
+			using iterator_category = std::forward_iterator_tag;
+			using value_type = flat_hash_map::value_type;
+			using difference_type = std::ptrdiff_t;
+			using pointer = std::conditional_t<Const, const value_type*, value_type*>;
+			using reference = std::conditional_t<Const, const value_type&, value_type&>;
+
+			basic_iterator() = default;
+
+			basic_iterator(map_ptr map, const size_t index)
+			:map(map), index(index)
+			{
+				skip_empty_slots();
+			}
+
+			// iterators can be converted to const_iterators
+			operator basic_iterator<true>() const { return basic_iterator<true>(map, index); }
+
+			reference operator*() const { return *map->slots[index].get(); }
+			pointer operator->() const { return map->slots[index].get(); }
+
+			basic_iterator& operator++()
+			{
+				++index;
+				skip_empty_slots();
+				return *this;
+			}
+
+			basic_iterator operator++(int)
+			{
+				basic_iterator previous = *this;
+				++*this;
+				return previous;
+			}
+
+			bool operator==(const basic_iterator& other) const { return index == other.index; }
+
+		private:
+			void skip_empty_slots()
+			{
+				while (index < map->capacity && !is_full(map->ctrl[index]))
+					++index;
+			}
+
+			map_ptr map{nullptr};
+			size_t index{0};
+		};
+
+	public:
+		using iterator = basic_iterator<false>;
+		using const_iterator = basic_iterator<true>;
+
+		flat_hash_map() = default;
+
+		~flat_hash_map()
+		{
+			destroy_entries();
+		}
+
+		flat_hash_map(const flat_hash_map& other)
+		{
+			reserve(other.entry_count);
+			for (const value_type& entry : other)
+				try_emplace(entry.first, entry.second);
+		}
+
+		flat_hash_map(flat_hash_map&& other) noexcept
+		{
+			swap(other);
+		}
+
+		flat_hash_map& operator=(const flat_hash_map& other)
+		{
+			if (this != &other)
+			{
+				flat_hash_map copy(other);
+				swap(copy);
+			}
+
+			return *this;
+		}
+
+		flat_hash_map& operator=(flat_hash_map&& other) noexcept
+		{
+			if (this != &other)
+			{
+				flat_hash_map moved(std::move(other));
+				swap(moved);
+			}
+
+			return *this;
+		}
+
+		void swap(flat_hash_map& other) noexcept
+		{
+			std::swap(ctrl, other.ctrl);
+			std::swap(slots, other.slots);
+			std::swap(capacity, other.capacity);
+			std::swap(shift, other.shift);
+			std::swap(entry_count, other.entry_count);
+			std::swap(deleted_count, other.deleted_count);
+		}
+
+		iterator begin() { return iterator(this, 0); }
+		iterator end() { return iterator(this, capacity); }
+		const_iterator begin() const { return const_iterator(this, 0); }
+		const_iterator end() const { return const_iterator(this, capacity); }
+
+		__attribute__((warn_unused_result))
+		size_t size() const { return entry_count; }
+
+		__attribute__((warn_unused_result))
+		bool empty() const { return entry_count == 0; }
+
+		void clear()
+		{
+			destroy_entries();
+			if (ctrl)
+				std::memset(ctrl.get(), ctrl_empty, capacity);
+
+			entry_count = 0;
+			deleted_count = 0;
+		}
+
+		// make room for the given amount of entries without rehashing
+		void reserve(const size_t count)
+		{
+			size_t new_capacity = min_capacity;
+			while (count * 8 > new_capacity * 7)
+				new_capacity *= 2;
+
+			if (new_capacity > capacity)
+				rehash(new_capacity);
+		}
+
+		template<typename K>
+		__attribute__((warn_unused_result))
+		iterator find(const K& key)
+		{
+			const size_t index = find_index(key);
+			return index == npos ? end() : iterator(this, index);
+		}
+
+		template<typename K>
+		__attribute__((warn_unused_result))
+		const_iterator find(const K& key) const
+		{
+			const size_t index = find_index(key);
+			return index == npos ? end() : const_iterator(this, index);
+		}
+
+		template<typename K>
+		__attribute__((warn_unused_result))
+		bool contains(const K& key) const
+		{
+			return find_index(key) != npos;
+		}
+
+		template<typename K>
+		__attribute__((warn_unused_result))
+		Value& at(const K& key)
+		{
+			const size_t index = find_index(key);
+			if (index == npos)
+				throw std::out_of_range("flat_hash_map::at");
+
+			return slots[index].get()->second;
+		}
+
+		template<typename K>
+		__attribute__((warn_unused_result))
+		const Value& at(const K& key) const
+		{
+			const size_t index = find_index(key);
+			if (index == npos)
+				throw std::out_of_range("flat_hash_map::at");
+
+			return slots[index].get()->second;
+		}
+
+		// the key is only converted to Key if a new entry gets inserted
+		template<typename K, typename... Args>
+		std::pair<iterator, bool> try_emplace(K&& key, Args&&... args)
+		{
+			const size_t hash = mixed_hash(key);
+
+			size_t index = find_index(key, hash);
+			if (index != npos)
+				return { iterator(this, index), false };
+
+			if ((entry_count + deleted_count + 1) * 8 > capacity * 7)
+				rehash(entry_count * 2 >= capacity ? std::max(capacity * 2, min_capacity) : capacity);
+
+			index = free_index(hash);
+			new (slots[index].storage) value_type(std::piecewise_construct,
+					std::forward_as_tuple(std::forward<K>(key)),
+					std::forward_as_tuple(std::forward<Args>(args)...));
+
+			if (ctrl[index] == ctrl_deleted)
+				--deleted_count;
+
+			ctrl[index] = tag(hash);
+			++entry_count;
+
+			return { iterator(this, index), true };
+		}
+
+		template<typename K, typename V>
+		std::pair<iterator, bool> insert_or_assign(K&& key, V&& value)
+		{
+			auto [it, inserted] = try_emplace(std::forward<K>(key), std::forward<V>(value));
+			if (!inserted)
+				it->second = std::forward<V>(value);
+
+			return { it, inserted };
+		}
+
+		template<typename K>
+		Value& operator[](K&& key)
+		{
+			return try_emplace(std::forward<K>(key)).first->second;
+		}
+
+		template<typename K>
+		size_t erase(const K& key)
+		{
+			const size_t index = find_index(key);
+			if (index == npos)
+				return 0;
+
+			slots[index].get()->~value_type();
+			ctrl[index] = ctrl_deleted;
+			--entry_count;
+			++deleted_count;
+
+			return 1;
+		}
+
+	private:
+		// spread the bits of the hash, since std::hash is the identity
+		// function for integers and the index is taken from the top bits
+		template<typename K>
+		static size_t mixed_hash(const K& key)
+		{
+			return static_cast<size_t>(static_cast<u64>(Hash{}(key)) * 0x9E3779B97F4A7C15ull);
+		}
+
+		static u8 tag(const size_t hash)
+		{
+			return hash & 0x7F;
+		}
+
+		size_t first_index(const size_t hash) const
+		{
+			return hash >> shift;
+		}
+
+		template<typename K>
+		size_t find_index(const K& key) const
+		{
+			if (entry_count == 0)
+				return npos;
+
+			return find_index(key, mixed_hash(key));
+		}
+
+		template<typename K>
+		size_t find_index(const K& key, const size_t hash) const
+		{
+			if (capacity == 0)
+				return npos;
+
+			const u8 key_tag = tag(hash);
+			const size_t mask = capacity - 1;
+
+			for (size_t index = first_index(hash); ; index = (index + 1) & mask)
+			{
+				const u8 c = ctrl[index];
+				if (c == ctrl_empty)
+					return npos;
+
+				if (c == key_tag && KeyEqual{}(slots[index].get()->first, key))
+					return index;
+			}
+		}
+
+		// there's always at least one empty slot, since the load factor is kept below 7/8
+		size_t free_index(const size_t hash) const
+		{
+			const size_t mask = capacity - 1;
+
+			size_t index = first_index(hash);
+			while (is_full(ctrl[index]))
+				index = (index + 1) & mask;
+
+			return index;
+		}
+
+		void rehash(const size_t new_capacity)
+		{
+			assert(new_capacity >= min_capacity);
+			assert((new_capacity & (new_capacity - 1)) == 0 && "The capacity has to be a power of two");
+
+			std::unique_ptr<u8[]> old_ctrl = std::move(ctrl);
+			std::unique_ptr<slot[]> old_slots = std::move(slots);
+			const size_t old_capacity = capacity;
+
+			ctrl = std::make_unique<u8[]>(new_capacity);
+			std::memset(ctrl.get(), ctrl_empty, new_capacity);
+			slots = std::unique_ptr<slot[]>(new slot[new_capacity]);
+			capacity = new_capacity;
+			shift = 64 - std::countr_zero(new_capacity);
+			deleted_count = 0;
+
+			for (size_t i = 0; i < old_capacity; ++i)
+			{
+				if (!is_full(old_ctrl[i]))
+					continue;
+
+				value_type* const entry = old_slots[i].get();
+				const size_t hash = mixed_hash(entry->first);
+				const size_t index = free_index(hash);
+
+				new (slots[index].storage) value_type(std::move(*entry));
+				ctrl[index] = tag(hash);
+				entry->~value_type();
+			}
+		}
+
+		void destroy_entries()
+		{
+			for (size_t i = 0; i < capacity && entry_count > 0; ++i)
+			{
+				if (!is_full(ctrl[i]))
+					continue;
+
+				slots[i].get()->~value_type();
+				ctrl[i] = ctrl_empty;
+				--entry_count;
+			}
+		}
+
+		std::unique_ptr<u8[]> ctrl;
+		std::unique_ptr<slot[]> slots;
+		size_t capacity{0};
+		size_t shift{64};
+		size_t entry_count{0};
+		size_t deleted_count{0};
+	};
+
+#ifdef BIRB_TEST
+	TEST_CASE("flat_hash_map")
+	{
+		flat_hash_map<std::string, int, string_hash> map;
+		for (int i = 0; i < 100; ++i)
+			map[std::to_string(i)] = i;
+
+		CHECK(map.size() == 100);
+		CHECK(map.at(std::string_view("42")) == 42);
+
+		CHECK(map.erase("42") == 1);
+		CHECK_FALSE(map.contains("42"));
+		CHECK(map.size() == 99);
+
+		CHECK(map.try_emplace("7", 0).second == false);
+		CHECK(map.at("7") == 7);
+	}
+#endif
+}
@@ -0,0 +1,42 @@
+#pragma once
+
+#include "Config.hpp"
+
+#include <optional>
+#include <string>
+#include <unistd.h>
+#include <vector>
+
+namespace birb
+{
+	struct image_export_options
+	{
+		// a directory, a file that ends with .tar, or - to
+		// write the tar stream to stdout
+		std::string output;
+
+		// where the tar stream goes when the output is -
+		int stdout_fd{STDOUT_FILENO};
+
+		// the packages to export along with their installed dependencies.
+		// Empty exports every installed package
+		std::vector<std::string> packages;
+
+		// only export the files that changed since the image that this
+		// manifest was written for. Files that were removed since then
+		// get removed from a directory image and listed in <output>.removed
+		// for a tar image
+		std::optional<std::string> previous_manifest;
+	};
+
+	// make stdout point to stderr, so that the messages don't get mixed
+	// into a tar stream in stdout. Returns a file descriptor of the
+	// original stdout for the stream
+	__attribute__((warn_unused_result))
+	int detach_stdout();
+
+	// merge the fakeroots of the packages into a root filesystem image with
+	// the files themselves instead of symlinks to the fakeroots. The list of
+	// exported files is written to <output>.manifest for incremental exports
+	void export_image(const image_export_options& options, const path_settings& paths);
+}
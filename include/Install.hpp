@@ -1,10 +1,10 @@
 #pragma once
 
 #include <string>
-#include <unordered_set>
 #include <vector>
 
 #include "Config.hpp"
+#include "DeferredTests.hpp"
 #include "PackageInfo.hpp"
 
 namespace birb
@@ -12,7 +12,27 @@ namespace birb
 	// start the process of installing packages to the system
 	void install(const std::vector<std::string>& packages, const path_settings& paths, const birb_config& config, const bool force_install);
 
-	void install_package(const std::string& pkg_name, const std::unordered_set<pkg_flag>& pkg_flags, const path_settings& paths, const birb_config& config, const bool xorg_running, const bool force_install);
+	// continue an installation that was interrupted
+	void resume_install(const path_settings& paths, const birb_config& config);
+
+	// continue a failed package build from the phase that failed
+	void resume_build(const std::string& pkg_name, const path_settings& paths, const birb_config& config);
+
+	// if tests are deferred, the test phases get started in background_tests
+	// instead of blocking the installation
+	void install_package(const std::string& pkg_name, const pkg_flag_set pkg_flags, const path_settings& paths, const birb_config& config, const bool xorg_running, const bool force_install, const bool resume_build = false, deferred_tests* background_tests = nullptr);
+
+	// packages with the 32bit flag get their 32-bit libraries built
+	// too if ENABLE_32BIT_PACKAGES is set in birb.conf
+	__attribute__((warn_unused_result))
+	bool is_multilib_build(const pkg_flag_set pkg_flags, const birb_config& config);
+
+	// build a package into its fakeroot without linking it to the system
+	void build_package(const std::string& pkg_name, const pkg_flag_set pkg_flags, const path_settings& paths, const birb_config& config, const bool xorg_running, const bool resume_build = false, deferred_tests* background_tests = nullptr);
+
+	// link a package that has already been built into its fakeroot
+	// and run its post-install hook
+	void install_prebuilt_package(const std::string& pkg_name, const path_settings& paths, const bool xorg_running, const bool force_install);
 
 	// create an empty skeleton fakeroot for a papckage
 	void prepare_fakeroot(const std::string& pkg_name, const path_settings& paths);
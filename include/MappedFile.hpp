@@ -0,0 +1,119 @@
+#pragma once
+
+#include "EnumTable.hpp"
+#include "Utils.hpp"
+
+#include <string>
+#include <string_view>
+
+namespace birb
+{
+	enum class file_error
+	{
+		noerr, not_found, not_a_file, no_permission, read_failed
+	};
+
+	constexpr auto file_error_str = make_enum_table<file_error>({
+		{ file_error::noerr, "no error" },
+		{ file_error::not_found, "the file doesn't exist" },
+		{ file_error::not_a_file, "not a regular file" },
+		{ file_error::no_permission, "permission denied" },
+		{ file_error::read_failed, "the file couldn't be read" }
+	});
+
+	// the lines of a text file without the empty lines and the comment
+	// lines that start with '#'. The lines point into the file contents
+	class file_lines
+	{
+	public:
+		class iterator
+		{
+		public:
+			using iterator_category = std::forward_iterator_tag;
+			using value_type = std::string_view;
+			using difference_type = std::ptrdiff_t;
+			using pointer = const std::string_view*;
+			using reference = const std::string_view&;
+
+			iterator() = default;
+
+			explicit iterator(const split_view::iterator line)
+			:line(line)
+			{
+				skip_ignored_lines();
+			}
+
+			reference operator*() const { return *line; }
+			pointer operator->() const { return line.operator->(); }
+
+			iterator& operator++()
+			{
+				++line;
+				skip_ignored_lines();
+				return *this;
+			}
+
+			iterator operator++(int)
+			{
+				iterator previous = *this;
+				++*this;
+				return previous;
+			}
+
+			bool operator==(const iterator& other) const { return line == other.line; }
+
+		private:
+			void skip_ignored_lines()
+			{
+				while (line != split_view::iterator() && (line->empty() || line->front() == '#'))
+					++line;
+			}
+
+			split_view::iterator line;
+		};
+
+		explicit file_lines(const std::string_view text)
+		:lines(text, "\n")
+		{}
+
+		iterator begin() const { return iterator(lines.begin()); }
+		iterator end() const { return iterator(lines.end()); }
+
+	private:
+		split_view lines;
+	};
+
+	// read only view to the contents of a file. Large files are mapped to
+	// memory and small files are read with a single read() call, since
+	// mapping a file costs more than reading a few pages
+	class mapped_file
+	{
+	public:
+		mapped_file() = default;
+		~mapped_file();
+
+		mapped_file(mapped_file&& other) noexcept;
+		mapped_file& operator=(mapped_file&& other) noexcept;
+
+		mapped_file(const mapped_file&) = delete;
+		mapped_file& operator=(const mapped_file&) = delete;
+
+		// replaces the previously opened file, if any. The contents
+		// are empty if the file couldn't be read
+		__attribute__((warn_unused_result))
+		file_error open(const std::string& file_path);
+
+		__attribute__((warn_unused_result))
+		std::string_view contents() const;
+
+		__attribute__((warn_unused_result))
+		file_lines lines() const;
+
+	private:
+		void close();
+
+		std::string buffer;
+		const char* mapping{nullptr};
+		size_t mapping_size{0};
+	};
+}
@@ -0,0 +1,17 @@
+#pragma once
+
+#include "Types.hpp"
+
+#include <string_view>
+
+namespace birb
+{
+	// small integer id for a package name, so that the caches don't need
+	// to store and hash a copy of the name for every entry
+	using pkg_id = u32;
+
+	// the same name always gets the same id until birb exits. This can
+	// be called from multiple threads
+	__attribute__((warn_unused_result))
+	pkg_id intern_pkg_name(const std::string_view pkg_name);
+}
@@ -2,10 +2,11 @@
 
 #include "Config.hpp"
 #include "Database.hpp"
+#include "EnumTable.hpp"
 
+#include <initializer_list>
 #include <optional>
-#include <unordered_map>
-#include <unordered_set>
+#include <type_traits>
 
 namespace birb
 {
@@ -23,30 +24,123 @@ namespace birb
 		empty_name
 	};
 
-	const static inline std::unordered_map<std::string, pkg_flag> pkg_flag_string_mappings = {
-		{ "32bit", pkg_flag::x86 },
-		{ "test32", pkg_flag::x86_test },
-		{ "test", pkg_flag::test },
-		{ "important", pkg_flag::important },
-		{ "python", pkg_flag::python },
-		{ "wip", pkg_flag::wip },
-		{ "font", pkg_flag::font },
-		{ "proprietary", pkg_flag::proprietary }
+	// the names of the flags in the FLAGS variable of seed.sh files
+	constexpr auto pkg_flag_names = make_enum_table<pkg_flag>({
+		{ pkg_flag::x86, "32bit" },
+		{ pkg_flag::x86_test, "test32" },
+		{ pkg_flag::test, "test" },
+		{ pkg_flag::important, "important" },
+		{ pkg_flag::python, "python" },
+		{ pkg_flag::wip, "wip" },
+		{ pkg_flag::font, "font" },
+		{ pkg_flag::proprietary, "proprietary" }
+	});
+
+	// set of package flags with one bit per flag
+	class pkg_flag_set
+	{
+	public:
+		constexpr pkg_flag_set() = default;
+
+		constexpr pkg_flag_set(const std::initializer_list<pkg_flag> flags)
+		{
+			for (const pkg_flag flag : flags)
+				insert(flag);
+		}
+
+		constexpr void insert(const pkg_flag flag)
+		{
+			bits |= bit(flag);
+		}
+
+		__attribute__((warn_unused_result))
+		constexpr bool contains(const pkg_flag flag) const
+		{
+			return bits & bit(flag);
+		}
+
+		__attribute__((warn_unused_result))
+		constexpr bool empty() const
+		{
+			return bits == 0;
+		}
+
+		constexpr bool operator==(const pkg_flag_set& other) const = default;
+
+	private:
+		static constexpr u8 bit(const pkg_flag flag)
+		{
+			return 1 << static_cast<u8>(flag);
+		}
+
+		u8 bits{0};
 	};
 
+	static_assert(pkg_flag_names.entries.size() <= 8, "The pkg_flag_set bits can't fit all of the flags");
+	static_assert(std::is_trivially_copyable_v<pkg_flag_set>);
+
 	// check if the package is valid in all regards
 	package_validation_error validate_package(const std::string& pkg_name, const path_settings& paths);
 
 	// check if the package name only contains allowed characters
+	// (lowercase letters, numbers and "_+-")
 	__attribute__((warn_unused_result))
-	bool is_valid_package_name(const std::string& pkg_name);
+	constexpr bool is_valid_package_name(const std::string_view pkg_name)
+	{
+		for (const char c : pkg_name)
+		{
+			const bool allowed = (c >= 'a' && c <= 'z') || (c >= '0' && c <= '9')
+				|| c == '_' || c == '+' || c == '-';
+
+			if (!allowed)
+				return false;
+		}
+
+		return true;
+	}
+
+	static_assert(is_valid_package_name("gtk+-3_x"));
+	static_assert(!is_valid_package_name("Vim"));
+	static_assert(!is_valid_package_name("../vim"));
 
 	// figure out which repository the package is in
 	__attribute__((warn_unused_result))
 	std::optional<pkg_source> locate_package(const std::string& pkg_name, const path_settings& paths);
 
+	// parse a space separated list of flags. Unknown flags are
+	// passed to the callback, which can be used for warning about them
+	template<typename F>
+	constexpr pkg_flag_set parse_pkg_flags(const std::string_view flag_str, F&& on_unknown_flag)
+	{
+		pkg_flag_set flags;
+
+		size_t begin = 0;
+		while (begin < flag_str.size())
+		{
+			size_t end = flag_str.find(' ', begin);
+			if (end == std::string_view::npos)
+				end = flag_str.size();
+
+			const std::string_view flag_name = flag_str.substr(begin, end - begin);
+			if (!flag_name.empty())
+			{
+				const std::optional<pkg_flag> flag = pkg_flag_names.parse(flag_name);
+				if (flag.has_value())
+					flags.insert(flag.value());
+				else
+					on_unknown_flag(flag_name);
+			}
+
+			begin = end + 1;
+		}
+
+		return flags;
+	}
+
+	static_assert(parse_pkg_flags("32bit  font", [](std::string_view) {}) == pkg_flag_set{ pkg_flag::x86, pkg_flag::font });
+
 	__attribute__((warn_unused_result))
-	std::unordered_set<pkg_flag> get_pkg_flags(const std::string& pkg_name, const pkg_source& repo);
+	pkg_flag_set get_pkg_flags(const std::string& pkg_name, const pkg_source& repo);
 
 	// find and cache all metapackages
 	void find_meta_packages(const path_settings& paths);
@@ -56,4 +150,8 @@ namespace birb
 
 	__attribute__((warn_unused_result))
 	const std::vector<std::string>& expand_meta_package(const std::string& meta_pkg_name, const path_settings& paths);
+
+	// forget everything that has been cached about the repositories and
+	// the package database, so that changes made to them get noticed
+	void clear_caches();
 }
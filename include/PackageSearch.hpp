@@ -10,4 +10,10 @@ namespace birb
 	// find a package and print information about it
 	// The output will be in the following format: `package;version;description [installed]`
 	void pkg_search(const std::vector<std::string>& packages, const path_settings& paths);
+
+	// find packages with names that contain the query words or are similar to them
+	// and print them in the same format as pkg_search(), the best matches first
+	//
+	// if search_descriptions is set, the package descriptions are searched too
+	void pkg_fuzzy_search(const std::vector<std::string>& query, const bool search_descriptions, const path_settings& paths);
 }
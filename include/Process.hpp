@@ -0,0 +1,162 @@
+#pragma once
+
+#include <atomic>
+#include <chrono>
+#include <functional>
+#include <optional>
+#include <string>
+#include <string_view>
+#include <sys/types.h>
+#include <vector>
+
+namespace birb
+{
+	// set of environment variables passed to a child process
+	//
+	// this lets each job have its own environment without
+	// touching the environment of the birb process itself
+	class environment
+	{
+	public:
+		// create a copy of the environment that birb was started with
+		__attribute__((warn_unused_result))
+		static environment inherit();
+
+		void set(const std::string& key, const std::string& value);
+		void unset(const std::string& key);
+
+		__attribute__((warn_unused_result))
+		std::optional<std::string> get(const std::string& key) const;
+
+		// KEY=value strings in the format expected by execve()
+		__attribute__((warn_unused_result))
+		const std::vector<std::string>& variables() const;
+
+	private:
+		std::vector<std::string> vars;
+	};
+
+	enum class stream_mode
+	{
+		inherit,	// share the stream with birb
+		pipe,		// connect the stream to a pipe owned by birb
+		null,		// redirect the stream to /dev/null
+		fd			// redirect the stream to a file descriptor owned by the caller
+	};
+
+	struct process_options
+	{
+		// argv of the child, the first argument is searched from PATH
+		std::vector<std::string> args;
+
+		environment env{environment::inherit()};
+
+		// working directory of the child, empty means the current
+		// working directory of birb
+		std::string working_dir;
+
+		// kill the child if it runs longer than this, zero disables the timeout
+		std::chrono::milliseconds timeout{0};
+
+		// kill the child when this turns true
+		const std::atomic<bool>* cancel{nullptr};
+
+		// put the child into its own process group so that the whole
+		// process tree can be killed on timeout or cancellation
+		//
+		// processes in their own group won't get signals from the terminal
+		bool own_process_group{false};
+
+		stream_mode stdin_mode{stream_mode::inherit};
+		stream_mode stdout_mode{stream_mode::inherit};
+		stream_mode stderr_mode{stream_mode::inherit};
+
+		// used with stream_mode::fd
+		int stdin_fd{-1};
+		int stdout_fd{-1};
+		int stderr_fd{-1};
+
+		// called with chunks of piped output. If a callback is not set,
+		// the output gets collected into process_result instead
+		std::function<void(std::string_view)> on_stdout;
+		std::function<void(std::string_view)> on_stderr;
+	};
+
+	struct process_result
+	{
+		// exit code of the child or -1 if it was killed by a signal
+		int exit_code{-1};
+
+		// signal that terminated the child
+		int signal{0};
+
+		bool spawn_failed{false};
+		bool timed_out{false};
+		bool cancelled{false};
+
+		// collected piped output if there were no output callbacks
+		std::string out;
+		std::string err;
+
+		__attribute__((warn_unused_result))
+		bool success() const;
+	};
+
+	class process
+	{
+	public:
+		process(const process&) = delete;
+		process& operator=(const process&) = delete;
+		process(process&& other) noexcept;
+		process& operator=(process&& other) noexcept;
+
+		// kills the child if it was never waited for
+		~process();
+
+		// launch a child process with posix_spawn()
+		__attribute__((warn_unused_result))
+		static std::optional<process> spawn(process_options options);
+
+		__attribute__((warn_unused_result))
+		pid_t pid() const;
+
+		// write end of the stdin pipe when using stream_mode::pipe for stdin
+		__attribute__((warn_unused_result))
+		int stdin_pipe() const;
+		void close_stdin();
+
+		// send a signal to the child (or its process group)
+		void kill(int sig);
+
+		// block until the child has exited and its piped output
+		// has been consumed
+		process_result wait();
+
+	private:
+		process() = default;
+		void close_fds();
+
+		process_options opts;
+		pid_t child_pid{-1};
+		int pidfd{-1};
+		int stdin_fd{-1};
+		int stdout_fd{-1};
+		int stderr_fd{-1};
+
+		bool exited{false};
+		bool reaped{false};
+		std::chrono::steady_clock::time_point start_time;
+		std::optional<std::chrono::steady_clock::time_point> kill_time;
+		process_result result;
+
+		friend std::vector<process_result> wait_all(std::vector<process*> processes);
+	};
+
+	// wait for multiple processes at once, so that the piped output of every
+	// one of them keeps flowing while waiting. The results are returned in
+	// the same order as the processes
+	std::vector<process_result> wait_all(std::vector<process*> processes);
+
+	// spawn a process and wait for it to finish
+	process_result run_process(process_options options);
+}
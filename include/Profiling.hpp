@@ -0,0 +1,144 @@
+#pragma once
+
+#include "EnumTable.hpp"
+#include "Types.hpp"
+
+#include <array>
+#include <atomic>
+#include <chrono>
+#include <string>
+#include <string_view>
+
+namespace birb
+{
+	// parts of the installation pipeline that get timed separately
+	enum class profile_category
+	{
+		resolve, fetch, shell, link, db
+	};
+
+	constexpr size_t profile_category_count = 5;
+
+	constexpr auto profile_category_names = make_enum_table<profile_category>({
+		{ profile_category::resolve, "resolve" },
+		{ profile_category::fetch, "fetch" },
+		{ profile_category::shell, "shell" },
+		{ profile_category::link, "link" },
+		{ profile_category::db, "db" }
+	});
+
+	struct profile_counter
+	{
+		std::atomic<u64> nanoseconds{0};
+		std::atomic<u64> count{0};
+	};
+
+	// the timers only check this flag when profiling is disabled. It is
+	// read from the thread pool workers, so the flag has to be atomic
+	inline std::atomic<bool> profiling_enabled{false};
+	inline std::array<profile_counter, profile_category_count> profile_counters;
+
+	// adds the time spent in the scope to the counter of the category
+	//
+	// the timers should not be nested within the same category,
+	// or the time gets counted twice
+	class scoped_timer
+	{
+	public:
+		explicit scoped_timer(const profile_category category)
+		:category(category)
+		{
+			if (profiling_enabled.load(std::memory_order_relaxed))
+				start = std::chrono::steady_clock::now();
+		}
+
+		~scoped_timer()
+		{
+			if (!profiling_enabled.load(std::memory_order_relaxed) || start == std::chrono::steady_clock::time_point{})
+				return;
+
+			const auto duration = std::chrono::steady_clock::now() - start;
+
+			profile_counter& counter = profile_counters.at(static_cast<size_t>(category));
+			counter.nanoseconds += std::chrono::duration_cast<std::chrono::nanoseconds>(duration).count();
+			++counter.count;
+		}
+
+		scoped_timer(const scoped_timer&) = delete;
+		scoped_timer& operator=(const scoped_timer&) = delete;
+
+	private:
+		const profile_category category;
+		std::chrono::steady_clock::time_point start{};
+	};
+
+	void reset_profile();
+
+	__attribute__((warn_unused_result))
+	f64 profile_time_ms(const profile_category category);
+
+	__attribute__((warn_unused_result))
+	u64 profile_count(const profile_category category);
+
+	// file system operations that get counted while tracing
+	enum class trace_counter
+	{
+		stat, open
+	};
+
+	constexpr size_t trace_counter_count = 2;
+
+	// the trace spans only check this flag when tracing is disabled
+	inline std::atomic<bool> tracing_enabled{false};
+	inline std::array<std::atomic<u64>, trace_counter_count> trace_counters;
+
+	inline void count_trace_event(const trace_counter counter, const u64 amount = 1)
+	{
+		if (tracing_enabled.load(std::memory_order_relaxed))
+			trace_counters.at(static_cast<size_t>(counter)) += amount;
+	}
+
+	// start collecting trace spans. They get written to the given file in the
+	// Chrome trace event format when birb exits, so the trace can be opened
+	// with Perfetto or chrome://tracing
+	void start_trace(const std::string& path);
+
+	__attribute__((warn_unused_result))
+	u64 trace_timestamp();
+
+	void record_trace_span(const char* name, const std::string& detail, const u64 start);
+
+	// records the time spent in the scope as a trace event
+	//
+	// the name has to be a string literal. The detail is shown as
+	// an argument of the event, for example the name of the package
+	class trace_span
+	{
+	public:
+		explicit trace_span(const char* name, const std::string_view detail = {})
+		:name(name)
+		{
+			if (!tracing_enabled.load(std::memory_order_relaxed))
+				return;
+
+			this->detail = detail;
+			start = trace_timestamp();
+			active = true;
+		}
+
+		~trace_span()
+		{
+			if (active && tracing_enabled.load(std::memory_order_relaxed))
+				record_trace_span(name, detail, start);
+		}
+
+		trace_span(const trace_span&) = delete;
+		trace_span& operator=(const trace_span&) = delete;
+
+	private:
+		const char* const name;
+		std::string detail;
+		u64 start{0};
+		bool active{false};
+	};
+}
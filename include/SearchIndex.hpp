@@ -0,0 +1,88 @@
+#pragma once
+
+#include "Config.hpp"
+#include "Types.hpp"
+
+#include <optional>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+namespace birb
+{
+	struct search_index_entry
+	{
+		std::string name;
+		std::string version;
+		std::string description;
+	};
+
+	struct search_match
+	{
+		u32 id;
+		f32 score;
+	};
+
+	// trigram index over the names and descriptions of all packages
+	// in the package repositories
+	//
+	// the index is built when the repositories are synced, so searching
+	// doesn't need to read any seed.sh files
+	class search_index
+	{
+	public:
+		// read the seed.sh files of all packages in the repositories. If the same
+		// package is in multiple repositories, the first repository wins
+		__attribute__((warn_unused_result))
+		static search_index build(const path_settings& paths);
+
+		__attribute__((warn_unused_result))
+		static std::optional<search_index> load(const path_settings& paths);
+
+		void save(const path_settings& paths) const;
+
+		// find packages with names (and optionally descriptions) that contain
+		// the query or are similar to it. The results are sorted by relevance
+		__attribute__((warn_unused_result))
+		std::vector<search_match> search(const std::string& query, const bool search_descriptions) const;
+
+		__attribute__((warn_unused_result))
+		const search_index_entry& entry(const u32 id) const;
+
+		__attribute__((warn_unused_result))
+		size_t size() const;
+
+	private:
+		// sorted lists of entry ids for each trigram
+		//
+		// the lists are stored back to back in a single array, so the index
+		// can be loaded with a couple of memcpy() calls
+		struct posting_list
+		{
+			struct range
+			{
+				u32 trigram;
+				u32 offset;
+				u32 count;
+			};
+
+			// sorted by the trigram
+			std::vector<range> ranges;
+			std::vector<u32> ids;
+
+			void build(const std::unordered_map<u32, std::vector<u32>>& postings);
+
+			// count how many of the given trigrams each entry has
+			void count_hits(const std::vector<u32>& trigrams, std::vector<u16>& hits) const;
+		};
+
+		std::vector<search_index_entry> entries;
+
+		// the names in lowercase for comparing them with the query. They
+		// aren't saved, since they are quick to make from the entries
+		std::vector<std::string> lower_names;
+
+		posting_list name_postings;
+		posting_list desc_postings;
+	};
+}
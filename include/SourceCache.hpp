@@ -0,0 +1,28 @@
+#pragma once
+
+#include "Config.hpp"
+
+#include <string>
+
+namespace birb
+{
+	// copy a directory tree while keeping the permissions, owners and
+	// timestamps intact
+	//
+	// the file contents get shared with copy-on-write clones (FICLONE)
+	// if the filesystem supports them. Otherwise the files are copied
+	// with copy_file_range() and finally with plain reads and writes
+	void clone_tree(const std::string& src, const std::string& dst);
+
+	// copy the extracted sources of a tarball from the source cache into
+	// the build directory. If the cache doesn't have them yet, the tarball
+	// gets extracted into the cache first
+	//
+	// the cache is keyed by the checksum of the tarball and the least recently
+	// used source trees get evicted when the cache grows too large
+	//
+	// returns false if the sources couldn't be cached, in which case
+	// the tarball needs to be extracted normally
+	__attribute__((warn_unused_result))
+	bool clone_cached_sources(const std::string& tarball_path, const std::string& checksum, const std::string& build_dir, const path_settings& paths, const birb_config& config);
+}
@@ -0,0 +1,98 @@
+#pragma once
+
+#include "Types.hpp"
+
+#include <algorithm>
+#include <atomic>
+#include <condition_variable>
+#include <exception>
+#include <functional>
+#include <mutex>
+
+namespace birb
+{
+	// limit the amount of threads that libbirb uses for parallel work,
+	// including the thread that waits for the work to finish. 0 uses one
+	// thread per CPU thread and 1 runs everything in the calling thread
+	//
+	// the worker threads are started when the first task gets queued, so
+	// this has no effect after that
+	void set_thread_limit(const u16 max_threads);
+
+	__attribute__((warn_unused_result))
+	u16 thread_limit();
+
+	// a set of tasks that are queued to the shared worker threads and
+	// waited on together
+	//
+	// the tasks are stolen by idle workers, so tasks can queue more tasks
+	// to the same group or to other groups without oversubscribing the CPU
+	class task_group
+	{
+	public:
+		task_group() = default;
+		~task_group();
+
+		task_group(const task_group&) = delete;
+		task_group& operator=(const task_group&) = delete;
+
+		void run(std::function<void()> task);
+
+		// wait until all of the tasks have finished. The waiting thread
+		// runs queued tasks in the meantime
+		//
+		// if any of the tasks threw an exception, the first one
+		// gets rethrown here
+		void wait();
+
+		// tasks that haven't started yet get skipped. Running tasks
+		// can check is_cancelled() to stop early
+		void cancel();
+
+		__attribute__((warn_unused_result))
+		bool is_cancelled() const;
+
+	private:
+		friend class thread_pool;
+
+		void execute(const std::function<void()>& task);
+		void finish_task();
+		void wait_for_tasks();
+
+		std::atomic<u32> pending{0};
+		std::mutex finished_mutex;
+		std::condition_variable finished;
+		std::atomic<bool> cancelled{false};
+
+		std::mutex exception_mutex;
+		std::exception_ptr exception;
+	};
+
+	// call func(i) for every i in [0, count) in parallel and wait for
+	// all of the calls to finish
+	template<typename F>
+	void parallel_for(const size_t count, F&& func)
+	{
+		if (count == 0)
+			return;
+
+		// queue a few chunks per thread instead of one task per index, so
+		// that small tasks don't drown in the scheduling overhead, but
+		// uneven chunks can still be balanced by stealing
+		const size_t chunk_count = std::min<size_t>(count, static_cast<size_t>(thread_limit()) * 4);
+		const size_t chunk_size = (count + chunk_count - 1) / chunk_count;
+
+		task_group group;
+		for (size_t begin = 0; begin < count; begin += chunk_size)
+		{
+			const size_t end = std::min(count, begin + chunk_size);
+			group.run([&func, &group, begin, end]
+			{
+				for (size_t i = begin; i < end && !group.is_cancelled(); ++i)
+					func(i);
+			});
+		}
+
+		group.wait();
+	}
+}
@@ -0,0 +1,45 @@
+#pragma once
+
+#include "Config.hpp"
+
+#include <optional>
+#include <string>
+#include <vector>
+
+namespace birb
+{
+	enum class transaction_state
+	{
+		pending,	// nothing has been done yet
+		verified,	// sources have been downloaded and their checksums verified
+		installed	// the package has been installed and added to the database
+	};
+
+	struct transaction_entry
+	{
+		std::string pkg_name;
+		transaction_state state{transaction_state::pending};
+
+		// the package was requested by the user and belongs to the nest
+		bool requested{false};
+	};
+
+	// the resolved install queue and the progress made with it
+	//
+	// the transaction gets written to disk when it starts and updated
+	// after each step, so that an interrupted installation can be
+	// continued without resolving the dependencies again
+	struct install_transaction
+	{
+		std::vector<transaction_entry> packages;
+		bool force_install{false};
+	};
+
+	void save_transaction(const install_transaction& transaction, const path_settings& paths);
+
+	// read the transaction of an unfinished installation, if there is one
+	__attribute__((warn_unused_result))
+	std::optional<install_transaction> load_transaction(const path_settings& paths);
+
+	void clear_transaction(const path_settings& paths);
+}
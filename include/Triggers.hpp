@@ -0,0 +1,58 @@
+#pragma once
+
+#include "Config.hpp"
+#include "Database.hpp"
+#include "EnumTable.hpp"
+#include "PackageInfo.hpp"
+
+#include <set>
+#include <string>
+#include <unordered_set>
+
+namespace birb
+{
+	// system wide caches that need to be updated after
+	// packages have been installed
+	enum class trigger
+	{
+		ldconfig, font_cache, icon_cache, desktop_database, man_db
+	};
+
+	// the names of the triggers in the TRIGGERS variable of seed.sh files
+	constexpr auto trigger_names = make_enum_table<trigger>({
+		{ trigger::ldconfig, "ldconfig" },
+		{ trigger::font_cache, "fc-cache" },
+		{ trigger::icon_cache, "gtk-update-icon-cache" },
+		{ trigger::desktop_database, "update-desktop-database" },
+		{ trigger::man_db, "mandb" }
+	});
+
+	// triggers collected from a set of packages
+	//
+	// each distinct trigger only needs to be run once no matter
+	// how many packages wanted it to be run
+	struct trigger_set
+	{
+		std::unordered_set<trigger> triggers;
+
+		// icon theme directories that need their icon cache updated
+		std::set<std::string> icon_themes;
+
+		void merge(const trigger_set& other);
+
+		__attribute__((warn_unused_result))
+		bool empty() const;
+	};
+
+	// find the triggers declared in the TRIGGERS variable of the package and
+	// the triggers implied by the files in the fakeroot of the package
+	__attribute__((warn_unused_result))
+	trigger_set find_pkg_triggers(const std::string& pkg_name, const pkg_flag_set pkg_flags, const pkg_source& repo, const path_settings& paths);
+
+	// run each trigger once
+	//
+	// ldconfig is run first, since the other triggers might use libraries
+	// that were just installed. The rest of the triggers don't depend on
+	// each other and get run in parallel
+	void run_triggers(const trigger_set& triggers, const path_settings& paths);
+}
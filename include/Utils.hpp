@@ -1,7 +1,11 @@
 #pragma once
 
+#include <array>
+#include <cstddef>
+#include <iterator>
 #include <optional>
 #include <string>
+#include <string_view>
 #include <vector>
 
 #include "Types.hpp"
@@ -11,23 +15,188 @@ namespace birb
 	__attribute__((warn_unused_result))
 	bool root_check();
 
-	void exec_shell_cmd(const std::string& cmd);
-
-	// read the return value gotten from a shell script that gets
-	// saved to /tmp/birb_ret
+	// run a command with bash and return its exit code
 	__attribute__((warn_unused_result))
-	u8 shell_return_value();
+	int exec_shell_cmd(const std::string& cmd);
 
 	// TODO: deprecate and replace with clipp
 	__attribute__((warn_unused_result))
 	bool argcmp(char* arg, int argc, const std::string& option, int required_arg_count);
 
+	// iterate over the tokens of a string without copying anything. The
+	// tokens point into the original string, so it has to outlive them
+	//
+	// the tokens are the same as with split_string(). Empty tokens between
+	// delimiters are kept, but there's no empty token after a trailing delimiter
+	class split_view
+	{
+	public:
+		class iterator
+		{
+		public:
+			using iterator_category = std::forward_iterator_tag;
+			using value_type = std::string_view;
+			using difference_type = std::ptrdiff_t;
+			using pointer = const std::string_view*;
+			using reference = const std::string_view&;
+
+			iterator() = default;
+
+			iterator(const std::string_view text, const std::string_view delimiter)
+			:rest(text), delimiter(delimiter), has_rest(!text.empty()), at_end(false)
+			{
+				next();
+			}
+
+			reference operator*() const { return token; }
+			pointer operator->() const { return &token; }
+
+			iterator& operator++()
+			{
+				next();
+				return *this;
+			}
+
+			iterator operator++(int)
+			{
+				iterator previous = *this;
+				next();
+				return previous;
+			}
+
+			bool operator==(const iterator& other) const
+			{
+				if (at_end || other.at_end)
+					return at_end == other.at_end;
+
+				return token.data() == other.token.data() && token.size() == other.token.size();
+			}
+
+		private:
+			void next()
+			{
+				if (!has_rest)
+				{
+					at_end = true;
+					return;
+				}
+
+				const size_t pos = rest.find(delimiter);
+				if (pos == std::string_view::npos)
+				{
+					token = rest;
+					has_rest = false;
+					return;
+				}
+
+				token = rest.substr(0, pos);
+				rest.remove_prefix(pos + delimiter.size());
+				has_rest = !rest.empty();
+			}
+
+			std::string_view rest;
+			std::string_view delimiter;
+			std::string_view token;
+			bool has_rest{false};
+			bool at_end{true};
+		};
+
+		split_view(const std::string_view text, const std::string_view delimiter)
+		:text(text), delimiter(delimiter)
+		{}
+
+		iterator begin() const { return iterator(text, delimiter); }
+		iterator end() const { return iterator(); }
+
+	private:
+		std::string_view text;
+		std::string_view delimiter;
+	};
+
+	// split a line that should have exactly N fields, like the database
+	// and index file lines. Returns nothing if the field count is wrong
+	template<size_t N>
+	__attribute__((warn_unused_result))
+	std::optional<std::array<std::string_view, N>> split_fields(const std::string_view text, const std::string_view delimiter)
+	{
+		std::array<std::string_view, N> fields;
+		size_t count{0};
+
+		for (const std::string_view field : split_view(text, delimiter))
+		{
+			if (count == N)
+				return {};
+
+			fields[count++] = field;
+		}
+
+		if (count != N)
+			return {};
+
+		return fields;
+	}
+
+	// the first token of a string, or the whole string if there's no delimiter
 	__attribute__((warn_unused_result))
-	std::vector<std::string> split_string(std::string text, const std::string& delimiter);
+	inline std::string_view first_token(const std::string_view text, const std::string_view delimiter)
+	{
+		return text.substr(0, text.find(delimiter));
+	}
+
+	// split_view() into owned strings for results that outlive the text
+	__attribute__((warn_unused_result))
+	std::vector<std::string> split_string(const std::string_view text, const std::string_view delimiter);
 
 	__attribute__((warn_unused_result))
 	std::vector<std::string> read_file(const std::string& file_path);
 
+	// 64-bit FNV-1a hash of the file contents as a hex string
+	//
+	// this is only meant for noticing changes in files and
+	// shouldn't be used for anything security related
+	__attribute__((warn_unused_result))
+	std::string file_hash(const std::string& file_path);
+
+	// write lines to a file so that the file is either fully
+	// written or not modified at all in case of a crash. Each write
+	// uses its own temporary file, so concurrent writers can't mix
+	// their contents together
+	void write_file_atomic(const std::string& file_path, const std::vector<std::string>& lines);
+	void write_file_atomic(const std::string& file_path, const std::vector<std::string_view>& lines);
+	void write_file_atomic(const std::string& file_path, std::string_view content);
+
+	// an exclusive lock on <file_path>.lock that is held until the object goes
+	// out of scope, for updating files that other birb processes or build
+	// workers might be updating at the same time. The lock file is separate,
+	// since write_file_atomic() replaces the file itself
+	class file_lock
+	{
+	public:
+		explicit file_lock(const std::string& file_path);
+		~file_lock();
+
+		file_lock(const file_lock&) = delete;
+		file_lock& operator=(const file_lock&) = delete;
+
+	private:
+		int fd{-1};
+	};
+
+	// write all of the data into a file descriptor, retrying short writes.
+	// Writing into a socket that has been closed fails instead of raising
+	// SIGPIPE
+	__attribute__((warn_unused_result))
+	bool write_all(const int fd, std::string_view data);
+
+	// parse a whole string as an unsigned decimal number
+	__attribute__((warn_unused_result))
+	std::optional<u64> parse_u64(const std::string_view text);
+
+	// parse a size like 500M or 20G into bytes. The suffixes are
+	// powers of 1024 and a size without a suffix is in bytes
+	__attribute__((warn_unused_result))
+	std::optional<u64> parse_size(const std::string& size_str);
+
 	// check if a process is running by checking if there is a command running
 	// in /proc that has the given process name
 	__attribute__((warn_unused_result))
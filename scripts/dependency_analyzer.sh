@@ -5,6 +5,9 @@
 #
 # This can be used to retroactively add in missing dependencies that
 # were unexpected or simply not noticed at the time of packaging
+#
+# Missing library dependencies of installed packages are found more
+# reliably with 'birb --check-libs'
 
 if [ -z "$1" ] || [ -z "$2" ] || [ -z "$3" ]
 then
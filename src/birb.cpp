@@ -3,18 +3,27 @@
 #include <cstdlib>
 #include <filesystem>
 #include <iostream>
+#include <string>
+#include <string_view>
 #include <unistd.h>
 #include <vector>
 
+#include "BuildWorker.hpp"
 #include "Database.hpp"
+#include "Dedupe.hpp"
 #include "Depclean.hpp"
 #include "Distclean.hpp"
+#include "ElfScan.hpp"
 #include "Download.hpp"
+#include "ImageExport.hpp"
 #include "Install.hpp"
 #include "Logging.hpp"
+#include "MappedFile.hpp"
 #include "PackageSearch.hpp"
+#include "Profiling.hpp"
 #include "Symlink.hpp"
 #include "Sync.hpp"
+#include "ThreadPool.hpp"
 #include "Uninstall.hpp"
 #include "Utils.hpp"
 
@@ -23,6 +32,8 @@ enum class exec_mode
 	help,
 	download,
 	install,
+	resume,
+	resume_build,
 	uninstall,
 	depclean,
 	distclean,
@@ -32,7 +43,11 @@ enum class exec_mode
 	list_installed,
 	update,
 	restore,
-	upgrade
+	upgrade,
+	worker,
+	check_libs,
+	dedupe,
+	export_image
 };
 
 struct opts
@@ -45,11 +60,62 @@ struct opts
 	// act as if we were running as root
 	bool pretend{false};
 
+	// print the full build output
+	bool verbose{false};
+
+	// reuse extracted source trees between builds
+	bool source_cache{false};
+
+	// write a trace of where the time went to this file
+	std::string trace_file;
+
+	// search options
+	bool fuzzy{false};
+	bool search_descriptions{false};
+
+	// distclean options
+	bool keep_installed{false};
+	std::string max_size;
+
+	// run package test suites
+	bool test{false};
+	bool defer_tests{false};
+	bool rollback_failed_tests{false};
+
+	// commands that start build workers
+	std::vector<std::string> build_workers;
+
+	// link identical files in the fakeroots after each package
+	bool dedupe{false};
+
+	// image export options
+	std::string image_path;
+	std::string previous_manifest;
+	bool world{false};
+
 	std::vector<std::string> packages;
 };
 
 int main(int argc, char** argv)
 {
+	// split --option=value arguments into two arguments
+	std::vector<std::string> args;
+	for (int i = 1; i < argc; ++i)
+	{
+		const std::string_view arg = argv[i];
+		const size_t separator = arg.find('=');
+
+		if (arg.starts_with("--") && separator != std::string_view::npos)
+		{
+			args.emplace_back(arg.substr(0, separator));
+			args.emplace_back(arg.substr(separator + 1));
+		}
+		else
+		{
+			args.emplace_back(arg);
+		}
+	}
+
 	// parse CLI arguments
 	opts o;
 
@@ -57,6 +123,15 @@ int main(int argc, char** argv)
 			clipp::option("--pretend").set(o.pretend)
 			% "act as if we were running with root privileges",
 
+			clipp::option("-v", "--verbose").set(o.verbose)
+			% "print the full build output instead of a progress summary",
+
+			clipp::option("--source-cache").set(o.source_cache)
+			% "reuse extracted source trees from earlier builds",
+
+			(clipp::option("--trace") & clipp::value("file", o.trace_file))
+			% "write a Chrome trace event file that shows where the time was spent",
+
 			clipp::one_of(
 				clipp::option("-h", "--help").set(o.mode, exec_mode::help)
 				% "display this help page and exit",
@@ -66,22 +141,38 @@ int main(int argc, char** argv)
 
 				(clipp::option("-i", "--install").set(o.mode, exec_mode::install)
 				 & clipp::option("--force").set(o.force)
+				 & clipp::option("--test").set(o.test) % "run the test suites of the packages"
+				 & clipp::option("--defer-tests").set(o.defer_tests) % "run the test suites in the background and report failures at the end"
+				 & clipp::option("--rollback-failed-tests").set(o.rollback_failed_tests) % "uninstall packages whose deferred test suites failed"
+				 & clipp::option("--dedupe").set(o.dedupe) % "link identical files in the fakeroot of each package to the files of the other packages"
+				 & clipp::repeatable(clipp::option("--build-worker") & clipp::value("command", o.build_workers)) % "build the packages with a worker started by the command, like 'ssh host birb --worker'"
 				 & clipp::values("package(s)").set(o.packages))
 				% "install given package(s) to the filesystem",
 
+				clipp::option("--resume").set(o.mode, exec_mode::resume)
+				% "continue an installation that was interrupted",
+
+				(clipp::option("--resume-build").set(o.mode, exec_mode::resume_build) & clipp::value("package").set(o.packages))
+				% "continue a failed package build from the phase that failed",
+
 				(clipp::option("-u", "--uninstall").set(o.mode, exec_mode::uninstall) & clipp::values("package(s)").set(o.packages))
 				% "uninstall given package(s) from the filesystem",
 
 				clipp::option("--depclean").set(o.mode, exec_mode::depclean)
 				% "find and uninstall orphan packages",
 
-				clipp::option("--distclean").set(o.mode, exec_mode::distclean)
+				(clipp::option("--distclean").set(o.mode, exec_mode::distclean)
+				 & clipp::option("--keep-installed").set(o.keep_installed) % "keep the source tarballs of installed packages"
+				 & (clipp::option("--max-size") & clipp::value("size", o.max_size)) % "remove least recently used source tarballs until the distcache fits in the given size (for example 20G)")
 				% "clear the distcache",
 
 				(clipp::option("--relink").set(o.mode, exec_mode::relink) & clipp::values("package(s)").set(o.packages))
 				% "re-create symlinks to the package fakeroots",
 
-				(clipp::option("-s", "--search").set(o.mode, exec_mode::search) & clipp::values("package(s)").set(o.packages))
+				(clipp::option("-s", "--search").set(o.mode, exec_mode::search)
+				 & clipp::option("--fuzzy").set(o.fuzzy) % "find packages with similar names and rank the results"
+				 & clipp::option("--desc").set(o.search_descriptions) % "search the package descriptions too"
+				 & clipp::values("package(s)").set(o.packages))
 				% "search for packages by name",
 
 				(clipp::option("--sync").set(o.mode, exec_mode::sync_repos) & clipp::option("--force").set(o.force))
@@ -90,6 +181,18 @@ int main(int argc, char** argv)
 				clipp::option("--list-installed").set(o.mode, exec_mode::list_installed)
 				% "list all currently installed packages",
 
+				clipp::option("--check-libs").set(o.mode, exec_mode::check_libs)
+				% "find installed programs that link against libraries missing from their DEPS or from the system",
+
+				clipp::option("--dedupe").set(o.mode, exec_mode::dedupe)
+				% "replace identical files in the package fakeroots with hardlinks to save space",
+
+				(clipp::option("--export-image").set(o.mode, exec_mode::export_image) & clipp::value("output", o.image_path)
+				 & clipp::option("--world").set(o.world) % "export every installed package"
+				 & (clipp::option("--since") & clipp::value("manifest", o.previous_manifest)) % "only export the files that changed since the image of the given manifest"
+				 & clipp::opt_values("package(s)", o.packages))
+				% "export the packages and their dependencies as a root filesystem into a directory, a .tar file or - for stdout",
+
 				(clipp::option("--restore").set(o.mode, exec_mode::restore) & clipp::value("package").set(o.packages))
 				% "restore a fakeroot backup",
 
@@ -97,11 +200,14 @@ int main(int argc, char** argv)
 				% "update out-of-date packages",
 
 				clipp::option("--upgrade").set(o.mode, exec_mode::upgrade)
-				% "update the birb package manager"
+				% "update the birb package manager",
+
+				clipp::option("--worker").set(o.mode, exec_mode::worker)
+				% "build packages for another birb process that talks to this one over stdin and stdout"
 			) | clipp::values("packages", o.packages).set(o.mode, exec_mode::install) % "install a list of packages"
 		);
 
-	if (!clipp::parse(argc, argv, cli) || o.mode == exec_mode::help)
+	if (!clipp::parse(args, cli) || o.mode == exec_mode::help)
 	{
 		clipp::doc_formatting fmt;
 		fmt.doc_column(40);
@@ -114,17 +220,31 @@ int main(int argc, char** argv)
 		return 0;
 	}
 
-	path_settings path_set;
-	birb_config config;
-
-	// verify that the configuration files exist
-	if (!std::filesystem::exists(path_set.birb_cfg))
-		birb::warning(path_set.birb_cfg, " is missing, please reinstall birb with 'birb --upgrade");
+	if (!o.trace_file.empty())
+		birb::start_trace(o.trace_file);
 
-	if (!std::filesystem::exists(path_set.birb_repo_list))
-		birb::error(path_set.birb_repo_list, " is missing. Check the TROUBLESHOOTING section in 'man birb' for instructions on how to fix this issue");
+	// the image gets streamed into stdout, so the messages that get
+	// printed from here on have to go to stderr instead
+	int image_stdout_fd{STDOUT_FILENO};
+	if (o.mode == exec_mode::export_image && o.image_path == "-")
+		image_stdout_fd = birb::detach_stdout();
 
-	const auto check_root_privileges = [&o]()
+	path_settings path_set;
+	birb_config config;
+	birb::load_birb_config(path_set, config);
+	config.verbose_build = o.verbose;
+	config.source_cache = o.source_cache;
+	config.enable_tests = o.test || o.defer_tests;
+	config.defer_tests = o.defer_tests;
+	config.rollback_failed_tests = o.rollback_failed_tests;
+	config.build_workers = o.build_workers;
+	config.dedupe_after_install = o.dedupe;
+
+	birb::set_thread_limit(config.max_threads);
+
+	// the read-only commands skip these checks to start up faster. The
+	// repository list gets checked when it's read for the first time
+	const auto check_root_privileges = [&o, &path_set]()
 	{
 		// check if we are running as the root user
 		if (!birb::root_check() && !o.pretend)
@@ -132,6 +252,10 @@ int main(int argc, char** argv)
 			birb::error("This command needs to be run with root privileges (￢_￢;) (use the --pretend flag to get around this error if necessary)");
 			exit(1);
 		}
+
+		// verify that the configuration file exists
+		if (!std::filesystem::exists(path_set.birb_cfg))
+			birb::warning(path_set.birb_cfg, " is missing, please reinstall birb with 'birb --upgrade");
 	};
 
 	switch (o.mode)
@@ -146,6 +270,17 @@ int main(int argc, char** argv)
 			birb::install(o.packages, path_set, config, o.force);
 			break;
 
+		case exec_mode::resume:
+			check_root_privileges();
+			birb::resume_install(path_set, config);
+			break;
+
+		case exec_mode::resume_build:
+			check_root_privileges();
+			assert(o.packages.size() == 1);
+			birb::resume_build(o.packages.front(), path_set, config);
+			break;
+
 		case exec_mode::uninstall:
 			check_root_privileges();
 			birb::uninstall(o.packages, path_set);
@@ -157,9 +292,22 @@ int main(int argc, char** argv)
 			break;
 
 		case exec_mode::distclean:
+		{
 			check_root_privileges();
-			birb::distclean(path_set);
+
+			birb::distclean_options distclean_opts;
+			distclean_opts.keep_installed = o.keep_installed;
+
+			if (!o.max_size.empty())
+			{
+				distclean_opts.max_size = birb::parse_size(o.max_size);
+				if (!distclean_opts.max_size.has_value())
+					birb::error("Invalid distcache size: ", o.max_size);
+			}
+
+			birb::distclean(path_set, distclean_opts);
 			break;
+		}
 
 		case exec_mode::relink:
 			check_root_privileges();
@@ -167,7 +315,10 @@ int main(int argc, char** argv)
 			break;
 
 		case exec_mode::search:
-			birb::pkg_search(o.packages, path_set);
+			if (o.fuzzy || o.search_descriptions)
+				birb::pkg_fuzzy_search(o.packages, o.search_descriptions, path_set);
+			else
+				birb::pkg_search(o.packages, path_set);
 			break;
 
 		case exec_mode::sync_repos:
@@ -175,11 +326,57 @@ int main(int argc, char** argv)
 			birb::sync_repositories(path_set);
 			break;
 
+		case exec_mode::worker:
+			check_root_privileges();
+			birb::run_build_worker(path_set, config);
+			break;
+
+		case exec_mode::check_libs:
+		{
+			const std::vector<birb::library_problem> problems = birb::find_library_problems(path_set);
+			for (const birb::library_problem& problem : problems)
+			{
+				if (problem.type == birb::library_problem_type::missing_dep)
+					std::cout << "[" << problem.pkg_name << "] links against " << problem.soname << " from [" << problem.provider << "], which isn't in its DEPS (" << problem.file << ")\n";
+				else
+					std::cout << "[" << problem.pkg_name << "] needs " << problem.soname << ", which isn't installed anymore (" << problem.file << ")\n";
+			}
+
+			if (!problems.empty())
+				return 1;
+
+			break;
+		}
+
+		case exec_mode::dedupe:
+			check_root_privileges();
+			birb::dedupe_fakeroots(path_set);
+			break;
+
+		case exec_mode::export_image:
+		{
+			if (o.world == !o.packages.empty())
+				birb::error("Give either a list of packages or --world to --export-image");
+
+			birb::image_export_options export_opts;
+			export_opts.output = o.image_path;
+			export_opts.packages = o.packages;
+			export_opts.stdout_fd = image_stdout_fd;
+
+			if (!o.previous_manifest.empty())
+				export_opts.previous_manifest = o.previous_manifest;
+
+			birb::export_image(export_opts, path_set);
+			break;
+		}
+
 		case exec_mode::list_installed:
 		{
-			const std::vector<std::string> installed_packages = birb::get_installed_packages(path_set);
-			for (const std::string& pkg_name : installed_packages)
-				std::cout << pkg_name << '\n';
+			// print the names straight from the database instead of
+			// copying them into the installed package cache first
+			const birb::mapped_file birb_db = birb::map_birb_db(path_set);
+			for (const std::string_view db_line : birb_db.lines())
+				std::cout << birb::first_token(db_line, ";") << '\n';
 
 			break;
 		}
@@ -0,0 +1,903 @@
+/* Microbenchmarks for the hot paths of libbirb
+ *
+ * The benchmarks are run against synthetic package repositories
+ * that get generated into a temporary directory. The directory is
+ * used as the LFS root, so nothing outside of it gets touched
+ *
+ * With --e2e whole install, uninstall and depclean runs are timed instead
+ * with stub packages that don't compile anything. Their sources are served
+ * from a local directory and the time is split between the different parts
+ * of the installation pipeline. The median run is reported, along with
+ * the fastest and the slowest one
+ *
+ * With --startup read-only commands of a birb binary are timed as whole
+ * processes. The exit status is non-zero if any of them takes longer
+ * than 5 ms, which is the target for startup latency
+ *
+ * The results are written as JSON, so that they can be compared
+ * across releases. Build with optimizations enabled to get useful
+ * numbers, for example 'make CXXFLAGS=-O2 birb_bench' */
+
+#include <algorithm>
+#include <cassert>
+#include <chrono>
+#include <clipp.h>
+#include <cstdlib>
+#include <ctime>
+#include <filesystem>
+#include <fstream>
+#include <functional>
+#include <iostream>
+#include <malloc.h>
+#include <numeric>
+#include <random>
+#include <string>
+#include <fcntl.h>
+#include <sstream>
+#include <unistd.h>
+#include <unordered_map>
+#include <vector>
+
+#include "Database.hpp"
+#include "Depclean.hpp"
+#include "Dependencies.hpp"
+#include "FlatHashMap.hpp"
+#include "Install.hpp"
+#include "Logging.hpp"
+#include "PackageInfo.hpp"
+#include "PackageId.hpp"
+#include "PackageSearch.hpp"
+#include "Process.hpp"
+#include "Profiling.hpp"
+#include "SearchIndex.hpp"
+#include "Uninstall.hpp"
+#include "Utils.hpp"
+
+struct synthetic_repo
+{
+	std::vector<std::string> packages;
+	std::vector<std::string> installed;
+	std::vector<std::string> nest;
+
+	// packages on the highest dependency level
+	std::vector<std::string> leaf_packages;
+};
+
+struct bench_result
+{
+	size_t packages;
+	std::string name;
+
+	// amount of operations done in a single sample
+	size_t operations;
+
+	std::vector<f64> samples_us;
+
+	// heap memory used by the data structure that was benchmarked, if any
+	size_t memory_bytes{0};
+};
+
+struct e2e_sample
+{
+	f64 total_ms;
+	std::array<f64, birb::profile_category_count> category_ms;
+};
+
+struct e2e_result
+{
+	std::string operation;
+
+	// amount of packages in the transaction
+	size_t packages;
+	size_t files_per_package;
+
+	std::vector<e2e_sample> samples;
+};
+
+// the sample with the median total time. The category times of
+// different samples don't add up, so they are reported from this one
+static const e2e_sample& median_sample(const e2e_result& result)
+{
+	std::vector<const e2e_sample*> sorted;
+	for (const e2e_sample& sample : result.samples)
+		sorted.push_back(&sample);
+
+	std::sort(sorted.begin(), sorted.end(), [](const e2e_sample* a, const e2e_sample* b) { return a->total_ms < b->total_ms; });
+	return *sorted.at(sorted.size() / 2);
+}
+
+// discard std::cout output while benchmarking, since
+// most of the functions print something
+struct null_buffer : public std::streambuf
+{
+	int overflow(int c) override { return c; }
+};
+
+// words for generating package descriptions
+static const std::vector<std::string> desc_words = {
+	"library", "tool", "utility", "daemon", "parser", "compiler", "editor",
+	"terminal", "graphics", "audio", "video", "network", "font", "image",
+	"archive", "compression", "database", "toolkit", "python", "bindings",
+	"server", "client", "shell", "player", "codec", "manager", "framework",
+	"wayland", "xorg", "kernel", "firmware", "documentation", "development"
+};
+
+// packages are split into dependency levels. Packages can only depend on
+// packages on the lower levels, so the dependencies form a DAG with a
+// similar depth as the real repositories
+constexpr size_t dependency_levels = 8;
+constexpr size_t max_deps = 4;
+
+static std::string synthetic_pkg_name(const size_t index)
+{
+	std::string number = std::to_string(index);
+	return "pkg" + std::string(6 - std::min<size_t>(number.size(), 6), '0') + number;
+}
+
+static synthetic_repo generate_repository(const std::string& root, const size_t package_count, const u32 seed)
+{
+	assert(package_count >= dependency_levels);
+
+	synthetic_repo repo;
+	std::mt19937 rng(seed);
+
+	const std::string repo_path = root + "/var/db/pkg/bench";
+	const std::string db_dir = root + "/var/lib/birb";
+	const std::string fakeroot_dir = root + "/var/db/fakeroot";
+
+	std::filesystem::create_directories(repo_path);
+	std::filesystem::create_directories(db_dir);
+	std::filesystem::create_directories(fakeroot_dir);
+	std::filesystem::create_directories(root + "/etc");
+
+	std::ofstream(root + "/etc/birb-sources.conf") << "bench;https://example.invalid/bench.git;/var/db/pkg/bench\n";
+
+	const size_t level_size = package_count / dependency_levels;
+	const auto level_start = [level_size](const size_t index) -> size_t
+	{
+		return std::min(index / level_size, dependency_levels - 1) * level_size;
+	};
+
+	for (size_t i = 0; i < package_count; ++i)
+		repo.packages.push_back(synthetic_pkg_name(i));
+
+	// meta packages group together packages from the lowest level
+	const size_t meta_count = std::max<size_t>(package_count / 200, 1);
+	std::vector<std::string> meta_names;
+	std::vector<std::vector<size_t>> meta_members;
+	std::ofstream meta_file(repo_path + "/meta_packages");
+	for (size_t i = 0; i < meta_count; ++i)
+	{
+		meta_names.push_back("meta" + std::to_string(i));
+		meta_members.emplace_back();
+
+		std::uniform_int_distribution<size_t> member_dist(0, level_size - 1);
+		const size_t member_count = 2 + rng() % 4;
+
+		std::string members_str;
+		for (size_t j = 0; j < member_count; ++j)
+		{
+			meta_members.back().push_back(member_dist(rng));
+			members_str += (j == 0 ? "" : " ") + repo.packages.at(meta_members.back().back());
+		}
+		meta_file << meta_names.back() << ":" << members_str << '\n';
+
+		// meta packages need a seed.sh file too to be found from the repositories
+		std::filesystem::create_directories(repo_path + "/" + meta_names.back());
+		std::ofstream(repo_path + "/" + meta_names.back() + "/seed.sh")
+			<< "NAME=\"" << meta_names.back() << "\"\n"
+			<< "DESC=\"Synthetic meta package\"\n"
+			<< "VERSION=\"1.0\"\n"
+			<< "DEPS=\"" << members_str << "\"\n"
+			<< "FLAGS=\"\"\n";
+	}
+	meta_file.close();
+
+	// direct dependencies of each package with the meta packages expanded
+	std::vector<std::vector<size_t>> dependencies(package_count);
+	std::vector<std::string> versions;
+
+	for (size_t i = 0; i < package_count; ++i)
+	{
+		const std::string& pkg_name = repo.packages[i];
+		const size_t lower_levels_end = level_start(i);
+
+		std::vector<std::string> deps;
+		if (lower_levels_end > 0)
+		{
+			std::uniform_int_distribution<size_t> dep_dist(0, lower_levels_end - 1);
+			const size_t dep_count = rng() % (max_deps + 1);
+			for (size_t j = 0; j < dep_count; ++j)
+			{
+				// every tenth dependency is a meta package
+				if (rng() % 10 == 0)
+				{
+					const size_t meta = rng() % meta_count;
+					deps.push_back(meta_names[meta]);
+					dependencies[i].insert(dependencies[i].end(), meta_members[meta].begin(), meta_members[meta].end());
+					continue;
+				}
+
+				const size_t dep = dep_dist(rng);
+				if (std::find(dependencies[i].begin(), dependencies[i].end(), dep) != dependencies[i].end())
+					continue;
+
+				deps.push_back(repo.packages[dep]);
+				dependencies[i].push_back(dep);
+			}
+		}
+
+		std::string deps_str;
+		for (const std::string& dep : deps)
+			deps_str += (deps_str.empty() ? "" : " ") + dep;
+
+		std::string desc = "Synthetic";
+		for (size_t j = 0; j < 4; ++j)
+			desc += " " + desc_words[rng() % desc_words.size()];
+
+		const std::string version = std::to_string(rng() % 10) + "." + std::to_string(rng() % 30) + "." + std::to_string(rng() % 100);
+		versions.push_back(version);
+
+		const std::string flags = rng() % 50 == 0 ? "important" : "";
+
+		std::filesystem::create_directories(repo_path + "/" + pkg_name);
+		std::ofstream(repo_path + "/" + pkg_name + "/seed.sh")
+			<< "NAME=\"" << pkg_name << "\"\n"
+			<< "DESC=\"" << desc << "\"\n"
+			<< "VERSION=\"" << version << "\"\n"
+			<< "SOURCE=\"https://example.invalid/" << pkg_name << "-" << version << ".tar.xz\"\n"
+			<< "CHECKSUM=\"" << std::hex << rng() << rng() << rng() << rng() << std::dec << "\"\n"
+			<< "DEPS=\"" << deps_str << "\"\n"
+			<< "FLAGS=\"" << flags << "\"\n"
+			<< "\n"
+			<< "_setup()\n{\n\ttar -xf $DISTFILES/$(basename $SOURCE)\n\tcd " << pkg_name << "-" << version << "\n}\n\n"
+			<< "_build()\n{\n\t./configure --prefix=/usr\n\tmake -j${BUILD_JOBS}\n}\n\n"
+			<< "_install()\n{\n\tmake DESTDIR=$FAKEROOT/$NAME install\n}\n";
+
+		if (lower_levels_end >= level_size * (dependency_levels - 1))
+			repo.leaf_packages.push_back(pkg_name);
+	}
+
+	// install packages with their dependencies until about 5% of the repository is
+	// installed. Some of the installed packages get left out from the nest to
+	// create orphans
+	std::vector<bool> is_installed(package_count, false);
+	std::vector<size_t> install_order;
+	const size_t installed_target = std::max<size_t>(package_count / 20, 1);
+	while (install_order.size() < installed_target)
+	{
+		const size_t root_pkg = rng() % package_count;
+		if (is_installed[root_pkg])
+			continue;
+
+		std::vector<size_t> stack = { root_pkg };
+		while (!stack.empty())
+		{
+			const size_t pkg = stack.back();
+			stack.pop_back();
+
+			if (is_installed[pkg])
+				continue;
+
+			is_installed[pkg] = true;
+			install_order.push_back(pkg);
+			stack.insert(stack.end(), dependencies[pkg].begin(), dependencies[pkg].end());
+		}
+
+		if (rng() % 5 != 0)
+			repo.nest.push_back(repo.packages[root_pkg]);
+	}
+
+	std::ofstream db_file(db_dir + "/birb_db");
+	for (const size_t pkg : install_order)
+	{
+		const std::string& pkg_name = repo.packages[pkg];
+		repo.installed.push_back(pkg_name);
+		db_file << pkg_name << ";" << versions[pkg] << '\n';
+		std::filesystem::create_directories(fakeroot_dir + "/" + pkg_name);
+	}
+	db_file.close();
+
+	std::ofstream nest_file(db_dir + "/nest");
+	for (const std::string& pkg_name : repo.nest)
+		nest_file << pkg_name << '\n';
+	nest_file.close();
+
+	std::ofstream package_list(db_dir + "/packages");
+	for (const std::string& pkg_name : repo.packages)
+		package_list << pkg_name << '\n';
+	for (const std::string& meta_name : meta_names)
+		package_list << meta_name << '\n';
+	package_list.close();
+
+	return repo;
+}
+
+// generate a repository of stub packages that don't compile anything. The
+// _install functions only create the given amount of files into the fakeroot
+//
+// returns the packages that no other package depends on, so installing
+// them installs the whole repository
+static std::vector<std::string> generate_stub_repository(const std::string& root, const size_t package_count, const size_t files_per_package, const u32 seed)
+{
+	assert(package_count > 0);
+	assert(files_per_package > 0);
+
+	std::mt19937 rng(seed);
+
+	const std::string repo_path = root + "/var/db/pkg";
+	const std::string mirror_path = root + "/mirror";
+
+	for (const char* dir : { "/etc", "/bin", "/mirror/stub", "/var/db/pkg", "/var/lib/birb", "/var/cache/distfiles", "/var/db/fakeroot" })
+		std::filesystem::create_directories(root + dir);
+
+	std::ofstream(root + "/etc/birb-sources.conf") << "bench;https://example.invalid/bench.git;/var/db/pkg\n";
+	std::ofstream(root + "/etc/birb.conf").close();
+
+	// all of the packages share the same source tarball contents
+	std::ofstream(mirror_path + "/stub/README") << "stub package sources\n";
+
+	birb::process_options tar_opts;
+	tar_opts.args = { "tar", "-C", mirror_path, "-czf", mirror_path + "/stub.tar.gz", "stub" };
+	if (!birb::run_process(std::move(tar_opts)).success())
+		birb::error("Could not create the stub source tarball");
+
+	birb::process_options md5_opts;
+	md5_opts.args = { "md5sum", mirror_path + "/stub.tar.gz" };
+	md5_opts.stdout_mode = birb::stream_mode::pipe;
+	const birb::process_result md5_result = birb::run_process(std::move(md5_opts));
+	if (!md5_result.success())
+		birb::error("Could not calculate the checksum of the stub source tarball");
+
+	const std::string checksum = md5_result.out.substr(0, md5_result.out.find(' '));
+
+	// wget replacement that serves the tarballs from the mirror directory
+	const std::string wget_path = root + "/bin/wget";
+	std::ofstream(wget_path)
+		<< "#!/bin/bash\n"
+		<< "for arg in \"$@\"\ndo\n"
+		<< "\tcase \"$arg\" in\n"
+		<< "\t\t--directory-prefix=*) prefix=\"${arg#*=}\" ;;\n"
+		<< "\t\t-*) ;;\n"
+		<< "\t\t*) url=\"$arg\" ;;\n"
+		<< "\tesac\n"
+		<< "done\n"
+		<< "cp \"" << mirror_path << "/$(basename \"$url\")\" \"$prefix/\"\n";
+	std::filesystem::permissions(wget_path, std::filesystem::perms::owner_all | std::filesystem::perms::group_read | std::filesystem::perms::others_read);
+
+	constexpr size_t stub_dependency_levels = 4;
+	const size_t level_size = std::max<size_t>(package_count / stub_dependency_levels, 1);
+
+	std::vector<bool> is_dependency(package_count, false);
+	for (size_t i = 0; i < package_count; ++i)
+	{
+		const std::string pkg_name = synthetic_pkg_name(i);
+		std::filesystem::copy_file(mirror_path + "/stub.tar.gz", mirror_path + "/" + pkg_name + "-1.0.tar.gz");
+
+		// packages can only depend on packages on the lower levels
+		std::vector<size_t> deps;
+		const size_t lower_levels_end = std::min(i / level_size, stub_dependency_levels - 1) * level_size;
+		if (lower_levels_end > 0)
+		{
+			const size_t dep_count = rng() % max_deps;
+			for (size_t j = 0; j < dep_count; ++j)
+			{
+				const size_t dep = rng() % lower_levels_end;
+				if (std::find(deps.begin(), deps.end(), dep) == deps.end())
+					deps.push_back(dep);
+			}
+		}
+
+		std::string deps_str;
+		for (const size_t dep : deps)
+		{
+			is_dependency[dep] = true;
+			deps_str += (deps_str.empty() ? "" : " ") + synthetic_pkg_name(dep);
+		}
+
+		std::filesystem::create_directories(repo_path + "/" + pkg_name);
+		std::ofstream(repo_path + "/" + pkg_name + "/seed.sh")
+			<< "NAME=\"" << pkg_name << "\"\n"
+			<< "DESC=\"Stub package for benchmarking\"\n"
+			<< "VERSION=\"1.0\"\n"
+			<< "SOURCE=\"https://mirror.invalid/" << pkg_name << "-1.0.tar.gz\"\n"
+			<< "CHECKSUM=\"" << checksum << "\"\n"
+			<< "DEPS=\"" << deps_str << "\"\n"
+			<< "FLAGS=\"\"\n"
+			<< "\n"
+			<< "_setup()\n{\n\ttar -xf $DISTFILES/$(basename $SOURCE)\n\tcd stub\n}\n\n"
+			<< "_build()\n{\n\t:\n}\n\n"
+			<< "_install()\n{\n"
+			<< "\tmkdir -p $FAKEROOT/$NAME/usr/bin $FAKEROOT/$NAME/usr/share/$NAME\n"
+			<< "\techo '#!/bin/sh' > $FAKEROOT/$NAME/usr/bin/$NAME\n"
+			<< "\tfor i in $(seq 1 " << files_per_package - 1 << ")\n\tdo\n"
+			<< "\t\techo $i > $FAKEROOT/$NAME/usr/share/$NAME/file$i\n"
+			<< "\tdone\n"
+			<< "}\n";
+	}
+
+	std::vector<std::string> requested_packages;
+	for (size_t i = 0; i < package_count; ++i)
+		if (!is_dependency[i])
+			requested_packages.push_back(synthetic_pkg_name(i));
+
+	return requested_packages;
+}
+
+// pick count random entries from the list
+static std::vector<std::string> sample(const std::vector<std::string>& list, const size_t count, std::mt19937& rng)
+{
+	std::vector<std::string> result;
+	for (size_t i = 0; i < count && !list.empty(); ++i)
+		result.push_back(list[rng() % list.size()]);
+
+	return result;
+}
+
+// run the benchmark the given amount of times. The caches get
+// cleared before each run, so that every run starts cold
+static bench_result run_benchmark(const std::string& name, const size_t package_count, const size_t operations, const size_t iterations, const std::function<void()>& benchmark)
+{
+	bench_result result { package_count, name, operations, {}, 0 };
+
+	null_buffer null_buf;
+	for (size_t i = 0; i < iterations; ++i)
+	{
+		birb::clear_caches();
+
+		std::streambuf* const cout_buf = std::cout.rdbuf(&null_buf);
+		const auto start = std::chrono::steady_clock::now();
+
+		benchmark();
+
+		const auto end = std::chrono::steady_clock::now();
+		std::cout.rdbuf(cout_buf);
+
+		result.samples_us.push_back(std::chrono::duration<f64, std::micro>(end - start).count());
+	}
+
+	std::vector<f64> sorted = result.samples_us;
+	std::sort(sorted.begin(), sorted.end());
+	std::cerr << "  " << name << ": " << sorted.at(sorted.size() / 2) / 1000.0 << " ms (" << operations << " ops)\n";
+
+	return result;
+}
+
+// heap memory in use, for measuring the size of the cache maps
+static size_t heap_usage()
+{
+	return mallinfo2().uordblks;
+}
+
+// compare the string keyed std::unordered_map that var_cache used to be with
+// the current flat_hash_map keyed by interned package ids. The interned names
+// are shared by all of the caches, so they aren't counted in the memory usage
+static std::vector<bench_result> run_cache_benchmarks(const std::vector<std::string>& packages, const size_t iterations)
+{
+	std::vector<bench_result> results;
+	const std::string version = "1.0.0";
+
+	{
+		const size_t heap_before = heap_usage();
+		std::unordered_map<std::string, std::string> cache;
+		for (const std::string& pkg_name : packages)
+			cache[pkg_name + "VERSION"] = version;
+		const size_t memory = heap_usage() - heap_before;
+
+		results.push_back(run_benchmark("var_cache_unordered_map", packages.size(), packages.size(), iterations, [&]()
+		{
+			for (const std::string& pkg_name : packages)
+			{
+				const auto it = cache.find(pkg_name + "VERSION");
+				assert(it != cache.end());
+			}
+		}));
+		results.back().memory_bytes = memory;
+	}
+
+	for (const std::string& pkg_name : packages)
+		[[maybe_unused]] const birb::pkg_id id = birb::intern_pkg_name(pkg_name);
+
+	{
+		const size_t heap_before = heap_usage();
+		birb::flat_hash_map<u64, std::string> cache;
+		for (const std::string& pkg_name : packages)
+			cache[birb::var_cache_key(birb::intern_pkg_name(pkg_name), pkg_variable::version)] = version;
+		const size_t memory = heap_usage() - heap_before;
+
+		results.push_back(run_benchmark("var_cache_flat_hash_map", packages.size(), packages.size(), iterations, [&]()
+		{
+			for (const std::string& pkg_name : packages)
+			{
+				const auto it = cache.find(birb::var_cache_key(birb::intern_pkg_name(pkg_name), pkg_variable::version));
+				assert(it != cache.end());
+			}
+		}));
+		results.back().memory_bytes = memory;
+	}
+
+	for (const bench_result& r : results)
+		std::cerr << "  " << r.name << " memory: " << r.memory_bytes / 1024 << " KiB\n";
+
+	return results;
+}
+
+static std::vector<bench_result> run_benchmarks(const std::string& root, const size_t package_count, const size_t iterations, const u32 seed)
+{
+	std::cerr << "Generating a repository with " << package_count << " packages\n";
+	const synthetic_repo repo = generate_repository(root, package_count, seed);
+
+	setenv("LFS", root.c_str(), 1);
+	const path_settings paths;
+
+	const std::vector<pkg_source> repos = birb::get_pkg_sources(paths);
+	assert(!repos.empty());
+
+	birb::search_index::build(paths).save(paths);
+
+	std::cerr << "Running benchmarks (" << repo.installed.size() << " installed packages, " << repo.nest.size() << " in the nest)\n";
+
+	std::mt19937 rng(seed);
+	std::vector<bench_result> results = run_cache_benchmarks(repo.packages, iterations);
+
+	results.push_back(run_benchmark("read_birb_db", package_count, 1, iterations, [&]()
+	{
+		const std::vector<std::string> db = birb::read_birb_db(paths);
+		assert(db.size() == repo.installed.size());
+	}));
+
+	const std::vector<std::string> var_packages = sample(repo.packages, 1000, rng);
+	results.push_back(run_benchmark("read_pkg_variable", package_count, var_packages.size(), iterations, [&]()
+	{
+		for (const std::string& pkg_name : var_packages)
+		{
+			const std::string version = birb::read_pkg_variable(pkg_name, pkg_variable::version, repos.front().path);
+			assert(!version.empty());
+		}
+	}));
+
+	const std::vector<std::string> resolve_packages = sample(repo.leaf_packages, 10, rng);
+	results.push_back(run_benchmark("resolve_dependencies", package_count, 1, iterations, [&]()
+	{
+		const std::vector<std::string> packages = birb::resolve_dependencies(resolve_packages, paths);
+		assert(packages.size() >= resolve_packages.size());
+	}));
+
+	const std::vector<std::string> reverse_dep_packages = sample(repo.installed, 100, rng);
+	results.push_back(run_benchmark("get_reverse_dependencies", package_count, reverse_dep_packages.size(), iterations, [&]()
+	{
+		for (const std::string& pkg_name : reverse_dep_packages)
+		{
+			const std::vector<std::string> reverse_deps = birb::get_reverse_dependencies(pkg_name, repos, paths);
+		}
+	}));
+
+	results.push_back(run_benchmark("find_orphan_packages", package_count, 1, iterations, [&]()
+	{
+		const std::vector<std::string> orphans = birb::find_orphan_packages(repos, paths);
+	}));
+
+	const std::vector<std::string> search_packages = sample(repo.packages, 50, rng);
+	results.push_back(run_benchmark("pkg_search", package_count, search_packages.size(), iterations, [&]()
+	{
+		birb::pkg_search(search_packages, paths);
+	}));
+
+	results.push_back(run_benchmark("pkg_fuzzy_search", package_count, 1, iterations, [&]()
+	{
+		birb::pkg_fuzzy_search({ "pkg00012", "video", "player" }, true, paths);
+	}));
+
+	return results;
+}
+
+// read-only commands should finish within this time
+constexpr f64 startup_target_ms = 5.0;
+
+// time read-only birb commands as whole processes, since most of their
+// time goes to starting up. The results that miss the startup target are
+// reported with missed_target
+static std::vector<bench_result> run_startup_benchmarks(const std::string& root, const std::string& birb_path, const size_t package_count, const size_t iterations, const u32 seed, bool& missed_target)
+{
+	std::cerr << "Generating a repository with " << package_count << " packages\n";
+	const synthetic_repo repo = generate_repository(root, package_count, seed);
+
+	setenv("LFS", root.c_str(), 1);
+
+	std::cerr << "Timing " << birb_path << " (" << repo.installed.size() << " installed packages)\n";
+
+	std::mt19937 rng(seed);
+	const std::vector<std::pair<std::string, std::vector<std::string>>> commands = {
+		{ "startup_list_installed", { "--list-installed" } },
+		{ "startup_search", { "--search", sample(repo.packages, 1, rng).front() } },
+		{ "startup_search_installed", { "--search", sample(repo.installed, 1, rng).front() } }
+	};
+
+	std::vector<bench_result> results;
+	for (const auto& [name, args] : commands)
+	{
+		birb::process_options opts;
+		opts.args = { birb_path };
+		opts.args.insert(opts.args.end(), args.begin(), args.end());
+		opts.stdout_mode = birb::stream_mode::null;
+
+		results.push_back(run_benchmark(name, package_count, 1, iterations, [&]()
+		{
+			const birb::process_result result = birb::run_process(opts);
+			if (!result.success())
+				birb::error("Running ", birb_path, " ", args.front(), " failed");
+		}));
+
+		std::vector<f64> samples = results.back().samples_us;
+		std::sort(samples.begin(), samples.end());
+		if (samples.at(samples.size() / 2) / 1000.0 > startup_target_ms)
+		{
+			std::cerr << "  " << results.back().name << " missed the startup target of " << startup_target_ms << " ms\n";
+			missed_target = true;
+		}
+	}
+
+	return results;
+}
+
+// every iteration starts from a freshly generated repository with
+// nothing installed, since each operation changes the installed state
+static std::vector<e2e_result> run_e2e_benchmarks(const std::string& root, const size_t package_count, const size_t files_per_package, const size_t iterations, const u32 seed)
+{
+	std::cerr << "Generating " << package_count << " stub packages with " << files_per_package << " files each\n";
+
+	const std::string original_path = getenv("PATH") ? getenv("PATH") : "";
+	setenv("LFS", root.c_str(), 1);
+	setenv("PATH", (root + "/bin:" + original_path).c_str(), 1);
+
+	// answer all of the confirmation prompts with the default answer
+	std::istringstream answers;
+	std::streambuf* const cin_buf = std::cin.rdbuf(answers.rdbuf());
+
+	// the child processes write to stdout too
+	std::cout.flush();
+	const int stdout_fd = dup(STDOUT_FILENO);
+	const int null_fd = open("/dev/null", O_WRONLY | O_CLOEXEC);
+	dup2(null_fd, STDOUT_FILENO);
+	close(null_fd);
+
+	birb::profiling_enabled.store(true, std::memory_order_relaxed);
+
+	std::vector<e2e_result> results;
+	for (size_t iteration = 0; iteration < iterations; ++iteration)
+	{
+		std::filesystem::remove_all(root);
+		const std::vector<std::string> requested_packages = generate_stub_repository(root, package_count, files_per_package, seed);
+
+		birb::clear_caches();
+		const path_settings paths;
+		const birb_config config;
+
+		answers.str(std::string(4096, '\n'));
+		answers.clear();
+
+		// the operations are run in the same order on every
+		// iteration, so their results are always at the same index
+		size_t operation_index{0};
+		const auto run_operation = [&](const std::string& operation, const size_t packages, const std::function<void()>& func)
+		{
+			birb::clear_caches();
+			birb::reset_profile();
+
+			const auto start = std::chrono::steady_clock::now();
+			func();
+			const auto end = std::chrono::steady_clock::now();
+
+			e2e_sample sample { std::chrono::duration<f64, std::milli>(end - start).count(), {} };
+			for (size_t i = 0; i < birb::profile_category_count; ++i)
+				sample.category_ms[i] = birb::profile_time_ms(static_cast<birb::profile_category>(i));
+
+			if (operation_index == results.size())
+				results.push_back(e2e_result { operation, packages, files_per_package, {} });
+
+			results.at(operation_index++).samples.push_back(sample);
+		};
+
+		run_operation("install", package_count, [&]()
+		{
+			birb::install(requested_packages, paths, config, false);
+		});
+
+		// uninstalling a half of the requested packages leaves some of
+		// their dependencies orphaned for depclean
+		const std::vector<std::string> uninstalled_packages(requested_packages.begin(), requested_packages.begin() + (requested_packages.size() + 1) / 2);
+		run_operation("uninstall", uninstalled_packages.size(), [&]()
+		{
+			birb::uninstall(uninstalled_packages, paths);
+		});
+
+		const size_t installed_before_depclean = birb::get_installed_packages(paths).size();
+		run_operation("depclean", installed_before_depclean, [&]()
+		{
+			birb::depclean(paths);
+		});
+	}
+
+	birb::profiling_enabled.store(false, std::memory_order_relaxed);
+
+	std::cout.flush();
+	dup2(stdout_fd, STDOUT_FILENO);
+	close(stdout_fd);
+
+	std::cin.rdbuf(cin_buf);
+	setenv("PATH", original_path.c_str(), 1);
+
+	for (const e2e_result& result : results)
+	{
+		const e2e_sample& sample = median_sample(result);
+		std::cerr << "  " << result.operation << " (" << result.packages << " packages): " << sample.total_ms << " ms";
+		for (size_t i = 0; i < birb::profile_category_count; ++i)
+			std::cerr << ", " << birb::profile_category_names.name(static_cast<birb::profile_category>(i)) << " " << sample.category_ms[i] << " ms";
+		std::cerr << '\n';
+	}
+
+	return results;
+}
+
+static void write_json(const std::string& path, const std::vector<bench_result>& results, const std::vector<e2e_result>& e2e_results, const size_t iterations, const u32 seed)
+{
+	std::ofstream file(path);
+	if (!file.is_open())
+		birb::error("Can't write the results to ", path);
+
+	const auto median = [](std::vector<f64> samples) -> f64
+	{
+		std::sort(samples.begin(), samples.end());
+		return samples.at(samples.size() / 2);
+	};
+
+	file << "{\n"
+		<< "\t\"format\": 1,\n"
+		<< "\t\"timestamp\": " << std::time(nullptr) << ",\n"
+		<< "\t\"seed\": " << seed << ",\n"
+		<< "\t\"iterations\": " << iterations << ",\n"
+		<< "\t\"results\": [\n";
+
+	for (size_t i = 0; i < results.size(); ++i)
+	{
+		const bench_result& r = results[i];
+		const f64 mean = std::accumulate(r.samples_us.begin(), r.samples_us.end(), 0.0) / r.samples_us.size();
+
+		file << "\t\t{ "
+			<< "\"benchmark\": \"" << r.name << "\", "
+			<< "\"packages\": " << r.packages << ", "
+			<< "\"operations\": " << r.operations << ", "
+			<< "\"min_us\": " << *std::min_element(r.samples_us.begin(), r.samples_us.end()) << ", "
+			<< "\"median_us\": " << median(r.samples_us) << ", "
+			<< "\"mean_us\": " << mean << ", "
+			<< "\"max_us\": " << *std::max_element(r.samples_us.begin(), r.samples_us.end()) << ", "
+			<< "\"memory_bytes\": " << r.memory_bytes
+			<< " }" << (i + 1 < results.size() ? "," : "") << '\n';
+	}
+
+	file << "\t],\n"
+		<< "\t\"e2e\": [\n";
+
+	for (size_t i = 0; i < e2e_results.size(); ++i)
+	{
+		const e2e_result& r = e2e_results[i];
+		const e2e_sample& sample = median_sample(r);
+
+		const auto [min_sample, max_sample] = std::minmax_element(r.samples.begin(), r.samples.end(), [](const e2e_sample& a, const e2e_sample& b) { return a.total_ms < b.total_ms; });
+
+		// time that wasn't spent in any of the profiled parts
+		f64 other_ms = sample.total_ms;
+
+		file << "\t\t{ "
+			<< "\"operation\": \"" << r.operation << "\", "
+			<< "\"packages\": " << r.packages << ", "
+			<< "\"files_per_package\": " << r.files_per_package << ", "
+			<< "\"min_ms\": " << min_sample->total_ms << ", "
+			<< "\"max_ms\": " << max_sample->total_ms << ", "
+			<< "\"total_ms\": " << sample.total_ms;
+
+		// the breakdown of the median sample
+		for (size_t j = 0; j < birb::profile_category_count; ++j)
+		{
+			file << ", \"" << birb::profile_category_names.name(static_cast<birb::profile_category>(j)) << "_ms\": " << sample.category_ms[j];
+			other_ms -= sample.category_ms[j];
+		}
+
+		file << ", \"other_ms\": " << other_ms
+			<< " }" << (i + 1 < e2e_results.size() ? "," : "") << '\n';
+	}
+
+	file << "\t]\n}\n";
+}
+
+int main(int argc, char** argv)
+{
+	std::string sizes_str;
+	std::string iterations_str = "5";
+	std::string files_str = "20";
+	bool e2e{false};
+	std::string birb_path;
+	std::string seed_str = "1";
+	std::string output = "birb_bench.json";
+	std::string root;
+
+	auto cli = (
+		clipp::option("--e2e").set(e2e)
+		% "time whole installations, uninstallations and depcleans of stub packages",
+
+		(clipp::option("--sizes") & clipp::value("sizes", sizes_str))
+		% "comma separated list of repository sizes to benchmark (default: 1000,10000,100000, or 10,100,1000 with --e2e)",
+
+		(clipp::option("--startup") & clipp::value("birb", birb_path))
+		% "time read-only commands of the given birb binary and fail if they take longer than 5 ms (default size: 30000 packages, which installs 1500 of them)",
+
+		(clipp::option("--files") & clipp::value("count", files_str))
+		% "amount of files that each stub package installs with --e2e (default: 20)",
+
+		(clipp::option("--iterations") & clipp::value("count", iterations_str))
+		% "amount of times to run each benchmark (default: 5)",
+
+		(clipp::option("--seed") & clipp::value("seed", seed_str))
+		% "seed for generating the repositories (default: 1)",
+
+		(clipp::option("-o", "--output") & clipp::value("file", output))
+		% "file to write the JSON results to (default: birb_bench.json)",
+
+		(clipp::option("--root") & clipp::value("directory", root))
+		% "generate the repositories into the given directory and keep them"
+	);
+
+	if (!clipp::parse(argc, argv, cli))
+	{
+		std::cout << clipp::make_man_page(cli, "birb_bench") << '\n';
+		return 1;
+	}
+
+	if (sizes_str.empty())
+		sizes_str = e2e ? "10,100,1000" : !birb_path.empty() ? "30000" : "1000,10000,100000";
+
+	std::vector<size_t> sizes;
+	for (const std::string& size : birb::split_string(sizes_str, ","))
+		sizes.push_back(std::stoul(size));
+
+	const size_t iterations = std::max<size_t>(std::stoul(iterations_str), 1);
+	const size_t files_per_package = std::max<size_t>(std::stoul(files_str), 1);
+	const u32 seed = std::stoul(seed_str);
+
+	const bool keep_root = !root.empty();
+	if (!keep_root)
+		root = std::filesystem::temp_directory_path().string() + "/birb_bench-" + std::to_string(getpid());
+
+	std::vector<bench_result> results;
+	std::vector<e2e_result> e2e_results;
+	bool missed_target{false};
+	for (const size_t size : sizes)
+	{
+		const std::string size_root = root + "/" + std::to_string(size);
+		std::filesystem::remove_all(size_root);
+
+		if (!birb_path.empty())
+		{
+			const std::vector<bench_result> size_results = run_startup_benchmarks(size_root, birb_path, size, iterations, seed, missed_target);
+			results.insert(results.end(), size_results.begin(), size_results.end());
+		}
+		else if (e2e)
+		{
+			const std::vector<e2e_result> size_results = run_e2e_benchmarks(size_root, size, files_per_package, iterations, seed);
+			e2e_results.insert(e2e_results.end(), size_results.begin(), size_results.end());
+		}
+		else
+		{
+			const std::vector<bench_result> size_results = run_benchmarks(size_root, size, iterations, seed);
+			results.insert(results.end(), size_results.begin(), size_results.end());
+		}
+	}
+
+	if (!keep_root)
+		std::filesystem::remove_all(root);
+
+	write_json(output, results, e2e_results, iterations, seed);
+	std::cerr << "Results written to " << output << '\n';
+
+	return missed_target ? 1 : 0;
+}
@@ -0,0 +1,56 @@
+#include <clipp.h>
+#include <iostream>
+#include <string>
+#include <vector>
+
+#include "Daemon.hpp"
+#include "Logging.hpp"
+
+int main(int argc, char** argv)
+{
+	bool query_mode{false};
+	bool help{false};
+	std::vector<std::string> query;
+
+	auto cli = (
+		clipp::option("-h", "--help").set(help)
+		% "display this help page and exit",
+
+		(clipp::option("-q", "--query").set(query_mode) & clipp::values("query", query))
+		% "send a query to a running birbd and print the answer"
+	);
+
+	if (!clipp::parse(argc, argv, cli) || help || (query_mode && query.empty()))
+	{
+		clipp::doc_formatting fmt;
+		fmt.doc_column(40);
+		std::cout << clipp::make_man_page(cli, "birbd", fmt) << '\n'
+			<< "Without any options birbd starts serving queries\n\n"
+			<< "Queries:\n"
+			<< "  search WORD(s)         packages with similar names or descriptions\n"
+			<< "  is-installed PACKAGE   'yes' or 'no'\n"
+			<< "  version PACKAGE        version of the package in the repositories\n"
+			<< "  deps PACKAGE           packages that installing the package needs\n"
+			<< "  reverse-deps PACKAGE   installed packages that depend on the package\n"
+			<< "  owner FILE             package that the file belongs to\n"
+			<< "  packages               all packages in the repositories\n"
+			<< "  installed              installed packages and their versions\n"
+			<< "  ping                   check if birbd is running\n";
+
+		return help ? 0 : 1;
+	}
+
+	const path_settings paths;
+
+	if (query_mode)
+	{
+		const int ret = birb::query_daemon(query, paths);
+		if (ret == 2)
+			birb::non_fatal_error("Can't reach birbd at ", paths.daemon_socket);
+
+		return ret;
+	}
+
+	birb::run_daemon(paths);
+	return 0;
+}
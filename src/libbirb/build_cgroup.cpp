@@ -0,0 +1,227 @@
+#include "BuildCgroup.hpp"
+#include "Logging.hpp"
+#include "MappedFile.hpp"
+#include "Utils.hpp"
+
+#include <algorithm>
+#include <array>
+#include <cassert>
+#include <cerrno>
+#include <cmath>
+#include <csignal>
+#include <cstring>
+#include <fcntl.h>
+#include <filesystem>
+#include <format>
+#include <linux/magic.h>
+#include <mutex>
+#include <string_view>
+#include <sys/stat.h>
+#include <sys/statfs.h>
+#include <unistd.h>
+
+namespace birb
+{
+	constexpr char cgroup_root[] = "/sys/fs/cgroup";
+	constexpr char birb_cgroup[] = "/sys/fs/cgroup/birb";
+
+	// the controllers that the limits in birb_config need
+	constexpr std::array<std::string_view, 3> build_controllers = { "cpu", "memory", "io" };
+
+	// the weights that cgroups use by default
+	constexpr f64 default_weight = 100.0;
+
+	// the reason for falling back to nice and ionice is the same for every
+	// package, so it's only worth mentioning once
+	static void fallback_warning(const std::string& reason)
+	{
+		static std::once_flag warned;
+		std::call_once(warned, [&reason]
+		{
+			warning(reason, ", running the builds with a lower priority instead");
+		});
+	}
+
+	static bool write_cgroup_file(const std::string& path, const std::string& value)
+	{
+		const int fd = open(path.c_str(), O_WRONLY | O_CLOEXEC);
+		if (fd < 0)
+			return false;
+
+		const bool written = write(fd, value.data(), value.size()) == static_cast<ssize_t>(value.size());
+		close(fd);
+
+		return written;
+	}
+
+	// the controllers that can be enabled for the birb cgroups
+	static std::string available_controllers()
+	{
+		mapped_file controllers_file;
+		if (controllers_file.open(std::string(cgroup_root) + "/cgroup.controllers") != file_error::noerr)
+			return "";
+
+		std::string controllers;
+		for (const std::string_view controller : split_view(controllers_file.contents(), " "))
+		{
+			const std::string_view name = controller.substr(0, controller.find('\n'));
+			if (std::find(build_controllers.begin(), build_controllers.end(), name) != build_controllers.end())
+				controllers += std::string(controllers.empty() ? "+" : " +") + std::string(name);
+		}
+
+		return controllers;
+	}
+
+	// remove the build cgroups of birb processes that have exited.
+	// The names end with the PID of the birb process that created them
+	static void remove_stale_cgroups()
+	{
+		std::error_code ec;
+		for (const std::filesystem::directory_entry& entry : std::filesystem::directory_iterator(birb_cgroup, ec))
+		{
+			if (!entry.is_directory())
+				continue;
+
+			const std::string name = entry.path().filename().string();
+			const size_t separator = name.rfind('-');
+			if (separator == std::string::npos)
+				continue;
+
+			const std::optional<u64> pid = parse_u64(std::string_view(name).substr(separator + 1));
+			if (!pid.has_value() || (kill(pid.value(), 0) != 0 && errno == ESRCH))
+				rmdir(entry.path().c_str());
+		}
+	}
+
+	build_cgroup::build_cgroup(const std::string& pkg_name, const birb_config& config)
+	{
+		assert(!pkg_name.empty());
+
+		const f64 cpu_weight = std::clamp<u16>(config.build_cpu_weight, 1, 10000);
+		const f64 io_weight = std::clamp<u16>(config.build_io_weight, 1, 10000);
+
+		// the kernel gives each nice level about 25% more CPU time than the
+		// next one, and the best-effort I/O priorities go from 0 to 7 with 4
+		// being the default. The fallback only ever lowers the priority, since
+		// a higher priority would take resources away from everything else
+		niceness = std::clamp<i32>(std::lround(std::log(default_weight / cpu_weight) / std::log(1.25)), 0, 19);
+		ionice_level = std::clamp<i32>(4 + std::lround(std::log2(default_weight / io_weight)), 4, 7);
+
+		// creating cgroups needs root and the unified hierarchy
+		struct statfs fs;
+		if (!root_check() || statfs(cgroup_root, &fs) != 0 || fs.f_type != CGROUP2_SUPER_MAGIC)
+			return;
+
+		const std::string controllers = available_controllers();
+		if (controllers.empty())
+			return;
+
+		// the controllers need to be enabled on every level above the
+		// build cgroups. The birb cgroup never has processes of its own,
+		// so its subtree is allowed to have controllers
+		if (!write_cgroup_file(std::string(cgroup_root) + "/cgroup.subtree_control", controllers)
+			|| (mkdir(birb_cgroup, 0755) != 0 && errno != EEXIST)
+			|| !write_cgroup_file(std::string(birb_cgroup) + "/cgroup.subtree_control", controllers))
+		{
+			fallback_warning(std::format("Could not set up the birb cgroup ({})", std::strerror(errno)));
+			return;
+		}
+
+		remove_stale_cgroups();
+
+		const std::string path = std::format("{}/{}-{}", birb_cgroup, pkg_name, getpid());
+		if (mkdir(path.c_str(), 0755) != 0 && errno != EEXIST)
+		{
+			fallback_warning(std::format("Could not create the cgroup {} ({})", path, std::strerror(errno)));
+			return;
+		}
+
+		cgroup_path = path;
+
+		// the limits are applied on a best effort basis, since some of the
+		// controllers might be missing
+		const auto set_limit = [this](const std::string& file, const std::string& value)
+		{
+			if (!write_cgroup_file(cgroup_path + "/" + file, value))
+				warning("Could not set ", file, " of the build cgroup to ", value);
+		};
+
+		set_limit("cpu.weight", std::to_string(static_cast<u32>(cpu_weight)));
+		set_limit("io.weight", std::format("default {}", static_cast<u32>(io_weight)));
+
+		if (config.build_memory_high != 0)
+			set_limit("memory.high", std::to_string(config.build_memory_high));
+
+		if (config.build_memory_max != 0)
+			set_limit("memory.max", std::to_string(config.build_memory_max));
+	}
+
+	build_cgroup::~build_cgroup()
+	{
+		// fails if some process of the build is still running, in which
+		// case the cgroup gets removed by a later birb run
+		if (!cgroup_path.empty())
+			rmdir(cgroup_path.c_str());
+	}
+
+	void build_cgroup::wrap(std::vector<std::string>& args) const
+	{
+		assert(!args.empty());
+
+		// the paths and priorities are passed as arguments to sh, so
+		// that they don't need to be quoted
+		if (isolated())
+		{
+			args.insert(args.begin(), { "sh", "-c", R"(echo $$ > "$1" ; shift ; exec "$@")", "birb-build", cgroup_path + "/cgroup.procs" });
+		}
+		else
+		{
+			args.insert(args.begin(), { "sh", "-c", R"(ionice -c 2 -n "$1" -p $$ > /dev/null 2>&1 ; niceness="$2" ; shift 2 ; exec nice -n "$niceness" "$@")",
+					"birb-build", std::to_string(ionice_level), std::to_string(niceness) });
+		}
+	}
+
+	bool build_cgroup::isolated() const
+	{
+		return !cgroup_path.empty();
+	}
+
+	std::optional<build_resource_usage> build_cgroup::usage() const
+	{
+		if (!isolated())
+			return {};
+
+		build_resource_usage usage;
+		mapped_file file;
+
+		if (file.open(cgroup_path + "/cpu.stat") == file_error::noerr)
+		{
+			for (const std::string_view line : file.lines())
+			{
+				const std::optional<std::array<std::string_view, 2>> fields = split_fields<2>(line, " ");
+				if (fields.has_value() && fields.value()[0] == "usage_usec")
+					usage.cpu_usec = parse_u64(fields.value()[1]).value_or(0);
+			}
+		}
+
+		// one line per device: "8:0 rbytes=1024 wbytes=4096 rios=1 ..."
+		if (file.open(cgroup_path + "/io.stat") == file_error::noerr)
+		{
+			for (const std::string_view line : file.lines())
+			{
+				for (const std::string_view field : split_view(line, " "))
+				{
+					if (field.starts_with("rbytes="))
+						usage.io_read_bytes += parse_u64(field.substr(7)).value_or(0);
+					else if (field.starts_with("wbytes="))
+						usage.io_write_bytes += parse_u64(field.substr(7)).value_or(0);
+				}
+			}
+		}
+
+		if (file.open(cgroup_path + "/memory.peak") == file_error::noerr)
+			usage.memory_peak = parse_u64(first_token(file.contents(), "\n"));
+
+		return usage;
+	}
+}
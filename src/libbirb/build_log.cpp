@@ -0,0 +1,222 @@
+#include "BuildLog.hpp"
+#include "Logging.hpp"
+
+#include <algorithm>
+#include <cassert>
+#include <cerrno>
+#include <csignal>
+#include <cstring>
+#include <fcntl.h>
+#include <filesystem>
+#include <format>
+#include <iostream>
+#include <unistd.h>
+
+// terminal progress updates are limited to this interval
+constexpr static std::chrono::milliseconds progress_update_interval{100};
+
+// the last line of output shown in the progress view is cut to this length
+constexpr static size_t progress_line_length = 60;
+
+namespace birb
+{
+	build_log::build_log(const std::string& log_path, const size_t tail_line_count, const bool append)
+	:log_path(log_path), tail_lines(tail_line_count)
+	{
+		assert(!log_path.empty());
+		std::filesystem::create_directories(std::filesystem::path(log_path).parent_path());
+
+		log_fd = open(log_path.c_str(), O_WRONLY | O_CREAT | O_CLOEXEC | (append ? O_APPEND : O_TRUNC), 0644);
+		if (log_fd < 0)
+		{
+			warning("Can't open the build log at ", log_path, ": ", strerror(errno));
+			return;
+		}
+
+		// compress the log with gzip as it gets written. Multiple gzip streams
+		// appended to the same file are still a valid gzip file, so appending
+		// to an earlier log works too
+		process_options opts;
+		opts.args = { "gzip", "-c", "-6" };
+		opts.stdin_mode = stream_mode::pipe;
+		opts.stdout_mode = stream_mode::fd;
+		opts.stdout_fd = log_fd;
+
+		compressor = process::spawn(std::move(opts));
+		if (compressor.has_value())
+			return;
+
+		// uncompressed output would make the .gz file unreadable, so
+		// the log goes into a plain text file next to it instead
+		close(log_fd);
+		if (!append)
+			std::filesystem::remove(log_path);
+
+		this->log_path = log_path.ends_with(".gz") ? log_path.substr(0, log_path.size() - 3) : log_path + ".log";
+		log_fd = open(this->log_path.c_str(), O_WRONLY | O_CREAT | O_CLOEXEC | (append ? O_APPEND : O_TRUNC), 0644);
+		if (log_fd < 0)
+		{
+			warning("Can't open the build log at ", this->log_path, ": ", strerror(errno));
+			return;
+		}
+
+		warning("gzip could not be started, the build log is written uncompressed to ", this->log_path);
+	}
+
+	build_log::~build_log()
+	{
+		finish();
+	}
+
+	void build_log::begin_phase(const std::string& phase_name)
+	{
+		phase = phase_name;
+		phase_line_count = 0;
+		write_to_file(std::format("==> {}\n", phase_name));
+	}
+
+	void build_log::end_phase()
+	{
+		if (!progress_visible)
+			return;
+
+		print_progress(true);
+		std::cout << '\n';
+		progress_visible = false;
+	}
+
+	void build_log::write(std::string_view chunk)
+	{
+		write_to_file(chunk);
+
+		// split the chunk into lines for the ring buffer
+		while (!chunk.empty())
+		{
+			const size_t newline = chunk.find('\n');
+			partial_line.append(chunk.substr(0, newline));
+
+			if (newline == std::string_view::npos)
+				break;
+
+			++phase_line_count;
+
+			if (!tail_lines.empty())
+			{
+				tail_lines[tail_next] = std::move(partial_line);
+				tail_next = (tail_next + 1) % tail_lines.size();
+				tail_count = std::min(tail_count + 1, tail_lines.size());
+			}
+
+			partial_line.clear();
+			chunk.remove_prefix(newline + 1);
+		}
+	}
+
+	void build_log::finish()
+	{
+		if (compressor.has_value())
+		{
+			compressor.value().close_stdin();
+			if (!compressor.value().wait().success())
+				warning("Compressing the build log at ", log_path, " failed");
+
+			compressor.reset();
+		}
+
+		if (log_fd >= 0)
+		{
+			close(log_fd);
+			log_fd = -1;
+		}
+
+		end_phase();
+	}
+
+	const std::string& build_log::path() const
+	{
+		return log_path;
+	}
+
+	void build_log::print_tail() const
+	{
+		if (tail_lines.empty() || (tail_count == 0 && partial_line.empty()))
+			return;
+
+		info("\nLast ", tail_count, " lines of the build output:");
+
+		const size_t first = (tail_next + tail_lines.size() - tail_count) % tail_lines.size();
+		for (size_t i = 0; i < tail_count; ++i)
+			std::cout << tail_lines[(first + i) % tail_lines.size()] << '\n';
+
+		if (!partial_line.empty())
+			std::cout << partial_line << '\n';
+
+		info("\nFull build log: ", log_path);
+	}
+
+	void build_log::print_progress(const bool force)
+	{
+		// the progress line relies on carriage returns, so only
+		// show it in a terminal
+		if (!isatty(STDOUT_FILENO))
+			return;
+
+		const auto now = std::chrono::steady_clock::now();
+		if (!force && now - last_progress_update < progress_update_interval)
+			return;
+
+		last_progress_update = now;
+
+		std::string last_line;
+		if (tail_count > 0)
+			last_line = tail_lines[(tail_next + tail_lines.size() - 1) % tail_lines.size()];
+
+		// strip tabs and escape sequences that would mess up the progress line
+		std::replace_if(last_line.begin(), last_line.end(), [](const char c) { return c == '\t' || c == '\033' || c == '\r'; }, ' ');
+		if (last_line.size() > progress_line_length)
+			last_line.resize(progress_line_length);
+
+		std::cout << "\r\033[K[" << phase << "] " << phase_line_count << " lines | " << last_line << std::flush;
+		progress_visible = true;
+	}
+
+	void build_log::write_to_file(std::string_view data)
+	{
+		if (write_failed || log_fd < 0)
+			return;
+
+		const int fd = compressor.has_value() ? compressor.value().stdin_pipe() : log_fd;
+
+		// if gzip dies, writing to the pipe would kill birb with SIGPIPE,
+		// so block the signal for the duration of the write and clear it afterwards
+		sigset_t sigpipe_set, old_set;
+		sigemptyset(&sigpipe_set);
+		sigaddset(&sigpipe_set, SIGPIPE);
+		pthread_sigmask(SIG_BLOCK, &sigpipe_set, &old_set);
+
+		while (!data.empty())
+		{
+			const ssize_t ret = ::write(fd, data.data(), data.size());
+			if (ret < 0 && errno == EINTR)
+				continue;
+
+			if (ret < 0)
+			{
+				warning("Writing to the build log at ", log_path, " failed: ", strerror(errno));
+				write_failed = true;
+
+				if (errno == EPIPE)
+				{
+					const timespec no_wait{0, 0};
+					sigtimedwait(&sigpipe_set, nullptr, &no_wait);
+				}
+
+				break;
+			}
+
+			data.remove_prefix(ret);
+		}
+
+		pthread_sigmask(SIG_SETMASK, &old_set, nullptr);
+	}
+}
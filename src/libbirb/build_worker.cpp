@@ -0,0 +1,610 @@
+#include "BuildWorker.hpp"
+#include "Database.hpp"
+#include "Dedupe.hpp"
+#include "DeferredTests.hpp"
+#include "Dependencies.hpp"
+#include "Download.hpp"
+#include "Install.hpp"
+#include "Logging.hpp"
+#include "PackageInfo.hpp"
+#include "Process.hpp"
+#include "Utils.hpp"
+
+#include <algorithm>
+#include <array>
+#include <cassert>
+#include <cerrno>
+#include <csignal>
+#include <cstring>
+#include <deque>
+#include <fcntl.h>
+#include <filesystem>
+#include <format>
+#include <iostream>
+#include <poll.h>
+#include <sys/sendfile.h>
+#include <unistd.h>
+#include <unordered_set>
+
+namespace birb
+{
+	constexpr std::string_view worker_greeting = "birb-worker 1";
+
+	// protocol lines are short, so anything longer means that
+	// the stream has gotten out of sync
+	constexpr size_t max_line_length = 4096;
+
+	// output that a worker prints before the greeting (like a login
+	// banner from ssh) is skipped, up to this many lines
+	constexpr size_t max_greeting_lines = 64;
+
+	static std::optional<std::string> read_line(const int fd)
+	{
+		// the line is read one byte at a time, so that nothing after
+		// it gets consumed from the stream
+		std::string line;
+		while (line.size() < max_line_length)
+		{
+			char c;
+			const ssize_t ret = read(fd, &c, 1);
+			if (ret < 0 && errno == EINTR)
+				continue;
+
+			if (ret <= 0)
+				return {};
+
+			if (c == '\n')
+				return line;
+
+			line += c;
+		}
+
+		return {};
+	}
+
+	static std::optional<u64> file_size_of(const std::string& path)
+	{
+		std::error_code ec;
+		const u64 size = std::filesystem::file_size(path, ec);
+		if (ec)
+			return {};
+
+		return size;
+	}
+
+	static bool send_file(const int fd, const std::string& path, u64 size)
+	{
+		const int file_fd = open(path.c_str(), O_RDONLY | O_CLOEXEC);
+		if (file_fd < 0)
+			return false;
+
+		// sendfile() copies the data in the kernel, which matters
+		// with source tarballs that are hundreds of megabytes
+		while (size > 0)
+		{
+			const ssize_t ret = sendfile(fd, file_fd, nullptr, size);
+			if (ret < 0 && errno == EINTR)
+				continue;
+
+			if (ret <= 0)
+				break;
+
+			size -= ret;
+		}
+
+		close(file_fd);
+		return size == 0;
+	}
+
+	static bool receive_file(const int fd, const std::string& path, u64 size)
+	{
+		const int file_fd = open(path.c_str(), O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+		if (file_fd < 0)
+			return false;
+
+		std::array<char, 65536> buffer;
+		bool written{true};
+
+		while (size > 0)
+		{
+			const ssize_t ret = read(fd, buffer.data(), std::min<u64>(buffer.size(), size));
+			if (ret < 0 && errno == EINTR)
+				continue;
+
+			if (ret <= 0)
+				break;
+
+			// the rest of the payload still has to be read even if it
+			// can't be written, so that the stream stays in sync
+			written = written && write_all(file_fd, std::string_view(buffer.data(), ret));
+			size -= ret;
+		}
+
+		close(file_fd);
+		return size == 0 && written;
+	}
+
+	static bool receive_string(const int fd, std::string& text, const u64 size)
+	{
+		text.resize(size);
+		u64 received{0};
+
+		while (received < size)
+		{
+			const ssize_t ret = read(fd, text.data() + received, size - received);
+			if (ret < 0 && errno == EINTR)
+				continue;
+
+			if (ret <= 0)
+				return false;
+
+			received += ret;
+		}
+
+		return true;
+	}
+
+	static bool run_tar(std::vector<std::string> args)
+	{
+		process_options opts;
+		opts.args = { "tar" };
+		opts.args.insert(opts.args.end(), args.begin(), args.end());
+		opts.stdin_mode = stream_mode::null;
+
+		return run_process(std::move(opts)).success();
+	}
+
+	std::string build_config_hash(const path_settings& paths, const birb_config& config)
+	{
+		const std::string cfg_hash = std::filesystem::exists(paths.birb_cfg) ? file_hash(paths.birb_cfg) : "none";
+		return std::format("{}-lto{:d}-multilib{:d}", cfg_hash, config.enable_lto, config.enable_32bit_packages);
+	}
+
+	void run_build_worker(const path_settings& paths, const birb_config& config)
+	{
+		// the protocol gets its own copies of stdin and stdout. The build
+		// output goes to stderr and the builds can't read anything from
+		// stdin, so neither of them can mess up the protocol stream
+		std::cout.flush();
+		const int in_fd = fcntl(STDIN_FILENO, F_DUPFD_CLOEXEC, 3);
+		const int out_fd = fcntl(STDOUT_FILENO, F_DUPFD_CLOEXEC, 3);
+		if (in_fd < 0 || out_fd < 0)
+			error("Could not set up the worker streams: ", strerror(errno));
+
+		const int null_fd = open("/dev/null", O_RDONLY | O_CLOEXEC);
+		if (null_fd < 0 || dup2(null_fd, STDIN_FILENO) < 0 || dup2(STDERR_FILENO, STDOUT_FILENO) < 0)
+			error("Could not set up the worker streams: ", strerror(errno));
+		close(null_fd);
+
+		// the packages are built from a repository that only has the
+		// packages that have been sent to this worker. The packages get
+		// installed into a fakeroot of their own, so that the fakeroots of
+		// the packages that are installed on the worker don't get replaced
+		// and nothing that is left in them ends up in the result
+		const std::string work_dir = std::format("{}/birb_worker-{}", paths.build_dir, getpid());
+
+		path_settings worker_paths = paths;
+		worker_paths.repo_dir = work_dir + "/repo";
+		worker_paths.distfiles = work_dir + "/distfiles";
+		worker_paths.fakeroot = work_dir + "/fakeroot";
+		worker_paths.birb_repo_list = work_dir + "/birb-sources.conf";
+
+		// the work directory paths already have the LFS prefix in them
+		worker_paths.lfs_var_set = false;
+		worker_paths.lfs_path.clear();
+
+		std::filesystem::remove_all(work_dir);
+		std::filesystem::create_directories(worker_paths.repo_dir);
+		std::filesystem::create_directories(worker_paths.distfiles);
+		write_file_atomic(worker_paths.birb_repo_list, std::format("worker;worker;{}\n", worker_paths.repo_dir));
+
+		const std::string config_hash = build_config_hash(paths, config);
+
+		if (!write_all(out_fd, std::format("{}\n", worker_greeting)))
+			error("Could not greet the coordinator");
+
+		const auto reply = [out_fd](const std::string_view status, const std::string& pkg_name, const std::string_view payload)
+		{
+			if (!write_all(out_fd, std::format("{} {} {}\n", status, pkg_name, payload.size())) || !write_all(out_fd, payload))
+				error("Lost the connection to the coordinator");
+		};
+
+		while (const std::optional<std::string> header = read_line(in_fd))
+		{
+			const std::optional<std::array<std::string_view, 6>> fields = split_fields<6>(header.value(), " ");
+			if (!fields.has_value() || fields.value()[0] != "job")
+				error("Invalid job from the coordinator: ", header.value());
+
+			const auto [tag, pkg_field, job_config_hash, pkg_dir_size_field, source_name, source_size_field] = fields.value();
+			const std::string pkg_name(pkg_field);
+			const std::optional<u64> pkg_dir_size = parse_u64(pkg_dir_size_field);
+			const std::optional<u64> source_size = parse_u64(source_size_field);
+
+			if (!pkg_dir_size.has_value() || !source_size.has_value())
+				error("Invalid job from the coordinator: ", header.value());
+
+			log("Received a job for [", pkg_name, "]");
+
+			// read the whole job before checking it, so that the
+			// next job header can be found if this one gets refused
+			const std::string pkg_dir_tar = work_dir + "/package.tar";
+			const bool valid_source_name = source_name == "-" || (source_name.find('/') == std::string_view::npos && source_name != "..");
+			const std::string source_path = std::format("{}/{}", worker_paths.distfiles, valid_source_name ? source_name : "invalid");
+
+			const bool received = receive_file(in_fd, pkg_dir_tar, pkg_dir_size.value())
+				&& (source_name == "-" || receive_file(in_fd, source_path, source_size.value()));
+
+			if (!received)
+				error("Could not receive the job for [", pkg_name, "]");
+
+			if (!is_valid_package_name(pkg_name) || !valid_source_name)
+			{
+				reply("failed", pkg_name, "Invalid package or source tarball name");
+				continue;
+			}
+
+			if (job_config_hash != config_hash)
+			{
+				reply("failed", pkg_name, std::format("The build settings of the worker ({}) don't match the settings of the coordinator ({})", config_hash, job_config_hash));
+				continue;
+			}
+
+			std::filesystem::remove_all(worker_paths.repo_dir + "/" + pkg_name);
+			if (!run_tar({ "-C", worker_paths.repo_dir, "-xf", pkg_dir_tar }))
+			{
+				reply("failed", pkg_name, "Could not unpack the package directory");
+				continue;
+			}
+
+			// the previous job might have been an older version of the package
+			clear_caches();
+
+			const std::optional<pkg_source> repo = locate_package(pkg_name, worker_paths);
+			if (!repo.has_value() || !repo.value().is_valid())
+			{
+				reply("failed", pkg_name, "The package directory is missing from the job");
+				continue;
+			}
+
+			// a failed build exits the worker, and the coordinator
+			// shows the end of the worker log with the build output
+			build_package(pkg_name, get_pkg_flags(pkg_name, repo.value()), worker_paths, config, false);
+
+			const std::string fakeroot_path = std::format("{}/{}", worker_paths.fakeroot, pkg_name);
+			const std::string fakeroot_tar = work_dir + "/fakeroot.tar";
+			const bool packed = run_tar({ "-C", fakeroot_path, "-cf", fakeroot_tar, "." });
+			std::filesystem::remove_all(fakeroot_path);
+
+			if (!packed)
+			{
+				reply("failed", pkg_name, "Could not pack the fakeroot");
+				continue;
+			}
+
+			const std::optional<u64> fakeroot_size = file_size_of(fakeroot_tar);
+			if (!fakeroot_size.has_value())
+				error("Could not read the packed fakeroot at ", fakeroot_tar);
+
+			if (!write_all(out_fd, std::format("done {} {}\n", pkg_name, fakeroot_size.value())) || !send_file(out_fd, fakeroot_tar, fakeroot_size.value()))
+				error("Lost the connection to the coordinator");
+
+			std::filesystem::remove(fakeroot_tar);
+			std::filesystem::remove(pkg_dir_tar);
+			if (source_name != "-")
+				std::filesystem::remove(source_path);
+
+			log("Sent the fakeroot of [", pkg_name, "]");
+		}
+
+		std::filesystem::remove_all(work_dir);
+	}
+
+	// a build worker process as seen from the coordinator
+	struct worker_connection
+	{
+		worker_connection() = default;
+		worker_connection(const worker_connection&) = delete;
+		worker_connection& operator=(const worker_connection&) = delete;
+
+		~worker_connection()
+		{
+			if (from_worker >= 0)
+				close(from_worker);
+		}
+
+		std::string command;
+		std::string log_path;
+		std::optional<process> proc;
+		int from_worker{-1};
+
+		// empty if the worker is idle
+		std::string pkg_name;
+	};
+
+	static bool start_worker(worker_connection& worker)
+	{
+		std::array<int, 2> out_pipe;
+		if (pipe2(out_pipe.data(), O_CLOEXEC) != 0)
+			return false;
+
+		const int log_fd = open(worker.log_path.c_str(), O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+		if (log_fd < 0)
+		{
+			close(out_pipe[0]);
+			close(out_pipe[1]);
+			return false;
+		}
+
+		// the workers get their own process groups, so that killing
+		// a worker also kills the build it's running
+		process_options opts;
+		opts.args = { "sh", "-c", worker.command };
+		opts.own_process_group = true;
+		opts.stdin_mode = stream_mode::pipe;
+		opts.stdout_mode = stream_mode::fd;
+		opts.stderr_mode = stream_mode::fd;
+		opts.stdout_fd = out_pipe[1];
+		opts.stderr_fd = log_fd;
+
+		worker.proc = process::spawn(std::move(opts));
+		close(out_pipe[1]);
+		close(log_fd);
+
+		worker.from_worker = out_pipe[0];
+		if (!worker.proc.has_value())
+			return false;
+
+		for (size_t i = 0; i < max_greeting_lines; ++i)
+		{
+			const std::optional<std::string> line = read_line(worker.from_worker);
+			if (!line.has_value())
+				return false;
+
+			if (line.value() == worker_greeting)
+				return true;
+		}
+
+		return false;
+	}
+
+	void offload_builds(const std::vector<std::string>& packages, const path_settings& paths, const birb_config& config,
+			const std::function<void(const std::string&)>& on_built)
+	{
+		assert(!config.build_workers.empty());
+
+		if (packages.empty())
+			return;
+
+		// a worker that exits would kill birb with SIGPIPE when the next
+		// job gets sent to it, so the signal is blocked while the workers
+		// are running and failed writes are handled as failed jobs instead
+		sigset_t sigpipe_set, old_set;
+		sigemptyset(&sigpipe_set);
+		sigaddset(&sigpipe_set, SIGPIPE);
+		pthread_sigmask(SIG_BLOCK, &sigpipe_set, &old_set);
+
+		std::filesystem::create_directories(paths.build_logs());
+		std::filesystem::create_directories(paths.build_dir);
+
+		// there's no point in starting more workers than there are packages
+		const size_t worker_count = std::min(config.build_workers.size(), packages.size());
+		std::deque<worker_connection> workers;
+
+		for (size_t i = 0; i < worker_count; ++i)
+		{
+			worker_connection& worker = workers.emplace_back();
+			worker.command = config.build_workers.at(i);
+			worker.log_path = std::format("{}/worker-{}.log", paths.build_logs(), i);
+
+			log("Starting the build worker '", worker.command, "'");
+			if (!start_worker(worker))
+			{
+				non_fatal_error("Could not start the build worker '", worker.command, "'");
+				print_log_tail(worker.log_path, config.build_log_tail_lines);
+				exit(1);
+			}
+		}
+
+		const auto abort_builds = [&workers, &config](const worker_connection& failed_worker, const std::string& reason)
+		{
+			non_fatal_error(reason);
+			print_log_tail(failed_worker.log_path, config.build_log_tail_lines);
+
+			for (worker_connection& worker : workers)
+				if (worker.proc.has_value())
+					worker.proc.value().kill(SIGKILL);
+
+			exit(1);
+		};
+
+		// the packages in this batch that each package needs to have
+		// installed before it can be built
+		const std::vector<pkg_source> repos = get_pkg_sources(paths);
+		const std::unordered_set<std::string> batch(packages.begin(), packages.end());
+		std::unordered_set<std::string> not_installed = batch;
+		std::vector<std::vector<std::string>> blockers(packages.size());
+
+		for (size_t i = 0; i < packages.size(); ++i)
+		{
+			std::vector<std::string> deps = get_dependencies(packages[i], repos, 512, paths);
+
+			// fonts get fontconfig added as a dependency when resolving the dependencies
+			const std::optional<pkg_source> repo = locate_package(packages[i], paths);
+			if (repo.has_value() && get_pkg_flags(packages[i], repo.value()).contains(pkg_flag::font))
+				deps.emplace_back("fontconfig");
+
+			for (std::string& dep : deps)
+				if (dep != packages[i] && batch.contains(dep) && std::find(blockers[i].begin(), blockers[i].end(), dep) == blockers[i].end())
+					blockers[i].push_back(std::move(dep));
+		}
+
+		std::vector<bool> dispatched(packages.size(), false);
+		size_t builds_running{0};
+
+		const auto next_package = [&]() -> std::optional<size_t>
+		{
+			for (size_t i = 0; i < packages.size(); ++i)
+			{
+				if (dispatched[i])
+					continue;
+
+				const bool ready = std::none_of(blockers[i].begin(), blockers[i].end(),
+						[&not_installed](const std::string& dep) { return not_installed.contains(dep); });
+
+				if (ready)
+					return i;
+			}
+
+			// with a dependency loop nothing might be ready, in
+			// which case the installation order gets followed
+			if (builds_running == 0)
+			{
+				const auto first = std::find(dispatched.begin(), dispatched.end(), false);
+				if (first != dispatched.end())
+					return std::distance(dispatched.begin(), first);
+			}
+
+			return {};
+		};
+
+		const auto send_job = [&](worker_connection& worker, const std::string& pkg_name)
+		{
+			const std::optional<pkg_source> repo = locate_package(pkg_name, paths);
+			assert(repo.has_value());
+
+			// the package directory has the seed.sh file and any patches
+			const std::string pkg_dir_tar = std::format("{}/birb_offload-{}.tar", paths.build_dir, pkg_name);
+			if (!run_tar({ "-C", repo.value().path, "-cf", pkg_dir_tar, pkg_name }))
+				error("Could not pack the package directory of [", pkg_name, "]");
+
+			const std::string source_name = get_source_tarball(pkg_name, paths);
+			const std::string source_path = paths.distfiles + "/" + source_name;
+			const std::optional<u64> source_size = source_name.empty() ? std::nullopt : file_size_of(source_path);
+
+			// the source name is - for packages without a source tarball
+			const bool has_source = source_size.has_value();
+			const std::string source_field = has_source ? source_name : "-";
+			const u64 source_bytes = source_size.value_or(0);
+
+			const std::optional<u64> pkg_dir_size = file_size_of(pkg_dir_tar);
+			assert(pkg_dir_size.has_value());
+
+			const std::string header = std::format("job {} {} {} {} {}\n", pkg_name, build_config_hash(paths, config), pkg_dir_size.value(), source_field, source_bytes);
+
+			log("Building [", pkg_name, "] on '", worker.command, "'");
+
+			const bool sent = write_all(worker.proc.value().stdin_pipe(), header)
+				&& send_file(worker.proc.value().stdin_pipe(), pkg_dir_tar, pkg_dir_size.value())
+				&& (!has_source || send_file(worker.proc.value().stdin_pipe(), source_path, source_bytes));
+
+			std::filesystem::remove(pkg_dir_tar);
+
+			if (!sent)
+				abort_builds(worker, std::format("Could not send [{}] to the build worker '{}'", pkg_name, worker.command));
+
+			worker.pkg_name = pkg_name;
+			++builds_running;
+		};
+
+		const auto receive_result = [&](worker_connection& worker)
+		{
+			const std::string pkg_name = std::exchange(worker.pkg_name, "");
+			--builds_running;
+
+			const std::optional<std::string> header = read_line(worker.from_worker);
+			if (!header.has_value())
+				abort_builds(worker, std::format("Building [{}] on the build worker '{}' failed", pkg_name, worker.command));
+
+			const std::optional<std::array<std::string_view, 3>> fields = split_fields<3>(header.value(), " ");
+			const std::optional<u64> size = fields.has_value() ? parse_u64(fields.value()[2]) : std::nullopt;
+
+			if (!fields.has_value() || fields.value()[1] != pkg_name || !size.has_value())
+				abort_builds(worker, std::format("Invalid reply from the build worker '{}': {}", worker.command, header.value()));
+
+			if (fields.value()[0] == "failed")
+			{
+				std::string message;
+				if (!receive_string(worker.from_worker, message, size.value()))
+					message = "unknown error";
+
+				abort_builds(worker, std::format("The build worker '{}' refused [{}]: {}", worker.command, pkg_name, message));
+			}
+
+			if (fields.value()[0] != "done")
+				abort_builds(worker, std::format("Invalid reply from the build worker '{}': {}", worker.command, header.value()));
+
+			const std::string fakeroot_tar = std::format("{}/birb_offload-{}-fakeroot.tar", paths.build_dir, pkg_name);
+			if (!receive_file(worker.from_worker, fakeroot_tar, size.value()))
+				abort_builds(worker, std::format("Could not receive the fakeroot of [{}] from the build worker '{}'", pkg_name, worker.command));
+
+			// the tarball gets unpacked on top of an existing fakeroot
+			// the same way that a local build installs into it
+			const std::string fakeroot_path = std::format("{}/{}", paths.fakeroot, pkg_name);
+			std::filesystem::create_directories(fakeroot_path);
+			unshare_fakeroot(pkg_name, paths);
+
+			if (!run_tar({ "-C", fakeroot_path, "-xpf", fakeroot_tar }))
+				error("Could not unpack the fakeroot of [", pkg_name, "]");
+
+			std::filesystem::remove(fakeroot_tar);
+
+			log("Installing [", pkg_name, "] that was built on '", worker.command, "'");
+			on_built(pkg_name);
+			not_installed.erase(pkg_name);
+		};
+
+		while (!not_installed.empty())
+		{
+			for (worker_connection& worker : workers)
+			{
+				if (!worker.pkg_name.empty())
+					continue;
+
+				const std::optional<size_t> next = next_package();
+				if (!next.has_value())
+					break;
+
+				dispatched[next.value()] = true;
+				send_job(worker, packages[next.value()]);
+			}
+
+			assert(builds_running > 0);
+
+			std::vector<pollfd> fds;
+			std::vector<worker_connection*> busy_workers;
+			for (worker_connection& worker : workers)
+			{
+				if (worker.pkg_name.empty())
+					continue;
+
+				fds.push_back({ worker.from_worker, POLLIN, 0 });
+				busy_workers.push_back(&worker);
+			}
+
+			if (poll(fds.data(), fds.size(), -1) < 0)
+			{
+				if (errno == EINTR)
+					continue;
+
+				error("Waiting for the build workers failed: ", strerror(errno));
+			}
+
+			for (size_t i = 0; i < fds.size(); ++i)
+				if (fds[i].revents != 0)
+					receive_result(*busy_workers[i]);
+		}
+
+		// closing stdin tells the workers to quit
+		for (worker_connection& worker : workers)
+		{
+			worker.proc.value().close_stdin();
+			if (!worker.proc.value().wait().success())
+				warning("The build worker '", worker.command, "' did not exit cleanly, see ", worker.log_path);
+		}
+
+		// clear a SIGPIPE that might have been raised by a failed write
+		const timespec no_wait{0, 0};
+		while (sigtimedwait(&sigpipe_set, nullptr, &no_wait) > 0);
+		pthread_sigmask(SIG_SETMASK, &old_set, nullptr);
+	}
+}
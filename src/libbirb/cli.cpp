@@ -1,9 +1,14 @@
 #include "CLI.hpp"
 
 #include <cassert>
+#include <cstdlib>
+#include <filesystem>
 #include <ios>
 #include <iostream>
 #include <limits>
+#include <string_view>
+#include <system_error>
+#include <unistd.h>
 
 namespace birb
 {
@@ -36,4 +41,23 @@ namespace birb
 		assert(!title_text.empty());
 		std::cout << "\033kbirb: " << title_text << "\033\\";
 	}
+
+	bool can_set_win_title()
+	{
+		// the escape sequence would end up in logs and pipes
+		if (!isatty(STDOUT_FILENO))
+			return false;
+
+		const char* const term = getenv("TERM");
+		if (term == nullptr || std::string_view(term) == "dumb" || std::string_view(term) == "linux")
+			return false;
+
+		if (getenv("DISPLAY") != nullptr || getenv("WAYLAND_DISPLAY") != nullptr)
+			return true;
+
+		// sudo doesn't keep DISPLAY by default, but a running X server
+		// has a socket in here
+		std::error_code ec;
+		return !std::filesystem::is_empty("/tmp/.X11-unix", ec) && !ec;
+	}
 }
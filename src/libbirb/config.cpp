@@ -0,0 +1,124 @@
+#ifdef BIRB_TEST
+#include <doctest/doctest.h>
+#endif /* BIRB_TEST */
+
+#include "Config.hpp"
+#include "Logging.hpp"
+#include "MappedFile.hpp"
+#include "Utils.hpp"
+
+#include <optional>
+#include <string>
+
+namespace birb
+{
+	// the largest weight that the cgroup cpu and io controllers accept
+	constexpr u64 max_cgroup_weight = 10000;
+
+	constexpr u64 max_thread_limit = 1024;
+
+	static std::optional<bool> parse_bool(const std::string_view value)
+	{
+		if (value == "yes" || value == "true" || value == "1")
+			return true;
+
+		if (value == "no" || value == "false" || value == "0")
+			return false;
+
+		return {};
+	}
+
+	void parse_birb_config(const std::string_view text, birb_config& config)
+	{
+		for (std::string_view line : file_lines(text))
+		{
+			if (line.starts_with("export "))
+				line.remove_prefix(7);
+
+			const std::optional<std::array<std::string_view, 2>> fields = split_fields<2>(line, "=");
+			if (!fields.has_value())
+				continue;
+
+			const auto [key, quoted_value] = fields.value();
+			std::string_view value = quoted_value;
+			if (value.size() >= 2 && (value.front() == '"' || value.front() == '\'') && value.back() == value.front())
+				value = value.substr(1, value.size() - 2);
+
+			if (value.find_first_of("$`") != std::string_view::npos)
+				continue;
+
+			const auto set_bool = [&](bool& setting)
+			{
+				const std::optional<bool> parsed = parse_bool(value);
+				if (parsed.has_value())
+					setting = parsed.value();
+				else
+					warning("Invalid value for ", key, " in birb.conf: ", value, " (use yes or no)");
+			};
+
+			const auto set_number = [&](auto& setting, const u64 min, const u64 max)
+			{
+				const std::optional<u64> parsed = parse_u64(value);
+				if (parsed.has_value() && parsed.value() >= min && parsed.value() <= max)
+					setting = parsed.value();
+				else
+					warning("Invalid value for ", key, " in birb.conf: ", value, " (use a number from ", min, " to ", max, ")");
+			};
+
+			const auto set_size = [&](u64& setting)
+			{
+				const std::optional<u64> parsed = parse_size(std::string(value));
+				if (parsed.has_value())
+					setting = parsed.value();
+				else
+					warning("Invalid value for ", key, " in birb.conf: ", value, " (use a size like 500M or 20G)");
+			};
+
+			if (key == "ENABLE_LTO")
+				set_bool(config.enable_lto);
+			else if (key == "ENABLE_32BIT_PACKAGES")
+				set_bool(config.enable_32bit_packages);
+			else if (key == "MAX_THREADS")
+				set_number(config.max_threads, 0, max_thread_limit);
+			else if (key == "BUILD_CPU_WEIGHT")
+				set_number(config.build_cpu_weight, 1, max_cgroup_weight);
+			else if (key == "BUILD_IO_WEIGHT")
+				set_number(config.build_io_weight, 1, max_cgroup_weight);
+			else if (key == "BUILD_MEMORY_HIGH")
+				set_size(config.build_memory_high);
+			else if (key == "BUILD_MEMORY_MAX")
+				set_size(config.build_memory_max);
+			else if (key == "SOURCE_CACHE_MAX_SIZE")
+				set_size(config.source_cache_max_size);
+		}
+	}
+
+#ifdef BIRB_TEST
+	TEST_CASE("parse_birb_config()")
+	{
+		birb_config config;
+		parse_birb_config("# comment\nexport ENABLE_LTO=no\nexport ENABLE_32BIT_PACKAGES=\"yes\"\nexport BUILD_JOBS=\"$(nproc)\"\n", config);
+		CHECK_FALSE(config.enable_lto);
+		CHECK(config.enable_32bit_packages);
+
+		parse_birb_config("ENABLE_32BIT_PACKAGES=maybe\n", config);
+		CHECK(config.enable_32bit_packages);
+
+		parse_birb_config("MAX_THREADS=2\nBUILD_CPU_WEIGHT=20\nBUILD_IO_WEIGHT=0\nBUILD_MEMORY_MAX=8G\nSOURCE_CACHE_MAX_SIZE=500M\n", config);
+		CHECK(config.max_threads == 2);
+		CHECK(config.build_cpu_weight == 20);
+		CHECK(config.build_io_weight == 50);
+		CHECK(config.build_memory_max == 8ull * 1024 * 1024 * 1024);
+		CHECK(config.source_cache_max_size == 500ull * 1024 * 1024);
+	}
+#endif
+
+	void load_birb_config(const path_settings& paths, birb_config& config)
+	{
+		mapped_file file;
+		if (file.open(paths.birb_cfg) != file_error::noerr)
+			return;
+
+		parse_birb_config(file.contents(), config);
+	}
+}
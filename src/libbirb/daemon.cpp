@@ -0,0 +1,863 @@
+#include "Daemon.hpp"
+#include "Database.hpp"
+#include "Dependencies.hpp"
+#include "Logging.hpp"
+#include "PackageInfo.hpp"
+#include "SearchIndex.hpp"
+#include "Utils.hpp"
+
+#include <algorithm>
+#include <cassert>
+#include <chrono>
+#include <csignal>
+#include <cstring>
+#include <filesystem>
+#include <optional>
+#include <poll.h>
+#include <sys/inotify.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/un.h>
+#include <unistd.h>
+#include <unordered_map>
+#include <unordered_set>
+
+namespace birb
+{
+	// requests and answers are short, so anything longer is garbage
+	constexpr size_t max_request_length = 4096;
+
+	// limit the search results the same way as 'birb --search --fuzzy'
+	constexpr size_t max_search_results = 50;
+
+	// wait for the repositories to stop changing for this long
+	// before reading them again
+	constexpr int repository_settle_time_ms = 250;
+
+	// a client that doesn't send its query and read the answer in
+	// this time gets disconnected, so that it can't hold on to a slot
+	constexpr std::chrono::seconds client_timeout(5);
+
+	// clients above this wait in the listen backlog
+	constexpr size_t max_clients = 128;
+
+	struct daemon_answer
+	{
+		bool success{true};
+		std::vector<std::string> lines;
+	};
+
+	static daemon_answer failure(const std::string& message)
+	{
+		return { false, { message } };
+	}
+
+	// in-memory copy of the repositories and the package database
+	class daemon_state
+	{
+	public:
+		explicit daemon_state(const path_settings& paths)
+		:paths(paths)
+		{}
+
+		// the caches get rebuilt on the next query or once the files have stopped
+		// changing, so that a burst of changes (like a repository sync) only
+		// causes a single rebuild
+		bool repositories_stale{true};
+		bool database_stale{true};
+
+		daemon_answer answer(const std::vector<std::string>& query);
+
+		// directories that should be watched for changes
+		__attribute__((warn_unused_result))
+		std::vector<std::string> repository_dirs() const;
+
+		void refresh();
+
+	private:
+		// direct dependencies of a package with meta packages expanded.
+		// Returns nothing if the seed.sh file is malformed
+		__attribute__((warn_unused_result))
+		std::optional<std::vector<std::string>> direct_dependencies(const std::string& pkg_name, const pkg_source& repo) const;
+
+		// resolve_dependencies() exits or asserts on broken packages, so the
+		// dependency tree is checked for them before a query resolves it
+		__attribute__((warn_unused_result))
+		std::optional<std::string> dependency_problem(const std::string& pkg_name) const;
+
+		__attribute__((warn_unused_result))
+		std::optional<std::string> file_owner(const std::string& file_path) const;
+
+		const path_settings& paths;
+
+		// set if the repository list can't be read
+		std::optional<std::string> repository_error;
+
+		std::vector<pkg_source> repos;
+		std::optional<search_index> index;
+		std::unordered_map<std::string, u32> package_ids;
+
+		// <package, installed version>
+		std::unordered_map<std::string, std::string> installed;
+		std::unordered_map<std::string, std::vector<std::string>> reverse_deps;
+	};
+
+	std::optional<std::vector<std::string>> daemon_state::direct_dependencies(const std::string& pkg_name, const pkg_source& repo) const
+	{
+		std::vector<std::string> deps;
+
+		const std::optional<std::string> dep_line = try_read_pkg_variable(pkg_name, pkg_variable::deps, repo.path);
+		if (!dep_line.has_value())
+			return {};
+
+		for (const std::string_view dep_token : split_view(dep_line.value(), " "))
+		{
+			if (dep_token.empty())
+				continue;
+
+			std::string dep(dep_token);
+
+			if (is_meta_package(dep, paths))
+			{
+				const std::vector<std::string>& expanded = expand_meta_package(dep, paths);
+				deps.insert(deps.end(), expanded.begin(), expanded.end());
+			}
+			else
+			{
+				deps.push_back(std::move(dep));
+			}
+		}
+
+		return deps;
+	}
+
+	std::optional<std::string> daemon_state::dependency_problem(const std::string& pkg_name) const
+	{
+		if (!try_read_pkg_variable(pkg_name, pkg_variable::flags, locate_pkg_repo(pkg_name, repos).path).has_value())
+			return "The FLAGS variable of [" + pkg_name + "] is malformed";
+
+		std::unordered_set<std::string> visited;
+		std::vector<std::string> unvisited = { pkg_name };
+
+		while (!unvisited.empty())
+		{
+			const std::string pkg = std::move(unvisited.back());
+			unvisited.pop_back();
+
+			if (!visited.insert(pkg).second || is_meta_package(pkg, paths))
+				continue;
+
+			const pkg_source repo = locate_pkg_repo(pkg, repos);
+			if (!repo.is_valid())
+				return "Package [" + pkg + "] is needed by [" + pkg_name + "], but it doesn't exist";
+
+			const std::optional<std::string> dep_line = try_read_pkg_variable(pkg, pkg_variable::deps, repo.path);
+			if (!dep_line.has_value())
+				return "The DEPS variable of [" + pkg + "] is malformed";
+
+			if (dep_line.value().empty())
+				continue;
+
+			// get_dependencies() expects every entry to be a package name
+			// and at least one package after the meta packages are expanded
+			bool has_deps = false;
+			for (const std::string_view dep_token : split_view(dep_line.value(), " "))
+			{
+				std::string dep(dep_token);
+				if (dep.empty())
+					return "The DEPS variable of [" + pkg + "] has extra spaces";
+
+				if (is_meta_package(dep, paths))
+				{
+					const std::vector<std::string>& expanded = expand_meta_package(dep, paths);
+					has_deps |= !expanded.empty();
+					unvisited.insert(unvisited.end(), expanded.begin(), expanded.end());
+				}
+				else
+				{
+					has_deps = true;
+					unvisited.push_back(std::move(dep));
+				}
+			}
+
+			if (!has_deps)
+				return "The DEPS variable of [" + pkg + "] only has empty meta packages";
+		}
+
+		return {};
+	}
+
+	void daemon_state::refresh()
+	{
+		if (repositories_stale)
+		{
+			log("Reading the package repositories");
+
+			// the seed.sh files and meta packages may have changed, so
+			// everything that libbirb has cached is out-of-date
+			clear_caches();
+
+			// the rest of libbirb exits if it can't read the repository
+			// list, so nothing else gets read until inotify notices that
+			// the list has been fixed
+			std::optional<std::vector<pkg_source>> sources = try_get_pkg_sources(paths);
+			if (!sources.has_value())
+			{
+				repository_error = "Can't read the repository list at " + paths.birb_repo_list;
+				repos.clear();
+				index.reset();
+				package_ids.clear();
+				repositories_stale = false;
+				return;
+			}
+
+			repository_error.reset();
+			repos = std::move(sources.value());
+			index = search_index::build(paths);
+
+			package_ids.clear();
+			for (u32 i = 0; i < index.value().size(); ++i)
+				package_ids[index.value().entry(i).name] = i;
+
+			repositories_stale = false;
+
+			// the reverse dependencies depend on the seed.sh files too
+			database_stale = true;
+		}
+
+		if (database_stale)
+		{
+			log("Reading the package database");
+
+			installed_packages_cache.clear();
+			installed.clear();
+			reverse_deps.clear();
+
+			for (const std::string& line : read_birb_db(paths))
+			{
+				if (line.empty())
+					continue;
+
+				const auto tokens = split_fields<DB_LINE_COLUMN_COUNT>(line, ";");
+				if (!tokens.has_value())
+				{
+					warning("Malformed package database entry: ", line);
+					continue;
+				}
+
+				installed[std::string(tokens.value()[0])] = tokens.value()[1];
+			}
+
+			for (const auto& [pkg_name, version] : installed)
+			{
+				if (repos.empty())
+					break;
+
+				const pkg_source repo = locate_pkg_repo(pkg_name, repos);
+				if (!repo.is_valid())
+					continue;
+
+				const std::optional<std::vector<std::string>> deps = direct_dependencies(pkg_name, repo);
+				if (!deps.has_value())
+				{
+					warning("The DEPS variable of [", pkg_name, "] is malformed");
+					continue;
+				}
+
+				for (const std::string& dep : deps.value())
+					reverse_deps[dep].push_back(pkg_name);
+			}
+
+			for (auto& [pkg_name, dependants] : reverse_deps)
+			{
+				std::sort(dependants.begin(), dependants.end());
+				dependants.erase(std::unique(dependants.begin(), dependants.end()), dependants.end());
+			}
+
+			database_stale = false;
+		}
+	}
+
+	std::vector<std::string> daemon_state::repository_dirs() const
+	{
+		std::vector<std::string> dirs;
+
+		for (const pkg_source& repo : repos)
+		{
+			if (!std::filesystem::is_directory(repo.path))
+				continue;
+
+			dirs.push_back(repo.path);
+
+			// the seed.sh files are in the package directories
+			for (const std::filesystem::directory_entry& dir : std::filesystem::directory_iterator(repo.path))
+			{
+				if (dir.is_directory() && !dir.path().filename().string().starts_with('.'))
+					dirs.push_back(dir.path().string());
+			}
+		}
+
+		return dirs;
+	}
+
+	std::optional<std::string> daemon_state::file_owner(const std::string& file_path) const
+	{
+		// the files are symlinks to the package fakeroots, so the owner can
+		// be seen from where the symlink points to
+		//
+		// with LFS the symlinks point to the fakeroot paths as they are seen
+		// from inside of the LFS root
+		std::string fakeroot = paths.fakeroot;
+		std::string full_path = file_path;
+		if (paths.lfs_var_set)
+		{
+			fakeroot.erase(0, paths.lfs_path.size());
+			full_path.insert(0, paths.lfs_path);
+		}
+
+		std::error_code ec;
+		std::string target = file_path;
+		if (std::filesystem::is_symlink(full_path, ec))
+			target = std::filesystem::read_symlink(full_path, ec).string();
+
+		if (ec || !target.starts_with(fakeroot + "/"))
+			return {};
+
+		target.erase(0, fakeroot.size() + 1);
+		const std::string pkg_name = target.substr(0, target.find('/'));
+
+		if (pkg_name.empty() || !installed.contains(pkg_name))
+			return {};
+
+		return pkg_name;
+	}
+
+	daemon_answer daemon_state::answer(const std::vector<std::string>& query)
+	{
+		if (query.empty())
+			return failure("Empty query");
+
+		refresh();
+
+		const std::string& command = query.front();
+		const std::vector<std::string> args(query.begin() + 1, query.end());
+
+		if (command == "ping")
+			return { true, { "pong" } };
+
+		if (repository_error.has_value())
+			return failure(repository_error.value());
+
+		if (command == "packages")
+		{
+			daemon_answer result;
+			for (u32 i = 0; i < index.value().size(); ++i)
+				result.lines.push_back(index.value().entry(i).name);
+
+			return result;
+		}
+
+		if (command == "installed")
+		{
+			daemon_answer result;
+			for (const auto& [pkg_name, version] : installed)
+				result.lines.push_back(pkg_name + ";" + version);
+
+			std::sort(result.lines.begin(), result.lines.end());
+			return result;
+		}
+
+		if (command == "search")
+		{
+			if (args.empty())
+				return failure("Missing search query");
+
+			std::string query_str;
+			for (const std::string& word : args)
+				query_str += word + " ";
+
+			const std::vector<search_match> matches = index.value().search(query_str, true);
+
+			daemon_answer result;
+			for (size_t i = 0; i < matches.size() && i < max_search_results; ++i)
+			{
+				const search_index_entry& entry = index.value().entry(matches[i].id);
+				result.lines.push_back(entry.name + ";" + entry.version + ";" + entry.description + ";" + (installed.contains(entry.name) ? "[installed]" : ""));
+			}
+
+			return result;
+		}
+
+		if (command == "owner")
+		{
+			if (args.size() != 1 || !args.front().starts_with('/'))
+				return failure("Expected an absolute file path");
+
+			const std::optional<std::string> owner = file_owner(args.front());
+			if (!owner.has_value())
+				return failure(args.front() + " isn't owned by any package");
+
+			return { true, { owner.value() } };
+		}
+
+		// the rest of the queries are about a single package
+		if (args.size() != 1)
+			return failure("Expected a single package name");
+
+		const std::string& pkg_name = args.front();
+
+		if (command == "is-installed")
+			return { true, { installed.contains(pkg_name) ? "yes" : "no" } };
+
+		if (command != "version" && command != "deps" && command != "reverse-deps")
+			return failure("Unknown query: " + command);
+
+		if (!is_valid_package_name(pkg_name) || repos.empty() || !locate_pkg_repo(pkg_name, repos).is_valid())
+			return failure("Package [" + pkg_name + "] doesn't exist");
+
+		if (command == "deps")
+		{
+			if (const std::optional<std::string> problem = dependency_problem(pkg_name); problem.has_value())
+				return failure(problem.value());
+
+			// the full list of packages that installing the package would need
+			std::vector<std::string> deps = resolve_dependencies({ pkg_name }, paths);
+			std::erase(deps, pkg_name);
+			return { true, deps };
+		}
+
+		if (command == "reverse-deps")
+		{
+			if (!reverse_deps.contains(pkg_name))
+				return { true, {} };
+
+			return { true, reverse_deps.at(pkg_name) };
+		}
+
+		assert(command == "version");
+
+		if (!package_ids.contains(pkg_name))
+			return failure("Package [" + pkg_name + "] doesn't have a version");
+
+		return { true, { index.value().entry(package_ids.at(pkg_name)).version } };
+	}
+
+	static volatile std::sig_atomic_t stop_requested = 0;
+
+	static void request_stop(int)
+	{
+		stop_requested = 1;
+	}
+
+	struct client_connection
+	{
+		int fd{-1};
+		std::chrono::steady_clock::time_point deadline;
+
+		std::string request;
+		bool request_complete{false};
+
+		// the answer and how much of it has been sent
+		std::string response;
+		size_t sent{0};
+	};
+
+	// read what the client has sent so far, until there's a full line.
+	// Returns false if the client should be disconnected
+	static bool read_request(client_connection& client)
+	{
+		std::array<char, 512> buffer;
+
+		while (!client.request_complete)
+		{
+			const ssize_t len = recv(client.fd, buffer.data(), buffer.size(), 0);
+			if (len < 0 && errno == EINTR)
+				continue;
+
+			if (len < 0)
+				return errno == EAGAIN;
+
+			// a query without a newline ends when the client stops writing
+			if (len == 0)
+			{
+				client.request_complete = true;
+				break;
+			}
+
+			client.request.append(buffer.data(), len);
+
+			const size_t newline = client.request.find('\n');
+			if (newline != std::string::npos)
+			{
+				client.request.resize(newline);
+				client.request_complete = true;
+			}
+			else if (client.request.size() > max_request_length)
+			{
+				return false;
+			}
+		}
+
+		return true;
+	}
+
+	static std::string answer_request(const std::string& request, daemon_state& state)
+	{
+		std::vector<std::string> query;
+		for (const std::string_view word : split_view(request, " "))
+			if (!word.empty())
+				query.emplace_back(word);
+
+		const daemon_answer answer = state.answer(query);
+
+		// the first line tells if the query succeeded
+		std::string response = answer.success ? "ok\n" : "error\n";
+		for (const std::string& line : answer.lines)
+			response.append(line).append("\n");
+
+		return response;
+	}
+
+	// send as much of the answer as the socket takes. Returns false once
+	// the client is done with, because everything has been sent or
+	// because the client went away
+	static bool send_response(client_connection& client)
+	{
+		while (client.sent < client.response.size())
+		{
+			const ssize_t ret = send(client.fd, client.response.data() + client.sent, client.response.size() - client.sent, MSG_NOSIGNAL);
+			if (ret < 0 && errno == EINTR)
+				continue;
+
+			if (ret < 0 && errno == EAGAIN)
+				return true;
+
+			if (ret <= 0)
+				return false;
+
+			client.sent += ret;
+		}
+
+		return false;
+	}
+
+	// returns false if the client should be disconnected
+	static bool handle_client(client_connection& client, daemon_state& state)
+	{
+		if (!client.request_complete)
+		{
+			if (!read_request(client))
+				return false;
+
+			if (!client.request_complete)
+				return true;
+
+			client.response = answer_request(client.request, state);
+		}
+
+		return send_response(client);
+	}
+
+	class inotify_watcher
+	{
+	public:
+		explicit inotify_watcher(const path_settings& paths)
+		:paths(paths)
+		{
+			fd = inotify_init1(IN_NONBLOCK | IN_CLOEXEC);
+			if (fd < 0)
+				error("Can't initialize inotify: ", strerror(errno));
+
+			const u32 file_events = IN_CLOSE_WRITE | IN_MOVED_TO | IN_MOVED_FROM | IN_CREATE | IN_DELETE;
+
+			db_wd = inotify_add_watch(fd, paths.db_dir.c_str(), file_events);
+			if (db_wd < 0)
+				warning("Can't watch ", paths.db_dir, " for changes: ", strerror(errno));
+
+			const std::string config_dir = std::filesystem::path(paths.birb_repo_list).parent_path().string();
+			config_wd = inotify_add_watch(fd, config_dir.c_str(), file_events);
+			if (config_wd < 0)
+				warning("Can't watch ", config_dir, " for changes: ", strerror(errno));
+		}
+
+		~inotify_watcher()
+		{
+			close(fd);
+		}
+
+		inotify_watcher(const inotify_watcher&) = delete;
+		inotify_watcher& operator=(const inotify_watcher&) = delete;
+
+		void watch_repositories(const std::vector<std::string>& dirs)
+		{
+			const u32 file_events = IN_CLOSE_WRITE | IN_MOVED_TO | IN_MOVED_FROM | IN_CREATE | IN_DELETE;
+
+			// adding a watch for a directory that is already
+			// watched returns the existing watch
+			for (const std::string& dir : dirs)
+			{
+				const int wd = inotify_add_watch(fd, dir.c_str(), file_events);
+				if (wd < 0)
+				{
+					warning("Can't watch ", dir, " for changes: ", strerror(errno));
+					continue;
+				}
+
+				repo_wds.insert(wd);
+			}
+		}
+
+		// mark the caches stale depending on what has changed
+		void process_events(daemon_state& state)
+		{
+			alignas(inotify_event) std::array<char, 16384> buffer;
+
+			while (true)
+			{
+				const ssize_t len = read(fd, buffer.data(), buffer.size());
+				if (len <= 0)
+					return;
+
+				for (ssize_t offset = 0; offset < len; )
+				{
+					const inotify_event* event = reinterpret_cast<const inotify_event*>(buffer.data() + offset);
+					offset += sizeof(inotify_event) + event->len;
+
+					const std::string name = event->len > 0 ? event->name : "";
+
+					if (event->mask & IN_Q_OVERFLOW)
+					{
+						state.repositories_stale = true;
+						state.database_stale = true;
+						continue;
+					}
+
+					if (event->wd == db_wd)
+					{
+						if (name == "birb_db" || name == "nest")
+							state.database_stale = true;
+
+						// syncing the repositories updates the package list last
+						if (name == "packages" || name == "search_index")
+							state.repositories_stale = true;
+					}
+					else if (event->wd == config_wd)
+					{
+						if (name == std::filesystem::path(paths.birb_repo_list).filename())
+							state.repositories_stale = true;
+					}
+					else if (repo_wds.contains(event->wd))
+					{
+						state.repositories_stale = true;
+					}
+				}
+			}
+		}
+
+		int fd{-1};
+
+	private:
+		const path_settings& paths;
+		int db_wd{-1};
+		int config_wd{-1};
+		std::unordered_set<int> repo_wds;
+	};
+
+	void run_daemon(const path_settings& paths)
+	{
+		const int listen_fd = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+		if (listen_fd < 0)
+			error("Can't create a socket: ", strerror(errno));
+
+		sockaddr_un addr{};
+		addr.sun_family = AF_UNIX;
+		if (paths.daemon_socket.size() >= sizeof(addr.sun_path))
+			error("The socket path is too long: ", paths.daemon_socket);
+
+		strncpy(addr.sun_path, paths.daemon_socket.c_str(), sizeof(addr.sun_path) - 1);
+
+		// get rid of a socket left behind by a daemon that wasn't stopped cleanly
+		std::filesystem::create_directories(std::filesystem::path(paths.daemon_socket).parent_path());
+		unlink(paths.daemon_socket.c_str());
+
+		if (bind(listen_fd, reinterpret_cast<const sockaddr*>(&addr), sizeof(addr)) != 0)
+			error("Can't bind to ", paths.daemon_socket, ": ", strerror(errno));
+
+		// the queries only read things, so anyone is allowed to ask
+		chmod(paths.daemon_socket.c_str(), 0666);
+
+		if (listen(listen_fd, 64) != 0)
+			error("Can't listen to ", paths.daemon_socket, ": ", strerror(errno));
+
+		struct sigaction action{};
+		action.sa_handler = request_stop;
+		sigaction(SIGINT, &action, nullptr);
+		sigaction(SIGTERM, &action, nullptr);
+
+		daemon_state state(paths);
+		inotify_watcher watcher(paths);
+
+		state.refresh();
+		watcher.watch_repositories(state.repository_dirs());
+
+		log("Listening to ", paths.daemon_socket);
+
+		// set when the repositories have changed, since there
+		// might be new package directories to watch
+		bool rewatch{false};
+
+		// the clients are served one step at a time, so that a slow
+		// client can't hold up the queries of the others
+		std::vector<client_connection> clients;
+
+		while (!stop_requested)
+		{
+			std::vector<pollfd> fds = {
+				{ listen_fd, static_cast<short>(clients.size() < max_clients ? POLLIN : 0), 0 },
+				{ watcher.fd, POLLIN, 0 }
+			};
+
+			for (const client_connection& client : clients)
+				fds.push_back({ client.fd, static_cast<short>(client.request_complete ? POLLOUT : POLLIN), 0 });
+
+			int timeout = state.repositories_stale ? repository_settle_time_ms : -1;
+			if (!clients.empty())
+			{
+				const auto next_deadline = std::min_element(clients.begin(), clients.end(), [](const client_connection& a, const client_connection& b)
+				{
+					return a.deadline < b.deadline;
+				})->deadline;
+
+				const auto until_deadline = std::chrono::ceil<std::chrono::milliseconds>(next_deadline - std::chrono::steady_clock::now());
+				const int deadline_timeout = std::max<int>(0, until_deadline.count());
+				timeout = timeout < 0 ? deadline_timeout : std::min(timeout, deadline_timeout);
+			}
+
+			const int ret = poll(fds.data(), fds.size(), timeout);
+			if (ret < 0)
+			{
+				if (errno == EINTR)
+					continue;
+
+				non_fatal_error("poll() failed: ", strerror(errno));
+				break;
+			}
+
+			// the repositories have stopped changing, so read them
+			// in before anyone needs to wait for it
+			if (ret == 0 && state.repositories_stale)
+				state.refresh();
+
+			if (fds[1].revents & POLLIN)
+			{
+				watcher.process_events(state);
+				if (state.repositories_stale)
+					rewatch = true;
+			}
+
+			const auto now = std::chrono::steady_clock::now();
+			for (size_t i = 0; i < clients.size(); ++i)
+			{
+				client_connection& client = clients[i];
+
+				bool keep = now < client.deadline;
+				if (keep && fds[i + 2].revents != 0)
+					keep = handle_client(client, state);
+
+				if (!keep)
+				{
+					close(client.fd);
+					client.fd = -1;
+				}
+			}
+
+			std::erase_if(clients, [](const client_connection& client) { return client.fd < 0; });
+
+			if (fds[0].revents & POLLIN)
+			{
+				const int client_fd = accept4(listen_fd, nullptr, nullptr, SOCK_CLOEXEC | SOCK_NONBLOCK);
+				if (client_fd >= 0)
+				{
+					client_connection& client = clients.emplace_back();
+					client.fd = client_fd;
+					client.deadline = std::chrono::steady_clock::now() + client_timeout;
+				}
+			}
+
+			if (rewatch && !state.repositories_stale)
+			{
+				watcher.watch_repositories(state.repository_dirs());
+				rewatch = false;
+			}
+		}
+
+		log("Stopping");
+
+		for (const client_connection& client : clients)
+			close(client.fd);
+
+		close(listen_fd);
+		unlink(paths.daemon_socket.c_str());
+	}
+
+	int query_daemon(const std::vector<std::string>& query, const path_settings& paths)
+	{
+		assert(!query.empty());
+
+		const int fd = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+		if (fd < 0)
+			return 2;
+
+		sockaddr_un addr{};
+		addr.sun_family = AF_UNIX;
+		strncpy(addr.sun_path, paths.daemon_socket.c_str(), sizeof(addr.sun_path) - 1);
+
+		if (connect(fd, reinterpret_cast<const sockaddr*>(&addr), sizeof(addr)) != 0)
+		{
+			close(fd);
+			return 2;
+		}
+
+		std::string request;
+		for (const std::string& word : query)
+			request += (request.empty() ? "" : " ") + word;
+
+		if (!write_all(fd, request + "\n"))
+		{
+			close(fd);
+			return 2;
+		}
+
+		std::string response;
+		std::array<char, 65536> buffer;
+		ssize_t len;
+		while ((len = recv(fd, buffer.data(), buffer.size(), 0)) != 0)
+		{
+			if (len < 0 && errno == EINTR)
+				continue;
+
+			if (len < 0)
+				break;
+
+			response.append(buffer.data(), len);
+		}
+
+		close(fd);
+
+		const size_t status_end = response.find('\n');
+		if (status_end == std::string::npos)
+			return 2;
+
+		const bool success = response.substr(0, status_end) == "ok";
+		const std::string body = response.substr(status_end + 1);
+
+		if (success)
+		{
+			std::cout << body << std::flush;
+			return 0;
+		}
+
+		std::cerr << body << std::flush;
+		return 1;
+	}
+}
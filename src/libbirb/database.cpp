@@ -1,12 +1,16 @@
 #include "Database.hpp"
 #include "Config.hpp"
+#include "EnumTable.hpp"
+#include "MappedFile.hpp"
+#include "Profiling.hpp"
+#include "ThreadPool.hpp"
 #include "Utils.hpp"
 #include <cassert>
 #include <filesystem>
-#include <fstream>
 #include <iostream>
+#include <mutex>
 
-const static inline std::unordered_map<pkg_variable, std::string> pkg_variable_str = {
+constexpr auto pkg_variable_names = birb::make_enum_table<pkg_variable>({
 	{ pkg_variable::name, "NAME" },
 	{ pkg_variable::desc, "DESC" },
 	{ pkg_variable::version, "VERSION" },
@@ -14,8 +18,15 @@ const static inline std::unordered_map<pkg_variable, std::string> pkg_variable_s
 	{ pkg_variable::checksum, "CHECKSUM" },
 	{ pkg_variable::deps, "DEPS" },
 	{ pkg_variable::flags, "FLAGS" },
-	{ pkg_variable::notes, "NOTES" }
-};
+	{ pkg_variable::notes, "NOTES" },
+	{ pkg_variable::triggers, "TRIGGERS" }
+});
+
+// variables that packages don't need to define
+constexpr bool is_optional_pkg_variable(const pkg_variable var)
+{
+	return var == pkg_variable::notes || var == pkg_variable::triggers;
+}
 
 pkg_source::pkg_source() {}
 
@@ -37,21 +48,37 @@ bool pkg_source::is_valid() const
 
 namespace birb
 {
-	std::vector<pkg_source> get_pkg_sources(const path_settings& paths)
+	/* The repository list is only checked when something needs it, so that
+	 * commands that don't touch the repositories start up faster */
+	static mapped_file map_repo_list(const path_settings& paths)
 	{
-		/* Read the birb-sources.conf file line by line */
-		const std::vector<std::string> repository_lines = read_file(paths.birb_repo_list);
+		mapped_file repo_list;
+		const file_error err = repo_list.open(paths.birb_repo_list);
+
+		if (err == file_error::not_found)
+			error(paths.birb_repo_list, " is missing. Check the TROUBLESHOOTING section in 'man birb' for instructions on how to fix this issue");
+
+		if (err != file_error::noerr)
+			error("Can't read ", paths.birb_repo_list, ": ", file_error_str.name(err));
+
+		return repo_list;
+	}
 
+	/* Returns nothing if a line is malformed, and bad_line is set to point to it */
+	static std::optional<std::vector<pkg_source>> parse_pkg_sources(const mapped_file& repo_list, const path_settings& paths, std::string_view& bad_line)
+	{
 		std::vector<pkg_source> sources;
-		for (size_t i = 0; i < repository_lines.size(); ++i)
+		for (const std::string_view repository_line : repo_list.lines())
 		{
-			std::vector<std::string> line = split_string(repository_lines[i], ";");
-
-			pkg_source s(line.at(0), line.at(1), line.at(2));
+			const std::optional<std::array<std::string_view, 3>> line = split_fields<3>(repository_line, ";");
+			if (!line.has_value() || line.value()[0].empty() || line.value()[1].empty() || line.value()[2].empty())
+			{
+				bad_line = repository_line;
+				return {};
+			}
 
-			assert(s.name.empty() == false);
-			assert(s.url.empty()  == false);
-			assert(s.path.empty() == false);
+			const auto [name, url, path] = line.value();
+			pkg_source s{std::string(name), std::string(url), std::string(path)};
 
 			// handle the LFS path
 			if (paths.lfs_var_set)
@@ -63,9 +90,40 @@ namespace birb
 		return sources;
 	}
 
+	std::vector<pkg_source> get_pkg_sources(const path_settings& paths)
+	{
+		/* Read the birb-sources.conf file line by line */
+		const mapped_file repo_list = map_repo_list(paths);
+
+		std::string_view bad_line;
+		std::optional<std::vector<pkg_source>> sources = parse_pkg_sources(repo_list, paths, bad_line);
+		if (!sources.has_value())
+			error("Malformed repository entry in ", paths.birb_repo_list, ": ", bad_line);
+
+		return std::move(sources.value());
+	}
+
+	std::optional<std::vector<pkg_source>> try_get_pkg_sources(const path_settings& paths)
+	{
+		mapped_file repo_list;
+		if (const file_error err = repo_list.open(paths.birb_repo_list); err != file_error::noerr)
+		{
+			warning("Can't read ", paths.birb_repo_list, ": ", file_error_str.name(err));
+			return {};
+		}
+
+		std::string_view bad_line;
+		std::optional<std::vector<pkg_source>> sources = parse_pkg_sources(repo_list, paths, bad_line);
+		if (!sources.has_value())
+			warning("Malformed repository entry in ", paths.birb_repo_list, ": ", bad_line);
+
+		return sources;
+	}
+
 	std::vector<std::string> get_pkg_source_list(const path_settings& paths)
 	{
-		return read_file(paths.birb_repo_list);
+		const mapped_file repo_list = map_repo_list(paths);
+		return std::vector<std::string>(repo_list.lines().begin(), repo_list.lines().end());
 	}
 
 	pkg_source locate_pkg_repo(const std::string& pkg_name, const std::vector<pkg_source>& package_sources)
@@ -74,8 +132,11 @@ namespace birb
 		assert(package_sources.size() > 0);
 
 		/* Check if the result has already been cached */
-		if (pkg_repo_cache.contains(pkg_name))
-			return pkg_repo_cache[pkg_name];
+		const pkg_id id = intern_pkg_name(pkg_name);
+		if (const auto cached = pkg_repo_cache.find(id); cached != pkg_repo_cache.end())
+			return cached->second;
+
+		trace_span span("locate_pkg_repo", pkg_name);
 
 		/* Loop through all of the repositories and try to find
 		 * the seed.sh file for the given package */
@@ -84,10 +145,11 @@ namespace birb
 			assert(s.path.empty() == false);
 
 			const std::string seed_path = s.path + "/" + pkg_name + "/seed.sh";
+			count_trace_event(trace_counter::stat, 2);
 			if (std::filesystem::exists(seed_path) && std::filesystem::is_regular_file(seed_path))
 			{
 				///* Cache the results */
-				pkg_repo_cache[pkg_name] = s;
+				pkg_repo_cache[id] = s;
 
 				return s;
 			}
@@ -97,70 +159,100 @@ namespace birb
 	}
 
 	std::string read_pkg_variable(const std::string& pkg_name, const pkg_variable var, const std::string& repo_path)
+	{
+		const std::optional<std::string> value = try_read_pkg_variable(pkg_name, var, repo_path);
+		if (!value.has_value())
+		{
+			std::cerr << "Package " << pkg_name << " is corrupted! Please check the formatting for variable '" << pkg_variable_names.name(var) << "' in " << repo_path << "/" << pkg_name << "/seed.sh\n";
+			exit(1);
+		}
+
+		return value.value();
+	}
+
+	std::optional<std::string> try_read_pkg_variable(const std::string& pkg_name, const pkg_variable var, const std::string& repo_path)
 	{
 		assert(pkg_name.empty() == false);
 		assert(repo_path.empty() == false);
 
-		const std::string& var_name = pkg_variable_str.at(var);
+		const std::string_view var_name = pkg_variable_names.name(var);
 
 		/* Check if the result is already in the cache*/
-		const std::string key = pkg_name + var_name;
-		if (var_cache.contains(key))
-			return var_cache[key];
+		const u64 key = var_cache_key(intern_pkg_name(pkg_name), var);
+		{
+			std::lock_guard<std::mutex> lock(var_cache_mutex);
+			if (const auto cached = var_cache.find(key); cached != var_cache.end())
+				return cached->second;
+		}
+
+		trace_span span("read_pkg_variable", pkg_name);
 
 		const std::string pkg_path = repo_path + "/" + pkg_name + "/seed.sh";
 
 		/* Read data from the package file */
-		std::string var_line;
-		std::ifstream pkg_file(pkg_path);
-
-		if (!pkg_file.is_open())
+		mapped_file pkg_file;
+		if (pkg_file.open(pkg_path) != file_error::noerr)
 		{
 			//std::cout << "File [" << pkg_path << "] can't be opened!\n";
 			return "";
 		}
 
-		const std::string var_line_beginning = var_name + "=\"";
-		while (std::getline(pkg_file, var_line))
+		const std::string var_line_beginning = std::string(var_name) + "=\"";
+		std::string_view var_line;
+		bool found = false;
+		for (const std::string_view line : pkg_file.lines())
 		{
 			/* Check if we have located the dependency line */
-			if (var_line.substr(0, var_name.size() + 2) == var_line_beginning)
+			if (line.starts_with(var_line_beginning))
 			{
 				/* Break the file reading loop */
+				var_line = line;
+				found = true;
 				break;
 			}
 		}
 
-		if (var_line.size() <= var_name.size() + 2)
+		/* Optional variables are empty if they aren't defined */
+		if (!found && is_optional_pkg_variable(var))
 		{
-			std::cerr << "Package " << pkg_name << " is corrupted! Please check the formatting for variable '" << var_name << "' in " << repo_path << "/" << pkg_name << "/seed.sh\n";
-			exit(1);
+			std::lock_guard<std::mutex> lock(var_cache_mutex);
+			var_cache[key] = "";
+			return "";
 		}
 
-		/* We are done with the file, stop reading it */
-		pkg_file.close();
+		if (var_line.size() <= var_name.size() + 2)
+			return {};
 
 		/* Clean up the string */
-		var_line.erase(0, var_name.size() + 2);
-		var_line.erase(var_line.size() - 1, 1);
+		const std::string value(var_line.substr(var_name.size() + 2, var_line.size() - var_name.size() - 3));
 
 		/* Cache the result */
-		var_cache[key] = var_line;
+		std::lock_guard<std::mutex> lock(var_cache_mutex);
+		var_cache[key] = value;
 
-		return var_line;
+		return value;
 	}
 
-	std::vector<std::string> read_birb_db(const path_settings& paths)
+	mapped_file map_birb_db(const path_settings& paths)
 	{
-		std::vector<std::string> db_file;
+		mapped_file db_file;
 
-		/* Read in the package database, if it exists */
-		if (std::filesystem::exists(paths.database()) && std::filesystem::is_regular_file(paths.database()))
-			db_file = read_file(paths.database());
+		/* The database doesn't exist before anything has been installed */
+		const file_error err = db_file.open(paths.database());
+		if (err != file_error::noerr && err != file_error::not_found && err != file_error::not_a_file)
+			error("Can't read the package database at ", paths.database(), ": ", file_error_str.name(err));
 
 		return db_file;
 	}
 
+	std::vector<std::string> read_birb_db(const path_settings& paths)
+	{
+		trace_span span("read_birb_db");
+
+		const mapped_file db_file = map_birb_db(paths);
+		return std::vector<std::string>(db_file.lines().begin(), db_file.lines().end());
+	}
+
 	std::vector<std::string> find_db_entry(const std::vector<std::string>& db_file, const std::string& pkg_name)
 	{
 		assert(db_file.empty() == false);
@@ -169,10 +261,10 @@ namespace birb
 		for (size_t i = 0; i < db_file.size(); ++i)
 		{
 			/* Split the db line package;version */
-			std::vector<std::string> result = birb::split_string(db_file[i], ";");
+			const auto result = birb::split_fields<DB_LINE_COLUMN_COUNT>(db_file[i], ";");
 
-			if (result.at(0) == pkg_name && result.size() == DB_LINE_COLUMN_COUNT)
-				return result;
+			if (result.has_value() && result.value()[0] == pkg_name)
+				return { std::string(result.value()[0]), std::string(result.value()[1]) };
 		}
 
 		return std::vector<std::string>(0);
@@ -184,13 +276,12 @@ namespace birb
 		if (!installed_packages_cache.empty())
 			return installed_packages_cache;
 
-		const std::vector<std::string> birb_db = read_birb_db(paths);
+		const mapped_file birb_db = map_birb_db(paths);
 
 		/* Split the strings to get package names */
 		std::vector<std::string> pkg_names;
-		pkg_names.reserve(birb_db.size());
-		for (size_t i = 0; i < birb_db.size(); ++i)
-			pkg_names.push_back(split_string(birb_db[i], ";")[0]);
+		for (const std::string_view db_line : birb_db.lines())
+			pkg_names.emplace_back(first_token(db_line, ";"));
 
 		/* Cache the result */
 		installed_packages_cache = pkg_names;
@@ -204,17 +295,32 @@ namespace birb
 		const std::vector<pkg_source> pkg_sources = birb::get_pkg_sources(paths);
 		assert(pkg_sources.size() > 0 && "Package sources couldn't be found");
 
-		std::unordered_map<std::string, std::string> pkgs;
-
 		/* Get list of all packages in the fakeroot */
+		std::vector<std::string> pkg_names;
 		for (auto& p : std::filesystem::directory_iterator(paths.fakeroot))
 		{
 			if (p.is_directory())
-			{
-				/* Iterate through the package source repositories and get the version
-				 * from the first repository that has the package in it */
-				pkgs[p.path().filename().string()] = birb::read_pkg_variable(p.path().filename().string(), pkg_variable::version, paths.repo_dir);
-			}
+				pkg_names.push_back(p.path().filename().string());
+		}
+
+		/* Iterate through the package source repositories and get the version
+		 * from the first repository that has the package in it */
+		std::vector<std::optional<std::string>> versions(pkg_names.size());
+		parallel_for(pkg_names.size(), [&](const size_t i)
+		{
+			versions[i] = birb::try_read_pkg_variable(pkg_names[i], pkg_variable::version, paths.repo_dir);
+		});
+
+		/* Corrupted packages are reported by read_pkg_variable() on this thread,
+		 * since exiting from a pool worker would race with the other workers */
+		std::unordered_map<std::string, std::string> pkgs;
+		pkgs.reserve(pkg_names.size());
+		for (size_t i = 0; i < pkg_names.size(); ++i)
+		{
+			if (!versions[i].has_value())
+				versions[i] = birb::read_pkg_variable(pkg_names[i], pkg_variable::version, paths.repo_dir);
+
+			pkgs[pkg_names[i]] = std::move(versions[i].value());
 		}
 
 		return pkgs;
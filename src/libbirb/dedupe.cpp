@@ -0,0 +1,454 @@
+#include "Database.hpp"
+#include "Dedupe.hpp"
+#include "Logging.hpp"
+#include "MappedFile.hpp"
+#include "Profiling.hpp"
+#include "ThreadPool.hpp"
+#include "Utils.hpp"
+
+#include <algorithm>
+#include <array>
+#include <cassert>
+#include <cerrno>
+#include <cstring>
+#include <fcntl.h>
+#include <filesystem>
+#include <format>
+#include <functional>
+#include <iterator>
+#include <optional>
+#include <string_view>
+#include <sys/stat.h>
+#include <tuple>
+#include <unistd.h>
+
+namespace birb
+{
+	// top level directories of the fakeroots that have configuration files
+	// and other files that get modified in place through the symlinks
+	constexpr std::array<std::string_view, 2> mutable_dirs = { "etc", "var" };
+
+	namespace
+	{
+		struct fakeroot_file
+		{
+			std::string path;
+			struct stat st;
+
+			// index of the fakeroot that the file is in
+			size_t root;
+		};
+
+		// a file and the hardlinks to it in the fakeroots
+		struct inode_files
+		{
+			std::vector<size_t> files;
+			std::optional<u64> digest;
+		};
+	}
+
+	// the manifest has one line per linked file in the format digest;path
+	// where the files with the same digest are links to the same file
+	static std::string_view manifest_path(const std::string_view line)
+	{
+		const size_t separator = line.find(';');
+		return separator == std::string_view::npos ? std::string_view() : line.substr(separator + 1);
+	}
+
+	static std::vector<std::string> read_manifest(const path_settings& paths)
+	{
+		mapped_file file;
+		if (const file_error err = file.open(paths.dedupe_manifest()); err != file_error::noerr)
+		{
+			if (err == file_error::not_found)
+				return {};
+
+			// rewriting the manifest without its entries would
+			// forget which files are shared with other packages
+			error("Can't read the dedupe manifest at ", paths.dedupe_manifest(), ": ", file_error_str.name(err));
+		}
+
+		std::vector<std::string> lines;
+		for (const std::string_view line : file.lines())
+		{
+			if (manifest_path(line).empty())
+			{
+				warning("Malformed dedupe manifest entry: ", line);
+				continue;
+			}
+
+			lines.emplace_back(line);
+		}
+
+		return lines;
+	}
+
+	static std::vector<fakeroot_file> scan_fakeroot(const std::string& root_path, const size_t root)
+	{
+		std::vector<fakeroot_file> files;
+
+		std::error_code ec;
+		std::filesystem::recursive_directory_iterator it(root_path, ec);
+		for (; !ec && it != std::filesystem::recursive_directory_iterator(); it.increment(ec))
+		{
+			const std::filesystem::directory_entry& entry = *it;
+
+			std::error_code type_ec;
+			if (entry.is_symlink(type_ec))
+				continue;
+
+			if (entry.is_directory(type_ec))
+			{
+				if (it.depth() == 0 && std::ranges::find(mutable_dirs, entry.path().filename().string()) != mutable_dirs.end())
+					it.disable_recursion_pending();
+
+				continue;
+			}
+
+			fakeroot_file file{ entry.path().string(), {}, root };
+			count_trace_event(trace_counter::stat);
+			if (lstat(file.path.c_str(), &file.st) != 0 || !S_ISREG(file.st.st_mode))
+				continue;
+
+			// linking empty files wouldn't save anything
+			if (file.st.st_size == 0)
+				continue;
+
+			files.push_back(std::move(file));
+		}
+
+		return files;
+	}
+
+	static std::optional<u64> content_digest(const std::string& path)
+	{
+		mapped_file file;
+		if (file.open(path) != file_error::noerr)
+			return {};
+
+		return std::hash<std::string_view>{}(file.contents());
+	}
+
+	static bool same_contents(const std::string_view contents, const std::string& path)
+	{
+		mapped_file file;
+		return file.open(path) == file_error::noerr && file.contents() == contents;
+	}
+
+	// the link is created next to the duplicate and renamed over it,
+	// so the path never disappears even if birb gets interrupted
+	static bool replace_with_link(const std::string& original_path, const fakeroot_file& duplicate)
+	{
+		// skip files that were changed after they were compared
+		struct stat st;
+		if (lstat(duplicate.path.c_str(), &st) != 0 || st.st_ino != duplicate.st.st_ino || st.st_dev != duplicate.st.st_dev || st.st_mtime != duplicate.st.st_mtime)
+			return false;
+
+		const std::string temp_path = duplicate.path + ".birb-dedupe";
+		if (link(original_path.c_str(), temp_path.c_str()) != 0)
+		{
+			warning("Could not link ", duplicate.path, " to ", original_path, ": ", std::strerror(errno));
+			return false;
+		}
+
+		if (rename(temp_path.c_str(), duplicate.path.c_str()) != 0)
+		{
+			warning("Could not replace ", duplicate.path, ": ", std::strerror(errno));
+			unlink(temp_path.c_str());
+			return false;
+		}
+
+		return true;
+	}
+
+	dedupe_stats dedupe_fakeroots(const path_settings& paths, const std::optional<std::string>& pkg_name)
+	{
+		trace_span span("dedupe_fakeroots", pkg_name.value_or(""));
+		assert(!paths.fakeroot.empty());
+
+		std::vector<std::string> roots;
+		for (const std::string& installed_pkg : get_installed_packages(paths))
+			if (std::filesystem::is_directory(paths.fakeroot + "/" + installed_pkg))
+				roots.push_back(paths.fakeroot + "/" + installed_pkg);
+
+		// the backups are full copies of the fakeroots, so almost
+		// every file in them has a duplicate
+		std::error_code ec;
+		for (const std::filesystem::directory_entry& backup : std::filesystem::directory_iterator(paths.fakeroot_backup, ec))
+			if (backup.is_directory(ec))
+				roots.push_back(backup.path().string());
+
+		std::optional<size_t> pkg_root;
+		if (pkg_name.has_value())
+		{
+			const auto root = std::ranges::find(roots, paths.fakeroot + "/" + pkg_name.value());
+			if (root == roots.end())
+				return {};
+
+			pkg_root = std::distance(roots.begin(), root);
+		}
+
+		log("Looking for identical files in ", roots.size(), " fakeroots");
+
+		std::vector<std::vector<fakeroot_file>> scans(roots.size());
+		parallel_for(roots.size(), [&](const size_t i)
+		{
+			scans[i] = scan_fakeroot(roots[i], i);
+		});
+
+		std::vector<fakeroot_file> files;
+		for (std::vector<fakeroot_file>& scan : scans)
+			std::ranges::move(scan, std::back_inserter(files));
+
+		scans.clear();
+
+		dedupe_stats stats;
+		stats.scanned_files = files.size();
+
+		// files that are already hardlinks to each other get handled as one
+		std::vector<size_t> order(files.size());
+		for (size_t i = 0; i < order.size(); ++i)
+			order[i] = i;
+
+		std::ranges::sort(order, [&files](const size_t a, const size_t b)
+		{
+			return std::tie(files[a].st.st_dev, files[a].st.st_ino) < std::tie(files[b].st.st_dev, files[b].st.st_ino);
+		});
+
+		std::vector<inode_files> inodes;
+		for (size_t i = 0; i < order.size(); ++i)
+		{
+			const fakeroot_file& file = files[order[i]];
+			if (i == 0 || file.st.st_ino != files[order[i - 1]].st.st_ino || file.st.st_dev != files[order[i - 1]].st.st_dev)
+				inodes.emplace_back();
+
+			inodes.back().files.push_back(order[i]);
+		}
+
+		const auto first_stat = [&](const size_t inode) -> const struct stat& { return files[inodes[inode].files.front()].st; };
+		const auto in_pkg_root = [&](const size_t inode)
+		{
+			return !pkg_root.has_value() || std::ranges::any_of(inodes[inode].files, [&](const size_t file) { return files[file].root == pkg_root.value(); });
+		};
+
+		// only files with the same size can be identical. Hardlinks share
+		// the owner, the permissions and the modification time too, so those
+		// have to match as well for the files to stay the same as before
+		const auto link_key = [&](const size_t inode)
+		{
+			const struct stat& st = first_stat(inode);
+			return std::tie(st.st_size, st.st_dev, st.st_mode, st.st_uid, st.st_gid, st.st_mtim.tv_sec, st.st_mtim.tv_nsec);
+		};
+
+		std::vector<size_t> candidates(inodes.size());
+		for (size_t i = 0; i < candidates.size(); ++i)
+			candidates[i] = i;
+
+		std::ranges::sort(candidates, [&](const size_t a, const size_t b) { return link_key(a) < link_key(b); });
+
+		// split the [begin, end) ranges of candidates further into ranges of
+		// candidates that could be identical. Ranges with only one file or
+		// without any files from pkg_name don't have anything to link
+		using candidate_ranges = std::vector<std::pair<size_t, size_t>>;
+		const auto split_ranges = [&](const candidate_ranges& ranges, const auto& same)
+		{
+			candidate_ranges split;
+			for (const auto& [begin, end] : ranges)
+			{
+				size_t range_begin = begin;
+				for (size_t i = begin + 1; i <= end; ++i)
+				{
+					if (i < end && same(candidates[range_begin], candidates[i]))
+						continue;
+
+					if (i - range_begin > 1 && std::any_of(candidates.begin() + range_begin, candidates.begin() + i, in_pkg_root))
+						split.emplace_back(range_begin, i);
+
+					range_begin = i;
+				}
+			}
+
+			return split;
+		};
+
+		candidate_ranges ranges = split_ranges({ { 0, candidates.size() } }, [&](const size_t a, const size_t b)
+		{
+			return link_key(a) == link_key(b);
+		});
+
+		// files with a unique size never get read, which skips most of them
+		std::vector<size_t> hashed_inodes;
+		for (const auto& [begin, end] : ranges)
+			hashed_inodes.insert(hashed_inodes.end(), candidates.begin() + begin, candidates.begin() + end);
+
+		parallel_for(hashed_inodes.size(), [&](const size_t i)
+		{
+			inode_files& inode = inodes[hashed_inodes[i]];
+			inode.digest = content_digest(files[inode.files.front()].path);
+		});
+
+		// files that couldn't be read end up in a range of their own
+		for (const auto& [begin, end] : ranges)
+		{
+			std::sort(candidates.begin() + begin, candidates.begin() + end, [&](const size_t a, const size_t b)
+			{
+				return inodes[a].digest < inodes[b].digest;
+			});
+		}
+
+		ranges = split_ranges(ranges, [&](const size_t a, const size_t b)
+		{
+			return inodes[a].digest.has_value() && inodes[a].digest == inodes[b].digest;
+		});
+
+		// the file with the most links already stays, so that the files
+		// that were linked before don't need to be linked again. The
+		// digests could collide, so the contents get compared too
+		std::vector<size_t> originals(ranges.size());
+		std::vector<std::vector<size_t>> duplicates(ranges.size());
+		parallel_for(ranges.size(), [&](const size_t i)
+		{
+			const auto [begin, end] = ranges[i];
+			originals[i] = *std::max_element(candidates.begin() + begin, candidates.begin() + end, [&](const size_t a, const size_t b)
+			{
+				return first_stat(a).st_nlink < first_stat(b).st_nlink;
+			});
+
+			mapped_file original;
+			if (original.open(files[inodes[originals[i]].files.front()].path) != file_error::noerr)
+				return;
+
+			for (size_t j = begin; j < end; ++j)
+				if (candidates[j] != originals[i] && same_contents(original.contents(), files[inodes[candidates[j]].files.front()].path))
+					duplicates[i].push_back(candidates[j]);
+		});
+
+		std::vector<std::string> manifest = read_manifest(paths);
+
+		for (size_t i = 0; i < ranges.size(); ++i)
+		{
+			if (duplicates[i].empty())
+				continue;
+
+			const inode_files& original = inodes[originals[i]];
+			const std::string digest = std::format("{:016x}", original.digest.value());
+			const std::string& original_path = files[original.files.front()].path;
+
+			for (const size_t file : original.files)
+				manifest.push_back(std::format("{};{}", digest, files[file].path));
+
+			for (const size_t inode : duplicates[i])
+			{
+				bool replaced_all = true;
+				for (const size_t file : inodes[inode].files)
+				{
+					if (!replace_with_link(original_path, files[file]))
+					{
+						replaced_all = false;
+						continue;
+					}
+
+					++stats.linked_files;
+					manifest.push_back(std::format("{};{}", digest, files[file].path));
+				}
+
+				// the space is freed only after the last link is gone
+				if (replaced_all)
+					stats.saved_bytes += first_stat(inode).st_size;
+			}
+		}
+
+		// forget the files that were removed or that don't have
+		// any other links anymore
+		std::ranges::sort(manifest, {}, manifest_path);
+		manifest.erase(std::ranges::unique(manifest, {}, manifest_path).begin(), manifest.end());
+		std::erase_if(manifest, [](const std::string& line)
+		{
+			struct stat st;
+			return lstat(std::string(manifest_path(line)).c_str(), &st) != 0 || st.st_nlink < 2;
+		});
+
+		write_file_atomic(paths.dedupe_manifest(), manifest);
+
+		constexpr f64 mib = 1024.0 * 1024.0;
+		info(std::format("Linked {} identical files and saved {:.1f} MiB", stats.linked_files, stats.saved_bytes / mib));
+
+		return stats;
+	}
+
+	// copy the file and rename the copy over the link, which keeps the
+	// other links pointing to the original file
+	static bool copy_over_link(const std::string& path, const struct stat& st)
+	{
+		const std::string temp_path = path + ".birb-unshare";
+
+		std::error_code ec;
+		std::filesystem::copy_file(path, temp_path, std::filesystem::copy_options::overwrite_existing, ec);
+		if (ec)
+		{
+			warning("Could not copy ", path, ": ", ec.message());
+			return false;
+		}
+
+		// chown clears the setuid and setgid bits, so the
+		// permissions have to be set after the owner
+		const std::array<timespec, 2> times = { st.st_atim, st.st_mtim };
+		if (chown(temp_path.c_str(), st.st_uid, st.st_gid) != 0
+				|| chmod(temp_path.c_str(), st.st_mode & 07777) != 0
+				|| utimensat(AT_FDCWD, temp_path.c_str(), times.data(), 0) != 0
+				|| rename(temp_path.c_str(), path.c_str()) != 0)
+		{
+			warning("Could not replace ", path, ": ", std::strerror(errno));
+			unlink(temp_path.c_str());
+			return false;
+		}
+
+		return true;
+	}
+
+	void unshare_fakeroot(const std::string& pkg_name, const path_settings& paths)
+	{
+		assert(!pkg_name.empty());
+
+		std::vector<std::string> manifest = read_manifest(paths);
+		const std::string prefix = std::format("{}/{}/", paths.fakeroot, pkg_name);
+
+		u64 copied_files{0};
+		const size_t size_before = manifest.size();
+		std::erase_if(manifest, [&](const std::string& line)
+		{
+			const std::string path(manifest_path(line));
+			if (!path.starts_with(prefix))
+				return false;
+
+			struct stat st;
+			if (lstat(path.c_str(), &st) != 0 || !S_ISREG(st.st_mode) || st.st_nlink < 2)
+				return true;
+
+			if (!copy_over_link(path, st))
+				error("Could not give [", pkg_name, "] its own copy of ", path, ", cancelling so that the files of other packages don't get overwritten");
+
+			++copied_files;
+			return true;
+		});
+
+		if (manifest.size() == size_before)
+			return;
+
+		if (copied_files > 0)
+			info("Copied ", copied_files, " linked files in the fakeroot of [", pkg_name, "]");
+
+		write_file_atomic(paths.dedupe_manifest(), manifest);
+	}
+
+	void forget_deduped_files(const std::string& pkg_name, const path_settings& paths)
+	{
+		assert(!pkg_name.empty());
+
+		std::vector<std::string> manifest = read_manifest(paths);
+		const std::string prefix = std::format("{}/{}/", paths.fakeroot, pkg_name);
+
+		if (std::erase_if(manifest, [&prefix](const std::string& line) { return manifest_path(line).starts_with(prefix); }) > 0)
+			write_file_atomic(paths.dedupe_manifest(), manifest);
+	}
+}
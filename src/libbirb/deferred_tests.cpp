@@ -0,0 +1,186 @@
+#include "DeferredTests.hpp"
+#include "Logging.hpp"
+
+#include <algorithm>
+#include <cassert>
+#include <csignal>
+#include <cstdlib>
+#include <fcntl.h>
+#include <filesystem>
+#include <fstream>
+#include <iostream>
+#include <iterator>
+#include <unistd.h>
+
+namespace birb
+{
+	// the test suites run with the lowest scheduling priority,
+	// so that they only use the CPU time that the builds leave unused
+	constexpr char test_niceness[] = "19";
+
+	// the instances that need to be cancelled if birb exits
+	static std::vector<deferred_tests*> live_tests;
+
+	static void cancel_live_tests()
+	{
+		for (deferred_tests* tests : live_tests)
+			tests->cancel();
+	}
+
+	deferred_tests::deferred_tests()
+	{
+		// birb exits with error() from all over the place when
+		// an installation fails, so the tests are cancelled in
+		// an exit handler instead of on every failure path
+		static const bool handler_registered = std::atexit(cancel_live_tests) == 0;
+		assert(handler_registered);
+
+		live_tests.push_back(this);
+	}
+
+	deferred_tests::~deferred_tests()
+	{
+		live_tests.erase(std::find(live_tests.begin(), live_tests.end(), this));
+	}
+
+	void deferred_tests::start(const std::string& pkg_name, const std::string& phase, const std::string& build_dir,
+			const std::string& snapshot_dir, const std::string& log_path, process_options options)
+	{
+		assert(!build_dir.empty());
+		assert(!snapshot_dir.empty());
+		assert(build_dir != snapshot_dir);
+
+		// cp can use reflinks on filesystems that support them, which makes
+		// the snapshot close to free even for large build directories
+		std::filesystem::remove_all(snapshot_dir);
+
+		process_options cp_opts;
+		cp_opts.args = { "cp", "-a", "--reflink=auto", build_dir, snapshot_dir };
+		if (!run_process(std::move(cp_opts)).success())
+			error("Could not create a snapshot of ", build_dir, " for running ", phase);
+
+		// the test sees the snapshot at the path of the build directory, so
+		// the paths in Makefiles, libtool wrappers and config.status files
+		// stay valid. The working directory has to be entered after the
+		// mount, since it would point to the build directory otherwise
+		const std::string working_dir = options.working_dir.starts_with(build_dir) ? options.working_dir : build_dir;
+		options.working_dir = "/";
+
+		std::vector<std::string> args = {
+			"unshare", "--mount", "--propagation", "private",
+			"sh", "-c", "mount --bind \"$1\" \"$2\" && cd \"$3\" && shift 3 && exec \"$@\"",
+			"sh", snapshot_dir, build_dir, working_dir,
+			"nice", "-n", test_niceness
+		};
+		std::ranges::move(options.args, std::back_inserter(args));
+		options.args = std::move(args);
+
+		// the whole process tree has to be killed if the installation fails
+		options.own_process_group = true;
+
+		std::filesystem::create_directories(std::filesystem::path(log_path).parent_path());
+		const int log_fd = open(log_path.c_str(), O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+		if (log_fd < 0)
+			error("Could not open the test log at ", log_path);
+
+		options.stdin_mode = stream_mode::null;
+		options.stdout_mode = stream_mode::fd;
+		options.stderr_mode = stream_mode::fd;
+		options.stdout_fd = log_fd;
+		options.stderr_fd = log_fd;
+
+		std::optional<process> proc = process::spawn(std::move(options));
+
+		// the child has its own copy of the log file descriptor
+		close(log_fd);
+
+		if (!proc.has_value())
+			error("Could not start ", phase, " for [", pkg_name, "]");
+
+		tests.push_back({ pkg_name, phase, build_dir, snapshot_dir, log_path, std::move(proc.value()) });
+	}
+
+	bool deferred_tests::empty() const
+	{
+		return tests.empty();
+	}
+
+	size_t deferred_tests::size() const
+	{
+		return tests.size();
+	}
+
+	std::vector<deferred_test_result> deferred_tests::wait()
+	{
+		std::vector<process*> processes;
+		processes.reserve(tests.size());
+
+		for (test& t : tests)
+			processes.push_back(&t.proc);
+
+		const std::vector<process_result> process_results = wait_all(processes);
+		assert(process_results.size() == tests.size());
+
+		std::vector<deferred_test_result> results;
+		results.reserve(tests.size());
+
+		for (size_t i = 0; i < tests.size(); ++i)
+		{
+			std::filesystem::remove_all(tests[i].snapshot_dir);
+			std::filesystem::remove_all(tests[i].build_dir);
+			results.push_back({ tests[i].pkg_name, tests[i].phase, tests[i].log_path, process_results[i] });
+		}
+
+		tests.clear();
+		return results;
+	}
+
+	void deferred_tests::cancel()
+	{
+		if (tests.empty())
+			return;
+
+		log("Cancelling ", tests.size(), " tests that were running in the background");
+
+		for (test& t : tests)
+			t.proc.kill(SIGKILL);
+
+		// wait() reaps the processes and removes the snapshots
+		wait();
+	}
+
+	void print_log_tail(const std::string& log_path, const size_t line_count)
+	{
+		// test logs can get large, so only read the end of the file
+		constexpr std::streamoff max_tail_size = 64 * 1024;
+
+		std::ifstream file(log_path, std::ios::binary | std::ios::ate);
+		if (!file.is_open() || line_count == 0)
+			return;
+
+		const std::streamoff file_size = file.tellg();
+		const std::streamoff tail_size = std::min(file_size, max_tail_size);
+		file.seekg(file_size - tail_size);
+
+		std::string tail(tail_size, '\0');
+		file.read(tail.data(), tail_size);
+
+		if (!tail.empty() && tail.back() == '\n')
+			tail.pop_back();
+
+		// find the start of the last lines
+		size_t start = tail.size();
+		size_t lines = 0;
+		while (start > 0)
+		{
+			if (tail[start - 1] == '\n' && ++lines == line_count)
+				break;
+
+			--start;
+		}
+
+		info("\nLast lines of the output:");
+		std::cout << std::string_view(tail).substr(start) << '\n';
+		info("\nFull log: ", log_path);
+	}
+}
@@ -15,7 +15,7 @@ namespace birb
 	{
 		log("Looking for orphan packages");
 
-		const bool xorg_running = is_process_running("Xorg");
+		const bool xorg_running = can_set_win_title();
 		if (xorg_running)
 			set_win_title("finding orphan packages");
 
@@ -36,8 +36,7 @@ namespace birb
 			return;
 
 		log("Uninstalling orphans");
-		for (const std::string& pkg_name : orphan_packages)
-			uninstall(orphan_packages, paths);
+		uninstall(orphan_packages, paths);
 
 		if (xorg_running)
 			set_win_title("done!");
@@ -2,6 +2,7 @@
 #include "Dependencies.hpp"
 #include "Logging.hpp"
 #include "PackageInfo.hpp"
+#include "Profiling.hpp"
 
 #include "Utils.hpp"
 #include <algorithm>
@@ -14,6 +15,9 @@ namespace birb
 {
 	std::vector<std::string> resolve_dependencies(const std::vector<std::string>& packages, const path_settings& paths)
 	{
+		scoped_timer timer(profile_category::resolve);
+		trace_span span("resolve_dependencies");
+
 		std::vector<std::string> full_package_list;
 		const std::vector<pkg_source> repos = get_pkg_sources(paths);
 
@@ -24,7 +28,7 @@ namespace birb
 			// if the package is a font, add fontconfig as a dependency before the package
 			const std::optional<pkg_source> repo = locate_package(pkg_name, paths);
 			assert(repo.has_value());
-			std::unordered_set<pkg_flag> flags = get_pkg_flags(pkg_name, repo.value());
+			pkg_flag_set flags = get_pkg_flags(pkg_name, repo.value());
 
 			if (flags.contains(pkg_flag::font))
 				full_package_list.emplace_back("fontconfig");
@@ -45,8 +49,11 @@ namespace birb
 		assert(repos.size() > 0);
 
 		/* Check if this package has its dependencies in the cache already */
-		if (dependency_cache.contains(pkg))
-			return dependency_cache[pkg];
+		const pkg_id id = intern_pkg_name(pkg);
+		if (const auto cached = dependency_cache.find(id); cached != dependency_cache.end())
+			return cached->second;
+
+		trace_span span("get_dependencies", pkg);
 
 		std::vector<std::string> deps;
 
@@ -65,7 +72,7 @@ namespace birb
 		if (!is_meta_package(pkg, paths))
 		{
 			/* Read data from the package file */
-			std::string dep_line = birb::read_pkg_variable(pkg, pkg_variable::deps, repo.path);
+			const std::string dep_line = birb::read_pkg_variable(pkg, pkg_variable::deps, repo.path);
 
 			/* Return empty dependency list if the dep_line is empty
 			 * The line could be empty for example when the package doesn't exist or is invalid etc. */
@@ -73,10 +80,9 @@ namespace birb
 				return deps;
 
 			/* Split the string */
-			size_t pos = 0;
-			while ((pos = dep_line.find(" ")) != std::string::npos)
+			for (const std::string_view dep_token : birb::split_view(dep_line, " "))
 			{
-				const std::string dep = dep_line.substr(0, pos);
+				std::string dep(dep_token);
 
 				/* Check if the dependency is a meta package and should be expanded */
 				if (is_meta_package(dep, paths))
@@ -87,15 +93,10 @@ namespace birb
 				}
 				else
 				{
-					deps.push_back(dep);
+					deps.push_back(std::move(dep));
 				}
-
-				dep_line.erase(0, pos + 1);
 			}
 
-			if (!dep_line.empty())
-				deps.push_back(dep_line);
-
 			assert(deps.size() > 0);
 		}
 		else
@@ -112,10 +113,10 @@ namespace birb
 			deps.insert(deps.end(), sub_deps.begin(), sub_deps.end());
 		}
 
-		assert(dependency_cache.contains(pkg) == false && "Overwriting old cache results");
+		assert(dependency_cache.contains(id) == false && "Overwriting old cache results");
 
 		/* Cache the results */
-		dependency_cache[pkg] = deps;
+		dependency_cache[id] = deps;
 
 		/* Deduplicate */
 		//deps = deduplicated_dep_list(deps);
@@ -126,6 +127,7 @@ namespace birb
 
 	std::vector<std::string> get_reverse_dependencies(const std::string& pkg_name, const std::vector<pkg_source>& repos, const path_settings& paths)
 	{
+		trace_span span("get_reverse_dependencies", pkg_name);
 		std::vector<std::string> dependencies;
 
 		/* Get list of installed packages */
@@ -180,10 +182,17 @@ namespace birb
 
 	std::vector<std::string> find_orphan_packages(const std::vector<pkg_source>& repos, const path_settings& paths)
 	{
+		scoped_timer timer(profile_category::resolve);
+		trace_span span("find_orphan_packages");
+
 		std::unordered_set<std::string> result;
 
 		// read in the list of packages installed by the user
-		const std::vector<std::string> nest = birb::read_file(paths.nest());
+		mapped_file nest_file;
+		if (const file_error err = nest_file.open(paths.nest()); err != file_error::noerr)
+			error("Can't read the nest file at ", paths.nest(), ": ", file_error_str.name(err));
+
+		const std::unordered_set<std::string_view> nest(nest_file.lines().begin(), nest_file.lines().end());
 
 		// get the list of all installed applications
 		const std::vector<std::string> installed_packages = birb::get_installed_packages(paths);
@@ -193,13 +202,13 @@ namespace birb
 
 		// we'll reserve the memory instead of constructing a big array
 		// to avoid empty objects
-		orphan_candidates.reserve(installed_packages.size() - nest.size());
+		orphan_candidates.reserve(installed_packages.size() - std::min(nest.size(), installed_packages.size()));
 
 		// find all orphan candidates
 		for (const std::string& pkg_name : installed_packages)
 		{
 			assert(!pkg_name.empty());
-			if (std::find(nest.begin(), nest.end(), pkg_name) == nest.end())
+			if (!nest.contains(pkg_name))
 				orphan_candidates.push_back(pkg_name);
 		}
 
@@ -231,25 +240,27 @@ namespace birb
 					continue;
 
 				/* Skip the package if it doesn't have a fakeroot */
+				count_trace_event(trace_counter::stat);
 				if (!std::filesystem::exists(paths.fakeroot + "/" + orphan_candidates[i]))
 					continue;
 
 				/* Check if the package is "important" and should be skipped */
 				const pkg_source repo = birb::locate_pkg_repo(orphan_candidates[i], repos);
-				const std::unordered_set<pkg_flag> flags = get_pkg_flags(orphan_candidates[i], repo);
+				const pkg_flag_set flags = get_pkg_flags(orphan_candidates[i], repo);
 
 				if (flags.contains(pkg_flag::important))
 					continue;
 
 				/* Check if the package has any reverse dependencies */
-				if (birb::reverse_dependency_cache.contains(orphan_candidates[i]))
+				const pkg_id candidate_id = birb::intern_pkg_name(orphan_candidates[i]);
+				if (const auto cached = birb::reverse_dependency_cache.find(candidate_id); cached != birb::reverse_dependency_cache.end())
 				{
-					reverse_deps = birb::reverse_dependency_cache[orphan_candidates[i]];
+					reverse_deps = cached->second;
 				}
 				else
 				{
 					reverse_deps = birb::get_reverse_dependencies(orphan_candidates[i], repos, paths);
-					birb::reverse_dependency_cache[orphan_candidates[i]] = reverse_deps;
+					birb::reverse_dependency_cache[candidate_id] = reverse_deps;
 				}
 				clean_reverse_deps.clear();
 
@@ -1,26 +1,263 @@
+#include "Database.hpp"
 #include "Distclean.hpp"
+#include "Download.hpp"
 #include "Logging.hpp"
+#include "MappedFile.hpp"
+#include "PackageInfo.hpp"
+#include "ThreadPool.hpp"
+#include "Utils.hpp"
 
+#include <algorithm>
+#include <ctime>
 #include <filesystem>
+#include <format>
+#include <unordered_map>
+#include <unordered_set>
+#include <vector>
 
 namespace birb
 {
-	void distclean(const path_settings& paths)
+	struct distfile_entry
+	{
+		std::string tarball;
+		std::string pkg_name;
+		std::string version;
+		u64 last_used{0};
+	};
+
+	// the index has one line per distfile in the format
+	// tarball;package;version;last_used
+	//
+	// returns nothing if the index exists but can't be read
+	static std::optional<std::vector<distfile_entry>> read_distfile_index(const path_settings& paths)
+	{
+		std::vector<distfile_entry> entries;
+
+		mapped_file file;
+		if (const file_error err = file.open(paths.distfile_index()); err != file_error::noerr)
+		{
+			if (err == file_error::not_found)
+				return entries;
+
+			warning("Can't read the distfile index at ", paths.distfile_index(), ": ", file_error_str.name(err));
+			return {};
+		}
+
+		for (const std::string_view line : file.lines())
+		{
+			const std::optional<std::array<std::string_view, 4>> tokens = split_fields<4>(line, ";");
+			if (!tokens.has_value())
+			{
+				warning("Malformed distfile index entry: ", line);
+				continue;
+			}
+
+			const auto [tarball, pkg_name, version, last_used_str] = tokens.value();
+
+			const std::optional<u64> last_used = parse_u64(last_used_str);
+			if (!last_used.has_value())
+			{
+				warning("Malformed distfile index entry: ", line);
+				continue;
+			}
+
+			entries.push_back({ std::string(tarball), std::string(pkg_name), std::string(version), last_used.value() });
+		}
+
+		return entries;
+	}
+
+	static void write_distfile_index(const std::vector<distfile_entry>& entries, const path_settings& paths)
+	{
+		std::vector<std::string> lines;
+		lines.reserve(entries.size());
+
+		for (const distfile_entry& entry : entries)
+			lines.push_back(std::format("{};{};{};{}", entry.tarball, entry.pkg_name, entry.version, entry.last_used));
+
+		write_file_atomic(paths.distfile_index(), lines);
+	}
+
+	void record_distfile_use(const std::string& tarball, const std::string& pkg_name, const std::string& version, const path_settings& paths)
+	{
+		// other birb processes might be downloading at the same time
+		const file_lock index_lock(paths.distfile_index());
+
+		// rewriting an index that couldn't be read would lose its entries
+		std::optional<std::vector<distfile_entry>> index = read_distfile_index(paths);
+		if (!index.has_value())
+			return;
+
+		std::vector<distfile_entry> entries = std::move(index.value());
+
+		auto entry = std::find_if(entries.begin(), entries.end(),
+				[&tarball](const distfile_entry& entry) { return entry.tarball == tarball; });
+
+		const u64 now = std::time(nullptr);
+
+		if (entry == entries.end())
+			entries.push_back({ tarball, pkg_name, version, now });
+		else
+			*entry = { tarball, pkg_name, version, now };
+
+		write_distfile_index(entries, paths);
+	}
+
+	// find the distfiles of the package versions that are currently installed
+	static std::unordered_set<std::string> installed_distfiles(const std::vector<distfile_entry>& entries, const path_settings& paths)
+	{
+		std::unordered_map<std::string, std::string> installed_versions;
+		for (const std::string& db_line : read_birb_db(paths))
+		{
+			const auto tokens = split_fields<DB_LINE_COLUMN_COUNT>(db_line, ";");
+			if (tokens.has_value())
+				installed_versions[std::string(tokens.value()[0])] = tokens.value()[1];
+		}
+
+		std::unordered_set<std::string> distfiles;
+		std::unordered_set<std::string> tracked_packages;
+
+		for (const distfile_entry& entry : entries)
+		{
+			const auto installed = installed_versions.find(entry.pkg_name);
+			if (installed != installed_versions.end() && installed->second == entry.version)
+			{
+				distfiles.insert(entry.tarball);
+				tracked_packages.insert(entry.pkg_name);
+			}
+		}
+
+		// distfiles downloaded before the index existed can still be found
+		// from the seed.sh files if the repository version is the installed one
+		for (const auto& [pkg_name, version] : installed_versions)
+		{
+			if (tracked_packages.contains(pkg_name))
+				continue;
+
+			const std::optional<pkg_source> repo = locate_package(pkg_name, paths);
+			if (!repo.has_value() || !repo.value().is_valid())
+				continue;
+
+			// a broken seed.sh file shouldn't stop the cleanup, but its
+			// distfile can't be told apart from the others either
+			if (try_read_pkg_variable(pkg_name, pkg_variable::version, repo.value().path) != version)
+				continue;
+
+			const std::optional<std::string> tarball = try_get_source_tarball(pkg_name, paths);
+			if (!tarball.has_value())
+			{
+				warning("Could not figure out the source tarball of [", pkg_name, "], its distfile might get removed");
+				continue;
+			}
+
+			distfiles.insert(tarball.value());
+		}
+
+		return distfiles;
+	}
+
+	void distclean(const path_settings& paths, const distclean_options& options)
 	{
 		log("Clearing distcache at ", paths.distfiles);
 
-		size_t total_file_size{0};
-		for (std::filesystem::path dist_file : std::filesystem::directory_iterator(paths.distfiles))
+		// downloads that finish during the cleanup would
+		// otherwise get dropped from the index
+		const file_lock index_lock(paths.distfile_index());
+
+		// without the index, the distfiles of the installed packages
+		// can't be told apart from the old ones
+		std::optional<std::vector<distfile_entry>> index = read_distfile_index(paths);
+		if (!index.has_value())
+			error("Cancelling the cleanup, since the distfile index couldn't be read");
+
+		std::vector<distfile_entry> entries = std::move(index.value());
+
+		std::unordered_set<std::string> kept_distfiles;
+		if (options.keep_installed)
+			kept_distfiles = installed_distfiles(entries, paths);
+
+		std::unordered_map<std::string, u64> last_used;
+		for (const distfile_entry& entry : entries)
+			last_used[entry.tarball] = entry.last_used;
+
+		struct dist_file
+		{
+			std::filesystem::path path;
+			u64 size;
+			u64 last_used;
+			bool removed{false};
+		};
+
+		std::vector<dist_file> dist_files;
+
+		for (const std::filesystem::directory_entry& entry : std::filesystem::directory_iterator(paths.distfiles))
 		{
 			// skip directories (we don't want to remove the birb source code)
-			if (!std::filesystem::is_regular_file(dist_file))
+			if (!entry.is_regular_file())
 				continue;
 
-			total_file_size += std::filesystem::file_size(dist_file);
-			std::filesystem::remove(dist_file);
+			const std::string tarball = entry.path().filename().string();
+			const auto used = last_used.find(tarball);
+
+			// distfiles that were never recorded are treated as the oldest ones
+			dist_files.push_back({ entry.path(), 0, used == last_used.end() ? 0 : used->second, false });
+		}
+
+		// the file sizes aren't cached by the directory iterator
+		// and the distcache can have thousands of files. Files that get
+		// removed during the scan are skipped
+		parallel_for(dist_files.size(), [&dist_files](const size_t i)
+		{
+			std::error_code ec;
+			const std::uintmax_t size = std::filesystem::file_size(dist_files[i].path, ec);
+			dist_files[i].size = ec ? 0 : size;
+			dist_files[i].removed = static_cast<bool>(ec);
+		});
+
+		std::erase_if(dist_files, [](const dist_file& dist_file) { return dist_file.removed; });
+
+		u64 cache_size{0};
+		for (const dist_file& dist_file : dist_files)
+			cache_size += dist_file.size;
+
+		// remove the least recently used distfiles first
+		std::sort(dist_files.begin(), dist_files.end(),
+				[](const dist_file& a, const dist_file& b) { return a.last_used < b.last_used; });
+
+		std::vector<std::filesystem::path> removed_files;
+		std::unordered_set<std::string> removed_tarballs;
+
+		size_t total_file_size{0};
+		for (const dist_file& dist_file : dist_files)
+		{
+			if (options.max_size.has_value() && cache_size <= options.max_size.value())
+				break;
+
+			if (kept_distfiles.contains(dist_file.path.filename().string()))
+				continue;
+
+			total_file_size += dist_file.size;
+			cache_size -= dist_file.size;
+			removed_files.push_back(dist_file.path);
+			removed_tarballs.insert(dist_file.path.filename().string());
 		}
 
+		parallel_for(removed_files.size(), [&removed_files](const size_t i)
+		{
+			std::error_code ec;
+			std::filesystem::remove(removed_files[i], ec);
+		});
+
+		std::erase_if(entries, [&removed_tarballs](const distfile_entry& entry) { return removed_tarballs.contains(entry.tarball); });
+
+		if (std::filesystem::exists(paths.distfile_index()))
+			write_distfile_index(entries, paths);
+
 		info("Freed up ", total_file_size / (1024 * 1024), "MB of storage");
+
+		if (options.max_size.has_value() && cache_size > options.max_size.value())
+			warning("The distcache is still ", cache_size / (1024 * 1024), "MB in size, since the rest of the distfiles belong to installed packages");
+
 		log("Distcache cleared ヽ(*・ω・)ﾉ");
 	}
 }
@@ -1,12 +1,14 @@
 #include "CLI.hpp"
+#include "Distclean.hpp"
 #include "Download.hpp"
 #include "Logging.hpp"
 #include "PackageInfo.hpp"
+#include "Process.hpp"
+#include "Profiling.hpp"
 #include "Utils.hpp"
 
 #include <cassert>
 #include <format>
-#include <fstream>
 
 namespace birb
 {
@@ -30,9 +32,9 @@ namespace birb
 		if (!confirmation_menu("Continue?", true))
 			return;
 
-		// check if Xorg is running to avoid unnecessarily setting
-		// the window title
-		const bool xorg_running = is_process_running("Xorg");
+		// avoid setting the window title when there's no
+		// graphical session
+		const bool xorg_running = can_set_win_title();
 
 		log("Dowloading sources");
 		for (const std::string& pkg_name : packages)
@@ -42,6 +44,8 @@ namespace birb
 	void download_package(const std::string& pkg_name, const path_settings& paths, const bool xorg_running)
 	{
 		assert(!pkg_name.empty());
+		scoped_timer timer(profile_category::fetch);
+		trace_span span("download_package", pkg_name);
 
 		if (xorg_running)
 			set_win_title(std::format("installing {} (download)", pkg_name));
@@ -77,7 +81,6 @@ then
 	if [ "$CACHE_CHECKSUM" == "$CHECKSUM" ]
 	then
 		echo "ok"
-		echo -n "ok" > /tmp/birb_integrity_check
 		exit 0
 	fi
 fi
@@ -91,28 +94,52 @@ CACHE_CHECKSUM="$(md5sum $DISTFILES/$TARBALL | cut -d ' ' -f1)"
 if [ "$CACHE_CHECKSUM" == "$CHECKSUM" ]
 then
 	echo "ok"
-	echo -n "ok" > /tmp/birb_integrity_check
 	exit 0
 fi
 
 echo "fail"
-echo -n "fail" > /tmp/birb_integrity_check
+exit 1
 )~~", seed_file_path, paths.distfiles);
 
-		exec_shell_cmd(download_script);
-
-		// check the integrity file to see if the download went okay
-		std::ifstream integrity_file("/tmp/birb_integrity_check");
+		// the script exits with a non-zero value if the download or
+		// the integrity check failed
+		if (exec_shell_cmd(download_script) != 0)
+			error("File integrity check failed. Not continuing with the installation");
 
-		if (!integrity_file.is_open())
-			error("Could not open the file integrity file");
+		// keep track of when the distfile was last needed, so that
+		// distclean can remove the least recently used ones first
+		const std::optional<pkg_source> repo = locate_package(pkg_name, paths);
+		if (repo.has_value() && repo.value().is_valid())
+			record_distfile_use(get_source_tarball(pkg_name, paths), pkg_name, read_pkg_variable(pkg_name, pkg_variable::version, repo.value().path), paths);
+	}
 
-		std::string integrity_check_result;
-		integrity_file >> integrity_check_result;
-		assert(!integrity_check_result.empty());
+	std::string get_source_tarball(const std::string& pkg_name, const path_settings& paths)
+	{
+		const std::optional<std::string> tarball = try_get_source_tarball(pkg_name, paths);
+		if (!tarball.has_value())
+			error("Could not figure out the source tarball of [", pkg_name, "]");
 
-		if (integrity_check_result != "ok")
-			error("File integrity check failed. Not continuing with the installation");
+		return tarball.value();
 	}
 
+	std::optional<std::string> try_get_source_tarball(const std::string& pkg_name, const path_settings& paths)
+	{
+		assert(!pkg_name.empty());
+
+		const std::string seed_file_path = std::format("{}/{}/seed.sh", paths.repo_dir, pkg_name);
+
+		process_options opts;
+		opts.args = { "bash", "-c", std::format("source {} ; basename \"$SOURCE\"", seed_file_path) };
+		opts.stdout_mode = stream_mode::pipe;
+
+		const process_result result = run_process(std::move(opts));
+		if (!result.success())
+			return {};
+
+		std::string tarball = result.out;
+		while (!tarball.empty() && (tarball.back() == '\n' || tarball.back() == ' '))
+			tarball.pop_back();
+
+		return tarball;
+	}
 }
@@ -0,0 +1,410 @@
+#ifdef BIRB_TEST
+#include <doctest/doctest.h>
+#endif /* BIRB_TEST */
+
+#include "Database.hpp"
+#include "Dependencies.hpp"
+#include "ElfScan.hpp"
+#include "FlatHashMap.hpp"
+#include "Logging.hpp"
+#include "PackageInfo.hpp"
+#include "Profiling.hpp"
+#include "ThreadPool.hpp"
+
+#include <algorithm>
+#include <array>
+#include <atomic>
+#include <bit>
+#include <cassert>
+#include <cstring>
+#include <elf.h>
+#include <fcntl.h>
+#include <filesystem>
+#include <format>
+#include <string_view>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <tuple>
+#include <unistd.h>
+#include <unordered_set>
+
+namespace birb
+{
+	// directories in the fakeroots that never have any ELF files in
+	// them, but can have lots of other files
+	constexpr std::array<std::string_view, 5> skipped_dirs = {
+		"usr/include", "usr/share/doc", "usr/share/icons", "usr/share/locale", "usr/share/man"
+	};
+
+	// directories that the dynamic linker finds libraries from for libraries
+	// that aren't in any fakeroot, like the ones from the base system
+	constexpr std::array<std::string_view, 5> library_dirs64 = { "lib", "lib64", "usr/lib", "usr/lib64", "usr/local/lib" };
+	constexpr std::array<std::string_view, 2> library_dirs32 = { "lib32", "usr/lib32" };
+
+	template<typename T>
+	static std::optional<T> read_struct(const std::string_view contents, const u64 offset)
+	{
+		if (offset > contents.size() || contents.size() - offset < sizeof(T))
+			return {};
+
+		// the file contents don't need to be aligned for T
+		T value;
+		std::memcpy(&value, contents.data() + offset, sizeof(T));
+		return value;
+	}
+
+	template<typename Ehdr, typename Phdr, typename Dyn>
+	static std::optional<elf_info> parse_elf_dynamic(const std::string_view contents)
+	{
+		const std::optional<Ehdr> header = read_struct<Ehdr>(contents, 0);
+		if (!header.has_value() || (header->e_type != ET_EXEC && header->e_type != ET_DYN) || header->e_phentsize < sizeof(Phdr))
+			return {};
+
+		std::optional<Phdr> dynamic;
+		std::vector<Phdr> loads;
+
+		for (u64 i = 0; i < header->e_phnum; ++i)
+		{
+			const std::optional<Phdr> phdr = read_struct<Phdr>(contents, header->e_phoff + i * header->e_phentsize);
+			if (!phdr.has_value())
+				return {};
+
+			if (phdr->p_type == PT_DYNAMIC)
+				dynamic = phdr;
+			else if (phdr->p_type == PT_LOAD)
+				loads.push_back(phdr.value());
+		}
+
+		// static executables don't have a dynamic section
+		if (!dynamic.has_value())
+			return {};
+
+		std::vector<u64> needed_offsets;
+		std::optional<u64> soname_offset;
+		u64 strtab_addr{0};
+		u64 strtab_size{0};
+
+		for (u64 offset = dynamic->p_offset; offset + sizeof(Dyn) <= dynamic->p_offset + dynamic->p_filesz; offset += sizeof(Dyn))
+		{
+			const std::optional<Dyn> entry = read_struct<Dyn>(contents, offset);
+			if (!entry.has_value() || entry->d_tag == DT_NULL)
+				break;
+
+			switch (entry->d_tag)
+			{
+				case DT_NEEDED:	needed_offsets.push_back(entry->d_un.d_val); break;
+				case DT_SONAME:	soname_offset = entry->d_un.d_val; break;
+				case DT_STRTAB:	strtab_addr = entry->d_un.d_ptr; break;
+				case DT_STRSZ:	strtab_size = entry->d_un.d_val; break;
+			}
+		}
+
+		// the string table is given as a virtual address, which has to
+		// be converted into a file offset with the loaded segments
+		std::optional<u64> strtab_offset;
+		for (const Phdr& load : loads)
+			if (strtab_addr >= load.p_vaddr && strtab_addr < load.p_vaddr + load.p_filesz)
+				strtab_offset = strtab_addr - load.p_vaddr + load.p_offset;
+
+		if (!strtab_offset.has_value() || strtab_offset.value() > contents.size())
+			return {};
+
+		const std::string_view strtab = contents.substr(strtab_offset.value(), strtab_size);
+		const auto read_string = [&strtab](const u64 offset) -> std::string
+		{
+			if (offset >= strtab.size())
+				return "";
+
+			const std::string_view rest = strtab.substr(offset);
+			return std::string(rest.substr(0, rest.find('\0')));
+		};
+
+		elf_info info;
+		info.is_64bit = sizeof(Ehdr) == sizeof(Elf64_Ehdr);
+
+		if (soname_offset.has_value())
+			info.soname = read_string(soname_offset.value());
+
+		for (const u64 offset : needed_offsets)
+			if (std::string name = read_string(offset); !name.empty())
+				info.needed.push_back(std::move(name));
+
+		return info;
+	}
+
+	std::optional<elf_info> parse_elf_dynamic(const std::string_view contents)
+	{
+		if (contents.size() < EI_NIDENT || std::memcmp(contents.data(), ELFMAG, SELFMAG) != 0)
+			return {};
+
+		constexpr u8 native_data = std::endian::native == std::endian::little ? ELFDATA2LSB : ELFDATA2MSB;
+		if (static_cast<u8>(contents[EI_DATA]) != native_data)
+			return {};
+
+		switch (contents[EI_CLASS])
+		{
+			case ELFCLASS64: return parse_elf_dynamic<Elf64_Ehdr, Elf64_Phdr, Elf64_Dyn>(contents);
+			case ELFCLASS32: return parse_elf_dynamic<Elf32_Ehdr, Elf32_Phdr, Elf32_Dyn>(contents);
+			default: return {};
+		}
+	}
+
+#ifdef BIRB_TEST
+	TEST_CASE("parse_elf_dynamic()")
+	{
+		// a shared library with a dynamic section and a string table
+		// that are both inside of a single loaded segment
+		constexpr std::string_view strtab("\0libfoo.so.1\0libc.so.6\0libbar.so.2\0", 35);
+		constexpr u64 phdr_offset = sizeof(Elf64_Ehdr);
+		constexpr u64 dynamic_offset = phdr_offset + 2 * sizeof(Elf64_Phdr);
+		constexpr u64 strtab_offset = dynamic_offset + 5 * sizeof(Elf64_Dyn);
+		constexpr u64 base_addr = 0x400000;
+
+		std::string elf(strtab_offset + strtab.size(), '\0');
+
+		Elf64_Ehdr header{};
+		std::memcpy(header.e_ident, ELFMAG, SELFMAG);
+		header.e_ident[EI_CLASS] = ELFCLASS64;
+		header.e_ident[EI_DATA] = ELFDATA2LSB;
+		header.e_type = ET_DYN;
+		header.e_phoff = phdr_offset;
+		header.e_phentsize = sizeof(Elf64_Phdr);
+		header.e_phnum = 2;
+		std::memcpy(elf.data(), &header, sizeof(header));
+
+		Elf64_Phdr load{};
+		load.p_type = PT_LOAD;
+		load.p_offset = 0;
+		load.p_vaddr = base_addr;
+		load.p_filesz = elf.size();
+
+		Elf64_Phdr dynamic_header{};
+		dynamic_header.p_type = PT_DYNAMIC;
+		dynamic_header.p_offset = dynamic_offset;
+		dynamic_header.p_vaddr = base_addr + dynamic_offset;
+		dynamic_header.p_filesz = 5 * sizeof(Elf64_Dyn);
+
+		const std::array<Elf64_Phdr, 2> phdrs = { load, dynamic_header };
+		std::memcpy(elf.data() + phdr_offset, phdrs.data(), sizeof(phdrs));
+
+		const std::array<Elf64_Dyn, 5> dynamic = {{
+			{ DT_NEEDED, { 13 } },
+			{ DT_SONAME, { 1 } },
+			{ DT_STRTAB, { base_addr + strtab_offset } },
+			{ DT_STRSZ, { strtab.size() } },
+			{ DT_NULL, { 0 } }
+		}};
+		std::memcpy(elf.data() + dynamic_offset, dynamic.data(), sizeof(dynamic));
+		std::memcpy(elf.data() + strtab_offset, strtab.data(), strtab.size());
+
+		const std::optional<elf_info> info = parse_elf_dynamic(elf);
+		REQUIRE(info.has_value());
+		CHECK(info->is_64bit);
+		CHECK(info->soname == "libfoo.so.1");
+		REQUIRE(info->needed.size() == 1);
+		CHECK(info->needed[0] == "libc.so.6");
+
+		CHECK_FALSE(parse_elf_dynamic("#!/bin/sh\n").has_value());
+		CHECK_FALSE(parse_elf_dynamic(std::string_view(elf).substr(0, 32)).has_value());
+	}
+#endif
+
+	// check the magic bytes before mapping the file, since most of
+	// the files in a fakeroot aren't ELF files
+	static std::optional<elf_info> read_elf_file(const std::string& path)
+	{
+		const int fd = open(path.c_str(), O_RDONLY | O_CLOEXEC);
+		if (fd < 0)
+			return {};
+
+		std::array<char, SELFMAG> magic;
+		struct stat st;
+		if (pread(fd, magic.data(), magic.size(), 0) != SELFMAG || std::memcmp(magic.data(), ELFMAG, SELFMAG) != 0 || fstat(fd, &st) != 0)
+		{
+			close(fd);
+			return {};
+		}
+
+		// only the headers and the dynamic section get paged in
+		void* const mapping = mmap(nullptr, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+		close(fd);
+
+		if (mapping == MAP_FAILED)
+			return {};
+
+		std::optional<elf_info> info = parse_elf_dynamic(std::string_view(static_cast<const char*>(mapping), st.st_size));
+		munmap(mapping, st.st_size);
+
+		return info;
+	}
+
+	namespace
+	{
+		struct needed_library
+		{
+			std::string soname;
+			std::string file;
+			bool is_64bit;
+		};
+
+		// the libraries that a package provides and needs
+		struct package_scan
+		{
+			std::array<std::vector<std::string>, 2> provided;
+			std::vector<needed_library> needed;
+		};
+	}
+
+	static package_scan scan_fakeroot(const std::string& fakeroot_path, std::atomic<u64>& elf_file_count)
+	{
+		package_scan scan;
+
+		std::error_code ec;
+		std::filesystem::recursive_directory_iterator it(fakeroot_path, ec);
+		for (; !ec && it != std::filesystem::recursive_directory_iterator(); it.increment(ec))
+		{
+			const std::filesystem::directory_entry& entry = *it;
+			const std::string relative_path = entry.path().string().substr(fakeroot_path.size() + 1);
+
+			// the symlinks to libraries are named after the sonames
+			// of the libraries, so the libraries are enough
+			std::error_code type_ec;
+			if (entry.is_symlink(type_ec))
+				continue;
+
+			if (entry.is_directory(type_ec))
+			{
+				if (std::ranges::find(skipped_dirs, relative_path) != skipped_dirs.end())
+					it.disable_recursion_pending();
+
+				continue;
+			}
+
+			if (!entry.is_regular_file(type_ec))
+				continue;
+
+			const std::optional<elf_info> info = read_elf_file(entry.path().string());
+			if (!info.has_value())
+				continue;
+
+			++elf_file_count;
+
+			std::vector<std::string>& provided = scan.provided[info->is_64bit];
+			provided.push_back(entry.path().filename().string());
+			if (!info->soname.empty())
+				provided.push_back(info->soname);
+
+			for (const std::string& soname : info->needed)
+			{
+				const bool seen = std::ranges::any_of(scan.needed, [&](const needed_library& lib)
+				{
+					return lib.soname == soname && lib.is_64bit == info->is_64bit;
+				});
+
+				if (!seen)
+					scan.needed.push_back({ soname, relative_path, info->is_64bit });
+			}
+		}
+
+		return scan;
+	}
+
+	std::vector<library_problem> find_library_problems(const path_settings& paths)
+	{
+		trace_span span("find_library_problems");
+
+		const std::vector<std::string> installed_packages = get_installed_packages(paths);
+
+		log("Scanning the fakeroots of ", installed_packages.size(), " packages");
+
+		std::atomic<u64> elf_file_count{0};
+		std::vector<package_scan> scans(installed_packages.size());
+		parallel_for(installed_packages.size(), [&](const size_t i)
+		{
+			scans[i] = scan_fakeroot(paths.fakeroot + "/" + installed_packages[i], elf_file_count);
+		});
+
+		info("Found ", elf_file_count.load(), " ELF files");
+
+		// indices of the packages that provide each library, separately
+		// for 32-bit and 64-bit libraries
+		std::array<flat_hash_map<std::string, std::vector<size_t>, string_hash>, 2> providers;
+		for (size_t i = 0; i < scans.size(); ++i)
+		{
+			for (const bool is_64bit : { false, true })
+			{
+				for (const std::string& soname : scans[i].provided[is_64bit])
+				{
+					std::vector<size_t>& pkgs = providers[is_64bit][soname];
+					if (pkgs.empty() || pkgs.back() != i)
+						pkgs.push_back(i);
+				}
+			}
+		}
+
+		// libraries that aren't in any fakeroot are looked up only
+		// once, since most of them are needed by lots of packages
+		std::array<flat_hash_map<std::string, bool, string_hash>, 2> system_libraries;
+		const auto on_system = [&](const std::string& soname, const bool is_64bit)
+		{
+			const auto [it, inserted] = system_libraries[is_64bit].try_emplace(soname, false);
+			if (!inserted)
+				return it->second;
+
+			const auto exists = [&](const std::string_view dir)
+			{
+				return std::filesystem::exists(std::format("{}/{}/{}", paths.lfs_path, dir, soname));
+			};
+
+			it->second = is_64bit ? std::ranges::any_of(library_dirs64, exists) : std::ranges::any_of(library_dirs32, exists);
+			return it->second;
+		};
+
+		const std::vector<pkg_source> repos = get_pkg_sources(paths);
+		std::vector<library_problem> problems;
+
+		for (size_t i = 0; i < scans.size(); ++i)
+		{
+			const std::string& pkg_name = installed_packages[i];
+
+			// packages that were removed from the repositories don't
+			// have any DEPS to compare against
+			const bool in_repos = locate_pkg_repo(pkg_name, repos).is_valid();
+
+			std::unordered_set<std::string> deps;
+			if (in_repos)
+			{
+				const std::vector<std::string> dep_list = get_dependencies(pkg_name, repos, 512, paths);
+				deps.insert(dep_list.begin(), dep_list.end());
+			}
+
+			for (const needed_library& lib : scans[i].needed)
+			{
+				const auto provider = providers[lib.is_64bit].find(lib.soname);
+				if (provider == providers[lib.is_64bit].end())
+				{
+					if (!on_system(lib.soname, lib.is_64bit))
+						problems.push_back({ library_problem_type::missing_library, pkg_name, lib.soname, lib.file, "" });
+
+					continue;
+				}
+
+				const std::vector<size_t>& pkgs = provider->second;
+				const bool satisfied = std::ranges::any_of(pkgs, [&](const size_t provider_index)
+				{
+					return provider_index == i || deps.contains(installed_packages[provider_index]);
+				});
+
+				if (!satisfied && in_repos)
+					problems.push_back({ library_problem_type::missing_dep, pkg_name, lib.soname, lib.file, installed_packages[pkgs.front()] });
+			}
+		}
+
+		std::ranges::sort(problems, [](const library_problem& a, const library_problem& b)
+		{
+			return std::tie(a.pkg_name, a.soname) < std::tie(b.pkg_name, b.soname);
+		});
+
+		return problems;
+	}
+}
@@ -0,0 +1,693 @@
+#include "Database.hpp"
+#include "Dependencies.hpp"
+#include "ImageExport.hpp"
+#include "Logging.hpp"
+#include "MappedFile.hpp"
+#include "PackageInfo.hpp"
+#include "Profiling.hpp"
+#include "ThreadPool.hpp"
+#include "Utils.hpp"
+
+#include <algorithm>
+#include <array>
+#include <cassert>
+#include <cerrno>
+#include <cstring>
+#include <fcntl.h>
+#include <filesystem>
+#include <format>
+#include <map>
+#include <string_view>
+#include <sys/sendfile.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include <unordered_map>
+#include <unordered_set>
+
+namespace birb
+{
+	namespace
+	{
+		struct image_entry
+		{
+			// the path in the image without the leading slash
+			std::string path;
+
+			// the path of the file in the fakeroot
+			std::string source;
+
+			struct stat st;
+			std::string link_target;
+
+			// index of the package that the file came from
+			size_t pkg;
+
+			// an earlier path in the image that is a hardlink to the same
+			// file, which happens with files that were linked by --dedupe
+			std::string hardlink;
+
+			// false if the file is the same as in the previous image
+			bool changed{true};
+		};
+	}
+
+	static char entry_type(const image_entry& entry)
+	{
+		if (S_ISDIR(entry.st.st_mode))
+			return 'd';
+
+		if (S_ISLNK(entry.st.st_mode))
+			return 'l';
+
+		return 'f';
+	}
+
+	// the manifest has one line per file in the format
+	// type;mode;uid;gid;size;mtime;path
+	static std::string manifest_line(const image_entry& entry)
+	{
+		return std::format("{};{:o};{};{};{};{};{}", entry_type(entry), entry.st.st_mode & 07777, entry.st.st_uid, entry.st.st_gid,
+				S_ISDIR(entry.st.st_mode) ? 0 : entry.st.st_size, entry.st.st_mtime, entry.path);
+	}
+
+	static std::unordered_map<std::string, std::string> read_image_manifest(const std::string& manifest_path)
+	{
+		mapped_file file;
+		const file_error err = file.open(manifest_path);
+
+		if (err == file_error::not_found)
+			error("Image manifest ", manifest_path, " doesn't exist");
+
+		if (err != file_error::noerr)
+			error("Can't read the image manifest ", manifest_path, ": ", file_error_str.name(err));
+
+		std::unordered_map<std::string, std::string> manifest;
+		for (const std::string_view line : file.lines())
+		{
+			// the path is the last field, so it can have semicolons in it
+			if (std::ranges::count(line, ';') < 6)
+			{
+				warning("Malformed image manifest entry: ", line);
+				continue;
+			}
+
+			size_t path_start = 0;
+			for (int i = 0; i < 6; ++i)
+				path_start = line.find(';', path_start) + 1;
+
+			manifest.emplace(line.substr(path_start), line);
+		}
+
+		return manifest;
+	}
+
+	static std::vector<image_entry> scan_fakeroot(const std::string& fakeroot_path, const size_t pkg)
+	{
+		std::vector<image_entry> entries;
+
+		std::error_code ec;
+		std::filesystem::recursive_directory_iterator it(fakeroot_path, ec);
+		for (; !ec && it != std::filesystem::recursive_directory_iterator(); it.increment(ec))
+		{
+			image_entry entry;
+			entry.source = it->path().string();
+			entry.path = entry.source.substr(fakeroot_path.size() + 1);
+			entry.pkg = pkg;
+
+			count_trace_event(trace_counter::stat);
+			if (lstat(entry.source.c_str(), &entry.st) != 0)
+				error("Can't read ", entry.source, ": ", std::strerror(errno));
+
+			if (S_ISLNK(entry.st.st_mode))
+			{
+				std::error_code link_ec;
+				entry.link_target = std::filesystem::read_symlink(entry.source, link_ec).string();
+				if (link_ec)
+					error("Can't read the symlink ", entry.source, ": ", link_ec.message());
+			}
+			else if (!S_ISDIR(entry.st.st_mode) && !S_ISREG(entry.st.st_mode))
+			{
+				warning("Skipping ", entry.source, ", since it isn't a regular file, a directory or a symlink");
+				continue;
+			}
+
+			entries.push_back(std::move(entry));
+		}
+
+		if (ec)
+			warning("Can't read the fakeroot ", fakeroot_path, ": ", ec.message());
+
+		return entries;
+	}
+
+	namespace
+	{
+		// writes a POSIX tar stream. The headers get collected into a
+		// buffer and the file contents are copied into the output with
+		// sendfile(), so they never get copied through birb itself
+		class tar_writer
+		{
+		public:
+			explicit tar_writer(const int fd)
+			:fd(fd)
+			{}
+
+			void add(const image_entry& entry)
+			{
+				const char type = !entry.hardlink.empty() ? '1'
+					: S_ISDIR(entry.st.st_mode) ? '5'
+					: S_ISLNK(entry.st.st_mode) ? '2'
+					: '0';
+
+				const u64 size = type == '0' ? entry.st.st_size : 0;
+				const std::string name = S_ISDIR(entry.st.st_mode) ? entry.path + "/" : entry.path;
+				const std::string& link_name = type == '1' ? entry.hardlink : entry.link_target;
+
+				// values that don't fit into the ustar header
+				// go into a pax extended header before it
+				std::string pax_records;
+				if (name.size() > 100)
+					pax_records += pax_record("path", name);
+
+				if (link_name.size() > 100)
+					pax_records += pax_record("linkpath", link_name);
+
+				if (size > max_octal(12))
+					pax_records += pax_record("size", std::to_string(size));
+
+				if (entry.st.st_uid > max_octal(8))
+					pax_records += pax_record("uid", std::to_string(entry.st.st_uid));
+
+				if (entry.st.st_gid > max_octal(8))
+					pax_records += pax_record("gid", std::to_string(entry.st.st_gid));
+
+				if (!pax_records.empty())
+				{
+					write_header("././@PaxHeader", 'x', 0644, 0, 0, pax_records.size(), entry.st.st_mtime, "");
+					buffer += pax_records;
+					pad(pax_records.size());
+				}
+
+				write_header(name, type, entry.st.st_mode & 07777, entry.st.st_uid, entry.st.st_gid, size, entry.st.st_mtime, link_name);
+
+				if (size > 0)
+				{
+					flush();
+					send_contents(entry, size);
+					pad(size);
+				}
+
+				if (buffer.size() >= 65536)
+					flush();
+			}
+
+			// the end of the archive is marked with two empty blocks
+			void finish()
+			{
+				buffer.append(block_size * 2, '\0');
+				flush();
+			}
+
+		private:
+			static constexpr size_t block_size = 512;
+
+			static constexpr u64 max_octal(const size_t field_width)
+			{
+				return (1ull << (3 * (field_width - 1))) - 1;
+			}
+
+			static void set_field(std::array<char, block_size>& header, const size_t offset, const size_t width, const std::string_view value)
+			{
+				std::memcpy(header.data() + offset, value.data(), std::min(width, value.size()));
+			}
+
+			static void set_octal(std::array<char, block_size>& header, const size_t offset, const size_t width, const u64 value)
+			{
+				const u64 clamped = std::min(value, max_octal(width));
+				set_field(header, offset, width - 1, std::format("{:0{}o}", clamped, width - 1));
+			}
+
+			// the length at the start of a record includes itself
+			static std::string pax_record(const std::string_view key, const std::string_view value)
+			{
+				const size_t base_length = key.size() + value.size() + 3;
+				size_t length = base_length + std::to_string(base_length).size();
+				length = base_length + std::to_string(length).size();
+				return std::format("{} {}={}\n", length, key, value);
+			}
+
+			void write_header(const std::string_view name, const char type, const u32 mode, const u64 uid, const u64 gid,
+					const u64 size, const i64 mtime, const std::string_view link_name)
+			{
+				std::array<char, block_size> header{};
+				set_field(header, 0, 100, name);
+				set_octal(header, 100, 8, mode);
+				set_octal(header, 108, 8, uid);
+				set_octal(header, 116, 8, gid);
+				set_octal(header, 124, 12, size);
+				set_octal(header, 136, 12, std::max<i64>(mtime, 0));
+				header[156] = type;
+				set_field(header, 157, 100, link_name);
+				set_field(header, 257, 6, std::string_view("ustar\0", 6));
+				set_field(header, 263, 2, "00");
+
+				// the checksum is calculated with the checksum field filled with spaces
+				std::memset(header.data() + 148, ' ', 8);
+				u32 checksum = 0;
+				for (const char c : header)
+					checksum += static_cast<u8>(c);
+
+				set_field(header, 148, 7, std::format("{:06o}", checksum));
+
+				buffer.append(header.data(), header.size());
+			}
+
+			void pad(const u64 size)
+			{
+				if (size % block_size != 0)
+					buffer.append(block_size - size % block_size, '\0');
+			}
+
+			void flush()
+			{
+				if (!write_all(fd, buffer))
+					error("Could not write the image: ", std::strerror(errno));
+
+				buffer.clear();
+			}
+
+			void send_contents(const image_entry& entry, u64 size)
+			{
+				const int file_fd = open(entry.source.c_str(), O_RDONLY | O_CLOEXEC);
+				if (file_fd < 0)
+					error("Can't open ", entry.source, ": ", std::strerror(errno));
+
+				// the size in the header is already written, so a file
+				// that shrinks while it's being read breaks the archive
+				while (size > 0)
+				{
+					const ssize_t ret = sendfile(fd, file_fd, nullptr, size);
+					if (ret < 0 && errno == EINTR)
+						continue;
+
+					if (ret < 0)
+						error("Could not write ", entry.source, " into the image: ", std::strerror(errno));
+
+					if (ret == 0)
+						error(entry.source, " changed while it was being exported");
+
+					size -= ret;
+				}
+
+				close(file_fd);
+			}
+
+			const int fd;
+			std::string buffer;
+		};
+	}
+
+	// copy_file_range() can copy the data without reading it at all on
+	// file systems that support reflinks, and sendfile() is used if the
+	// image is on a file system that copy_file_range() can't write to
+	static bool copy_contents(const int in_fd, const int out_fd, u64 size)
+	{
+		bool use_sendfile = false;
+		while (size > 0)
+		{
+			const ssize_t ret = use_sendfile ? sendfile(out_fd, in_fd, nullptr, size) : copy_file_range(in_fd, nullptr, out_fd, nullptr, size, 0);
+			if (ret < 0 && errno == EINTR)
+				continue;
+
+			if (ret < 0 && !use_sendfile && (errno == EXDEV || errno == EINVAL || errno == ENOSYS || errno == EOPNOTSUPP))
+			{
+				use_sendfile = true;
+				continue;
+			}
+
+			if (ret <= 0)
+				return false;
+
+			size -= ret;
+		}
+
+		return true;
+	}
+
+	static bool copy_file(const image_entry& entry, const std::string& destination)
+	{
+		// the old file could be a hardlink to another file in the image
+		if (unlink(destination.c_str()) != 0 && errno != ENOENT)
+			return false;
+
+		const int in_fd = open(entry.source.c_str(), O_RDONLY | O_CLOEXEC);
+		if (in_fd < 0)
+			return false;
+
+		const int out_fd = open(destination.c_str(), O_WRONLY | O_CREAT | O_EXCL | O_CLOEXEC, 0600);
+		if (out_fd < 0)
+		{
+			close(in_fd);
+			return false;
+		}
+
+		// chown clears the setuid and setgid bits, so the
+		// permissions have to be set after the owner
+		const std::array<timespec, 2> times = { entry.st.st_atim, entry.st.st_mtim };
+		const bool success = copy_contents(in_fd, out_fd, entry.st.st_size)
+			&& fchown(out_fd, entry.st.st_uid, entry.st.st_gid) == 0
+			&& fchmod(out_fd, entry.st.st_mode & 07777) == 0
+			&& futimens(out_fd, times.data()) == 0;
+
+		close(in_fd);
+		close(out_fd);
+
+		return success;
+	}
+
+	static void write_directory_image(const std::vector<image_entry>& entries, const std::vector<std::string>& removed_paths, const std::string& image_path)
+	{
+		std::error_code ec;
+		std::filesystem::create_directories(image_path, ec);
+		if (ec)
+			error("Can't create the image directory ", image_path, ": ", ec.message());
+
+		// remove the files that aren't in the image anymore, the files
+		// in the directories before the directories themselves
+		for (auto path = removed_paths.rbegin(); path != removed_paths.rend(); ++path)
+		{
+			std::filesystem::remove(image_path + "/" + *path, ec);
+			if (ec)
+				warning("Can't remove ", image_path, "/", *path, ": ", ec.message());
+		}
+
+		// the directories and symlinks are created first, so that the
+		// files can be copied in parallel
+		std::vector<const image_entry*> files;
+		std::vector<const image_entry*> hardlinks;
+		for (const image_entry& entry : entries)
+		{
+			if (!entry.changed)
+				continue;
+
+			const std::string destination = image_path + "/" + entry.path;
+
+			if (S_ISDIR(entry.st.st_mode))
+			{
+				if (mkdir(destination.c_str(), 0700) != 0 && errno != EEXIST)
+					error("Can't create the directory ", destination, ": ", std::strerror(errno));
+			}
+			else if (S_ISLNK(entry.st.st_mode))
+			{
+				const std::array<timespec, 2> times = { entry.st.st_atim, entry.st.st_mtim };
+				std::filesystem::remove(destination, ec);
+				if (symlink(entry.link_target.c_str(), destination.c_str()) != 0
+						|| lchown(destination.c_str(), entry.st.st_uid, entry.st.st_gid) != 0
+						|| utimensat(AT_FDCWD, destination.c_str(), times.data(), AT_SYMLINK_NOFOLLOW) != 0)
+					error("Can't create the symlink ", destination, ": ", std::strerror(errno));
+			}
+			else if (!entry.hardlink.empty())
+			{
+				hardlinks.push_back(&entry);
+			}
+			else
+			{
+				files.push_back(&entry);
+			}
+		}
+
+		// std::vector<bool> can't be written to from multiple threads
+		std::vector<u8> failed(files.size());
+		parallel_for(files.size(), [&](const size_t i)
+		{
+			failed[i] = !copy_file(*files[i], image_path + "/" + files[i]->path);
+		});
+
+		for (size_t i = 0; i < files.size(); ++i)
+			if (failed[i])
+				error("Could not copy ", files[i]->source, " into the image");
+
+		for (const image_entry* entry : hardlinks)
+		{
+			const std::string destination = image_path + "/" + entry->path;
+			if ((unlink(destination.c_str()) != 0 && errno != ENOENT) || link((image_path + "/" + entry->hardlink).c_str(), destination.c_str()) != 0)
+				error("Can't create the hardlink ", destination, ": ", std::strerror(errno));
+		}
+
+		// the directories get their permissions and timestamps last, since
+		// adding files into them changes the timestamps and read-only
+		// directories couldn't be filled
+		for (auto entry = entries.rbegin(); entry != entries.rend(); ++entry)
+		{
+			if (!entry->changed || !S_ISDIR(entry->st.st_mode))
+				continue;
+
+			const std::string destination = image_path + "/" + entry->path;
+			const std::array<timespec, 2> times = { entry->st.st_atim, entry->st.st_mtim };
+			if (chown(destination.c_str(), entry->st.st_uid, entry->st.st_gid) != 0
+					|| chmod(destination.c_str(), entry->st.st_mode & 07777) != 0
+					|| utimensat(AT_FDCWD, destination.c_str(), times.data(), 0) != 0)
+				error("Can't set the permissions of ", destination, ": ", std::strerror(errno));
+		}
+	}
+
+	static std::vector<std::string> image_packages(const std::vector<std::string>& requested, const path_settings& paths)
+	{
+		const std::vector<std::string> installed_packages = get_installed_packages(paths);
+		if (requested.empty())
+			return installed_packages;
+
+		const std::unordered_set<std::string> installed(installed_packages.begin(), installed_packages.end());
+		const std::vector<pkg_source> repos = get_pkg_sources(paths);
+
+		std::vector<std::string> packages;
+		std::unordered_set<std::string> added;
+		for (const std::string& pkg_name : requested)
+		{
+			if (!installed.contains(pkg_name))
+				error("Package [", pkg_name, "] is not installed");
+
+			std::vector<std::string> deps;
+			if (locate_pkg_repo(pkg_name, repos).is_valid())
+				deps = get_dependencies(pkg_name, repos, 512, paths);
+
+			deps.push_back(pkg_name);
+			for (const std::string& dep : deps)
+			{
+				// build time dependencies can be uninstalled afterwards
+				if (!installed.contains(dep))
+					continue;
+
+				if (added.insert(dep).second)
+					packages.push_back(dep);
+			}
+		}
+
+		return packages;
+	}
+
+	int detach_stdout()
+	{
+		std::cout.flush();
+
+		const int fd = fcntl(STDOUT_FILENO, F_DUPFD_CLOEXEC, 3);
+		if (fd < 0 || dup2(STDERR_FILENO, STDOUT_FILENO) < 0)
+			error("Could not redirect the output: ", std::strerror(errno));
+
+		return fd;
+	}
+
+	void export_image(const image_export_options& options, const path_settings& paths)
+	{
+		trace_span span("export_image");
+		assert(!options.output.empty());
+
+		const bool to_stdout = options.output == "-";
+		const bool to_tar = to_stdout || options.output.ends_with(".tar");
+
+		// a directory image gets updated in place by incremental exports,
+		// but a full export would leave extra files behind in it
+		std::error_code ec;
+		if (!to_tar && !options.previous_manifest.has_value() && std::filesystem::exists(options.output)
+				&& !std::filesystem::is_empty(options.output, ec))
+			error("The image directory ", options.output, " is not empty");
+
+		int out_fd = options.stdout_fd;
+		if (to_stdout && isatty(out_fd))
+			error("Refusing to write a tar stream into a terminal");
+
+		const std::vector<std::string> packages = image_packages(options.packages, paths);
+
+		log("Reading the fakeroots of ", packages.size(), " packages");
+
+		std::vector<std::vector<image_entry>> scans(packages.size());
+		parallel_for(packages.size(), [&](const size_t i)
+		{
+			scans[i] = scan_fakeroot(paths.fakeroot + "/" + packages[i], i);
+		});
+
+		std::vector<image_entry> entries;
+		for (std::vector<image_entry>& scan : scans)
+			std::ranges::move(scan, std::back_inserter(entries));
+
+		scans.clear();
+
+		// parent directories sort before the files in them. Most of the
+		// directories are in every fakeroot, but a file should only be in
+		// one unless it was installed with --overwrite
+		std::ranges::stable_sort(entries, {}, &image_entry::path);
+		for (size_t i = 1, first = 0; i < entries.size(); ++i)
+		{
+			const image_entry& exported = entries[first];
+			const image_entry& entry = entries[i];
+			if (entry.path != exported.path)
+			{
+				first = i;
+				continue;
+			}
+
+			if (!S_ISDIR(entry.st.st_mode) || !S_ISDIR(exported.st.st_mode))
+				warning("/", entry.path, " is in both [", packages[exported.pkg], "] and [", packages[entry.pkg], "], exporting the one from [", packages[exported.pkg], "]");
+		}
+
+		entries.erase(std::ranges::unique(entries, {}, &image_entry::path).begin(), entries.end());
+
+		std::map<std::pair<dev_t, ino_t>, std::string> first_links;
+		for (image_entry& entry : entries)
+		{
+			if (!S_ISREG(entry.st.st_mode) || entry.st.st_nlink < 2)
+				continue;
+
+			const auto [first_link, inserted] = first_links.try_emplace({ entry.st.st_dev, entry.st.st_ino }, entry.path);
+			if (!inserted)
+				entry.hardlink = first_link->second;
+		}
+
+		std::vector<std::string> removed_paths;
+		if (options.previous_manifest.has_value())
+		{
+			std::unordered_map<std::string, std::string> previous = read_image_manifest(options.previous_manifest.value());
+			for (image_entry& entry : entries)
+			{
+				const auto previous_entry = previous.find(entry.path);
+				if (previous_entry == previous.end())
+					continue;
+
+				entry.changed = previous_entry->second != manifest_line(entry);
+				previous.erase(previous_entry);
+			}
+
+			for (auto& [path, line] : previous)
+				removed_paths.push_back(path);
+
+			std::ranges::sort(removed_paths);
+
+			// adding and removing files changes the timestamps of the
+			// directories that they are in, so those get exported again
+			std::unordered_set<std::string> changed_dirs;
+			const auto add_parent = [&changed_dirs](const std::string_view path)
+			{
+				const size_t separator = path.rfind('/');
+				if (separator != std::string_view::npos)
+					changed_dirs.emplace(path.substr(0, separator));
+			};
+
+			for (const image_entry& entry : entries)
+				if (entry.changed)
+					add_parent(entry.path);
+
+			for (const std::string& path : removed_paths)
+				add_parent(path);
+
+			for (image_entry& entry : entries)
+				if (S_ISDIR(entry.st.st_mode) && changed_dirs.contains(entry.path))
+					entry.changed = true;
+
+			// a hardlink entry in a tar stream needs the file that it links
+			// to earlier in the same stream, so a changed hardlink to a file
+			// that is left out gets written as a regular file instead. A
+			// directory image still has the file, so the link can be made there
+			if (to_tar)
+			{
+				for (image_entry& entry : entries)
+				{
+					if (!entry.changed || entry.hardlink.empty())
+						continue;
+
+					const auto first_link = std::ranges::lower_bound(entries, entry.hardlink, {}, &image_entry::path);
+					if (first_link == entries.end() || first_link->path != entry.hardlink || !first_link->changed)
+						entry.hardlink.clear();
+				}
+			}
+		}
+
+		u64 exported_files{0};
+		u64 exported_bytes{0};
+		for (const image_entry& entry : entries)
+		{
+			if (!entry.changed)
+				continue;
+
+			++exported_files;
+			if (S_ISREG(entry.st.st_mode) && entry.hardlink.empty())
+				exported_bytes += entry.st.st_size;
+		}
+
+		log("Exporting ", exported_files, " of ", entries.size(), " files into ", to_stdout ? "stdout" : options.output);
+
+		if (to_tar)
+		{
+			const std::string partial_path = options.output + ".partial";
+			if (!to_stdout)
+			{
+				out_fd = open(partial_path.c_str(), O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+				if (out_fd < 0)
+					error("Can't create ", partial_path, ": ", std::strerror(errno));
+			}
+
+			tar_writer tar(out_fd);
+			for (const image_entry& entry : entries)
+				if (entry.changed)
+					tar.add(entry);
+
+			tar.finish();
+			close(out_fd);
+
+			if (!to_stdout)
+			{
+				std::error_code ec;
+				std::filesystem::rename(partial_path, options.output, ec);
+				if (ec)
+				{
+					std::error_code remove_ec;
+					std::filesystem::remove(partial_path, remove_ec);
+					error("Can't move ", partial_path, " to ", options.output, ": ", ec.message());
+				}
+
+				if (options.previous_manifest.has_value())
+					write_file_atomic(options.output + ".removed", removed_paths);
+			}
+			else if (!removed_paths.empty())
+			{
+				warning(removed_paths.size(), " files were removed since the previous image, but they can't be listed with a tar stream");
+			}
+		}
+		else
+		{
+			write_directory_image(entries, removed_paths, options.output);
+		}
+
+		if (!to_stdout)
+		{
+			std::vector<std::string> manifest;
+			manifest.reserve(entries.size());
+			for (const image_entry& entry : entries)
+				manifest.push_back(manifest_line(entry));
+
+			write_file_atomic(options.output + ".manifest", manifest);
+		}
+
+		constexpr f64 mib = 1024.0 * 1024.0;
+		info(std::format("Exported {:.1f} MiB from {} packages", exported_bytes / mib, packages.size()));
+	}
+}
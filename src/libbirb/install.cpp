@@ -1,20 +1,36 @@
+#ifdef BIRB_TEST
+#include <doctest/doctest.h>
+#endif /* BIRB_TEST */
+
+#include "BuildCgroup.hpp"
+#include "BuildLog.hpp"
+#include "BuildWorker.hpp"
 #include "CLI.hpp"
+#include "DeferredTests.hpp"
 #include "Database.hpp"
+#include "Dedupe.hpp"
 #include "Dependencies.hpp"
 #include "Download.hpp"
+#include "EnumTable.hpp"
 #include "Install.hpp"
 #include "Logging.hpp"
 #include "PackageInfo.hpp"
+#include "Process.hpp"
+#include "Profiling.hpp"
+#include "SourceCache.hpp"
 #include "Symlink.hpp"
+#include "Transaction.hpp"
+#include "Triggers.hpp"
+#include "Uninstall.hpp"
 #include "Utils.hpp"
 
+#include <algorithm>
 #include <cassert>
 #include <cstdio>
 #include <cstdlib>
 #include <filesystem>
 #include <format>
 #include <fstream>
-#include <iterator>
 #include <unistd.h>
 #include <unordered_set>
 
@@ -30,7 +46,8 @@ enum class install_phase
 	post_install
 };
 
-const static std::unordered_map<install_phase, std::string> install_phase_str = {
+// the names of the functions in seed.sh files
+constexpr auto install_phase_names = birb::make_enum_table<install_phase>({
 	{ install_phase::setup, "_setup" },
 	{ install_phase::build, "_build" },
 	{ install_phase::install, "_install" },
@@ -39,58 +56,209 @@ const static std::unordered_map<install_phase, std::string> install_phase_str =
 	{ install_phase::test32, "_test32" },
 	{ install_phase::install32, "_install32" },
 	{ install_phase::post_install, "_post_install" }
+});
+
+// progress of a package build that is kept around in the build
+// directory so that a failed build can be continued later
+struct build_state
+{
+	std::string seed_hash;
+	std::string checksum;
+	std::vector<install_phase> completed_phases;
 };
 
-namespace birb
+static std::optional<build_state> read_build_state(const std::string& state_file_path)
 {
-	void install(const std::vector<std::string>& packages, const path_settings& paths, const birb_config& config, const bool force_install)
+	if (!std::filesystem::exists(state_file_path))
+		return {};
+
+	build_state state;
+	for (const std::string& line : birb::read_file(state_file_path))
 	{
-		assert(!packages.empty());
+		const std::optional<std::array<std::string_view, 2>> tokens = birb::split_fields<2>(line, ";");
+		if (!tokens.has_value())
+			return {};
 
-		// validate the packages and quit if something seems to be wrong
-		for (const std::string& pkg_name : packages)
+		const auto [key, value] = tokens.value();
+
+		if (key == "seed")
+			state.seed_hash = value;
+		else if (key == "checksum")
+			state.checksum = value;
+		else if (key == "phase")
 		{
-			if (validate_package(pkg_name, paths) != package_validation_error::noerr)
-				exit(1);
+			const std::optional<install_phase> phase = install_phase_names.parse(value);
+			if (!phase.has_value())
+				return {};
+
+			state.completed_phases.push_back(phase.value());
 		}
+	}
 
-		const std::vector<std::string> required_packages = birb::resolve_dependencies(packages, paths);
-		assert(!required_packages.empty());
+	return state;
+}
 
-		// figure out which packages have already been installed
-		// and what needs to be installed
+static void write_build_state(const std::string& state_file_path, const build_state& state)
+{
+	std::vector<std::string> lines = {
+		"seed;" + state.seed_hash,
+		"checksum;" + state.checksum
+	};
 
-		const std::vector<std::string> installed_packages_vec = get_installed_packages(paths);
-		const std::unordered_set<std::string> installed_packages(installed_packages_vec.begin(), installed_packages_vec.end());
+	for (const install_phase phase : state.completed_phases)
+		lines.emplace_back(std::format("phase;{}", install_phase_names.name(phase)));
 
-		std::vector<std::string> packages_to_install;
-		for (const std::string& pkg_name : required_packages)
-			if (!installed_packages.contains(pkg_name))
-				packages_to_install.emplace_back(pkg_name);
+	birb::write_file_atomic(state_file_path, lines);
+}
 
-		if (packages_to_install.empty())
+// a build directory with its own environment and build log
+// that the seed.sh phases get executed in
+struct seed_job
+{
+	seed_job(const std::string& build_dir, const birb::environment& env, const std::string& log_path, const birb_config& config, const bool append_log)
+	:build_dir(build_dir), pwd_file(build_dir + "/.birb_pwd"), working_dir(build_dir), env(env),
+	 log(log_path, config.build_log_tail_lines, append_log)
+	{}
+
+	const std::string build_dir;
+
+	// the build scripts expect to start from the build directory, and
+	// the working directory they end up in is passed on to the next phase
+	// with the pwd file
+	const std::string pwd_file;
+	std::string working_dir;
+
+	// shell code that gets run before the _setup function
+	std::string setup_prelude;
+
+	birb::environment env;
+	birb::build_log log;
+};
+
+namespace birb
+{
+	// wait for the test suites that were run in the background and
+	// report the ones that failed
+	static void finish_deferred_tests(deferred_tests& tests, const path_settings& paths, const birb_config& config)
+	{
+		log("Waiting for ", tests.size(), " test suite(s) to finish");
+		const std::vector<deferred_test_result> results = tests.wait();
+
+		std::vector<std::string> failed_packages;
+		for (const deferred_test_result& test : results)
 		{
-			log("Everything you need is already installed („• ᴗ •„)");
-			return;
-		}
+			if (test.result.success())
+			{
+				info(test.phase, " of [", test.pkg_name, "] passed");
+				continue;
+			}
 
-		std::cout << "The following packages would be installed:\n\n";
-		for (const std::string& pkg_name : packages_to_install)
-			std::cout << "  " << pkg_name << '\n';
+			non_fatal_error(test.phase, " of [", test.pkg_name, "] failed, ret: ", test.result.exit_code);
+			print_log_tail(test.log_path, config.build_log_tail_lines);
 
-		std::cout << '\n';
-		const bool install_confirmed = confirmation_menu("Continue?", true);
+			if (std::find(failed_packages.begin(), failed_packages.end(), test.pkg_name) == failed_packages.end())
+				failed_packages.push_back(test.pkg_name);
+		}
 
-		if (!install_confirmed)
+		if (failed_packages.empty())
 			return;
 
-		// read in the package database
+		if (!config.rollback_failed_tests)
+		{
+			warning("Packages with failing tests were left installed");
+			return;
+		}
+
+		log("Rolling back packages with failing tests");
+		uninstall(failed_packages, paths);
+	}
+
+	// install the packages in the transaction that haven't been installed yet
+	static void run_transaction(install_transaction& transaction, const path_settings& paths, const birb_config& config, const std::string& resume_build_pkg = "")
+	{
+		// read in the package database and the nest file
 		std::vector<std::string> db_file = birb::read_birb_db(paths);
+		std::vector<std::string> nest_file;
+		if (std::filesystem::exists(paths.nest()))
+			nest_file = birb::read_file(paths.nest());
 
-		const bool xorg_is_running = is_process_running("Xorg");
+		const bool xorg_is_running = can_set_win_title();
 
-		for (const std::string& pkg_name : packages_to_install)
+		// test suites that are run in the background while the
+		// rest of the packages are getting installed
+		deferred_tests background_tests;
+
+		// with build workers, the sources of every package get downloaded
+		// first and the builds happen on the workers afterwards. Continuing a
+		// failed build only works in the build directory of this system
+		const bool offload_builds_to_workers = !config.build_workers.empty() && resume_build_pkg.empty();
+		std::vector<std::string> offloaded_packages;
+
+		const auto mark_installed = [&](transaction_entry& entry)
 		{
+			const std::string& pkg_name = entry.pkg_name;
+
+			const std::optional<pkg_source> repo = locate_package(pkg_name, paths);
+			assert(repo.has_value());
+
+			// if the package is not a dependency, add it into the nest file
+			if (entry.requested && std::find(nest_file.begin(), nest_file.end(), pkg_name) == nest_file.end())
+			{
+				nest_file.push_back(pkg_name);
+
+				scoped_timer timer(profile_category::db);
+				write_file_atomic(paths.nest(), nest_file);
+			}
+
+			// update the version information in the database
+			auto db_entry = std::find_if(db_file.begin(), db_file.end(),
+				[&pkg_name](const std::string& entry)
+				{
+					if (!split_fields<DB_LINE_COLUMN_COUNT>(entry, ";").has_value())
+						warning("Malformed package database entry: ", entry);
+
+					return first_token(entry, ";") == pkg_name;
+				});
+
+			const std::string version_str = read_pkg_variable(pkg_name, pkg_variable::version, repo.value().path);
+
+			// if no results were found, add a new entry
+			// otherwise updated an existing one
+			if (db_entry == db_file.end())
+				db_file.emplace_back(pkg_name + ";" + version_str);
+			else
+				db_file.at(std::distance(db_file.begin(), db_entry)) = pkg_name + ";" + version_str;
+
+			// write the updated package database to disk after each package
+			// so that finished packages won't be lost if birb gets interrupted
+			{
+				scoped_timer timer(profile_category::db);
+				write_file_atomic(paths.database(), db_file);
+			}
+
+			// the cached list of installed packages is out-of-date now
+			installed_packages_cache.clear();
+
+			entry.state = transaction_state::installed;
+			save_transaction(transaction, paths);
+		};
+
+		for (transaction_entry& entry : transaction.packages)
+		{
+			const std::string& pkg_name = entry.pkg_name;
+
+			if (entry.state == transaction_state::installed)
+				continue;
+
+			// the database gets updated before the transaction, so if the package
+			// is already in there, it was installed right before an interruption
+			if (!db_file.empty() && !find_db_entry(db_file, pkg_name).empty())
+			{
+				entry.state = transaction_state::installed;
+				save_transaction(transaction, paths);
+				continue;
+			}
+
 			log("Starting the installation of package [", pkg_name, "]");
 
 			// do some checks on the package just in case
@@ -113,56 +281,79 @@ namespace birb
 				error("Package [", pkg_name, "] does not define a checksum");
 
 			// fetch package flags
-			const std::unordered_set<pkg_flag> flags = get_pkg_flags(pkg_name, repo.value());
+			const pkg_flag_set flags = get_pkg_flags(pkg_name, repo.value());
 
 			// start the installation process
 
-			log("Dowloading sources"); // download_package doesn't print this so do it here
-			download_package(pkg_name, paths, xorg_is_running);
-			install_package(pkg_name, flags, paths, config, xorg_is_running, force_install);
-
-			// mark the package as installed
+			if (entry.state == transaction_state::pending)
+			{
+				log("Dowloading sources"); // download_package doesn't print this so do it here
+				download_package(pkg_name, paths, xorg_is_running);
 
-			// if the package is not a dependency, add it into the nest file
-			if (std::find(packages.begin(), packages.end(), pkg_name) != packages.end())
+				entry.state = transaction_state::verified;
+				save_transaction(transaction, paths);
+			}
+			else
 			{
-				std::ofstream nest_file(paths.nest(), std::ios::app);
-				if (!nest_file.is_open())
-					error("Can't open the nest file for writing");
+				log("Sources were already verified during this installation");
+			}
 
-				nest_file << pkg_name << '\n';
+			if (offload_builds_to_workers)
+			{
+				offloaded_packages.push_back(pkg_name);
+				continue;
 			}
 
-			// update the version information in the database
-			auto db_entry = std::find_if(db_file.begin(), db_file.end(),
-				[&pkg_name](const std::string& entry)
-				{
-					const std::vector<std::string> entry_tokens = split_string(entry, ";");
-					assert(!entry_tokens.empty());
+			install_package(pkg_name, flags, paths, config, xorg_is_running, transaction.force_install, pkg_name == resume_build_pkg, &background_tests);
+			mark_installed(entry);
 
-					if (entry_tokens.size() != DB_LINE_COLUMN_COUNT)
-						warning("Malformed package database entry: ", entry);
+			if (config.dedupe_after_install)
+				dedupe_fakeroots(paths, pkg_name);
+		}
 
-					if (entry_tokens[0] == pkg_name)
-						return true;
+		if (!offloaded_packages.empty())
+		{
+			offload_builds(offloaded_packages, paths, config, [&](const std::string& pkg_name)
+			{
+				install_prebuilt_package(pkg_name, paths, xorg_is_running, transaction.force_install);
 
-					return false;
-				});
+				const auto entry = std::find_if(transaction.packages.begin(), transaction.packages.end(),
+						[&pkg_name](const transaction_entry& entry) { return entry.pkg_name == pkg_name; });
+				assert(entry != transaction.packages.end());
 
-			const std::string version_str = read_pkg_variable(pkg_name, pkg_variable::version, repo.value().path);
+				mark_installed(*entry);
 
-			// if no results were found, add a new entry
-			// otherwise updated an existing one
-			if (db_entry == db_file.end())
-				db_file.emplace_back(pkg_name + ";" + version_str);
-			else
-				db_file.at(std::distance(db_file.begin(), db_entry)) = pkg_name + ";" + version_str;
+				if (config.dedupe_after_install)
+					dedupe_fakeroots(paths, pkg_name);
+			});
+		}
+
+		// run the cache updates that the packages need only once for the
+		// whole transaction instead of after each package
+		trigger_set triggers;
+		for (const transaction_entry& entry : transaction.packages)
+		{
+			const std::optional<pkg_source> repo = locate_package(entry.pkg_name, paths);
+			if (!repo.has_value() || !repo.value().is_valid())
+				continue;
+
+			triggers.merge(find_pkg_triggers(entry.pkg_name, get_pkg_flags(entry.pkg_name, repo.value()), repo.value(), paths));
+		}
+
+		if (xorg_is_running && !triggers.empty())
+			set_win_title("running triggers");
+
+		run_triggers(triggers, paths);
+
+		if (!background_tests.empty())
+		{
+			if (xorg_is_running)
+				set_win_title("waiting for tests");
+
+			finish_deferred_tests(background_tests, paths, config);
 		}
 
-		// write the updated package database to disk
-		std::ofstream db_ofstream(paths.database());
-		std::ostream_iterator<std::string> output_iterator(db_ofstream, "\n");
-		std::copy(db_file.begin(), db_file.end(), output_iterator);
+		clear_transaction(paths);
 
 		if (xorg_is_running)
 			set_win_title("done!");
@@ -170,7 +361,167 @@ namespace birb
 		log("Done!");
 	}
 
-	void install_package(const std::string& pkg_name, const std::unordered_set<pkg_flag>& pkg_flags, const path_settings& paths, const birb_config& config, const bool xorg_running, const bool force_install)
+	void install(const std::vector<std::string>& packages, const path_settings& paths, const birb_config& config, const bool force_install)
+	{
+		assert(!packages.empty());
+
+		// validate the packages and quit if something seems to be wrong
+		for (const std::string& pkg_name : packages)
+		{
+			if (validate_package(pkg_name, paths) != package_validation_error::noerr)
+				exit(1);
+		}
+
+		if (load_transaction(paths).has_value())
+		{
+			warning("There is an unfinished installation that could be continued with 'birb --resume'");
+			if (!confirmation_menu("Discard it and start a new installation?", false))
+				return;
+		}
+
+		const std::vector<std::string> required_packages = birb::resolve_dependencies(packages, paths);
+		assert(!required_packages.empty());
+
+		// figure out which packages have already been installed
+		// and what needs to be installed
+
+		const std::vector<std::string> installed_packages_vec = get_installed_packages(paths);
+		const std::unordered_set<std::string> installed_packages(installed_packages_vec.begin(), installed_packages_vec.end());
+
+		std::vector<std::string> packages_to_install;
+		for (const std::string& pkg_name : required_packages)
+			if (!installed_packages.contains(pkg_name))
+				packages_to_install.emplace_back(pkg_name);
+
+		if (packages_to_install.empty())
+		{
+			log("Everything you need is already installed („• ᴗ •„)");
+			return;
+		}
+
+		std::cout << "The following packages would be installed:\n\n";
+		for (const std::string& pkg_name : packages_to_install)
+			std::cout << "  " << pkg_name << '\n';
+
+		std::cout << '\n';
+		const bool install_confirmed = confirmation_menu("Continue?", true);
+
+		if (!install_confirmed)
+			return;
+
+		// store the resolved queue before doing anything else
+		install_transaction transaction;
+		transaction.force_install = force_install;
+		for (const std::string& pkg_name : packages_to_install)
+		{
+			const bool requested = std::find(packages.begin(), packages.end(), pkg_name) != packages.end();
+			transaction.packages.push_back({ pkg_name, transaction_state::pending, requested });
+		}
+
+		save_transaction(transaction, paths);
+		run_transaction(transaction, paths, config);
+	}
+
+	void resume_install(const path_settings& paths, const birb_config& config)
+	{
+		std::optional<install_transaction> transaction = load_transaction(paths);
+		if (!transaction.has_value())
+		{
+			log("There is no unfinished installation to resume");
+			return;
+		}
+
+		const size_t remaining = std::count_if(transaction.value().packages.begin(), transaction.value().packages.end(),
+				[](const transaction_entry& entry) { return entry.state != transaction_state::installed; });
+
+		log("Resuming an unfinished installation, ", remaining, "/", transaction.value().packages.size(), " packages left");
+		run_transaction(transaction.value(), paths, config);
+	}
+
+	void resume_build(const std::string& pkg_name, const path_settings& paths, const birb_config& config)
+	{
+		if (validate_package(pkg_name, paths) != package_validation_error::noerr)
+			exit(1);
+
+		// if the package was a part of an unfinished installation, continue
+		// that installation instead of just the single package
+		std::optional<install_transaction> transaction = load_transaction(paths);
+		const bool part_of_transaction = transaction.has_value()
+			&& std::any_of(transaction.value().packages.begin(), transaction.value().packages.end(),
+				[&pkg_name](const transaction_entry& entry)
+				{
+					return entry.pkg_name == pkg_name && entry.state != transaction_state::installed;
+				});
+
+		if (!part_of_transaction)
+		{
+			// the sources are already in the build directory, so there's nothing to download
+			transaction = install_transaction{};
+			transaction.value().packages.push_back({ pkg_name, transaction_state::verified, true });
+			save_transaction(transaction.value(), paths);
+		}
+
+		run_transaction(transaction.value(), paths, config, pkg_name);
+	}
+
+	// the seed.sh file gets its own environment instead of
+	// the environment of birb being modified
+	static environment seed_environment(const std::string& pkg_name, const pkg_source& repo, const path_settings& paths)
+	{
+		assert(!paths.fakeroot.empty());
+		assert(!paths.distfiles.empty());
+		assert(!repo.path.empty());
+
+		const std::string XORG_PREFIX = std::format("{}/{}/usr", paths.fakeroot, pkg_name);
+		const std::string PYTHON_DIST = "usr/python_dist";
+
+		environment env = environment::inherit();
+
+		// make sure that no package variables leak into the seed.sh file
+		for (const char* var : { "NAME", "DESC", "VERSION", "SOURCE", "CHECKSUM", "DEPS", "FLAGS", "NOTES", "_post_install" })
+			env.unset(var);
+
+		env.set("PATH", "/usr/local/bin:/usr/bin:/usr/sbin:/usr/local/bin:/usr/python_bin:/opt/rustc/bin");
+		env.set("PKG_PATH", std::format("{}/{}", repo.path, pkg_name));
+		env.set("BUILD_DIR_PATH", paths.distfiles);
+		env.set("DISTFILES", paths.distfiles);
+		env.set("FAKEROOT", paths.fakeroot);
+		env.set("XORG_PREFIX", XORG_PREFIX);
+		env.set("XORG_CONFIG", std::format("--prefix={} --sysconfdir=/etc --localstatedir=/var --disable-static", XORG_PREFIX));
+		env.set("PYTHON_DIST", PYTHON_DIST);
+		env.set("PYTHON_PREFIX", std::format("{}/{}/{}", paths.fakeroot, pkg_name, PYTHON_DIST));
+		env.set("ACLOCAL_PATH", "/usr/share/aclocal");
+		env.set("XML_CATALOG_FILES", "/etc/xml/catalog");
+		env.set("GOPATH", "/usr/share/go");
+		env.set("PKG_CONFIG_PATH", "/usr/lib/pkgconfig:/usr/share/pkgconfig:/usr/lib32/pkgconfig");
+
+		return env;
+	}
+
+	bool is_multilib_build(const pkg_flag_set pkg_flags, const birb_config& config)
+	{
+		return config.enable_32bit_packages && pkg_flags.contains(pkg_flag::x86);
+	}
+
+#ifdef BIRB_TEST
+	TEST_CASE("is_multilib_build()")
+	{
+		birb_config config;
+		CHECK_FALSE(is_multilib_build({ pkg_flag::x86 }, config));
+
+		parse_birb_config("export ENABLE_32BIT_PACKAGES=yes\n", config);
+		CHECK(is_multilib_build({ pkg_flag::x86 }, config));
+		CHECK_FALSE(is_multilib_build({ pkg_flag::test }, config));
+	}
+#endif
+
+	void install_package(const std::string& pkg_name, const pkg_flag_set pkg_flags, const path_settings& paths, const birb_config& config, const bool xorg_running, const bool force_install, const bool resume_build, deferred_tests* background_tests)
+	{
+		build_package(pkg_name, pkg_flags, paths, config, xorg_running, resume_build, background_tests);
+		install_prebuilt_package(pkg_name, paths, xorg_running, force_install);
+	}
+
+	void build_package(const std::string& pkg_name, const pkg_flag_set pkg_flags, const path_settings& paths, const birb_config& config, const bool xorg_running, const bool resume_build, deferred_tests* background_tests)
 	{
 		assert(!pkg_name.empty());
 		log("Starting the compiling process");
@@ -185,15 +536,8 @@ namespace birb
 		if (pkg_flags.contains(pkg_flag::proprietary))
 			warning("This package contains binary blobs! Source code may or may not be available. Proceed with caution.");
 
-		// setup the environment variables used by the seed.sh file
-
-		assert(!paths.fakeroot.empty());
-		assert(!paths.distfiles.empty());
-		assert(!repo.value().path.empty());
-
-		const std::string XORG_PREFIX = std::format("{}/{}/usr", paths.fakeroot, pkg_name);
-		const std::string PYTHON_DIST = "usr/python_dist";
 		const std::string build_dir_path = std::format("{}/birb_package_build-{}", paths.build_dir, pkg_name);
+		const std::string build32_dir_path = std::format("{}/birb_package_build32-{}", paths.build_dir, pkg_name);
 
 		// make sure that the birb build directory exists
 		std::filesystem::create_directories(paths.build_dir);
@@ -201,107 +545,411 @@ namespace birb
 		assert(!build_dir_path.empty());
 		assert(build_dir_path != "/birb_package_build-");
 
-		setenv("PATH", "/usr/local/bin:/usr/bin:/usr/sbin:/usr/local/bin:/usr/python_bin:/opt/rustc/bin", true);
-		setenv("PKG_PATH", std::format("{}/{}", repo.value().path, pkg_name).c_str(), true);
-		setenv("BUILD_DIR_PATH", paths.distfiles.c_str(), true);
-		setenv("DISTFILES", paths.distfiles.c_str(), true);
-		setenv("FAKEROOT", paths.fakeroot.c_str(), true);
-		setenv("XORG_PREFIX", XORG_PREFIX.c_str(), true);
-		setenv("XORG_CONFIG", std::format("--prefix={} --sysconfdir=/etc --localstatedir=/var --disable-static", XORG_PREFIX).c_str(), true);
-		setenv("PYTHON_DIST", PYTHON_DIST.c_str(), true);
-		setenv("PYTHON_PREFIX", std::format("{}/{}/{}", paths.fakeroot, pkg_name, PYTHON_DIST).c_str(), true);
-		setenv("ACLOCAL_PATH", "/usr/share/aclocal", true);
-		setenv("XML_CATALOG_FILES", "/etc/xml/catalog", true);
-		setenv("GOPATH", "/usr/share/go", true);
-		setenv("PKG_CONFIG_PATH", "/usr/lib/pkgconfig:/usr/share/pkgconfig:/usr/lib32/pkgconfig", true);
-		setenv("TEMPORARY_BUILD_DIR", build_dir_path.c_str(), true);
-
-		unsetenv("NAME");
-		unsetenv("DESC");
-		unsetenv("VERSION");
-		unsetenv("SOURCE");
-		unsetenv("CHECKSUM");
-		unsetenv("DEPS");
-		unsetenv("FLAGS");
-		unsetenv("NOTES");
-		unsetenv("_post_install");
-
-		if (std::filesystem::exists(build_dir_path))
-			info("Remove the previous build directory at ", build_dir_path);
-
-		info("Creating new build directory to ", build_dir_path);
-		std::filesystem::create_directory(build_dir_path);
-
-		// change the current working directory to the build directory
-		// since the build scripts expect to for us to be there
-		chdir(build_dir_path.c_str());
+		// setup the environment variables used by the seed.sh file
+		environment env = seed_environment(pkg_name, repo.value(), paths);
+		env.set("TEMPORARY_BUILD_DIR", build_dir_path);
+
+		// the 32-bit libraries are built in their own build directory at the
+		// same time as the 64-bit build
+		const bool multilib = is_multilib_build(pkg_flags, config);
+		environment env32 = env;
+
+		if (multilib)
+		{
+			// split the build jobs between the two builds, so that running
+			// them at the same time won't use more CPU threads than a single build would
+			u16 build_jobs = config.build_jobs;
+			if (const std::optional<std::string> env_jobs = env.get("BUILD_JOBS"); env_jobs.has_value())
+				build_jobs = std::max(1, std::atoi(env_jobs.value().c_str()));
+
+			const u16 build_jobs32 = std::max(1, build_jobs / 2);
+			const u16 build_jobs64 = std::max(1, build_jobs - build_jobs32);
+
+			env.set("BUILD_JOBS", std::to_string(static_cast<u32>(build_jobs64)));
+			env32.set("BUILD_JOBS", std::to_string(static_cast<u32>(build_jobs32)));
+			env32.set("TEMPORARY_BUILD_DIR", build32_dir_path);
+		}
+
+		const std::string seed_file_path = std::format("{}/{}/seed.sh", paths.repo_dir, pkg_name);
+		const std::string build_state_file_path = build_dir_path + "/.birb_build_state";
+
+		build_state state;
+		state.seed_hash = file_hash(seed_file_path);
+		state.checksum = read_pkg_variable(pkg_name, pkg_variable::checksum, repo.value().path);
+
+		const auto phase_completed = [&state](const install_phase phase)
+		{
+			return std::find(state.completed_phases.begin(), state.completed_phases.end(), phase) != state.completed_phases.end();
+		};
+
+		if (resume_build)
+		{
+			const std::optional<build_state> previous_state = read_build_state(build_state_file_path);
+			if (!previous_state.has_value())
+				error("There is no failed build of [", pkg_name, "] that could be continued");
+
+			if (previous_state.value().seed_hash != state.seed_hash || previous_state.value().checksum != state.checksum)
+				error("The seed.sh file or the sources of [", pkg_name, "] have changed since the build failed. Install the package again to start a fresh build");
+
+			state.completed_phases = previous_state.value().completed_phases;
+
+			// the fakeroot is deleted if linking fails, so in that case
+			// the installation phases need to be run again
+			if (!std::filesystem::exists(paths.fakeroot + "/" + pkg_name))
+			{
+				std::erase(state.completed_phases, install_phase::install);
+				std::erase(state.completed_phases, install_phase::install32);
+			}
+
+			info("Continuing the build in ", build_dir_path);
+		}
+		else
+		{
+			if (std::filesystem::exists(build_dir_path))
+			{
+				info("Remove the previous build directory at ", build_dir_path);
+				std::filesystem::remove_all(build_dir_path);
+			}
+
+			info("Creating new build directory to ", build_dir_path);
+			std::filesystem::create_directory(build_dir_path);
+			write_build_state(build_state_file_path, state);
+		}
+
+		// the 32-bit build directory is set up again unless the 32-bit build
+		// was already finished during a previous attempt
+		const bool setup32 = multilib && !phase_completed(install_phase::build32);
+		if (setup32)
+		{
+			std::filesystem::remove_all(build32_dir_path);
+			std::filesystem::create_directory(build32_dir_path);
+		}
 
 		log("Setting things up for compiling");
 		if (xorg_running)
 			set_win_title(std::format("installing {} (setup)", pkg_name));
-		const std::string seed_file_path = std::format("{}/{}/seed.sh", paths.repo_dir, pkg_name);
-		const std::string pwd_restore_file_path = "/tmp/birb_pwd";
 		info("Seed file: ", seed_file_path);
 
-		// remove the old pwd restoring file
-		std::filesystem::remove(pwd_restore_file_path);
+		// the build output goes into compressed log files and only a condensed
+		// progress view is shown, unless the full output was asked for
+		seed_job job64(build_dir_path, env, std::format("{}/{}.log.gz", paths.build_logs(), pkg_name), config, resume_build);
+
+		std::optional<seed_job> job32;
+		if (multilib)
+			job32.emplace(build32_dir_path, env32, std::format("{}/{}-32.log.gz", paths.build_logs(), pkg_name), config, resume_build);
+
+		// both of the builds share the same resource limits
+		const build_cgroup cgroup(pkg_name, config);
+
+		const auto output_handler = [&config](build_log& log, std::ostream& stream)
+		{
+			return [&log, &config, &stream](std::string_view chunk)
+			{
+				log.write(chunk);
+
+				if (config.verbose_build)
+					stream << chunk << std::flush;
+				else
+					log.print_progress();
+			};
+		};
+
+		// if the pwd restoring file exists, restore the working directory state
+		const auto restore_working_dir = [](seed_job& job)
+		{
+			if (!std::filesystem::exists(job.pwd_file))
+				return;
+
+			std::ifstream file(job.pwd_file);
+			if (!file.is_open())
+				error("Can't open the pwd restoring file: ", job.pwd_file);
+
+			std::getline(file, job.working_dir);
+			assert(!job.working_dir.empty());
+		};
+
+		struct phase_step
+		{
+			seed_job* job;
+			install_phase phase;
+
+			// completed phases are recorded into the build state
+			bool tracked{true};
+		};
 
-		const auto exec_seed_phase = [&seed_file_path, &pwd_restore_file_path](const install_phase phase)
+		// run a set of phases at the same time and wait for all of them to finish
+		const auto exec_seed_phases = [&](std::vector<phase_step> steps)
 		{
-			// if the pwd restoring file exists, restore the working directory state
-			if (std::filesystem::exists(pwd_restore_file_path))
+			scoped_timer timer(profile_category::shell);
+
+			std::string phase_names;
+			for (const phase_step& step : steps)
+				phase_names.append(" ").append(install_phase_names.name(step.phase));
+
+			trace_span span("exec_seed_phases", pkg_name + ":" + phase_names);
+
+			std::erase_if(steps, [&phase_completed](const phase_step& step)
 			{
-				std::ifstream file(pwd_restore_file_path);
-				if (!file.is_open())
-					error("Can't open the pwd restoring file: ", pwd_restore_file_path);
-
-				std::string path;
-				file >> path;
-				assert(!path.empty());
-				chdir(path.c_str());
+				if (!step.tracked || !phase_completed(step.phase))
+					return false;
+
+				info("Skipping ", install_phase_names.name(step.phase), ", it was completed during the previous attempt");
+				return true;
+			});
+
+			std::vector<process> processes;
+			processes.reserve(steps.size());
+
+			for (const phase_step& step : steps)
+			{
+				seed_job& job = *step.job;
+
+				restore_working_dir(job);
+
+				process_options opts;
+				opts.args = { "bash", "-c", std::format("{}source {} ; {} ; BIRB_RET=$? ; pwd > {} ; exit $BIRB_RET",
+						step.phase == install_phase::setup ? job.setup_prelude : "",
+						seed_file_path, install_phase_names.name(step.phase), job.pwd_file) };
+				cgroup.wrap(opts.args);
+				opts.env = job.env;
+				opts.working_dir = job.working_dir;
+				opts.stdout_mode = stream_mode::pipe;
+				opts.stderr_mode = stream_mode::pipe;
+				opts.on_stdout = output_handler(job.log, std::cout);
+				opts.on_stderr = output_handler(job.log, std::cerr);
+
+				job.log.begin_phase(std::string(install_phase_names.name(step.phase)));
+
+				std::optional<process> proc = process::spawn(std::move(opts));
+				if (!proc.has_value())
+					error("Could not start ", install_phase_names.name(step.phase));
+
+				processes.push_back(std::move(proc.value()));
 			}
 
-			exec_shell_cmd(std::format("source {} ; {} ; echo -n $? > /tmp/birb_ret ; pwd > {}", seed_file_path, install_phase_str.at(phase), pwd_restore_file_path));
-			const u8 ret = shell_return_value();
-			if (ret)
-				error("Something went wrong during ", install_phase_str.at(phase), ", ret: ", (i32)ret);
+			std::vector<process*> process_ptrs;
+			for (process& proc : processes)
+				process_ptrs.push_back(&proc);
+
+			const std::vector<process_result> results = wait_all(process_ptrs);
+			assert(results.size() == steps.size());
+
+			// record the phases that succeeded before reporting any failures,
+			// so that they won't be run again when the build is continued
+			for (size_t i = 0; i < steps.size(); ++i)
+			{
+				steps[i].job->log.end_phase();
+
+				if (results[i].success() && steps[i].tracked)
+				{
+					state.completed_phases.push_back(steps[i].phase);
+					write_build_state(build_state_file_path, state);
+				}
+			}
+
+			for (size_t i = 0; i < steps.size(); ++i)
+			{
+				if (results[i].success())
+					continue;
+
+				steps[i].job->log.finish();
+				steps[i].job->log.print_tail();
+
+				// keep the build directories around, so that the build
+				// can be continued from this phase
+				non_fatal_error("Something went wrong during ", install_phase_names.name(steps[i].phase), ", ret: ", results[i].exit_code);
+				info("The build directory was kept at ", steps[i].job->build_dir);
+				info("Continue the build with 'birb --resume-build ", pkg_name, "'");
+				exit(1);
+			}
 		};
 
+		// clone the extracted sources from the source cache instead of
+		// letting the seed.sh file extract the tarball again
+		if (config.source_cache)
+		{
+			const std::string tarball = get_source_tarball(pkg_name, paths);
+			const std::string tarball_path = paths.distfiles + "/" + tarball;
+
+			const auto use_cached_sources = [&](seed_job& job)
+			{
+				if (!std::filesystem::exists(tarball_path) || !clone_cached_sources(tarball_path, state.checksum, job.build_dir, paths, config))
+					return;
+
+				// skip the extraction of the tarball in the _setup function, since
+				// the sources are already in the build directory
+				job.setup_prelude = std::format(R"~~(
+tar()
+{{
+	if [ "$#" -eq 2 ] && [[ "$1" =~ ^-?[a-zA-Z]*x[a-zA-Z]*f$ ]] && [ "$(basename "$2")" == '{}' ]
+	then
+		return 0
+	fi
+
+	command tar "$@"
+}}
+)~~", tarball);
+			};
+
+			if (!resume_build)
+				use_cached_sources(job64);
+
+			if (setup32)
+				use_cached_sources(job32.value());
+		}
+
 		// call the _setup function in the seed.sh file
-		exec_seed_phase(install_phase::setup);
+		std::vector<phase_step> setup_steps = { { &job64, install_phase::setup } };
+		if (setup32)
+			setup_steps.push_back({ &job32.value(), install_phase::setup, false });
+		exec_seed_phases(setup_steps);
 
 		// TODO: make it possible to customize CFLAGS and CXXFLAGS
 		log("Building the package");
 		if (xorg_running)
 			set_win_title(std::format("installing {} (compile)", pkg_name));
-		exec_seed_phase(install_phase::build);
+
+		std::vector<phase_step> build_steps = { { &job64, install_phase::build } };
+		if (multilib)
+			build_steps.push_back({ &job32.value(), install_phase::build32 });
+		exec_seed_phases(build_steps);
 
 		// run tests if the package has them and test running is enabled
+		std::vector<phase_step> test_steps;
 		if (config.enable_tests && pkg_flags.contains(pkg_flag::test))
+			test_steps.push_back({ &job64, install_phase::test });
+
+		if (config.enable_tests && multilib && pkg_flags.contains(pkg_flag::x86_test))
+			test_steps.push_back({ &job32.value(), install_phase::test32 });
+
+		// build directories that the deferred tests are using. They get
+		// removed once the tests have finished
+		bool tests_use_build_dir = false;
+		bool tests_use_build32_dir = false;
+
+		if (!test_steps.empty() && config.defer_tests && background_tests != nullptr)
+		{
+			log("Starting the tests in the background");
+
+			for (const phase_step& step : test_steps)
+			{
+				seed_job& job = *step.job;
+				restore_working_dir(job);
+
+				const bool is_test32 = step.phase == install_phase::test32;
+				const std::string snapshot_dir = std::format("{}/birb_package_{}-{}", paths.build_dir, is_test32 ? "test32" : "test", pkg_name);
+
+				process_options opts;
+				opts.args = { "bash", "-c", std::format("source {} ; {}", seed_file_path, install_phase_names.name(step.phase)) };
+				opts.env = job.env;
+				opts.working_dir = job.working_dir;
+
+				if (is_test32)
+					tests_use_build32_dir = true;
+				else
+					tests_use_build_dir = true;
+
+				background_tests->start(pkg_name, std::string(install_phase_names.name(step.phase)), job.build_dir, snapshot_dir,
+						std::format("{}/{}-{}.log", paths.build_logs(), pkg_name, is_test32 ? "test32" : "test"), std::move(opts));
+			}
+		}
+		else if (!test_steps.empty())
 		{
 			log("Running tests");
 			if (xorg_running)
 				set_win_title(std::format("installing {} (test)", pkg_name));
-			exec_seed_phase(install_phase::test);
+			exec_seed_phases(test_steps);
 		}
 
 		log("Installing the package");
 		if (xorg_running)
 			set_win_title(std::format("installing {} (install)", pkg_name));
 
-		prepare_fakeroot(pkg_name, paths);
-		exec_seed_phase(install_phase::install);
+		if (!phase_completed(install_phase::install))
+		{
+			// get rid of anything left behind by a failed installation attempt
+			if (resume_build)
+			{
+				std::filesystem::remove_all(paths.fakeroot + "/" + pkg_name);
+				forget_deduped_files(pkg_name, paths);
+			}
+			else
+				unshare_fakeroot(pkg_name, paths);
+
+			prepare_fakeroot(pkg_name, paths);
+		}
+
+		// the installation phases are run one after another, so that
+		// the 32-bit files always get installed on top of the 64-bit files
+		exec_seed_phases({ { &job64, install_phase::install } });
+		if (multilib)
+			exec_seed_phases({ { &job32.value(), install_phase::install32 } });
+
+		job64.log.finish();
+		info("Build log: ", job64.log.path());
+
+		if (multilib)
+		{
+			job32.value().log.finish();
+			info("32-bit build log: ", job32.value().log.path());
+		}
+
+		if (const std::optional<build_resource_usage> usage = cgroup.usage(); usage.has_value())
+		{
+			constexpr f64 mib = 1024.0 * 1024.0;
+			info(std::format("Build resources: {:.1f}s of CPU time, {:.0f} MiB read, {:.0f} MiB written{}",
+					usage->cpu_usec / 1'000'000.0, usage->io_read_bytes / mib, usage->io_write_bytes / mib,
+					usage->memory_peak.has_value() ? std::format(", {:.0f} MiB peak memory", usage->memory_peak.value() / mib) : ""));
+		}
 
 		log("Cleaning up");
 		if (xorg_running)
 			set_win_title(std::format("installing {} (cleanup)", pkg_name));
 
-		std::filesystem::remove_all(build_dir_path);
+		if (!tests_use_build_dir)
+			std::filesystem::remove_all(build_dir_path);
+
+		if (!tests_use_build32_dir)
+			std::filesystem::remove_all(build32_dir_path);
+	}
+
+	void install_prebuilt_package(const std::string& pkg_name, const path_settings& paths, const bool xorg_running, const bool force_install)
+	{
+		assert(!pkg_name.empty());
+
+		const std::optional<pkg_source> repo = locate_package(pkg_name, paths);
+		assert(repo.has_value());
 
 		if (xorg_running)
 			set_win_title(std::format("installing {} (symlink)", pkg_name));
 
 		link_package(pkg_name, paths, force_install);
+
+		// run the post-install hook if the package has one
+		const std::string seed_file_path = std::format("{}/{}/seed.sh", paths.repo_dir, pkg_name);
+		const std::vector<std::string> seed_lines = read_file(seed_file_path);
+		const bool has_post_install = std::any_of(seed_lines.begin(), seed_lines.end(),
+				[](const std::string& line) { return line.starts_with(install_phase_names.name(install_phase::post_install)); });
+
+		if (has_post_install)
+		{
+			log("Running post-install commands");
+			if (xorg_running)
+				set_win_title(std::format("installing {} (post-install)", pkg_name));
+
+			scoped_timer timer(profile_category::shell);
+			trace_span span("post_install", pkg_name);
+
+			process_options opts;
+			opts.args = { "bash", "-c", std::format("source {} ; {}", seed_file_path, install_phase_names.name(install_phase::post_install)) };
+			opts.env = seed_environment(pkg_name, repo.value(), paths);
+
+			// the package is already installed at this point, so there's
+			// nothing to continue or roll back if the hook fails
+			const process_result result = run_process(std::move(opts));
+			if (!result.success())
+				warning(install_phase_names.name(install_phase::post_install), " of [", pkg_name, "] failed, ret: ", result.exit_code);
+		}
 	}
 
 	void prepare_fakeroot(const std::string& pkg_name, const path_settings& paths)
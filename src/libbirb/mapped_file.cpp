@@ -0,0 +1,157 @@
+#include "MappedFile.hpp"
+#include "Profiling.hpp"
+
+#include <cassert>
+#include <cerrno>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include <utility>
+
+namespace birb
+{
+	// files smaller than this are read instead of mapped
+	constexpr size_t mmap_threshold = 64 * 1024;
+
+	static file_error errno_to_file_error(const int err)
+	{
+		switch (err)
+		{
+			case ENOENT:
+			case ENOTDIR:
+				return file_error::not_found;
+
+			case EACCES:
+			case EPERM:
+				return file_error::no_permission;
+
+			default:
+				return file_error::read_failed;
+		}
+	}
+
+	mapped_file::~mapped_file()
+	{
+		close();
+	}
+
+	mapped_file::mapped_file(mapped_file&& other) noexcept
+	:buffer(std::move(other.buffer)),
+	mapping(std::exchange(other.mapping, nullptr)),
+	mapping_size(std::exchange(other.mapping_size, 0))
+	{}
+
+	mapped_file& mapped_file::operator=(mapped_file&& other) noexcept
+	{
+		if (this == &other)
+			return *this;
+
+		close();
+		buffer = std::move(other.buffer);
+		mapping = std::exchange(other.mapping, nullptr);
+		mapping_size = std::exchange(other.mapping_size, 0);
+
+		return *this;
+	}
+
+	file_error mapped_file::open(const std::string& file_path)
+	{
+		assert(!file_path.empty());
+		trace_span span("mapped_file::open", file_path);
+
+		close();
+
+		count_trace_event(trace_counter::open);
+		const int fd = ::open(file_path.c_str(), O_RDONLY | O_CLOEXEC);
+		if (fd < 0)
+			return errno_to_file_error(errno);
+
+		struct stat st;
+		if (fstat(fd, &st) != 0)
+		{
+			const int err = errno;
+			::close(fd);
+			return errno_to_file_error(err);
+		}
+
+		if (!S_ISREG(st.st_mode))
+		{
+			::close(fd);
+			return file_error::not_a_file;
+		}
+
+		const size_t size = st.st_size;
+
+		if (size >= mmap_threshold)
+		{
+			void* const addr = mmap(nullptr, size, PROT_READ, MAP_PRIVATE, fd, 0);
+			::close(fd);
+
+			if (addr == MAP_FAILED)
+				return file_error::read_failed;
+
+			// the lines are mostly read from start to finish
+			madvise(addr, size, MADV_SEQUENTIAL);
+
+			mapping = static_cast<const char*>(addr);
+			mapping_size = size;
+			return file_error::noerr;
+		}
+
+		// the file could grow between the fstat() and the read(), so
+		// read one byte more to notice if there's anything left
+		buffer.resize(size + 1);
+
+		size_t bytes_read{0};
+		while (bytes_read < buffer.size())
+		{
+			const ssize_t ret = read(fd, buffer.data() + bytes_read, buffer.size() - bytes_read);
+			if (ret < 0 && errno == EINTR)
+				continue;
+
+			if (ret < 0)
+			{
+				::close(fd);
+				buffer.clear();
+				return file_error::read_failed;
+			}
+
+			if (ret == 0)
+				break;
+
+			bytes_read += ret;
+
+			if (bytes_read == buffer.size())
+				buffer.resize(buffer.size() * 2);
+		}
+
+		::close(fd);
+		buffer.resize(bytes_read);
+
+		return file_error::noerr;
+	}
+
+	std::string_view mapped_file::contents() const
+	{
+		if (mapping)
+			return std::string_view(mapping, mapping_size);
+
+		return buffer;
+	}
+
+	file_lines mapped_file::lines() const
+	{
+		return file_lines(contents());
+	}
+
+	void mapped_file::close()
+	{
+		if (mapping)
+			munmap(const_cast<char*>(mapping), mapping_size);
+
+		mapping = nullptr;
+		mapping_size = 0;
+		buffer.clear();
+	}
+}
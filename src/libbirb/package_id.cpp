@@ -0,0 +1,33 @@
+#include "FlatHashMap.hpp"
+#include "PackageId.hpp"
+
+#include <cassert>
+#include <limits>
+#include <mutex>
+#include <shared_mutex>
+#include <string>
+
+namespace birb
+{
+	static std::shared_mutex pkg_ids_mutex;
+	static flat_hash_map<std::string, pkg_id, string_hash> pkg_ids;
+
+	pkg_id intern_pkg_name(const std::string_view pkg_name)
+	{
+		assert(!pkg_name.empty());
+
+		// almost all of the names have been interned already
+		{
+			std::shared_lock<std::shared_mutex> lock(pkg_ids_mutex);
+			const auto id = pkg_ids.find(pkg_name);
+			if (id != pkg_ids.end())
+				return id->second;
+		}
+
+		std::unique_lock<std::shared_mutex> lock(pkg_ids_mutex);
+		assert(pkg_ids.size() < std::numeric_limits<pkg_id>::max());
+
+		// another thread could have added the name while the lock was released
+		return pkg_ids.try_emplace(pkg_name, static_cast<pkg_id>(pkg_ids.size())).first->second;
+	}
+}
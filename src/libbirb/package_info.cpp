@@ -1,15 +1,15 @@
 #include <cassert>
-#include <filesystem>
-#include <regex>
+#include <mutex>
 
+#include "Dependencies.hpp"
+#include "FlatHashMap.hpp"
 #include "Logging.hpp"
+#include "MappedFile.hpp"
 #include "PackageInfo.hpp"
 #include "Utils.hpp"
 
-const static std::regex package_name_regex("^[0-9a-z_+-]*$");
-
 static std::optional<std::vector<pkg_source>> repo_list;
-static std::optional<std::unordered_map<std::string, std::vector<std::string>>> meta_packages;
+static std::optional<birb::flat_hash_map<std::string, std::vector<std::string>, birb::string_hash>> meta_packages;
 
 namespace birb
 {
@@ -43,11 +43,6 @@ namespace birb
 		return package_validation_error::noerr;
 	}
 
-	bool is_valid_package_name(const std::string& pkg_name)
-	{
-		return std::regex_match(pkg_name, package_name_regex);
-	}
-
 	std::optional<pkg_source> locate_package(const std::string& pkg_name, const path_settings& paths)
 	{
 		// load the repo list if it hasn't been loaded get
@@ -64,31 +59,14 @@ namespace birb
 		return {};
 	}
 
-	std::unordered_set<pkg_flag> get_pkg_flags(const std::string& pkg_name, const pkg_source& repo)
+	pkg_flag_set get_pkg_flags(const std::string& pkg_name, const pkg_source& repo)
 	{
 		const std::string flag_str = read_pkg_variable(pkg_name, pkg_variable::flags, repo.path);
 
-		// if the flag_str is empty, there are no flags
-		if (flag_str.empty())
-			return {};
-
-		const std::vector<std::string> split_flag_strings = split_string(flag_str, " ");
-
-		// convert the strings to flag enum values
-
-		std::unordered_set<pkg_flag> flags;
-		for (const std::string& flag_str : split_flag_strings)
+		return parse_pkg_flags(flag_str, [&pkg_name](const std::string_view flag_name)
 		{
-			if (!pkg_flag_string_mappings.contains(flag_str))
-			{
-				warning("Package [", pkg_name, "] has an undefined flag: ", flag_str);
-				continue;
-			}
-
-			flags.insert(pkg_flag_string_mappings.at(flag_str));
-		}
-
-		return flags;
+			warning("Package [", pkg_name, "] has an undefined flag: ", flag_name);
+		});
 	}
 
 	void find_meta_packages(const path_settings& paths)
@@ -99,7 +77,8 @@ namespace birb
 
 		assert(repo_list.has_value());
 
-		std::vector<std::string> meta_package_list;
+		meta_packages.emplace();
+		assert(meta_packages.has_value());
 
 		for (const pkg_source& repo : repo_list.value())
 		{
@@ -110,26 +89,33 @@ namespace birb
 
 			/* Check if the repo has a meta_package file */
 			const std::string meta_path = repo.path + "/meta_packages";
-			if (!std::filesystem::exists(meta_path))
+			mapped_file meta_file;
+			const file_error err = meta_file.open(meta_path);
+			if (err == file_error::not_found)
 				continue;
 
-			const std::vector<std::string> meta_file = birb::read_file(meta_path);
-			meta_package_list.insert(meta_package_list.end(), meta_file.begin(), meta_file.end());
-		}
-
-		meta_packages = std::unordered_map<std::string, std::vector<std::string>>{};
-		assert(meta_packages.has_value());
-		for (const std::string& line : meta_package_list)
-		{
-			/* Find the delimiter */
-			const size_t pos = line.find(":");
-
-			/* Skip the line if the delimiter couldn't be found */
-			if (pos == std::string::npos)
+			if (err != file_error::noerr)
+			{
+				warning("Can't read ", meta_path, ": ", file_error_str.name(err));
 				continue;
+			}
 
-			/* Get the key and the corresponding value and assign it into a map */
-			meta_packages.value()[line.substr(0, pos)] = birb::split_string(line.substr(pos + 1, line.size() - (pos + 1)), " ");
+			for (const std::string_view line : meta_file.lines())
+			{
+				/* Find the delimiter */
+				const size_t pos = line.find(":");
+
+				/* Skip the line if the delimiter couldn't be found */
+				if (pos == std::string::npos)
+					continue;
+
+				/* Get the key and the corresponding value and assign it into a map
+				 * (the package lists are kept around, so they need to be owned strings) */
+				std::vector<std::string>& pkgs = meta_packages.value()[line.substr(0, pos)];
+				pkgs.clear();
+				for (const std::string_view pkg : birb::split_view(line.substr(pos + 1), " "))
+					pkgs.emplace_back(pkg);
+			}
 		}
 	}
 
@@ -157,4 +143,19 @@ namespace birb
 
 		return meta_packages.value().at(meta_pkg_name);
 	}
+
+	void clear_caches()
+	{
+		repo_list.reset();
+		meta_packages.reset();
+
+		{
+			std::lock_guard<std::mutex> lock(var_cache_mutex);
+			var_cache.clear();
+		}
+		installed_packages_cache.clear();
+		pkg_repo_cache.clear();
+		dependency_cache.clear();
+		reverse_dependency_cache.clear();
+	}
 }
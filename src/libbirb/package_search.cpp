@@ -1,28 +1,38 @@
 #include "Database.hpp"
 #include "Logging.hpp"
+#include "MappedFile.hpp"
 #include "PackageSearch.hpp"
+#include "SearchIndex.hpp"
 #include "Utils.hpp"
 
 #include <algorithm>
 #include <filesystem>
 #include <iostream>
 #include <string>
+#include <string_view>
+#include <system_error>
+#include <unordered_set>
 #include <vector>
 
 namespace birb
 {
 	void pkg_search(const std::vector<std::string>& packages, const path_settings& paths)
 	{
-		if (!std::filesystem::exists(paths.package_list()))
+		// the package list itself isn't needed, since the packages are looked
+		// up from the repositories, so only check that it has been synced
+		std::error_code ec;
+		const uintmax_t pkg_list_size = std::filesystem::file_size(paths.package_list(), ec);
+		if (ec)
 			error("Could not find the package list. Run 'birb --sync' to sync the repositories and update package cache.");
 
-		// read in the list of all existing packages
-		const std::vector<std::string> pkg_list = birb::read_file(paths.package_list());
-		if (pkg_list.empty())
+		if (pkg_list_size == 0)
 			error("Empty package cache");
 
-		// read in the list of installed packages
-		const std::vector<std::string> installed_packages = birb::get_installed_packages(paths);
+		// the names of the installed packages point into the mapped database
+		const mapped_file birb_db = birb::map_birb_db(paths);
+		std::unordered_set<std::string_view> installed_packages;
+		for (const std::string_view db_line : birb_db.lines())
+			installed_packages.insert(birb::first_token(db_line, ";"));
 
 		// get the list of repositories
 		const std::vector<pkg_source> pkg_sources = birb::get_pkg_sources(paths);
@@ -47,7 +57,41 @@ namespace birb
 						<< description << ";";
 
 			// check if the package is installed
-			if (std::find(installed_packages.begin(), installed_packages.end(), pkg_name) != installed_packages.end())
+			if (installed_packages.contains(pkg_name))
+				std::cout << "[installed]";
+
+			std::cout << "\n";
+		}
+	}
+
+	void pkg_fuzzy_search(const std::vector<std::string>& query, const bool search_descriptions, const path_settings& paths)
+	{
+		// only show the most relevant results, since short
+		// queries can match a large part of the repositories
+		constexpr size_t max_results = 50;
+
+		const std::optional<search_index> index = search_index::load(paths);
+		if (!index.has_value())
+			error("Could not find the search index. Run 'birb --sync' to sync the repositories and update package cache.");
+
+		const std::vector<std::string> installed_list = birb::get_installed_packages(paths);
+		const std::unordered_set<std::string> installed_packages(installed_list.begin(), installed_list.end());
+
+		std::string query_str;
+		for (const std::string& word : query)
+			query_str += word + " ";
+
+		const std::vector<search_match> matches = index.value().search(query_str, search_descriptions);
+
+		for (size_t i = 0; i < matches.size() && i < max_results; ++i)
+		{
+			const search_index_entry& entry = index.value().entry(matches[i].id);
+
+			std::cout 	<< entry.name << ";"
+						<< entry.version << ";"
+						<< entry.description << ";";
+
+			if (installed_packages.contains(entry.name))
 				std::cout << "[installed]";
 
 			std::cout << "\n";
@@ -0,0 +1,498 @@
+#include "Logging.hpp"
+#include "Process.hpp"
+#include "Profiling.hpp"
+
+#include <algorithm>
+#include <array>
+#include <cassert>
+#include <cerrno>
+#include <csignal>
+#include <cstring>
+#include <fcntl.h>
+#include <iostream>
+#include <poll.h>
+#include <spawn.h>
+#include <sys/syscall.h>
+#include <sys/wait.h>
+#include <unistd.h>
+#include <utility>
+
+extern char** environ;
+
+#ifndef P_PIDFD
+#define P_PIDFD 3
+#endif
+
+// time given for the child to exit after SIGTERM before it gets SIGKILL
+constexpr static std::chrono::seconds kill_grace_period{5};
+
+// poll interval used when we can't rely on a pidfd alone
+constexpr static int fallback_poll_interval_ms = 50;
+
+static int open_pidfd(const pid_t pid)
+{
+#ifdef SYS_pidfd_open
+	return syscall(SYS_pidfd_open, pid, 0);
+#else
+	return -1;
+#endif
+}
+
+static void close_fd(int& fd)
+{
+	if (fd < 0)
+		return;
+
+	close(fd);
+	fd = -1;
+}
+
+namespace birb
+{
+	environment environment::inherit()
+	{
+		environment env;
+		for (char** var = environ; var && *var; ++var)
+			env.vars.emplace_back(*var);
+
+		return env;
+	}
+
+	void environment::set(const std::string& key, const std::string& value)
+	{
+		assert(!key.empty());
+		unset(key);
+		vars.emplace_back(key + "=" + value);
+	}
+
+	void environment::unset(const std::string& key)
+	{
+		assert(!key.empty());
+		std::erase_if(vars, [&key](const std::string& var)
+		{
+			return var.size() > key.size() && var[key.size()] == '=' && var.starts_with(key);
+		});
+	}
+
+	std::optional<std::string> environment::get(const std::string& key) const
+	{
+		for (const std::string& var : vars)
+			if (var.size() > key.size() && var[key.size()] == '=' && var.starts_with(key))
+				return var.substr(key.size() + 1);
+
+		return {};
+	}
+
+	const std::vector<std::string>& environment::variables() const
+	{
+		return vars;
+	}
+
+	bool process_result::success() const
+	{
+		return !spawn_failed && !timed_out && !cancelled && exit_code == 0;
+	}
+
+	process::process(process&& other) noexcept
+	{
+		*this = std::move(other);
+	}
+
+	process& process::operator=(process&& other) noexcept
+	{
+		if (this == &other)
+			return *this;
+
+		opts		= std::move(other.opts);
+		child_pid	= std::exchange(other.child_pid, -1);
+		pidfd		= std::exchange(other.pidfd, -1);
+		stdin_fd	= std::exchange(other.stdin_fd, -1);
+		stdout_fd	= std::exchange(other.stdout_fd, -1);
+		stderr_fd	= std::exchange(other.stderr_fd, -1);
+		exited		= other.exited;
+		reaped		= std::exchange(other.reaped, true);
+		start_time	= other.start_time;
+		kill_time	= other.kill_time;
+		result		= std::move(other.result);
+
+		return *this;
+	}
+
+	process::~process()
+	{
+		if (child_pid > 0 && !reaped)
+		{
+			kill(SIGKILL);
+			waitpid(child_pid, nullptr, 0);
+		}
+
+		close_fds();
+	}
+
+	std::optional<process> process::spawn(process_options options)
+	{
+		assert(!options.args.empty());
+
+		// pipe ends that stay in birb get O_CLOEXEC so that other children
+		// spawned in the meantime won't keep them open
+		std::array<int, 2> in_pipe{-1, -1}, out_pipe{-1, -1}, err_pipe{-1, -1};
+		const auto make_pipe = [](std::array<int, 2>& p) { return pipe2(p.data(), O_CLOEXEC) == 0; };
+
+		if ((options.stdin_mode == stream_mode::pipe && !make_pipe(in_pipe))
+				|| (options.stdout_mode == stream_mode::pipe && !make_pipe(out_pipe))
+				|| (options.stderr_mode == stream_mode::pipe && !make_pipe(err_pipe)))
+		{
+			non_fatal_error("Can't create a pipe for [", options.args.front(), "]: ", strerror(errno));
+			for (int fd : { in_pipe[0], in_pipe[1], out_pipe[0], out_pipe[1], err_pipe[0], err_pipe[1] })
+				if (fd >= 0)
+					close(fd);
+
+			return {};
+		}
+
+		posix_spawn_file_actions_t actions;
+		posix_spawn_file_actions_init(&actions);
+
+		const auto redirect = [&actions](const stream_mode mode, const int target_fd, const int pipe_end, const int user_fd, const int open_flags)
+		{
+			switch (mode)
+			{
+				case stream_mode::inherit:
+					break;
+
+				case stream_mode::pipe:
+					posix_spawn_file_actions_adddup2(&actions, pipe_end, target_fd);
+					break;
+
+				case stream_mode::null:
+					posix_spawn_file_actions_addopen(&actions, target_fd, "/dev/null", open_flags, 0);
+					break;
+
+				case stream_mode::fd:
+					assert(user_fd >= 0);
+					posix_spawn_file_actions_adddup2(&actions, user_fd, target_fd);
+					break;
+			}
+		};
+
+		redirect(options.stdin_mode, STDIN_FILENO, in_pipe[0], options.stdin_fd, O_RDONLY);
+		redirect(options.stdout_mode, STDOUT_FILENO, out_pipe[1], options.stdout_fd, O_WRONLY);
+		redirect(options.stderr_mode, STDERR_FILENO, err_pipe[1], options.stderr_fd, O_WRONLY);
+
+		if (!options.working_dir.empty())
+			posix_spawn_file_actions_addchdir_np(&actions, options.working_dir.c_str());
+
+		// don't let the child inherit the signal dispositions or
+		// the signal mask of birb
+		posix_spawnattr_t attr;
+		posix_spawnattr_init(&attr);
+
+		sigset_t default_signals, empty_mask;
+		sigfillset(&default_signals);
+		sigemptyset(&empty_mask);
+		posix_spawnattr_setsigdefault(&attr, &default_signals);
+		posix_spawnattr_setsigmask(&attr, &empty_mask);
+
+		short spawn_flags = POSIX_SPAWN_SETSIGDEF | POSIX_SPAWN_SETSIGMASK;
+		if (options.own_process_group)
+		{
+			spawn_flags |= POSIX_SPAWN_SETPGROUP;
+			posix_spawnattr_setpgroup(&attr, 0);
+		}
+		posix_spawnattr_setflags(&attr, spawn_flags);
+
+		std::vector<char*> argv;
+		argv.reserve(options.args.size() + 1);
+		for (std::string& arg : options.args)
+			argv.push_back(arg.data());
+		argv.push_back(nullptr);
+
+		std::vector<std::string> env_vars = options.env.variables();
+		std::vector<char*> envp;
+		envp.reserve(env_vars.size() + 1);
+		for (std::string& var : env_vars)
+			envp.push_back(var.data());
+		envp.push_back(nullptr);
+
+		// the child writes straight to the inherited file descriptors, so anything
+		// still buffered in birb would otherwise get printed out of order
+		std::cout.flush();
+		std::cerr.flush();
+
+		pid_t pid{-1};
+		const int spawn_ret = posix_spawnp(&pid, argv[0], &actions, &attr, argv.data(), envp.data());
+
+		posix_spawn_file_actions_destroy(&actions);
+		posix_spawnattr_destroy(&attr);
+
+		// close the pipe ends that belong to the child
+		close_fd(in_pipe[0]);
+		close_fd(out_pipe[1]);
+		close_fd(err_pipe[1]);
+
+		if (spawn_ret != 0)
+		{
+			non_fatal_error("Can't start [", options.args.front(), "]: ", strerror(spawn_ret));
+			close_fd(in_pipe[1]);
+			close_fd(out_pipe[0]);
+			close_fd(err_pipe[0]);
+			return {};
+		}
+
+		process proc;
+		proc.opts		= std::move(options);
+		proc.child_pid	= pid;
+		proc.pidfd		= open_pidfd(pid);
+		proc.stdin_fd	= in_pipe[1];
+		proc.stdout_fd	= out_pipe[0];
+		proc.stderr_fd	= err_pipe[0];
+		proc.start_time	= std::chrono::steady_clock::now();
+
+		return proc;
+	}
+
+	pid_t process::pid() const
+	{
+		return child_pid;
+	}
+
+	int process::stdin_pipe() const
+	{
+		return stdin_fd;
+	}
+
+	void process::close_stdin()
+	{
+		close_fd(stdin_fd);
+	}
+
+	void process::kill(int sig)
+	{
+		if (child_pid <= 0 || reaped)
+			return;
+
+		::kill(opts.own_process_group ? -child_pid : child_pid, sig);
+	}
+
+	process_result process::wait()
+	{
+		return wait_all({ this }).front();
+	}
+
+	void process::close_fds()
+	{
+		close_fd(pidfd);
+		close_fd(stdin_fd);
+		close_fd(stdout_fd);
+		close_fd(stderr_fd);
+	}
+
+	// read whatever is available from a pipe and pass it on. Returns false
+	// when the pipe has been closed by the other end
+	static bool drain_pipe(int fd, const std::function<void(std::string_view)>& callback, std::string& collected)
+	{
+		std::array<char, 65536> buffer;
+		const ssize_t bytes_read = read(fd, buffer.data(), buffer.size());
+
+		if (bytes_read < 0)
+			return errno == EINTR || errno == EAGAIN;
+
+		if (bytes_read == 0)
+			return false;
+
+		const std::string_view chunk(buffer.data(), bytes_read);
+		if (callback)
+			callback(chunk);
+		else
+			collected.append(chunk);
+
+		return true;
+	}
+
+	std::vector<process_result> wait_all(std::vector<process*> processes)
+	{
+		using clock = std::chrono::steady_clock;
+
+		const auto reap = [](process& proc, const bool block)
+		{
+			siginfo_t info{};
+			const int ret = proc.pidfd >= 0
+				? waitid(static_cast<idtype_t>(P_PIDFD), proc.pidfd, &info, WEXITED | (block ? 0 : WNOHANG))
+				: waitid(P_PID, proc.child_pid, &info, WEXITED | (block ? 0 : WNOHANG));
+
+			// with WNOHANG si_pid stays zero if the child is still running
+			if (ret != 0 || info.si_pid == 0)
+				return;
+
+			proc.exited = true;
+			proc.reaped = true;
+
+			if (info.si_code == CLD_EXITED)
+				proc.result.exit_code = info.si_status;
+			else
+				proc.result.signal = info.si_status;
+		};
+
+		const auto finished = [](const process& proc)
+		{
+			return proc.reaped && proc.stdout_fd < 0 && proc.stderr_fd < 0;
+		};
+
+		while (!std::all_of(processes.begin(), processes.end(), [&finished](const process* p) { return finished(*p); }))
+		{
+			std::vector<pollfd> poll_fds;
+			int poll_timeout{-1};
+
+			for (process* proc : processes)
+			{
+				if (finished(*proc))
+					continue;
+
+				if (!proc->exited && proc->pidfd >= 0)
+					poll_fds.push_back({ proc->pidfd, POLLIN, 0 });
+
+				if (proc->stdout_fd >= 0)
+					poll_fds.push_back({ proc->stdout_fd, POLLIN, 0 });
+
+				if (proc->stderr_fd >= 0)
+					poll_fds.push_back({ proc->stderr_fd, POLLIN, 0 });
+
+				// without a pidfd there's nothing to notify us about the
+				// child exiting, so check back every once in a while
+				if (proc->pidfd < 0 || proc->opts.cancel)
+					poll_timeout = fallback_poll_interval_ms;
+
+				// wake up in time for timeouts and SIGKILL escalation
+				std::optional<clock::time_point> deadline;
+				if (proc->kill_time.has_value())
+					deadline = proc->kill_time.value() + kill_grace_period;
+				else if (proc->opts.timeout.count() > 0)
+					deadline = proc->start_time + proc->opts.timeout;
+
+				if (deadline.has_value())
+				{
+					const auto remaining = std::chrono::duration_cast<std::chrono::milliseconds>(deadline.value() - clock::now()).count();
+					const int remaining_ms = std::max<int>(0, remaining);
+					poll_timeout = poll_timeout < 0 ? remaining_ms : std::min(poll_timeout, remaining_ms);
+				}
+			}
+
+			if (poll(poll_fds.data(), poll_fds.size(), poll_timeout) < 0 && errno != EINTR)
+				error("poll() failed while waiting for child processes: ", strerror(errno));
+
+			for (process* proc : processes)
+			{
+				if (finished(*proc))
+					continue;
+
+				const auto revents_of = [&poll_fds](const int fd) -> short
+				{
+					for (const pollfd& pfd : poll_fds)
+						if (pfd.fd == fd)
+							return pfd.revents;
+
+					return 0;
+				};
+
+				if (proc->stdout_fd >= 0 && revents_of(proc->stdout_fd))
+					if (!drain_pipe(proc->stdout_fd, proc->opts.on_stdout, proc->result.out))
+						close_fd(proc->stdout_fd);
+
+				if (proc->stderr_fd >= 0 && revents_of(proc->stderr_fd))
+					if (!drain_pipe(proc->stderr_fd, proc->opts.on_stderr, proc->result.err))
+						close_fd(proc->stderr_fd);
+
+				if (!proc->exited)
+					reap(*proc, false);
+
+				if (proc->exited)
+				{
+					// the child might have left something running in the
+					// background that holds on to the pipes, so only read
+					// what is already there instead of waiting for EOF
+					for (int* fd : { &proc->stdout_fd, &proc->stderr_fd })
+					{
+						if (*fd < 0)
+							continue;
+
+						fcntl(*fd, F_SETFL, fcntl(*fd, F_GETFL) | O_NONBLOCK);
+						const auto& callback = fd == &proc->stdout_fd ? proc->opts.on_stdout : proc->opts.on_stderr;
+						std::string& collected = fd == &proc->stdout_fd ? proc->result.out : proc->result.err;
+
+						while (true)
+						{
+							errno = 0;
+							if (!drain_pipe(*fd, callback, collected) || errno == EAGAIN)
+								break;
+						}
+
+						close_fd(*fd);
+					}
+
+					continue;
+				}
+
+				// cancellation and timeouts
+				const clock::time_point now = clock::now();
+				if (!proc->kill_time.has_value())
+				{
+					if (proc->opts.cancel && proc->opts.cancel->load())
+					{
+						proc->result.cancelled = true;
+						proc->kill(SIGTERM);
+						proc->kill_time = now;
+					}
+					else if (proc->opts.timeout.count() > 0 && now - proc->start_time >= proc->opts.timeout)
+					{
+						proc->result.timed_out = true;
+						proc->kill(SIGTERM);
+						proc->kill_time = now;
+					}
+				}
+				else if (now - proc->kill_time.value() >= kill_grace_period)
+				{
+					proc->kill(SIGKILL);
+				}
+			}
+		}
+
+		std::vector<process_result> results;
+		results.reserve(processes.size());
+		for (process* proc : processes)
+		{
+			proc->close_fds();
+			results.push_back(std::move(proc->result));
+			proc->result = process_result{};
+		}
+
+		return results;
+	}
+
+	process_result run_process(process_options options)
+	{
+		// show the beginning of the command in the trace
+		std::string command;
+		if (tracing_enabled.load(std::memory_order_relaxed))
+		{
+			for (const std::string& arg : options.args)
+				command += (command.empty() ? "" : " ") + arg;
+
+			constexpr size_t max_command_length = 80;
+			if (command.size() > max_command_length)
+				command.resize(max_command_length);
+		}
+
+		trace_span span("run_process", command);
+
+		std::optional<process> proc = process::spawn(std::move(options));
+		if (!proc.has_value())
+		{
+			process_result result;
+			result.spawn_failed = true;
+			result.exit_code = 127;
+			return result;
+		}
+
+		return proc.value().wait();
+	}
+}
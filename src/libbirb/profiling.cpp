@@ -0,0 +1,145 @@
+#include "Logging.hpp"
+#include "Profiling.hpp"
+
+#include <cassert>
+#include <cstdlib>
+#include <fstream>
+#include <mutex>
+#include <thread>
+#include <unistd.h>
+#include <vector>
+
+namespace birb
+{
+	struct trace_event
+	{
+		const char* name;
+		std::string detail;
+		u64 start;
+		u64 duration;
+		u32 tid;
+
+		// values of the trace counters when the span ended
+		std::array<u64, trace_counter_count> counters;
+	};
+
+	static std::mutex trace_mutex;
+	static std::vector<trace_event> trace_events;
+	static std::string trace_path;
+	static std::chrono::steady_clock::time_point trace_start;
+
+	void reset_profile()
+	{
+		for (profile_counter& counter : profile_counters)
+		{
+			counter.nanoseconds = 0;
+			counter.count = 0;
+		}
+	}
+
+	f64 profile_time_ms(const profile_category category)
+	{
+		return profile_counters.at(static_cast<size_t>(category)).nanoseconds / 1'000'000.0;
+	}
+
+	u64 profile_count(const profile_category category)
+	{
+		return profile_counters.at(static_cast<size_t>(category)).count;
+	}
+
+	static std::string json_escape(const std::string& text)
+	{
+		std::string result;
+		result.reserve(text.size());
+
+		for (const char c : text)
+		{
+			if (c == '"' || c == '\\')
+				result += '\\';
+
+			// control characters aren't allowed in JSON strings
+			if (static_cast<unsigned char>(c) < 0x20)
+				continue;
+
+			result += c;
+		}
+
+		return result;
+	}
+
+	static void write_trace()
+	{
+		tracing_enabled.store(false, std::memory_order_relaxed);
+
+		std::lock_guard<std::mutex> lock(trace_mutex);
+
+		std::ofstream file(trace_path);
+		if (!file.is_open())
+		{
+			non_fatal_error("Can't write the trace to ", trace_path);
+			return;
+		}
+
+		const pid_t pid = getpid();
+
+		file << "{\"displayTimeUnit\":\"ms\",\"traceEvents\":[\n";
+
+		std::array<u64, trace_counter_count> previous_counters{};
+		for (size_t i = 0; i < trace_events.size(); ++i)
+		{
+			const trace_event& event = trace_events[i];
+
+			file << (i == 0 ? "" : ",\n")
+				<< "{\"name\":\"" << event.name << "\",\"cat\":\"birb\",\"ph\":\"X\""
+				<< ",\"ts\":" << event.start << ",\"dur\":" << event.duration
+				<< ",\"pid\":" << pid << ",\"tid\":" << event.tid;
+
+			if (!event.detail.empty())
+				file << ",\"args\":{\"detail\":\"" << json_escape(event.detail) << "\"}";
+
+			file << "}";
+
+			// the counters are only sampled when they have changed
+			if (event.counters == previous_counters)
+				continue;
+
+			file << ",\n{\"name\":\"filesystem\",\"ph\":\"C\",\"ts\":" << event.start + event.duration
+				<< ",\"pid\":" << pid << ",\"args\":{\"stat\":" << event.counters[static_cast<size_t>(trace_counter::stat)]
+				<< ",\"open\":" << event.counters[static_cast<size_t>(trace_counter::open)] << "}}";
+
+			previous_counters = event.counters;
+		}
+
+		file << "\n]}\n";
+	}
+
+	void start_trace(const std::string& path)
+	{
+		assert(!path.empty());
+
+		trace_path = path;
+		trace_start = std::chrono::steady_clock::now();
+		tracing_enabled.store(true, std::memory_order_relaxed);
+
+		// birb exits from all over the place when something fails, and those
+		// are the cases that are the most interesting to look at
+		std::atexit(write_trace);
+	}
+
+	u64 trace_timestamp()
+	{
+		return std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::steady_clock::now() - trace_start).count();
+	}
+
+	void record_trace_span(const char* name, const std::string& detail, const u64 start)
+	{
+		const u64 end = trace_timestamp();
+
+		trace_event event { name, detail, start, end - start, static_cast<u32>(gettid()), {} };
+		for (size_t i = 0; i < trace_counter_count; ++i)
+			event.counters[i] = trace_counters[i];
+
+		std::lock_guard<std::mutex> lock(trace_mutex);
+		trace_events.push_back(std::move(event));
+	}
+}
@@ -0,0 +1,422 @@
+#include "Database.hpp"
+#include "Logging.hpp"
+#include "SearchIndex.hpp"
+#include "ThreadPool.hpp"
+#include "Utils.hpp"
+
+#include <algorithm>
+#include <cassert>
+#include <cctype>
+#include <cstring>
+#include <filesystem>
+#include <format>
+#include <fstream>
+#include <unordered_set>
+
+namespace birb
+{
+	// how much of the trigrams of a query need to match for
+	// the result to be counted as a fuzzy match
+	constexpr f32 name_similarity_threshold = 0.5f;
+	constexpr f32 desc_similarity_threshold = 0.6f;
+
+	static std::string to_lower(std::string_view text)
+	{
+		std::string result(text);
+		std::transform(result.begin(), result.end(), result.begin(),
+				[](const unsigned char c) { return std::tolower(c); });
+		return result;
+	}
+
+	// unique trigrams of the text in sorted order
+	static std::vector<u32> trigrams(const std::string_view text)
+	{
+		std::vector<u32> result;
+		if (text.size() < 3)
+			return result;
+
+		result.reserve(text.size() - 2);
+		for (size_t i = 0; i + 2 < text.size(); ++i)
+		{
+			result.push_back(static_cast<u32>(static_cast<u8>(text[i])) << 16
+					| static_cast<u32>(static_cast<u8>(text[i + 1])) << 8
+					| static_cast<u32>(static_cast<u8>(text[i + 2])));
+		}
+
+		std::sort(result.begin(), result.end());
+		result.erase(std::unique(result.begin(), result.end()), result.end());
+		return result;
+	}
+
+	// read the version and the description from a seed.sh file
+	//
+	// a package with a broken seed.sh file shouldn't prevent
+	// the rest of the packages from being indexed, so this doesn't
+	// use read_pkg_variable()
+	static std::optional<search_index_entry> read_index_entry(const std::string& pkg_name, const std::string& seed_path)
+	{
+		std::ifstream seed_file(seed_path);
+		if (!seed_file.is_open())
+			return {};
+
+		search_index_entry entry;
+		entry.name = pkg_name;
+
+		const auto read_var = [](const std::string& line, const std::string_view var_name, std::string& value)
+		{
+			if (!line.starts_with(var_name) || line.size() < var_name.size() + 2 || line.back() != '"')
+				return false;
+
+			value = line.substr(var_name.size(), line.size() - var_name.size() - 1);
+			return true;
+		};
+
+		bool has_version = false;
+		bool has_desc = false;
+
+		std::string line;
+		while ((!has_version || !has_desc) && std::getline(seed_file, line))
+		{
+			has_version |= read_var(line, "VERSION=\"", entry.version);
+			has_desc |= read_var(line, "DESC=\"", entry.description);
+		}
+
+		if (!has_version)
+			return {};
+
+		return entry;
+	}
+
+	void search_index::posting_list::build(const std::unordered_map<u32, std::vector<u32>>& postings)
+	{
+		ranges.clear();
+		ids.clear();
+
+		for (const auto& [trigram, trigram_ids] : postings)
+			ranges.push_back({ trigram, 0, static_cast<u32>(trigram_ids.size()) });
+
+		std::sort(ranges.begin(), ranges.end(),
+				[](const range& a, const range& b) { return a.trigram < b.trigram; });
+
+		for (range& r : ranges)
+		{
+			const std::vector<u32>& trigram_ids = postings.at(r.trigram);
+			r.offset = ids.size();
+			ids.insert(ids.end(), trigram_ids.begin(), trigram_ids.end());
+		}
+	}
+
+	void search_index::posting_list::count_hits(const std::vector<u32>& trigrams, std::vector<u16>& hits) const
+	{
+		std::fill(hits.begin(), hits.end(), 0);
+
+		for (const u32 trigram : trigrams)
+		{
+			const auto r = std::lower_bound(ranges.begin(), ranges.end(), trigram,
+					[](const range& r, const u32 trigram) { return r.trigram < trigram; });
+
+			if (r == ranges.end() || r->trigram != trigram)
+				continue;
+
+			for (u32 i = r->offset; i < r->offset + r->count; ++i)
+				++hits[ids[i]];
+		}
+	}
+
+	search_index search_index::build(const path_settings& paths)
+	{
+		search_index index;
+		std::unordered_set<std::string> indexed_packages;
+		std::unordered_map<u32, std::vector<u32>> name_trigrams;
+		std::unordered_map<u32, std::vector<u32>> desc_trigrams;
+
+		// <package name, seed.sh path> in the repository order
+		std::vector<std::pair<std::string, std::string>> seed_files;
+
+		for (const pkg_source& repo : get_pkg_sources(paths))
+		{
+			if (!std::filesystem::exists(repo.path))
+				continue;
+
+			for (const std::filesystem::directory_entry& dir : std::filesystem::directory_iterator(repo.path))
+			{
+				std::string pkg_name = dir.path().filename().string();
+
+				// the same rules as with the package list
+				if (!dir.is_directory() || pkg_name == "birb" || pkg_name.starts_with('.'))
+					continue;
+
+				seed_files.emplace_back(std::move(pkg_name), dir.path().string() + "/seed.sh");
+			}
+		}
+
+		// reading the seed.sh files is where most of the time goes
+		std::vector<std::optional<search_index_entry>> entries(seed_files.size());
+		parallel_for(seed_files.size(), [&](const size_t i)
+		{
+			entries[i] = read_index_entry(seed_files[i].first, seed_files[i].second);
+		});
+
+		for (std::optional<search_index_entry>& entry : entries)
+		{
+			// packages in the earlier repositories take priority
+			if (!entry.has_value() || indexed_packages.contains(entry.value().name))
+				continue;
+
+			const u32 id = index.entries.size();
+
+			std::string lower_name = to_lower(entry.value().name);
+			for (const u32 trigram : trigrams(lower_name))
+				name_trigrams[trigram].push_back(id);
+
+			for (const u32 trigram : trigrams(to_lower(entry.value().description)))
+				desc_trigrams[trigram].push_back(id);
+
+			indexed_packages.insert(entry.value().name);
+			index.entries.push_back(std::move(entry.value()));
+			index.lower_names.push_back(std::move(lower_name));
+		}
+
+		index.name_postings.build(name_trigrams);
+		index.desc_postings.build(desc_trigrams);
+
+		return index;
+	}
+
+	// the index is stored in a binary format, since searching should be fast
+	// and most of the time would otherwise be spent on parsing text. The file
+	// gets regenerated on every sync, so it is in the native byte order
+	//
+	// magic
+	// entry count
+	// entries (name, version and description as length prefixed strings)
+	// name postings (range count, ranges, id count, ids)
+	// desc postings
+	constexpr std::string_view search_index_magic = "BIRBIDX1";
+
+	void search_index::save(const path_settings& paths) const
+	{
+		std::string data(search_index_magic);
+
+		const auto write_u32 = [&data](const u32 value)
+		{
+			data.append(reinterpret_cast<const char*>(&value), sizeof(value));
+		};
+
+		const auto write_str = [&](const std::string& str)
+		{
+			write_u32(str.size());
+			data.append(str);
+		};
+
+		const auto write_postings = [&](const posting_list& postings)
+		{
+			write_u32(postings.ranges.size());
+			data.append(reinterpret_cast<const char*>(postings.ranges.data()), postings.ranges.size() * sizeof(posting_list::range));
+			write_u32(postings.ids.size());
+			data.append(reinterpret_cast<const char*>(postings.ids.data()), postings.ids.size() * sizeof(u32));
+		};
+
+		write_u32(entries.size());
+		for (const search_index_entry& entry : entries)
+		{
+			write_str(entry.name);
+			write_str(entry.version);
+			write_str(entry.description);
+		}
+
+		write_postings(name_postings);
+		write_postings(desc_postings);
+
+		write_file_atomic(paths.search_index(), data);
+	}
+
+	std::optional<search_index> search_index::load(const path_settings& paths)
+	{
+		std::ifstream file(paths.search_index(), std::ios::binary | std::ios::ate);
+		if (!file.is_open())
+			return {};
+
+		std::string data(file.tellg(), '\0');
+		file.seekg(0);
+		file.read(data.data(), data.size());
+
+		if (!data.starts_with(search_index_magic))
+			return {};
+
+		size_t pos = search_index_magic.size();
+		bool truncated = false;
+
+		const auto read_bytes = [&](void* dst, const size_t size)
+		{
+			if (truncated || data.size() - pos < size)
+			{
+				truncated = true;
+				return;
+			}
+
+			std::memcpy(dst, data.data() + pos, size);
+			pos += size;
+		};
+
+		const auto read_u32 = [&]()
+		{
+			u32 value{0};
+			read_bytes(&value, sizeof(value));
+			return value;
+		};
+
+		const auto read_str = [&]()
+		{
+			std::string str(std::min<size_t>(read_u32(), data.size() - pos), '\0');
+			read_bytes(str.data(), str.size());
+			return str;
+		};
+
+		const auto read_postings = [&](posting_list& postings)
+		{
+			postings.ranges.resize(std::min<size_t>(read_u32(), (data.size() - pos) / sizeof(posting_list::range)));
+			read_bytes(postings.ranges.data(), postings.ranges.size() * sizeof(posting_list::range));
+			postings.ids.resize(std::min<size_t>(read_u32(), (data.size() - pos) / sizeof(u32)));
+			read_bytes(postings.ids.data(), postings.ids.size() * sizeof(u32));
+		};
+
+		search_index index;
+
+		const u32 entry_count = read_u32();
+		index.entries.reserve(std::min<size_t>(entry_count, data.size()));
+		for (u32 i = 0; i < entry_count && !truncated; ++i)
+		{
+			search_index_entry entry;
+			entry.name = read_str();
+			entry.version = read_str();
+			entry.description = read_str();
+			index.lower_names.push_back(to_lower(entry.name));
+			index.entries.push_back(std::move(entry));
+		}
+
+		read_postings(index.name_postings);
+		read_postings(index.desc_postings);
+
+		if (truncated || pos != data.size())
+			return {};
+
+		// make sure that the postings don't point outside of the package list
+		for (const posting_list* postings : { &index.name_postings, &index.desc_postings })
+		{
+			for (const posting_list::range& r : postings->ranges)
+			{
+				if (static_cast<u64>(r.offset) + r.count > postings->ids.size())
+					return {};
+			}
+
+			for (const u32 id : postings->ids)
+			{
+				if (id >= index.entries.size())
+					return {};
+			}
+		}
+
+		return index;
+	}
+
+	std::vector<search_match> search_index::search(const std::string& query, const bool search_descriptions) const
+	{
+		std::vector<f32> scores(entries.size(), 0.0f);
+		std::vector<u16> hits(entries.size(), 0);
+
+		// the query is in lowercase already
+		const auto contains_word = [](const std::string& text, const std::string_view word)
+		{
+			return std::search(text.begin(), text.end(), word.begin(), word.end(),
+					[](const unsigned char a, const unsigned char b) { return std::tolower(a) == b; }) != text.end();
+		};
+
+		const std::string lower_query = to_lower(query);
+		for (const std::string_view word : split_view(lower_query, " "))
+		{
+			if (word.empty())
+				continue;
+
+			const std::vector<u32> word_trigrams = trigrams(word);
+
+			// too short words for trigrams are compared against every package
+			const bool scan_all = word_trigrams.empty();
+
+			if (!scan_all)
+				name_postings.count_hits(word_trigrams, hits);
+
+			for (u32 id = 0; id < entries.size(); ++id)
+			{
+				if (!scan_all && hits[id] == 0)
+					continue;
+
+				const std::string& name = lower_names[id];
+				const f32 similarity = scan_all ? 0.0f : static_cast<f32>(hits[id]) / word_trigrams.size();
+
+				if (name == word)
+					scores[id] += 1000.0f;
+				else if (name.starts_with(word))
+					scores[id] += 500.0f + 100.0f * word.size() / name.size();
+				else if (name.find(word) != std::string::npos)
+					scores[id] += 300.0f + 100.0f * word.size() / name.size();
+				else if (similarity >= name_similarity_threshold)
+					scores[id] += 200.0f * similarity;
+			}
+
+			if (!search_descriptions)
+				continue;
+
+			if (!scan_all)
+				desc_postings.count_hits(word_trigrams, hits);
+
+			for (u32 id = 0; id < entries.size(); ++id)
+			{
+				if (!scan_all && hits[id] == 0)
+					continue;
+
+				const f32 similarity = scan_all ? 0.0f : static_cast<f32>(hits[id]) / word_trigrams.size();
+
+				// trigram hits alone don't guarantee a substring match
+				if (similarity == 1.0f || scan_all)
+				{
+					if (contains_word(entries[id].description, word))
+					{
+						scores[id] += 100.0f;
+						continue;
+					}
+				}
+
+				if (similarity >= desc_similarity_threshold)
+					scores[id] += 50.0f * similarity;
+			}
+		}
+
+		std::vector<search_match> matches;
+		for (u32 id = 0; id < entries.size(); ++id)
+		{
+			if (scores[id] > 0.0f)
+				matches.push_back({ id, scores[id] });
+		}
+
+		std::sort(matches.begin(), matches.end(), [this](const search_match& a, const search_match& b)
+		{
+			if (a.score != b.score)
+				return a.score > b.score;
+
+			return entries[a.id].name < entries[b.id].name;
+		});
+
+		return matches;
+	}
+
+	const search_index_entry& search_index::entry(const u32 id) const
+	{
+		return entries.at(id);
+	}
+
+	size_t search_index::size() const
+	{
+		return entries.size();
+	}
+}
@@ -0,0 +1,332 @@
+#include "Logging.hpp"
+#include "MappedFile.hpp"
+#include "Process.hpp"
+#include "SourceCache.hpp"
+#include "Utils.hpp"
+
+#include <algorithm>
+#include <cassert>
+#include <cerrno>
+#include <cstring>
+#include <ctime>
+#include <fcntl.h>
+#include <filesystem>
+#include <format>
+#include <linux/fs.h>
+#include <sys/ioctl.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include <vector>
+
+namespace birb
+{
+	struct source_cache_entry
+	{
+		std::string checksum;
+		u64 size{0};
+		u64 last_used{0};
+	};
+
+	static std::string source_cache_index(const path_settings& paths)
+	{
+		return paths.source_cache + "/index";
+	}
+
+	// the index has one line per cached source tree in the format
+	// checksum;size;last_used
+	//
+	// returns nothing if the index exists but can't be read
+	static std::optional<std::vector<source_cache_entry>> read_source_cache_index(const path_settings& paths)
+	{
+		std::vector<source_cache_entry> entries;
+
+		mapped_file file;
+		if (const file_error err = file.open(source_cache_index(paths)); err != file_error::noerr)
+		{
+			if (err == file_error::not_found)
+				return entries;
+
+			warning("Can't read the source cache index at ", source_cache_index(paths), ": ", file_error_str.name(err));
+			return {};
+		}
+
+		for (const std::string_view line : file.lines())
+		{
+			const std::optional<std::array<std::string_view, 3>> tokens = split_fields<3>(line, ";");
+			if (!tokens.has_value())
+			{
+				warning("Malformed source cache index entry: ", line);
+				continue;
+			}
+
+			const auto [checksum, size_str, last_used_str] = tokens.value();
+
+			const std::optional<u64> size = parse_u64(size_str);
+			const std::optional<u64> last_used = parse_u64(last_used_str);
+			if (!size.has_value() || !last_used.has_value())
+			{
+				warning("Malformed source cache index entry: ", line);
+				continue;
+			}
+
+			// entries without a source tree were left behind by an interrupted birb
+			const std::string checksum_str(checksum);
+			if (!std::filesystem::exists(paths.source_cache + "/" + checksum_str))
+				continue;
+
+			entries.push_back({ checksum_str, size.value(), last_used.value() });
+		}
+
+		return entries;
+	}
+
+	static void write_source_cache_index(const std::vector<source_cache_entry>& entries, const path_settings& paths)
+	{
+		std::vector<std::string> lines;
+		lines.reserve(entries.size());
+
+		for (const source_cache_entry& entry : entries)
+			lines.push_back(std::format("{};{};{}", entry.checksum, entry.size, entry.last_used));
+
+		write_file_atomic(source_cache_index(paths), lines);
+	}
+
+	static u64 tree_size(const std::string& path)
+	{
+		u64 size = 0;
+		for (const std::filesystem::directory_entry& entry : std::filesystem::recursive_directory_iterator(path))
+		{
+			if (entry.is_regular_file() && !entry.is_symlink())
+				size += entry.file_size();
+		}
+
+		return size;
+	}
+
+	static void copy_file_data(const int in_fd, const int out_fd, const off_t size, const std::string& path)
+	{
+		// copy-on-write clone shares the data blocks between the files
+		if (ioctl(out_fd, FICLONE, in_fd) == 0)
+			return;
+
+		// copy_file_range() avoids copying the data through userspace and
+		// can still make reflinks on some filesystems
+		off_t copied = 0;
+		while (copied < size)
+		{
+			const ssize_t ret = copy_file_range(in_fd, nullptr, out_fd, nullptr, size - copied, 0);
+			if (ret > 0)
+			{
+				copied += ret;
+				continue;
+			}
+
+			if (ret == 0)
+				return;
+
+			if (errno == EINTR)
+				continue;
+
+			if (errno == EXDEV || errno == ENOSYS || errno == EINVAL || errno == EOPNOTSUPP)
+				break;
+
+			error("Could not copy ", path, ": ", strerror(errno));
+		}
+
+		if (copied >= size)
+			return;
+
+		// plain copy as the last resort
+		std::vector<char> buffer(128 * 1024);
+		while (true)
+		{
+			const ssize_t bytes_read = pread(in_fd, buffer.data(), buffer.size(), copied);
+			if (bytes_read < 0 && errno == EINTR)
+				continue;
+
+			if (bytes_read < 0)
+				error("Could not read ", path, ": ", strerror(errno));
+
+			if (bytes_read == 0)
+				return;
+
+			ssize_t written = 0;
+			while (written < bytes_read)
+			{
+				const ssize_t ret = pwrite(out_fd, buffer.data() + written, bytes_read - written, copied + written);
+				if (ret < 0 && errno == EINTR)
+					continue;
+
+				if (ret < 0)
+					error("Could not write ", path, ": ", strerror(errno));
+
+				written += ret;
+			}
+
+			copied += bytes_read;
+		}
+	}
+
+	static void clone_entry(const std::string& src, const std::string& dst)
+	{
+		struct stat st;
+		if (lstat(src.c_str(), &st) != 0)
+			error("Could not stat ", src, ": ", strerror(errno));
+
+		const struct timespec times[2] = { st.st_atim, st.st_mtim };
+
+		if (S_ISDIR(st.st_mode))
+		{
+			if (mkdir(dst.c_str(), 0700) != 0 && errno != EEXIST)
+				error("Could not create directory ", dst, ": ", strerror(errno));
+
+			for (const std::filesystem::directory_entry& entry : std::filesystem::directory_iterator(src))
+				clone_entry(entry.path().string(), dst + "/" + entry.path().filename().string());
+
+			// the timestamps of the directory can only be restored
+			// after its contents have been created
+			if (lchown(dst.c_str(), st.st_uid, st.st_gid) != 0 && errno != EPERM)
+				warning("Could not change the owner of ", dst);
+
+			chmod(dst.c_str(), st.st_mode & 07777);
+			utimensat(AT_FDCWD, dst.c_str(), times, AT_SYMLINK_NOFOLLOW);
+		}
+		else if (S_ISLNK(st.st_mode))
+		{
+			std::string target(st.st_size + 1, '\0');
+			const ssize_t len = readlink(src.c_str(), target.data(), target.size());
+			if (len < 0)
+				error("Could not read the symlink ", src, ": ", strerror(errno));
+
+			target.resize(len);
+
+			if (symlink(target.c_str(), dst.c_str()) != 0)
+				error("Could not create the symlink ", dst, ": ", strerror(errno));
+
+			if (lchown(dst.c_str(), st.st_uid, st.st_gid) != 0 && errno != EPERM)
+				warning("Could not change the owner of ", dst);
+
+			utimensat(AT_FDCWD, dst.c_str(), times, AT_SYMLINK_NOFOLLOW);
+		}
+		else if (S_ISREG(st.st_mode))
+		{
+			const int in_fd = open(src.c_str(), O_RDONLY | O_CLOEXEC);
+			if (in_fd < 0)
+				error("Could not open ", src, ": ", strerror(errno));
+
+			const int out_fd = open(dst.c_str(), O_WRONLY | O_CREAT | O_EXCL | O_CLOEXEC, 0600);
+			if (out_fd < 0)
+				error("Could not create ", dst, ": ", strerror(errno));
+
+			copy_file_data(in_fd, out_fd, st.st_size, src);
+
+			// changing the owner clears setuid bits, so change the mode afterwards
+			if (fchown(out_fd, st.st_uid, st.st_gid) != 0 && errno != EPERM)
+				warning("Could not change the owner of ", dst);
+
+			fchmod(out_fd, st.st_mode & 07777);
+			futimens(out_fd, times);
+
+			close(out_fd);
+			close(in_fd);
+		}
+		else
+		{
+			// source tarballs shouldn't contain device files or fifos
+			warning("Skipping special file ", src);
+		}
+	}
+
+	void clone_tree(const std::string& src, const std::string& dst)
+	{
+		assert(!src.empty());
+		assert(!dst.empty());
+
+		clone_entry(src, dst);
+	}
+
+	bool clone_cached_sources(const std::string& tarball_path, const std::string& checksum, const std::string& build_dir, const path_settings& paths, const birb_config& config)
+	{
+		assert(!checksum.empty());
+		assert(checksum.find('/') == std::string::npos);
+
+		std::filesystem::create_directories(paths.source_cache);
+
+		// other birb processes and build workers share the cache, so the index
+		// stays locked until the updated index has been written. The lock
+		// also keeps them from extracting the same sources at the same time
+		const file_lock index_lock(source_cache_index(paths));
+
+		// the cache can't be used without knowing what is in it
+		std::optional<std::vector<source_cache_entry>> index = read_source_cache_index(paths);
+		if (!index.has_value())
+		{
+			info("Skipping the source cache");
+			return false;
+		}
+
+		std::vector<source_cache_entry> entries = std::move(index.value());
+		const std::string cached_tree = paths.source_cache + "/" + checksum;
+
+		auto cache_entry = std::find_if(entries.begin(), entries.end(),
+				[&checksum](const source_cache_entry& entry) { return entry.checksum == checksum; });
+
+		if (cache_entry == entries.end())
+		{
+			info("Extracting ", std::filesystem::path(tarball_path).filename().string(), " into the source cache");
+
+			// extract into a temporary directory first, so that an interrupted
+			// extraction won't leave a partial source tree into the cache
+			const std::string partial_tree = cached_tree + ".partial";
+			std::filesystem::remove_all(partial_tree);
+			std::filesystem::remove_all(cached_tree);
+			std::filesystem::create_directory(partial_tree);
+
+			process_options opts;
+			opts.args = { "tar", "-xf", tarball_path, "-C", partial_tree };
+			opts.stdout_mode = stream_mode::null;
+			opts.stderr_mode = stream_mode::pipe;
+
+			const process_result result = run_process(std::move(opts));
+			if (!result.success())
+			{
+				// not everything is a tarball, so let the seed.sh file
+				// figure out how to extract the sources
+				std::filesystem::remove_all(partial_tree);
+				info("The sources couldn't be extracted with tar, skipping the source cache");
+				return false;
+			}
+
+			std::filesystem::rename(partial_tree, cached_tree);
+
+			entries.push_back({ checksum, tree_size(cached_tree), 0 });
+			cache_entry = std::prev(entries.end());
+		}
+		else
+		{
+			info("Using the cached sources of ", std::filesystem::path(tarball_path).filename().string());
+		}
+
+		cache_entry->last_used = std::time(nullptr);
+		clone_tree(cached_tree, build_dir);
+
+		// evict the least recently used source trees until the cache fits
+		// within its size limit
+		std::sort(entries.begin(), entries.end(),
+				[](const source_cache_entry& a, const source_cache_entry& b) { return a.last_used > b.last_used; });
+
+		u64 total_size = 0;
+		std::erase_if(entries, [&](const source_cache_entry& entry)
+		{
+			total_size += entry.size;
+			if (total_size <= config.source_cache_max_size)
+				return false;
+
+			std::filesystem::remove_all(paths.source_cache + "/" + entry.checksum);
+			return true;
+		});
+
+		write_source_cache_index(entries, paths);
+		return true;
+	}
+}
@@ -1,24 +1,57 @@
 #include "CLI.hpp"
 #include "Logging.hpp"
 #include "PackageInfo.hpp"
+#include "Profiling.hpp"
 #include "Symlink.hpp"
+#include "ThreadPool.hpp"
 #include "Types.hpp"
 
+#include <algorithm>
 #include <cassert>
 #include <cmath>
 #include <filesystem>
 #include <format>
+#include <set>
+#include <tuple>
 #include <utility>
+#include <vector>
 
 namespace birb
 {
+	// figure out where the symlink for a file in a package fakeroot goes
+	// and where it should point to
+	// <symlink target, symlink path>
+	//
+	// if the LFS variable is set, the symlink is created under the LFS root
+	// and it points to the fakeroot file as it is seen after chrooting into
+	// the LFS root
+	static std::pair<std::filesystem::path, std::filesystem::path> fakeroot_symlink(const std::filesystem::path& fakeroot_file, const std::string& pkg_fakeroot_path, const path_settings& paths)
+	{
+		// remove the fakeroot path portion from the file path
+		std::string root_path = fakeroot_file.string().erase(0, pkg_fakeroot_path.size());
+		assert(root_path.at(0) == '/');
+
+		std::string target = fakeroot_file.string();
+
+		if (paths.lfs_var_set)
+		{
+			assert(target.starts_with(paths.lfs_path));
+			target.erase(0, paths.lfs_path.size());
+			root_path.insert(0, paths.lfs_path);
+		}
+
+		return { target, root_path };
+	}
+
 	void link_package(const std::string& pkg_name, const path_settings& paths, const bool force_install)
 	{
 		assert(!pkg_name.empty());
+		scoped_timer timer(profile_category::link);
+		trace_span span("link_package", pkg_name);
 
-		// fakeroot and root paths gathered from the first try run
+		// symlink targets and root paths gathered from the first try run
 		// that checks for conflicts
-		// <fakeroot,root>
+		// <symlink target, root>
 		std::vector<std::pair<std::filesystem::path, std::filesystem::path>> file_paths;
 
 		std::vector<std::string> conflicting_files;
@@ -26,22 +59,28 @@ namespace birb
 		log("Checking for conflicts");
 		assert(!paths.fakeroot.empty());
 		const std::string pkg_fakeroot_path = paths.fakeroot + "/" + pkg_name;
-		for (const std::filesystem::path& p : std::filesystem::recursive_directory_iterator(pkg_fakeroot_path))
+		for (const std::filesystem::directory_entry& entry : std::filesystem::recursive_directory_iterator(pkg_fakeroot_path))
 		{
 			// skip directories
-			if (!std::filesystem::is_regular_file(p))
+			if (!entry.is_regular_file())
 				continue;
 
-			// remove the fakeroot path portion from the file path
-			const std::string path_str = p.string().erase(0, pkg_fakeroot_path.size());
-			assert(path_str.at(0) == '/');
+			file_paths.emplace_back(fakeroot_symlink(entry.path(), pkg_fakeroot_path, paths));
+		}
 
-			// check for conflict
-			if (std::filesystem::exists(path_str))
-				conflicting_files.emplace_back(path_str);
+		// every file needs a stat call, so check them in parallel
+		// (std::vector<bool> can't be written to from multiple threads)
+		std::vector<u8> conflicts(file_paths.size());
+		parallel_for(file_paths.size(), [&](const size_t i)
+		{
+			// dangling symlinks count as conflicts too
+			count_trace_event(trace_counter::stat);
+			conflicts[i] = std::filesystem::exists(std::filesystem::symlink_status(file_paths[i].second));
+		});
 
-			file_paths.emplace_back(std::make_pair(p, path_str));
-		}
+		for (size_t i = 0; i < file_paths.size(); ++i)
+			if (conflicts[i])
+				conflicting_files.emplace_back(file_paths[i].second.string());
 
 		if (!conflicting_files.empty() && !force_install)
 		{
@@ -65,16 +104,27 @@ namespace birb
 		}
 
 		log("Creating symlinks");
-		for (const auto& [fakeroot, root] : file_paths)
+
+		// make sure that the required target directories exist. This is done
+		// before creating the symlinks so that the threads don't race with
+		// each other when creating the same directories
+		std::set<std::filesystem::path> target_dirs;
+		for (const auto& [target, root] : file_paths)
 		{
-			// make sure that the required target directories exist
 			assert(!root.parent_path().empty());
-			std::filesystem::create_directories(root.parent_path());
+			target_dirs.insert(root.parent_path());
+		}
+
+		for (const std::filesystem::path& dir : target_dirs)
+			std::filesystem::create_directories(dir);
 
-			assert(!fakeroot.empty());
+		parallel_for(file_paths.size(), [&file_paths](const size_t i)
+		{
+			const auto& [target, root] = file_paths[i];
+			assert(!target.empty());
 			assert(!root.empty());
-			std::filesystem::create_symlink(fakeroot, root);
-		}
+			std::filesystem::create_symlink(target, root);
+		});
 	}
 
 	void relink_package(const std::vector<std::string>& packages, const path_settings& paths)
@@ -91,45 +141,78 @@ namespace birb
 			log("Restoring symlinks for package [", pkg_name, "]");
 
 			const std::string pkg_fakeroot_path = paths.fakeroot + "/" + pkg_name;
+			scoped_timer timer(profile_category::link);
 
 			// check if there is a fakeroot for the package
 			if (!std::filesystem::exists(pkg_fakeroot_path) || !std::filesystem::is_directory(pkg_fakeroot_path))
 				error("There is no fakeroot for the package [", pkg_name, "]");
 
-			u64 recreated_symlink_count{0};
-			u64 equivalent_file_count{0};
-
-			for (const std::filesystem::path& p : std::filesystem::recursive_directory_iterator(pkg_fakeroot_path))
+			// <symlink target, root, fakeroot file>
+			std::vector<std::tuple<std::filesystem::path, std::filesystem::path, std::filesystem::path>> files;
+			for (const std::filesystem::directory_entry& entry : std::filesystem::recursive_directory_iterator(pkg_fakeroot_path))
 			{
 				// skip directories
-				if (!std::filesystem::is_regular_file(p))
+				if (!entry.is_regular_file())
 					continue;
 
-				// remove the fakeroot path portion from the file path
-				const std::string path_str = p.string().erase(0, pkg_fakeroot_path.size());
-				assert(path_str.at(0) == '/');
+				const auto [target, root] = fakeroot_symlink(entry.path(), pkg_fakeroot_path, paths);
+				files.emplace_back(target, root, entry.path());
+			}
 
-				// check for conflicts
+			enum class link_state : u8
+			{
+				missing, in_place, conflict
+			};
+
+			// checking the files is stat heavy, so it is done in parallel
+			std::vector<link_state> states(files.size());
+			parallel_for(files.size(), [&](const size_t i)
+			{
+				const auto& [target, root, p] = files[i];
 
-				if (std::filesystem::exists(path_str))
+				if (!std::filesystem::exists(std::filesystem::symlink_status(root)))
 				{
-					// don't overwrite files that are already correctly inplace
-					if (std::filesystem::equivalent(path_str, p))
-					{
-						++equivalent_file_count;
-						continue;
-					}
+					states[i] = link_state::missing;
+					return;
+				}
 
-					if (!confirmation_menu(std::format("Overwrite a conflicting file {}?", path_str), true))
+				// don't overwrite files that are already correctly inplace
+				std::error_code ec;
+				if ((std::filesystem::is_symlink(root) && std::filesystem::read_symlink(root) == target) || std::filesystem::equivalent(root, p, ec))
+					states[i] = link_state::in_place;
+				else
+					states[i] = link_state::conflict;
+			});
+
+			const u64 equivalent_file_count = std::count(states.begin(), states.end(), link_state::in_place);
+
+			// ask about the conflicts one by one
+			std::vector<size_t> relinked_files;
+			for (size_t i = 0; i < files.size(); ++i)
+			{
+				if (states[i] == link_state::in_place)
+					continue;
+
+				if (states[i] == link_state::conflict)
+				{
+					const std::filesystem::path& root = std::get<1>(files[i]);
+					if (!confirmation_menu(std::format("Overwrite a conflicting file {}?", root.string()), true))
 						continue;
 
-					std::filesystem::remove(path_str);
+					std::filesystem::remove(root);
 				}
 
-				std::filesystem::create_symlink(p, path_str);
-				++recreated_symlink_count;
+				relinked_files.push_back(i);
 			}
 
+			parallel_for(relinked_files.size(), [&](const size_t i)
+			{
+				const auto& [target, root, p] = files[relinked_files[i]];
+				std::filesystem::create_symlink(target, root);
+			});
+
+			const u64 recreated_symlink_count = relinked_files.size();
+
 			info("Recreated symlinks: ", recreated_symlink_count);
 			info("Existing files: ", equivalent_file_count);
 		}
@@ -141,17 +224,24 @@ namespace birb
 	{
 		assert(!pkg_name.empty());
 		assert(!paths.fakeroot.empty());
+		scoped_timer timer(profile_category::link);
+		trace_span span("unlink_package", pkg_name);
 
 		const std::string pkg_fakeroot_path = paths.fakeroot + "/" + pkg_name;
-		for (const std::filesystem::path& p : std::filesystem::recursive_directory_iterator(pkg_fakeroot_path))
+
+		std::vector<std::filesystem::path> symlinks;
+		for (const std::filesystem::directory_entry& entry : std::filesystem::recursive_directory_iterator(pkg_fakeroot_path))
 		{
 			// skip directories
-			if (!std::filesystem::is_regular_file(p))
+			if (!entry.is_regular_file())
 				continue;
 
-			// remove the fakeroot path portion from the file path
-			const std::string path_str = p.string().erase(0, pkg_fakeroot_path.size());
-			std::filesystem::remove(path_str);
+			symlinks.push_back(fakeroot_symlink(entry.path(), pkg_fakeroot_path, paths).second);
 		}
+
+		parallel_for(symlinks.size(), [&symlinks](const size_t i)
+		{
+			std::filesystem::remove(symlinks[i]);
+		});
 	}
 }
@@ -1,12 +1,11 @@
 #include "Database.hpp"
 #include "Logging.hpp"
+#include "Process.hpp"
+#include "SearchIndex.hpp"
 #include "Sync.hpp"
-#include "Utils.hpp"
 
 #include <filesystem>
-#include <format>
 #include <fstream>
-#include <unistd.h>
 
 namespace birb
 {
@@ -36,13 +35,27 @@ namespace birb
 			if (!std::filesystem::exists(repo_path))
 			{
 				warning("The repo ", repo.name, " was missing. Cloning it...");
-				exec_shell_cmd(std::format("git clone {} {}", repo.url, repo_path));
+
+				process_options clone_opts;
+				clone_opts.args = { "git", "clone", repo.url, repo_path };
+				if (!run_process(std::move(clone_opts)).success())
+				{
+					non_fatal_error("Cloning the repo ", repo.name, " failed");
+					continue;
+				}
 			}
 			else
 			{
-				std::filesystem::current_path(repo_path);
-				info("Repo path: ", std::filesystem::current_path());
-				exec_shell_cmd("git fetch ; git pull");
+				info("Repo path: ", repo_path);
+				for (const char* git_cmd : { "fetch", "pull" })
+				{
+					process_options git_opts;
+					git_opts.args = { "git", git_cmd };
+					git_opts.working_dir = repo_path;
+
+					if (!run_process(std::move(git_opts)).success())
+						warning("git ", git_cmd, " failed for the repo ", repo.name);
+				}
 			}
 
 			// cache the package list
@@ -68,5 +81,11 @@ namespace birb
 		std::ofstream new_pkg_list(paths.package_list(), std::ios_base::app);
 		for (const std::string& pkg_name : package_name_list)
 			new_pkg_list << pkg_name << '\n';
+
+		// index the package names and descriptions for searching
+		log("Updating the search index");
+		const search_index index = search_index::build(paths);
+		index.save(paths);
+		info("Indexed ", index.size(), " packages");
 	}
 }
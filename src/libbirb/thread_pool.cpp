@@ -0,0 +1,247 @@
+#include "ThreadPool.hpp"
+
+#include <cassert>
+#include <condition_variable>
+#include <deque>
+#include <memory>
+#include <optional>
+#include <thread>
+#include <utility>
+#include <vector>
+
+namespace birb
+{
+	struct pool_task
+	{
+		task_group* group;
+		std::function<void()> func;
+	};
+
+	// every worker has its own queue. Workers take tasks from the back of
+	// their own queue and steal from the front of the other queues
+	struct task_queue
+	{
+		std::mutex mutex;
+		std::deque<pool_task> tasks;
+	};
+
+	static std::atomic<u16> max_thread_count{0};
+	static std::atomic<bool> pool_started{false};
+
+	// index of the queue that belongs to the current worker thread
+	static thread_local std::optional<size_t> worker_index;
+
+	class thread_pool
+	{
+	public:
+		explicit thread_pool(const u16 thread_count)
+		:queues(thread_count)
+		{
+			for (std::unique_ptr<task_queue>& queue : queues)
+				queue = std::make_unique<task_queue>();
+
+			// the thread that waits for a task group works too,
+			// so one thread less is needed
+			for (size_t i = 0; i + 1 < thread_count; ++i)
+				std::thread(&thread_pool::worker, this, i).detach();
+		}
+
+		void push(pool_task task)
+		{
+			// tasks queued outside of the workers get spread around
+			// and the stealing balances the rest
+			const size_t index = worker_index.has_value()
+				? worker_index.value()
+				: next_queue.fetch_add(1, std::memory_order_relaxed) % queues.size();
+
+			{
+				std::lock_guard<std::mutex> lock(queues[index]->mutex);
+				queues[index]->tasks.push_back(std::move(task));
+			}
+
+			{
+				std::lock_guard<std::mutex> lock(sleep_mutex);
+				++queued_tasks;
+			}
+			wake_up.notify_one();
+		}
+
+		// run one queued task if there is one
+		bool try_run_task()
+		{
+			std::optional<pool_task> task = pop();
+			if (!task.has_value())
+				return false;
+
+			task->group->execute(task->func);
+			task->group->finish_task();
+			return true;
+		}
+
+	private:
+		std::optional<pool_task> pop()
+		{
+			const size_t own = worker_index.value_or(0);
+
+			for (size_t i = 0; i < queues.size(); ++i)
+			{
+				const size_t index = (own + i) % queues.size();
+				const bool own_queue = (i == 0 && worker_index.has_value());
+
+				std::lock_guard<std::mutex> lock(queues[index]->mutex);
+				std::deque<pool_task>& tasks = queues[index]->tasks;
+				if (tasks.empty())
+					continue;
+
+				pool_task task = own_queue ? std::move(tasks.back()) : std::move(tasks.front());
+				if (own_queue)
+					tasks.pop_back();
+				else
+					tasks.pop_front();
+
+				std::lock_guard<std::mutex> sleep_lock(sleep_mutex);
+				--queued_tasks;
+
+				return task;
+			}
+
+			return {};
+		}
+
+		void worker(const size_t index)
+		{
+			worker_index = index;
+
+			while (true)
+			{
+				if (try_run_task())
+					continue;
+
+				std::unique_lock<std::mutex> lock(sleep_mutex);
+				wake_up.wait(lock, [this] { return queued_tasks > 0; });
+			}
+		}
+
+		// the queues are never resized after the pool has been created
+		std::vector<std::unique_ptr<task_queue>> queues;
+		std::atomic<size_t> next_queue{0};
+
+		std::mutex sleep_mutex;
+		std::condition_variable wake_up;
+		size_t queued_tasks{0};
+	};
+
+	static thread_pool& pool()
+	{
+		// the pool is never destroyed, since birb can exit() from
+		// within a task and the workers can't be joined then
+		static thread_pool* const instance = []
+		{
+			pool_started = true;
+			return new thread_pool(thread_limit());
+		}();
+
+		return *instance;
+	}
+
+	void set_thread_limit(const u16 max_threads)
+	{
+		assert(!pool_started && "The thread limit has to be set before the worker threads are started");
+		max_thread_count = max_threads;
+	}
+
+	u16 thread_limit()
+	{
+		if (max_thread_count != 0)
+			return max_thread_count;
+
+		return static_cast<u16>(std::max(1u, std::thread::hardware_concurrency()));
+	}
+
+	task_group::~task_group()
+	{
+		// the tasks have references to the group
+		cancel();
+		wait_for_tasks();
+	}
+
+	void task_group::run(std::function<void()> task)
+	{
+		if (cancelled)
+			return;
+
+		// there are no worker threads to hand the task to
+		if (thread_limit() == 1)
+		{
+			pool_started = true;
+			execute(task);
+			return;
+		}
+
+		++pending;
+		pool().push({ this, std::move(task) });
+	}
+
+	void task_group::wait()
+	{
+		wait_for_tasks();
+
+		std::lock_guard<std::mutex> lock(exception_mutex);
+		if (exception)
+			std::rethrow_exception(std::exchange(exception, nullptr));
+	}
+
+	void task_group::cancel()
+	{
+		cancelled = true;
+	}
+
+	bool task_group::is_cancelled() const
+	{
+		return cancelled;
+	}
+
+	void task_group::execute(const std::function<void()>& task)
+	{
+		if (!cancelled)
+		{
+			try
+			{
+				task();
+			}
+			catch (...)
+			{
+				// the rest of the tasks probably fail the same way
+				std::lock_guard<std::mutex> lock(exception_mutex);
+				if (!exception)
+					exception = std::current_exception();
+
+				cancelled = true;
+			}
+		}
+	}
+
+	void task_group::wait_for_tasks()
+	{
+		// help out with the queued tasks instead of sleeping. When
+		// there's nothing to take, the rest of the tasks are already
+		// running somewhere else
+		while (pending != 0)
+			if (!pool().try_run_task())
+				break;
+
+		// seeing pending drop to zero without the lock could let the group
+		// get destroyed while finish_task() is still notifying it
+		std::unique_lock<std::mutex> lock(finished_mutex);
+		finished.wait(lock, [this] { return pending == 0; });
+	}
+
+	void task_group::finish_task()
+	{
+		// the group can be destroyed as soon as the waiting thread sees the
+		// last task finish, so the lock is held until the group isn't needed
+		std::lock_guard<std::mutex> lock(finished_mutex);
+		if (--pending == 0)
+			finished.notify_all();
+	}
+}
@@ -0,0 +1,86 @@
+#include "EnumTable.hpp"
+#include "Logging.hpp"
+#include "MappedFile.hpp"
+#include "Profiling.hpp"
+#include "Transaction.hpp"
+#include "Utils.hpp"
+
+#include <cassert>
+#include <filesystem>
+#include <format>
+
+// the options line starts with a character that can't be in a package name
+constexpr static char force_install_key[] = "@force";
+
+constexpr auto state_names = birb::make_enum_table<birb::transaction_state>({
+	{ birb::transaction_state::pending, "pending" },
+	{ birb::transaction_state::verified, "verified" },
+	{ birb::transaction_state::installed, "installed" },
+});
+
+namespace birb
+{
+	void save_transaction(const install_transaction& transaction, const path_settings& paths)
+	{
+		scoped_timer timer(profile_category::db);
+		trace_span span("save_transaction");
+
+		std::vector<std::string> lines;
+		lines.reserve(transaction.packages.size() + 2);
+
+		lines.emplace_back("# unfinished birb installation, continue it with 'birb --resume'");
+		lines.emplace_back(std::string(force_install_key) + ";" + (transaction.force_install ? "1" : "0"));
+
+		for (const transaction_entry& entry : transaction.packages)
+		{
+			assert(!entry.pkg_name.empty());
+
+			lines.emplace_back(std::format("{};{};{}", entry.pkg_name, state_names.name(entry.state), entry.requested ? "1" : "0"));
+		}
+
+		write_file_atomic(paths.transaction(), lines);
+	}
+
+	std::optional<install_transaction> load_transaction(const path_settings& paths)
+	{
+		mapped_file file;
+		if (const file_error err = file.open(paths.transaction()); err != file_error::noerr)
+		{
+			if (err != file_error::not_found)
+				warning("Can't read the unfinished installation at ", paths.transaction(), ": ", file_error_str.name(err));
+
+			return {};
+		}
+
+		install_transaction transaction;
+
+		for (const std::string_view line : file.lines())
+		{
+			if (const auto option = split_fields<2>(line, ";"); option.has_value() && option.value()[0] == force_install_key)
+			{
+				transaction.force_install = option.value()[1] == "1";
+				continue;
+			}
+
+			const std::optional<std::array<std::string_view, 3>> tokens = split_fields<3>(line, ";");
+
+			const std::optional<transaction_state> state = tokens.has_value() ? state_names.parse(tokens.value()[1]) : std::nullopt;
+
+			if (!state.has_value())
+			{
+				warning("Malformed transaction entry: ", line);
+				return {};
+			}
+
+			transaction.packages.push_back({ std::string(tokens.value()[0]), state.value(), tokens.value()[2] == "1" });
+		}
+
+		return transaction;
+	}
+
+	void clear_transaction(const path_settings& paths)
+	{
+		scoped_timer timer(profile_category::db);
+		std::filesystem::remove(paths.transaction());
+	}
+}
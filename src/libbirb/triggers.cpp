@@ -0,0 +1,192 @@
+#include "Logging.hpp"
+#include "Process.hpp"
+#include "Triggers.hpp"
+#include "Utils.hpp"
+
+#include <algorithm>
+#include <array>
+#include <cassert>
+#include <filesystem>
+#include <iostream>
+#include <vector>
+
+namespace birb
+{
+	// directories that ldconfig looks for shared libraries from
+	constexpr std::array<std::string_view, 7> library_dirs = {
+		"lib", "lib32", "lib64", "usr/lib", "usr/lib32", "usr/lib64", "usr/local/lib"
+	};
+
+	static bool is_shared_library(const std::filesystem::path& path)
+	{
+		const std::string file_name = path.filename().string();
+		return file_name.ends_with(".so") || file_name.find(".so.") != std::string::npos;
+	}
+
+	void trigger_set::merge(const trigger_set& other)
+	{
+		triggers.insert(other.triggers.begin(), other.triggers.end());
+		icon_themes.insert(other.icon_themes.begin(), other.icon_themes.end());
+	}
+
+	bool trigger_set::empty() const
+	{
+		return triggers.empty();
+	}
+
+	trigger_set find_pkg_triggers(const std::string& pkg_name, const pkg_flag_set pkg_flags, const pkg_source& repo, const path_settings& paths)
+	{
+		trigger_set result;
+
+		if (pkg_flags.contains(pkg_flag::font))
+			result.triggers.insert(trigger::font_cache);
+
+		// triggers that the package asked for explicitly
+		const std::string declared_triggers = read_pkg_variable(pkg_name, pkg_variable::triggers, repo.path);
+		for (const std::string_view trigger_name : split_view(declared_triggers, " "))
+		{
+			if (trigger_name.empty())
+				continue;
+
+			const std::optional<trigger> t = trigger_names.parse(trigger_name);
+			if (!t.has_value())
+			{
+				warning("Package [", pkg_name, "] has an unknown trigger: ", trigger_name);
+				continue;
+			}
+
+			result.triggers.insert(t.value());
+
+			if (t.value() == trigger::icon_cache)
+				result.icon_themes.insert("/usr/share/icons/hicolor");
+		}
+
+		// infer the rest of the triggers from the files that the package installs
+		const std::filesystem::path fakeroot = paths.fakeroot + "/" + pkg_name;
+		if (!std::filesystem::exists(fakeroot))
+			return result;
+
+		for (const std::filesystem::directory_entry& entry : std::filesystem::recursive_directory_iterator(fakeroot))
+		{
+			// the fakeroot skeleton contains a bunch of empty directories
+			if (entry.is_directory())
+				continue;
+
+			const std::filesystem::path path = entry.path().lexically_relative(fakeroot);
+			const std::string path_str = path.string();
+
+			if (is_shared_library(path) && std::ranges::find(library_dirs, path.parent_path().string()) != library_dirs.end())
+				result.triggers.insert(trigger::ldconfig);
+			else if (path_str.starts_with("usr/share/fonts/"))
+				result.triggers.insert(trigger::font_cache);
+			else if (path_str.starts_with("usr/share/applications/") && path_str.ends_with(".desktop"))
+				result.triggers.insert(trigger::desktop_database);
+			else if (path_str.starts_with("usr/share/man/"))
+				result.triggers.insert(trigger::man_db);
+			else if (path_str.starts_with("usr/share/icons/"))
+			{
+				// usr/share/icons/<theme>/...
+				auto it = path.begin();
+				std::advance(it, 3);
+
+				if (it != path.end() && std::next(it) != path.end())
+				{
+					result.triggers.insert(trigger::icon_cache);
+					result.icon_themes.insert("/usr/share/icons/" + it->string());
+				}
+			}
+		}
+
+		return result;
+	}
+
+	void run_triggers(const trigger_set& triggers, const path_settings& paths)
+	{
+		if (triggers.empty())
+			return;
+
+		// the cache tools would update the caches of the host system
+		// instead of the system that is being installed
+		if (paths.lfs_var_set)
+		{
+			info("Skipping the post-install triggers, since the packages were installed to ", paths.lfs_path);
+			return;
+		}
+
+		log("Running post-install triggers");
+
+		const auto spawn_trigger = [](const std::vector<std::string>& args) -> std::optional<process>
+		{
+			info("Running ", args.front());
+
+			process_options opts;
+			opts.args = args;
+			opts.stdin_mode = stream_mode::null;
+			opts.stdout_mode = stream_mode::null;
+			opts.stderr_mode = stream_mode::pipe;
+
+			return process::spawn(std::move(opts));
+		};
+
+		const auto report_result = [](const std::string& name, const process_result& result)
+		{
+			if (result.success())
+				return;
+
+			warning(name, " failed, ret: ", result.exit_code);
+			if (!result.err.empty())
+				std::cerr << result.err;
+		};
+
+		// new libraries need to be found before anything else gets run
+		if (triggers.triggers.contains(trigger::ldconfig))
+		{
+			std::optional<process> ldconfig = spawn_trigger({ "ldconfig" });
+			if (ldconfig.has_value())
+				report_result("ldconfig", ldconfig.value().wait());
+		}
+
+		std::vector<std::vector<std::string>> commands;
+
+		if (triggers.triggers.contains(trigger::font_cache))
+			commands.push_back({ "fc-cache" });
+
+		if (triggers.triggers.contains(trigger::icon_cache))
+		{
+			for (const std::string& theme : triggers.icon_themes)
+			{
+				if (std::filesystem::exists(theme))
+					commands.push_back({ "gtk-update-icon-cache", "-q", "-t", "-f", theme });
+			}
+		}
+
+		if (triggers.triggers.contains(trigger::desktop_database))
+			commands.push_back({ "update-desktop-database", "-q", "/usr/share/applications" });
+
+		if (triggers.triggers.contains(trigger::man_db))
+			commands.push_back({ "mandb", "-q" });
+
+		std::vector<std::string> names;
+		std::vector<process> processes;
+
+		for (const std::vector<std::string>& command : commands)
+		{
+			std::optional<process> proc = spawn_trigger(command);
+			if (!proc.has_value())
+				continue;
+
+			names.push_back(command.front());
+			processes.push_back(std::move(proc.value()));
+		}
+
+		std::vector<process*> process_ptrs;
+		for (process& proc : processes)
+			process_ptrs.push_back(&proc);
+
+		const std::vector<process_result> results = wait_all(process_ptrs);
+		assert(results.size() == names.size());
+
+		for (size_t i = 0; i < results.size(); ++i)
+			report_result(names[i], results[i]);
+	}
+}
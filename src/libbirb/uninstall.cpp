@@ -1,8 +1,11 @@
 #include "CLI.hpp"
 #include "Database.hpp"
+#include "Dedupe.hpp"
 #include "Dependencies.hpp"
 #include "Logging.hpp"
 #include "PackageInfo.hpp"
+#include "Process.hpp"
+#include "Profiling.hpp"
 #include "Symlink.hpp"
 #include "Uninstall.hpp"
 #include "Utils.hpp"
@@ -11,8 +14,6 @@
 #include <cassert>
 #include <filesystem>
 #include <format>
-#include <fstream>
-#include <iterator>
 
 namespace birb
 {
@@ -37,7 +38,7 @@ namespace birb
 		for (const std::string& pkg_name : packages)
 		{
 			const std::optional<pkg_source> repo = locate_package(pkg_name, paths);
-			const std::unordered_set<pkg_flag> flags = get_pkg_flags(pkg_name, repo.value());
+			const pkg_flag_set flags = get_pkg_flags(pkg_name, repo.value());
 
 			if (flags.contains(pkg_flag::important))
 			{
@@ -52,7 +53,13 @@ namespace birb
 		const std::vector<pkg_source> repos = get_pkg_sources(paths);
 		for (const std::string& pkg_name : packages)
 		{
-			const std::vector<std::string> reverse_deps = get_reverse_dependencies(pkg_name, repos, paths);
+			std::vector<std::string> reverse_deps = get_reverse_dependencies(pkg_name, repos, paths);
+
+			// packages that are getting uninstalled at the same time don't count
+			std::erase_if(reverse_deps, [&packages](const std::string& rev_dep)
+			{
+				return std::find(packages.begin(), packages.end(), rev_dep) != packages.end();
+			});
 
 			// if the reverse dependency list is not empty, the package
 			// probably shouldn't be uninstalled
@@ -70,14 +77,20 @@ namespace birb
 			}
 		}
 
-		// check if Xorg is running
-		const bool xorg_running = is_process_running("Xorg");
+		// check if the window title can be set
+		const bool xorg_running = can_set_win_title();
 
-		// read in the package database
-		std::vector<std::string> db_file = birb::read_birb_db(paths);
+		// read in the package database. The lines point to the mapped
+		// files, so they have to stay around until the files are written
+		const mapped_file db_mapping = birb::map_birb_db(paths);
+		std::vector<std::string_view> db_file(db_mapping.lines().begin(), db_mapping.lines().end());
 
 		// read in the nest file
-		std::vector<std::string> nest_file = birb::read_file(paths.nest());
+		mapped_file nest_mapping;
+		if (const file_error err = nest_mapping.open(paths.nest()); err != file_error::noerr)
+			error("Can't read the nest file at ", paths.nest(), ": ", file_error_str.name(err));
+
+		std::vector<std::string_view> nest_file(nest_mapping.lines().begin(), nest_mapping.lines().end());
 
 		// start uninstalling the packages
 		for (const std::string& pkg_name : packages)
@@ -87,29 +100,35 @@ namespace birb
 				set_win_title(std::format("uninstalling {}", pkg_name));
 
 			const std::optional<pkg_source> repo = locate_package(pkg_name, paths);
-			const std::unordered_set<pkg_flag> flags = get_pkg_flags(pkg_name, repo.value());
+			const pkg_flag_set flags = get_pkg_flags(pkg_name, repo.value());
 
 			// python packages need to be uninstalled with pip
 			if (flags.contains(pkg_flag::python))
-				exec_shell_cmd(std::format("yes | pip3 uninstall {}", pkg_name));
+			{
+				process_options pip_opts;
+				pip_opts.args = { "pip3", "uninstall", "--yes", pkg_name };
+				if (!run_process(std::move(pip_opts)).success())
+					warning("pip3 failed to uninstall [", pkg_name, "]");
+			}
 
 			unlink_package(pkg_name, paths);
 
 			// remove the fakeroot
 			assert(!paths.fakeroot.empty()); // this would cause an unfortunate situation
 			std::filesystem::remove_all(paths.fakeroot + "/" + pkg_name);
+			forget_deduped_files(pkg_name, paths);
 
 			// remove the package from the db
 			db_file.erase(std::remove_if(db_file.begin(), db_file.end(),
-					[&pkg_name](const std::string& entry)
+					[&pkg_name](const std::string_view entry)
 					{
-						return birb::split_string(entry, ";")[0] == pkg_name;
+						return birb::first_token(entry, ";") == pkg_name;
 					}
 				), db_file.end());
 
 			// remove the package from the nest file (if it is there)
 			nest_file.erase(std::remove_if(nest_file.begin(), nest_file.end(),
-					[&pkg_name](const std::string& entry)
+					[&pkg_name](const std::string_view entry)
 					{
 						return entry == pkg_name;
 					}
@@ -119,12 +138,11 @@ namespace birb
 		}
 
 		// write the nest file and the database to disk
-		std::ofstream db_ofstream(paths.database());
-		std::ostream_iterator<std::string> output_iterator(db_ofstream, "\n");
-		std::copy(db_file.begin(), db_file.end(), output_iterator);
+		scoped_timer timer(profile_category::db);
+		write_file_atomic(paths.database(), db_file);
+		write_file_atomic(paths.nest(), nest_file);
 
-		std::ofstream nest_ofstream(paths.nest());
-		std::ostream_iterator<std::string> nest_iterator(nest_ofstream, "\n");
-		std::copy(nest_file.begin(), nest_file.end(), nest_iterator);
+		// the cached list of installed packages is out-of-date now
+		installed_packages_cache.clear();
 	}
 }
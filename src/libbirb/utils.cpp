@@ -5,14 +5,26 @@
 #endif /* BIRB_TEST */
 
 #include "Logging.hpp"
+#include "MappedFile.hpp"
+#include "Process.hpp"
+#include "Profiling.hpp"
 #include "Utils.hpp"
 
+#include <array>
 #include <cassert>
+#include <cctype>
+#include <cerrno>
+#include <charconv>
+#include <fcntl.h>
 #include <filesystem>
 #include <format>
 #include <fstream>
 #include <iostream>
+#include <limits>
 #include <string.h>
+#include <sys/file.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
 #include <unistd.h>
 #include <vector>
 
@@ -23,27 +35,14 @@ namespace birb
 		return getuid() == 0;
 	}
 
-	void exec_shell_cmd(const std::string& cmd)
+	int exec_shell_cmd(const std::string& cmd)
 	{
 		assert(!cmd.empty());
 
-		FILE* const bash_pipe = popen("bash", "w");
-		if (!bash_pipe)
-			error("Can't open a pipe to bash");
+		process_options opts;
+		opts.args = { "bash", "-c", cmd };
 
-		fputs(cmd.c_str(), bash_pipe);
-		pclose(bash_pipe);
-	}
-
-	u8 shell_return_value()
-	{
-		std::ifstream file("/tmp/birb_ret");
-		if (!file.is_open())
-			error("Could not open /tmp/birb_ret");
-
-		std::string ret_str;
-		file >> ret_str;
-		return std::atoi(ret_str.c_str());
+		return run_process(std::move(opts)).exit_code;
 	}
 
 	bool argcmp(char* arg, int argc, const std::string& option, int required_arg_count)
@@ -55,23 +54,14 @@ namespace birb
 		return (!strcmp(arg, option.c_str()) && required_arg_count + 1 < argc);
 	}
 
-	std::vector<std::string> split_string(std::string text, const std::string& delimiter)
+	std::vector<std::string> split_string(const std::string_view text, const std::string_view delimiter)
 	{
 		assert(text.empty() == false);
 		assert(delimiter.empty() == false);
 
 		std::vector<std::string> result;
-
-		/* Split the string */
-		size_t pos = 0;
-		while ((pos = text.find(delimiter)) != std::string::npos)
-		{
-			result.push_back(text.substr(0, pos));
-			text.erase(0, pos + delimiter.length());
-		}
-
-		if (!text.empty())
-			result.push_back(text);
+		for (const std::string_view token : split_view(text, delimiter))
+			result.emplace_back(token);
 
 		return result;
 	}
@@ -116,45 +106,236 @@ namespace birb
 			CHECK(A[1] == "world!");
 		}
 	}
+
+	TEST_CASE("split_view()")
+	{
+		SUBCASE("Empty tokens")
+		{
+			const split_view view(";a;;b;", ";");
+			const std::vector<std::string_view> A(view.begin(), view.end());
+			CHECK(A.size() == 4);
+			CHECK(A[0] == "");
+			CHECK(A[1] == "a");
+			CHECK(A[2] == "");
+			CHECK(A[3] == "b");
+		}
+
+		SUBCASE("Fixed field count")
+		{
+			CHECK(split_fields<2>("vim;9.0", ";").value()[1] == "9.0");
+			CHECK_FALSE(split_fields<2>("vim", ";").has_value());
+			CHECK_FALSE(split_fields<2>("vim;9.0;x", ";").has_value());
+		}
+	}
 #endif
 
 	std::vector<std::string> read_file(const std::string& file_path)
 	{
 		assert(file_path.empty() == false);
+		trace_span span("read_file", file_path);
 
-		std::ifstream file(file_path);
-
-		if (!file.is_open())
+		mapped_file file;
+		if (file.open(file_path) != file_error::noerr)
 		{
 			std::cout << "File [" << file_path << "] can't be opened!\n";
 			exit(2);
 		}
 
-		std::string line;
+		/* Empty lines and lines starting with '#' are ignored */
 		std::vector<std::string> lines;
+		for (const std::string_view line : file.lines())
+			lines.emplace_back(line);
+
+		return lines;
+	}
+
+	std::string file_hash(const std::string& file_path)
+	{
+		assert(!file_path.empty());
+
+		trace_span span("file_hash", file_path);
+
+		std::ifstream file(file_path, std::ios::binary);
+		count_trace_event(trace_counter::open);
+		if (!file.is_open())
+			error("Can't open [", file_path, "] for hashing");
+
+		u64 hash = 0xcbf29ce484222325;
+		std::array<char, 65536> buffer;
+		while (file.read(buffer.data(), buffer.size()) || file.gcount() > 0)
+		{
+			for (std::streamsize i = 0; i < file.gcount(); ++i)
+			{
+				hash ^= static_cast<u8>(buffer[i]);
+				hash *= 0x100000001b3;
+			}
+		}
+
+		return std::format("{:016x}", hash);
+	}
+
+	void write_file_atomic(const std::string& file_path, const std::vector<std::string>& lines)
+	{
+		std::string content;
+		for (const std::string& line : lines)
+			content.append(line).append("\n");
+
+		write_file_atomic(file_path, content);
+	}
+
+	void write_file_atomic(const std::string& file_path, const std::vector<std::string_view>& lines)
+	{
+		std::string content;
+		for (const std::string_view line : lines)
+			content.append(line).append("\n");
+
+		write_file_atomic(file_path, content);
+	}
+
+	void write_file_atomic(const std::string& file_path, std::string_view content)
+	{
+		assert(!file_path.empty());
+
+		trace_span span("write_file_atomic", file_path);
+
+		// the thread and process ids keep the temporary files of concurrent writers apart
+		const std::string tmp_path = std::format("{}.tmp.{}.{}", file_path, getpid(), gettid());
+		count_trace_event(trace_counter::open);
+		const int fd = open(tmp_path.c_str(), O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+		if (fd < 0)
+			error("Can't open [", tmp_path, "] for writing: ", strerror(errno));
+
+		size_t written{0};
+		while (written < content.size())
+		{
+			const ssize_t ret = write(fd, content.data() + written, content.size() - written);
+			if (ret < 0 && errno == EINTR)
+				continue;
+
+			if (ret < 0)
+				error("Writing to [", tmp_path, "] failed: ", strerror(errno));
+
+			written += ret;
+		}
+
+		// make sure that the data is on the disk before the old file gets replaced
+		fsync(fd);
+		close(fd);
 
-		/* Read the file */
-		while (std::getline(file, line))
+		if (rename(tmp_path.c_str(), file_path.c_str()) != 0)
+			error("Can't replace [", file_path, "]: ", strerror(errno));
+	}
+
+	file_lock::file_lock(const std::string& file_path)
+	{
+		assert(!file_path.empty());
+
+		const std::string lock_path = file_path + ".lock";
+		fd = open(lock_path.c_str(), O_RDWR | O_CREAT | O_CLOEXEC, 0644);
+		if (fd < 0)
+			error("Can't open the lock file [", lock_path, "]: ", strerror(errno));
+
+		trace_span span("file_lock", file_path);
+		while (flock(fd, LOCK_EX) != 0)
 		{
-			/* Ignore empty lines and lines starting with '#' */
-			if (line.size() == 0 || line.at(0) == '#')
+			if (errno != EINTR)
+				error("Can't lock [", lock_path, "]: ", strerror(errno));
+		}
+	}
+
+	file_lock::~file_lock()
+	{
+		// closing the file releases the lock
+		close(fd);
+	}
+
+	bool write_all(const int fd, std::string_view data)
+	{
+		struct stat st;
+		const bool is_socket = fstat(fd, &st) == 0 && S_ISSOCK(st.st_mode);
+
+		while (!data.empty())
+		{
+			const ssize_t ret = is_socket
+				? send(fd, data.data(), data.size(), MSG_NOSIGNAL)
+				: write(fd, data.data(), data.size());
+
+			if (ret < 0 && errno == EINTR)
 				continue;
 
-			lines.push_back(line);
+			if (ret <= 0)
+				return false;
+
+			data.remove_prefix(ret);
 		}
 
-		file.close();
+		return true;
+	}
 
-		return lines;
+	std::optional<u64> parse_u64(const std::string_view text)
+	{
+		u64 value{0};
+		const auto [ptr, ec] = std::from_chars(text.data(), text.data() + text.size(), value);
+		if (ec != std::errc() || ptr != text.data() + text.size())
+			return {};
+
+		return value;
+	}
+
+	std::optional<u64> parse_size(const std::string& size_str)
+	{
+		if (size_str.empty() || !std::isdigit(static_cast<unsigned char>(size_str.front())))
+			return {};
+
+		size_t suffix_pos{0};
+		u64 size{0};
+
+		try
+		{
+			size = std::stoull(size_str, &suffix_pos);
+		}
+		catch (const std::out_of_range&)
+		{
+			return {};
+		}
+
+		const std::string suffix = size_str.substr(suffix_pos);
+		if (suffix.empty() || suffix == "B")
+			return size;
+
+		constexpr std::string_view suffixes = "KMGT";
+		const size_t exponent = suffixes.find(std::toupper(static_cast<unsigned char>(suffix.front())));
+		if (exponent == std::string_view::npos || (suffix.size() > 1 && suffix.substr(1) != "B" && suffix.substr(1) != "iB"))
+			return {};
+
+		const size_t shift = 10 * (exponent + 1);
+		if (size > std::numeric_limits<u64>::max() >> shift)
+			return {};
+
+		return size << shift;
 	}
 
+#ifdef BIRB_TEST
+	TEST_CASE("parse_size()")
+	{
+		CHECK(parse_size("512") == 512);
+		CHECK(parse_size("20G") == 20ull * 1024 * 1024 * 1024);
+		CHECK(parse_size("16777215T") == 16777215ull << 40);
+		CHECK_FALSE(parse_size("16777216T").has_value());
+		CHECK_FALSE(parse_size("5X").has_value());
+	}
+#endif
+
 	bool is_process_running(const std::string& process_name)
 	{
 		assert(!process_name.empty());
+		trace_span span("is_process_running", process_name);
+
 		for (const auto& dir : std::filesystem::directory_iterator("/proc"))
 		{
 			// read the command
 			std::ifstream file(std::format("{}/comm", dir.path().string()));
+			count_trace_event(trace_counter::open);
 
 			// if the file could not be opened for reading, the directory
 			// is probably for something other than a process PID